@@ -1,7 +1,8 @@
 #!/bin/sh
 
-# Automatic snapshot collection script for OpenWrt API database
-# This script can be run via cron to collect system snapshots regularly
+# Snapshot helper for the OpenWrt API database
+# Periodic snapshots and cleanup are run by the server itself; "schedule"
+# sets them up in /etc/config/api_c
 
 API_URL="http://localhost:9000"
 LOG_FILE="/var/log/api_snapshot.log"
@@ -101,71 +102,60 @@ show_usage() {
   echo "  snapshot              Save current system snapshot"
   echo "  cleanup [days]        Cleanup data older than [days] (default: 7)"
   echo "  stats                 Show database statistics"
-  echo "  setup-cron [interval] Setup automatic snapshots"
-  echo "  remove-cron          Remove automatic snapshots"
+  echo "  schedule [seconds] [days]  Snapshot every [seconds], keep [days]"
+  echo "  unschedule            Stop automatic snapshots"
   echo ""
   echo "Examples:"
   echo "  $0 snapshot                    # Save one snapshot"
-  echo "  $0 setup-cron 15                  # Snapshot every 15 minutes"
-  echo "  $0 setup-cron hourly              # Snapshot every hour"
+  echo "  $0 schedule 30                    # Snapshot every 30 seconds"
+  echo "  $0 schedule 3600 30               # Hourly, keep 30 days"
   echo "  $0 stats                          # Show database info"
 }
 
-# Function to setup cron job
-setup_cron() {
-  local interval="${1:-15}"
-  local cron_entry=""
+# Remove cron entries left by older versions of this script
+remove_legacy_cron() {
+  crontab -l 2>/dev/null | grep -v "auto_snapshot.sh" | crontab -
+}
+
+# Function to configure the built-in scheduler
+setup_schedule() {
+  local interval="${1:-900}"
+  local days="${2:-7}"
 
   case "$interval" in
-  "hourly" | "60")
-    cron_entry="0 * * * * /usr/share/api_c/auto_snapshot.sh snapshot"
-    echo "Setting up hourly snapshots"
-    ;;
-  "daily" | "1440")
-    cron_entry="0 0 * * * /usr/share/api_c/auto_snapshot.sh snapshot"
-    echo "Setting up daily snapshots"
-    ;;
-  [0-9]*)
-    if [ "$interval" -lt 5 ]; then
-      echo "ERROR: Minimum interval is 5 minutes"
-      return 1
-    fi
-    cron_entry="*/$interval * * * * /usr/share/api_c/auto_snapshot.sh snapshot"
-    echo "Setting up snapshots every $interval minutes"
-    ;;
-  *)
-    echo "ERROR: Invalid interval. Use number (minutes), 'hourly', or 'daily'"
+  "hourly") interval=3600 ;;
+  "daily") interval=86400 ;;
+  esac
+  case "$interval$days" in
+  *[!0-9]*)
+    echo "ERROR: Interval and days must be numbers"
     return 1
     ;;
   esac
+  if [ "$interval" -lt 1 ] || [ "$days" -lt 1 ]; then
+    echo "ERROR: Interval and days must be at least 1"
+    return 1
+  fi
 
-  # Remove existing cron job
-  crontab -l 2>/dev/null | grep -v "auto_snapshot.sh" | crontab -
+  remove_legacy_cron
+  uci set api_c.general.snapshot_interval="$interval"
+  uci set api_c.general.retention_days="$days"
+  uci commit api_c
+  /etc/init.d/api_c restart
 
-  # Add new cron job
-  (
-    crontab -l 2>/dev/null
-    echo "$cron_entry"
-  ) | crontab -
-
-  log_message "Cron job setup: $cron_entry"
-  echo "Automatic snapshots configured successfully"
-  echo "Log file: $LOG_FILE"
-
-  # Also setup weekly cleanup
-  cleanup_cron="0 2 * * 0 /usr/share/api_c/auto_snapshot.sh cleanup 7"
-  (
-    crontab -l 2>/dev/null | grep -v "auto_snapshot.sh cleanup"
-    echo "$cleanup_cron"
-  ) | crontab -
-  echo "Weekly cleanup also configured (Sundays at 2 AM)"
+  log_message "Scheduler setup: every $interval s, keep $days days"
+  echo "Automatic snapshots every $interval seconds, keeping $days days"
+  echo "Status: curl $API_URL/api/database/scheduler"
 }
 
-# Function to remove cron job
-remove_cron() {
-  crontab -l 2>/dev/null | grep -v "auto_snapshot.sh" | crontab -
+# Function to disable the built-in scheduler
+remove_schedule() {
+  remove_legacy_cron
+  uci set api_c.general.snapshot_interval=0
+  uci commit api_c
+  /etc/init.d/api_c restart
   log_message "Automatic snapshots disabled"
-  echo "Automatic snapshots removed from cron"
+  echo "Automatic snapshots disabled"
 }
 
 # Function to test API connection
@@ -210,16 +200,27 @@ case "$1" in
   show_stats
   ;;
 
+"schedule")
+  setup_schedule "$2" "$3"
+  exit $?
+  ;;
+
+"unschedule")
+  remove_schedule
+  ;;
+
 "setup-cron")
-  if ! test_api; then
-    echo "Cannot setup cron - API is not working"
-    exit 1
-  fi
-  setup_cron "$2"
+  # Older interface, interval in minutes; it defaulted to every 15 minutes
+  case "$2" in
+  "") setup_schedule 900 ;;
+  *[!0-9]*) setup_schedule "$2" ;;
+  *) setup_schedule $(($2 * 60)) ;;
+  esac
+  exit $?
   ;;
 
 "remove-cron")
-  remove_cron
+  remove_schedule
   ;;
 
 "test")
@@ -23,12 +23,14 @@ cat >"$ENDPOINT_FILE" <<EOF
 #include "../helpers/system_info.h"
 
 // Handler for /api/${MODULE_LOWER}/status
-static void handle_${MODULE_LOWER}_status(struct mg_connection *c, struct mg_http_message *hm) {
+static void handle_${MODULE_LOWER}_status(struct mg_connection *c, struct mg_http_message *hm,
+        const route_params_t *params) {
     send_success_response(c, "${MODULE_NAME} module is working", NULL);
 }
 
 // Handler for /api/${MODULE_LOWER}/info
-static void handle_${MODULE_LOWER}_info(struct mg_connection *c, struct mg_http_message *hm) {
+static void handle_${MODULE_LOWER}_info(struct mg_connection *c, struct mg_http_message *hm,
+        const route_params_t *params) {
     const char *kvp[] = {
         "module", "${MODULE_LOWER}",
         "description", "${MODULE_NAME} management endpoint",
@@ -42,7 +44,8 @@ static void handle_${MODULE_LOWER}_info(struct mg_connection *c, struct mg_http_
 
 // Add more handlers here as needed
 // Example:
-// static void handle_${MODULE_LOWER}_list(struct mg_connection *c, struct mg_http_message *hm) {
+// static void handle_${MODULE_LOWER}_list(struct mg_connection *c, struct mg_http_message *hm,
+        const route_params_t *params) {
 //     // Implementation here
 // }
 
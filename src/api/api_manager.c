@@ -1,53 +1,297 @@
 #include "api_manager.h"
 #include "helpers/response.h"
+#include "helpers/worker_pool.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 void api_manager_init(api_manager_t *manager) {
   manager->route_count = 0;
-  memset(manager->routes, 0, sizeof(manager->routes));
+  manager->route_capacity = 0;
+  manager->routes = NULL;
+  manager->router = NULL;
 }
 
-int api_register_route(api_manager_t *manager, const char *path,
-                       http_method_t method, route_handler_t handler,
-                       const char *description) {
-  if (manager->route_count >= MAX_ROUTES) {
-    printf("Error: Maximum routes limit reached\n");
-    return -1;
+static void free_route_node(route_node_t *node) {
+  if (!node)
+    return;
+  for (int i = 0; i < node->child_count; i++)
+    free_route_node(node->children[i]);
+  free_route_node(node->param_child);
+  free(node->children);
+  free(node->segment);
+  free(node);
+}
+
+void api_manager_free(api_manager_t *manager) {
+  free_route_node(manager->router);
+  free(manager->routes);
+  api_manager_init(manager);
+}
+
+static int register_route(api_manager_t *manager, const char *path,
+                          http_method_t method, route_handler_t handler,
+                          const char *description, int blocking,
+                          int max_concurrent) {
+  if (manager->route_count >= manager->route_capacity) {
+    int capacity = manager->route_capacity > 0 ? manager->route_capacity * 2
+                                               : INITIAL_ROUTE_CAPACITY;
+    route_t *routes = realloc(manager->routes, capacity * sizeof(route_t));
+    if (!routes) {
+      printf("Error: Cannot grow route table\n");
+      return -1;
+    }
+    manager->routes = routes;
+    manager->route_capacity = capacity;
   }
 
   route_t *route = &manager->routes[manager->route_count];
+  memset(route, 0, sizeof(*route));
   strncpy(route->path, path, sizeof(route->path) - 1);
   route->method = method;
   route->handler = handler;
   strncpy(route->description, description, sizeof(route->description) - 1);
+  route->blocking = blocking;
+  route->max_concurrent = max_concurrent;
 
   manager->route_count++;
-  printf("Registered route: %s %s - %s\n", method_to_string(method), path,
-         description);
+
+  // Routes added after the router was built invalidate it
+  if (manager->router) {
+    free_route_node(manager->router);
+    manager->router = NULL;
+  }
+
+  printf("Registered route: %s %s - %s%s\n", method_to_string(method), path,
+         description, blocking ? " [blocking]" : "");
   return 0;
 }
 
+int api_register_route(api_manager_t *manager, const char *path,
+                       http_method_t method, route_handler_t handler,
+                       const char *description) {
+  return register_route(manager, path, method, handler, description, 0, 0);
+}
+
+// Blocking routes (shell-outs, scans, anything that can take seconds) are
+// run on the worker pool so they do not stall the event loop.
+int api_register_blocking_route(api_manager_t *manager, const char *path,
+                                http_method_t method, route_handler_t handler,
+                                const char *description, int max_concurrent) {
+  return register_route(manager, path, method, handler, description, 1,
+                        max_concurrent);
+}
+
+static route_node_t *new_route_node(const char *segment, size_t len) {
+  route_node_t *node = calloc(1, sizeof(route_node_t));
+  if (!node)
+    return NULL;
+  node->segment = malloc(len + 1);
+  if (!node->segment) {
+    free(node);
+    return NULL;
+  }
+  memcpy(node->segment, segment, len);
+  node->segment[len] = '\0';
+  node->segment_len = len;
+  for (int m = 0; m < METHOD_COUNT; m++)
+    node->route_index[m] = -1;
+  return node;
+}
+
+// Find or create the child of node for one path segment of a route pattern
+static route_node_t *route_node_child(route_node_t *node, const char *segment,
+                                      size_t len) {
+  if (len > 2 && segment[0] == '{' && segment[len - 1] == '}') {
+    if (!node->param_child) {
+      node->param_child = new_route_node(segment + 1, len - 2);
+    } else if (node->param_child->segment_len != len - 2 ||
+               memcmp(node->param_child->segment, segment + 1, len - 2)) {
+      printf("Warning: parameter {%.*s} shadowed by {%s}\n", (int)(len - 2),
+             segment + 1, node->param_child->segment);
+    }
+    return node->param_child;
+  }
+
+  for (int i = 0; i < node->child_count; i++) {
+    route_node_t *child = node->children[i];
+    if (child->segment_len == len && memcmp(child->segment, segment, len) == 0)
+      return child;
+  }
+
+  route_node_t **children =
+      realloc(node->children, (node->child_count + 1) * sizeof(*children));
+  if (!children)
+    return NULL;
+  node->children = children;
+
+  route_node_t *child = new_route_node(segment, len);
+  if (!child)
+    return NULL;
+  node->children[node->child_count++] = child;
+  return child;
+}
+
+int api_build_router(api_manager_t *manager) {
+  free_route_node(manager->router);
+  manager->router = new_route_node("", 0);
+  if (!manager->router)
+    return -1;
+
+  for (int i = 0; i < manager->route_count; i++) {
+    route_t *route = &manager->routes[i];
+    route_node_t *node = manager->router;
+    const char *p = route->path;
+
+    while (node && *p) {
+      if (*p == '/') {
+        p++;
+        continue;
+      }
+      const char *end = strchr(p, '/');
+      size_t len = end ? (size_t)(end - p) : strlen(p);
+      node = route_node_child(node, p, len);
+      p += len;
+    }
+
+    if (!node) {
+      printf("Error: Out of memory building router\n");
+      free_route_node(manager->router);
+      manager->router = NULL;
+      return -1;
+    }
+
+    if (node->route_index[route->method] >= 0) {
+      printf("Warning: duplicate route %s %s ignored\n",
+             method_to_string(route->method), route->path);
+      continue;
+    }
+    node->route_index[route->method] = i;
+  }
+
+  return 0;
+}
+
+static int node_has_routes(const route_node_t *node) {
+  for (int m = 0; m < METHOD_COUNT; m++) {
+    if (node->route_index[m] >= 0)
+      return 1;
+  }
+  return 0;
+}
+
+// Walk the trie one segment at a time. Literal segments take priority over
+// {param} captures; the capture branch is tried if the literal one has no
+// handler for the method. The first node matching the path whatever the
+// method is kept in *matched, to tell 405 from 404.
+static const route_node_t *route_lookup(const route_node_t *node,
+                                        const char *p, const char *end,
+                                        http_method_t method,
+                                        route_params_t *params,
+                                        const route_node_t **matched) {
+  while (p < end && *p == '/')
+    p++;
+  if (p >= end) {
+    if (!*matched && node_has_routes(node))
+      *matched = node;
+    return node->route_index[method] >= 0 ? node : NULL;
+  }
+
+  const char *seg_end = memchr(p, '/', end - p);
+  if (!seg_end)
+    seg_end = end;
+  size_t len = seg_end - p;
+
+  for (int i = 0; i < node->child_count; i++) {
+    const route_node_t *child = node->children[i];
+    if (child->segment_len == len && memcmp(child->segment, p, len) == 0) {
+      const route_node_t *found =
+          route_lookup(child, seg_end, end, method, params, matched);
+      if (found)
+        return found;
+      break;
+    }
+  }
+
+  if (node->param_child && params->count < MAX_ROUTE_PARAMS) {
+    int saved = params->count;
+    params->items[saved].name = node->param_child->segment;
+    params->items[saved].value = mg_str_n(p, len);
+    params->count++;
+    const route_node_t *found =
+        route_lookup(node->param_child, seg_end, end, method, params, matched);
+    if (found)
+      return found;
+    params->count = saved;
+  }
+
+  return NULL;
+}
+
+int api_find_route(api_manager_t *manager, struct mg_str uri,
+                   http_method_t method, route_params_t *params) {
+  params->count = 0;
+  if (!manager->router && api_build_router(manager) != 0)
+    return ROUTE_NOT_FOUND;
+
+  const route_node_t *matched = NULL;
+  const route_node_t *node = route_lookup(
+      manager->router, uri.buf, uri.buf + uri.len, method, params, &matched);
+  if (node)
+    return node->route_index[method];
+  return matched ? ROUTE_METHOD_NOT_ALLOWED : ROUTE_NOT_FOUND;
+}
+
+struct mg_str api_get_param(const route_params_t *params, const char *name) {
+  for (int i = 0; params && i < params->count; i++) {
+    if (strcmp(params->items[i].name, name) == 0)
+      return params->items[i].value;
+  }
+  return mg_str_n(NULL, 0);
+}
+
 void api_handle_request(api_manager_t *manager, struct mg_connection *c,
                         struct mg_http_message *hm) {
   http_method_t method = string_to_method(hm->method.buf);
 
   // Check for help/documentation endpoint
-  if (mg_match(hm->uri, mg_str("/api"), NULL) ||
-      mg_match(hm->uri, mg_str("/api/help"), NULL)) {
+  if (mg_strcmp(hm->uri, mg_str("/api")) == 0 ||
+      mg_strcmp(hm->uri, mg_str("/api/help")) == 0) {
     api_list_routes(manager, c, hm);
     return;
   }
 
   // Find matching route
-  for (int i = 0; i < manager->route_count; i++) {
-    route_t *route = &manager->routes[i];
-    if (route->method == method &&
-        mg_match(hm->uri, mg_str(route->path), NULL)) {
-      route->handler(c, hm);
-      return;
+  route_params_t params;
+  int index = api_find_route(manager, hm->uri, method, &params);
+  if (index >= 0) {
+    route_t *route = &manager->routes[index];
+
+    if (route->blocking && worker_pool_running()) {
+      int rc = worker_pool_submit(c, hm, route, &params);
+      if (rc == WORKER_SUBMIT_OK)
+        return;
+      if (rc == WORKER_SUBMIT_ROUTE_BUSY) {
+        send_error_response(c, 503, "Service Unavailable",
+                            "Too many concurrent requests for this endpoint");
+        return;
+      }
+      if (rc == WORKER_SUBMIT_QUEUE_FULL) {
+        send_error_response(c, 503, "Service Unavailable",
+                            "Worker queue is full");
+        return;
+      }
+      // Could not queue the job, run it inline instead
     }
+
+    route->handler(c, hm, &params);
+    return;
+  }
+
+  if (index == ROUTE_METHOD_NOT_ALLOWED) {
+    send_error_response(c, 405, "Method Not Allowed",
+                        "The endpoint does not support this method");
+    return;
   }
 
   // No route found
@@ -55,95 +299,30 @@ void api_handle_request(api_manager_t *manager, struct mg_connection *c,
                       "The requested endpoint does not exist");
 }
 
-// void api_list_routes(api_manager_t *manager, struct mg_connection *c,
-//                      struct mg_http_message *hm) {
-//   char *response = malloc(4096);
-//   strcpy(response, "{\n  \"api\": \"OpenWrt Modular API\",\n  \"version\": "
-//                    "\"1.0\",\n  \"endpoints\": [\n");
-//
-//   for (int i = 0; i < manager->route_count; i++) {
-//     route_t *route = &manager->routes[i];
-//     char endpoint[512];
-//     snprintf(endpoint, sizeof(endpoint),
-//              "    {\n"
-//              "      \"method\": \"%s\",\n"
-//              "      \"path\": \"%s\",\n"
-//              "      \"description\": \"%s\"\n"
-//              "    }%s\n",
-//              method_to_string(route->method), route->path,
-//              route->description, (i < manager->route_count - 1) ? "," : "");
-//     strcat(response, endpoint);
-//   }
-//
-//   strcat(response, "  ]\n}");
-//
-//   mg_http_reply(c, 200,
-//                 "Content-Type: application/json\r\n"
-//                 "Access-Control-Allow-Origin: *\r\n"
-//                 "Access-Control-Allow-Headers: Content-Type,
-//                 Authorization\r\n",
-//                 "%s", response);
-//   free(response);
-// }
-
 void api_list_routes(api_manager_t *manager, struct mg_connection *c,
                      struct mg_http_message *hm) {
-  // Gunakan ukuran yang lebih besar untuk berjaga-jaga
-  size_t response_size = 8192;
-  char *response = malloc(response_size);
-  if (!response) {
-    // Gagal mengalokasikan memori, kirim error server
-    mg_http_reply(c, 500, "", "Internal Server Error: Out of memory");
-    return;
-  }
-
-  // Gunakan pointer untuk melacak posisi saat ini dan sisa ruang
-  char *p = response;
-  size_t remaining = response_size;
-  int written;
-
-  // Tulis header JSON dengan aman
-  written = snprintf(p, remaining,
-                     "{\n  \"api\": \"OpenWrt Modular API\",\n  \"version\": "
-                     "\"1.0\",\n  \"endpoints\": [\n");
-  p += written;
-  remaining -= written;
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_string(&w, "api", "OpenWrt Modular API");
+  json_kv_string(&w, "version", "1.0");
+  json_key(&w, "endpoints");
+  json_array_begin(&w);
 
   for (int i = 0; i < manager->route_count; i++) {
-    if (remaining <= 1)
-      break; // Hentikan jika buffer hampir penuh
-
     route_t *route = &manager->routes[i];
+    json_object_begin(&w);
+    json_kv_string(&w, "method", method_to_string(route->method));
+    json_kv_string(&w, "path", route->path);
+    json_kv_string(&w, "description", route->description);
+    if (route->blocking)
+      json_kv_bool(&w, "blocking", 1);
+    json_object_end(&w);
+  }
 
-    // Tulis setiap endpoint dengan aman, langsung ke buffer response
-    written =
-        snprintf(p, remaining,
-                 "    {\n"
-                 "      \"method\": \"%s\",\n"
-                 "      \"path\": \"%s\",\n"
-                 "      \"description\": \"%s\"\n"
-                 "    }%s\n",
-                 method_to_string(route->method), route->path,
-                 route->description, (i < manager->route_count - 1) ? "," : "");
-
-    p += written;
-    remaining -= written;
-  }
-
-  if (remaining > 5) { // Pastikan ada cukup ruang untuk penutup
-    snprintf(p, remaining, "  ]\n}\n");
-  } else {
-    // Jika tidak, setidaknya tutup array JSON dengan benar
-    strcpy(p - (manager->route_count > 0 ? 2 : 0),
-           "\n  ]\n}\n"); // Menimpa koma terakhir jika ada
-  }
-
-  mg_http_reply(c, 200,
-                "Content-Type: application/json\r\n"
-                "Access-Control-Allow-Origin: *\r\n"
-                "Access-Control-Allow-Headers: Content-Type, Authorization\r\n",
-                "%s", response);
-  free(response);
+  json_array_end(&w);
+  json_object_end(&w);
+  json_reply_end(&w);
 }
 
 const char *method_to_string(http_method_t method) {
@@ -3,8 +3,15 @@
 
 #include "../mongoose/mongoose.h"
 
-// Maximum number of routes
-#define MAX_ROUTES 50
+// Initial capacity of the route table (grows on demand)
+#define INITIAL_ROUTE_CAPACITY 32
+
+// Maximum number of {param} captures in a single route
+#define MAX_ROUTE_PARAMS 8
+
+// api_find_route() results when no handler matches
+#define ROUTE_NOT_FOUND -1
+#define ROUTE_METHOD_NOT_ALLOWED -2
 
 // HTTP methods
 typedef enum {
@@ -12,12 +19,23 @@ typedef enum {
   METHOD_POST,
   METHOD_PUT,
   METHOD_DELETE,
-  METHOD_PATCH
+  METHOD_PATCH,
+  METHOD_COUNT
 } http_method_t;
 
+// Path parameters captured from a {name} segment of the route pattern
+typedef struct {
+  int count;
+  struct {
+    const char *name;
+    struct mg_str value;
+  } items[MAX_ROUTE_PARAMS];
+} route_params_t;
+
 // Route handler function type
 typedef void (*route_handler_t)(struct mg_connection *c,
-                                struct mg_http_message *hm);
+                                struct mg_http_message *hm,
+                                const route_params_t *params);
 
 // Route structure
 typedef struct {
@@ -25,12 +43,27 @@ typedef struct {
   http_method_t method;
   route_handler_t handler;
   char description[256];
+  int blocking;       // Run on the worker pool instead of the event loop
+  int max_concurrent; // Per-route cap on queued + running jobs, 0 = none
+  int in_flight;      // Guarded by the worker pool lock
 } route_t;
 
+// Router trie node, one per path segment
+typedef struct route_node {
+  char *segment;                 // Literal segment, or parameter name
+  size_t segment_len;
+  struct route_node **children;  // Literal child segments
+  int child_count;
+  struct route_node *param_child; // Child matching any {name} segment
+  int route_index[METHOD_COUNT];  // Index into routes[], -1 if none
+} route_node_t;
+
 // API Manager structure
 typedef struct {
-  route_t routes[MAX_ROUTES];
+  route_t *routes;
   int route_count;
+  int route_capacity;
+  route_node_t *router; // Built by api_build_router()
 } api_manager_t;
 
 // Function declarations
@@ -38,6 +71,14 @@ void api_manager_init(api_manager_t *manager);
 int api_register_route(api_manager_t *manager, const char *path,
                        http_method_t method, route_handler_t handler,
                        const char *description);
+int api_register_blocking_route(api_manager_t *manager, const char *path,
+                                http_method_t method, route_handler_t handler,
+                                const char *description, int max_concurrent);
+void api_manager_free(api_manager_t *manager);
+int api_build_router(api_manager_t *manager);
+int api_find_route(api_manager_t *manager, struct mg_str uri,
+                   http_method_t method, route_params_t *params);
+struct mg_str api_get_param(const route_params_t *params, const char *name);
 void api_handle_request(api_manager_t *manager, struct mg_connection *c,
                         struct mg_http_message *hm);
 void api_list_routes(api_manager_t *manager, struct mg_connection *c,
@@ -1,83 +1,37 @@
 #include "../helpers/database.h"
+#include "../helpers/db_writer.h"
+#include "../helpers/lttb.h"
 #include "../api_manager.h"
 #include "../helpers/response.h"
-#include "../helpers/system_info.h"
+#include "../helpers/snapshot_scheduler.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-// Forward declaration for monitoring integration
-extern int get_process_list_for_db(process_record_t **processes);
+// ctime()-style timestamp without the trailing newline
+static void format_datetime(time_t timestamp, char *buf, size_t size) {
+  struct tm tm;
+  if (localtime_r(&timestamp, &tm) == NULL ||
+      strftime(buf, size, "%a %b %e %H:%M:%S %Y", &tm) == 0) {
+    snprintf(buf, size, "unknown");
+  }
+}
 
 // Handler for /api/database/save/snapshot (POST)
 static void handle_save_snapshot(struct mg_connection *c,
-                                 struct mg_http_message *hm) {
-  system_snapshot_t snapshot = {0};
-  snapshot.timestamp = time(NULL);
-
-  // Get system information
-  char *uptime = get_system_uptime();
-  char *load_str = get_system_load();
-
-  // Parse load average (first value)
-  snapshot.cpu_load = 0.0;
-  if (load_str) {
-    sscanf(load_str, "%lf", &snapshot.cpu_load);
-  }
-
-  // Get memory information from /proc/meminfo
-  FILE *meminfo = fopen("/proc/meminfo", "r");
-  if (meminfo) {
-    char line[128];
-    while (fgets(line, sizeof(line), meminfo)) {
-      if (sscanf(line, "MemTotal: %d kB", &snapshot.memory_total_kb))
-        continue;
-      if (sscanf(line, "MemFree: %d kB", &snapshot.memory_free_kb))
-        continue;
-    }
-    fclose(meminfo);
-  }
-
-  snapshot.memory_used_kb = snapshot.memory_total_kb - snapshot.memory_free_kb;
-  if (snapshot.memory_total_kb > 0) {
-    snapshot.memory_usage_percent =
-        (double)snapshot.memory_used_kb / snapshot.memory_total_kb * 100.0;
-  }
-
-  // Get process information
+                                 struct mg_http_message *hm,
+                                 const route_params_t *params) {
+  system_snapshot_t snapshot;
   process_record_t *processes;
-  int proc_count = get_process_list_for_db(&processes);
-
-  if (proc_count > 0) {
-    snapshot.total_processes = proc_count;
-    snapshot.total_ram_kb = 0;
-
-    // Calculate total RAM and find top process
-    for (int i = 0; i < proc_count; i++) {
-      snapshot.total_ram_kb += processes[i].ram_kb;
-    }
-
-    // Top process is first (already sorted)
-    if (processes[0].ram_kb > 0) {
-      strncpy(snapshot.top_process, processes[0].process_name, 63);
-      snapshot.top_process_ram_kb = processes[0].ram_kb;
-    }
-  }
+  long sample_age_ms;
+  int proc_count = snapshot_collect(&snapshot, &processes, &sample_age_ms);
 
-  // Save snapshot to database
-  int snapshot_id = db_save_system_snapshot(&snapshot);
+  // Save snapshot and process records in one transaction; this waits for
+  // the database writer's next group commit
+  db_save_result_t saved;
+  int snapshot_id = db_save_snapshot(&snapshot, processes, proc_count, &saved);
   if (snapshot_id > 0) {
-    // Save process records
-    if (proc_count > 0) {
-      // Set snapshot_id and timestamp for all processes
-      for (int i = 0; i < proc_count; i++) {
-        processes[i].snapshot_id = snapshot_id;
-        processes[i].timestamp = snapshot.timestamp;
-        processes[i].rank_position = i + 1;
-      }
-      db_save_process_records(snapshot_id, processes, proc_count);
-    }
 
     // Log event
     char desc[128];
@@ -85,18 +39,20 @@ static void handle_save_snapshot(struct mg_connection *c,
              proc_count);
     db_log_event("SNAPSHOT", desc, NULL);
 
-    char response[256];
-    snprintf(response, sizeof(response),
-             "{"
-             "\"success\": true,"
-             "\"message\": \"Snapshot saved successfully\","
-             "\"snapshot_id\": %d,"
-             "\"processes_saved\": %d,"
-             "\"timestamp\": %ld"
-             "}",
-             snapshot_id, proc_count, snapshot.timestamp);
-
-    send_json_response(c, 200, response);
+    json_writer_t w;
+    json_reply_begin(&w, c, 200);
+    json_object_begin(&w);
+    json_kv_bool(&w, "success", 1);
+    json_kv_string(&w, "message", "Snapshot saved successfully");
+    json_kv_int(&w, "snapshot_id", snapshot_id);
+    json_kv_int(&w, "processes_saved", proc_count);
+    json_kv_int(&w, "rows_written", saved.rows_written);
+    json_kv_int(&w, "bytes_saved", saved.bytes_saved);
+    json_kv_double(&w, "elapsed_ms", saved.elapsed_ms, 3);
+    json_kv_int(&w, "timestamp", snapshot.timestamp);
+    json_kv_int(&w, "sample_age_ms", sample_age_ms);
+    json_object_end(&w);
+    json_reply_end(&w);
   } else {
     send_error_response(c, 500, "Database Error", "Failed to save snapshot");
   }
@@ -105,80 +61,115 @@ static void handle_save_snapshot(struct mg_connection *c,
     free(processes);
 }
 
-// Handler for /api/database/snapshots
-static void handle_get_snapshots(struct mg_connection *c,
-                                 struct mg_http_message *hm) {
-  // Parse query parameters (simplified)
-  int limit = 10;
-  int offset = 0;
-
-  // Get query string
-  char query[256] = {0};
-  if (hm->query.len > 0 && hm->query.len < 255) {
-    memcpy(query, hm->query.buf, hm->query.len);
-    query[hm->query.len] = '\0';
+static int query_number(struct mg_http_message *hm, const char *name,
+                        void *value, size_t size) {
+  char buf[24];
+  if (mg_http_get_var(&hm->query, name, buf, sizeof(buf)) <= 0)
+    return 0;
+  return mg_str_to_num(mg_str(buf), 10, value, size) ? 0 : -1;
+}
 
-    // Simple parameter parsing
-    char *limit_param = strstr(query, "limit=");
-    if (limit_param) {
-      sscanf(limit_param, "limit=%d", &limit);
-      if (limit > 100)
-        limit = 100;
+// Pagination shared by the list endpoints: limit and offset, plus the
+// keyset parameters cursor (next_cursor from the previous page), before_id
+// and after_ts. Sends a 400 and returns -1 for a malformed value.
+static int parse_page(struct mg_connection *c, struct mg_http_message *hm,
+                      int default_limit, db_page_t *page) {
+  memset(page, 0, sizeof(*page));
+  page->limit = default_limit;
+
+  char cursor[DB_PAGE_CURSOR_LEN];
+  int cursor_len = mg_http_get_var(&hm->query, "cursor", cursor,
+                                   sizeof(cursor));
+  if (cursor_len > 0) {
+    if (db_page_cursor_parse(cursor, &page->cursor) != 0) {
+      send_error_response(c, 400, "Bad Request", "Invalid cursor");
+      return -1;
     }
+    page->has_cursor = 1;
+  }
 
-    char *offset_param = strstr(query, "offset=");
-    if (offset_param) {
-      sscanf(offset_param, "offset=%d", &offset);
-    }
+  if (query_number(hm, "limit", &page->limit, sizeof(page->limit)) != 0 ||
+      query_number(hm, "offset", &page->offset, sizeof(page->offset)) != 0 ||
+      query_number(hm, "before_id", &page->before_id,
+                   sizeof(page->before_id)) != 0 ||
+      query_number(hm, "after_ts", &page->after_ts,
+                   sizeof(page->after_ts)) != 0) {
+    send_error_response(c, 400, "Bad Request",
+                        "limit, offset, before_id and after_ts must be "
+                        "numbers");
+    return -1;
   }
 
+  if (page->limit < 1)
+    page->limit = 1;
+  if (page->limit > DB_PAGE_MAX_LIMIT)
+    page->limit = DB_PAGE_MAX_LIMIT;
+  if (page->offset < 0)
+    page->offset = 0;
+  return 0;
+}
+
+// next_cursor continues the listing after the last row, or is null on the
+// last page
+static void write_next_cursor(json_writer_t *w, int more, long long timestamp,
+                              int id) {
+  char cursor[DB_PAGE_CURSOR_LEN];
+  db_page_key_t key = {timestamp, id};
+  db_page_cursor_format(&key, cursor, sizeof(cursor));
+  json_kv_bool(w, "has_more", more);
+  json_kv_string(w, "next_cursor", more ? cursor : NULL);
+}
+
+// Handler for /api/database/snapshots
+static void handle_get_snapshots(struct mg_connection *c,
+                                 struct mg_http_message *hm,
+                                 const route_params_t *params) {
+  db_page_t page;
+  if (parse_page(c, hm, 10, &page) != 0)
+    return;
+
   system_snapshot_t *snapshots;
-  int count = db_get_system_snapshots(&snapshots, limit, offset);
+  int more;
+  int count = db_get_system_snapshots(&snapshots, &page, &more);
 
   if (count >= 0) {
-    char *response = malloc(count * 300 + 1000);
-    sprintf(response,
-            "{\n  \"success\": true,\n  \"count\": %d,\n  \"snapshots\": [\n",
-            count);
+    json_writer_t w;
+    json_reply_begin(&w, c, 200);
+    json_object_begin(&w);
+    json_kv_bool(&w, "success", 1);
+    json_kv_int(&w, "count", count);
+    json_key(&w, "snapshots");
+    json_array_begin(&w);
 
     for (int i = 0; i < count; i++) {
-      char snapshot_json[300];
-      snprintf(
-          snapshot_json, sizeof(snapshot_json),
-          "    {\n"
-          "      \"id\": %d,\n"
-          "      \"timestamp\": %ld,\n"
-          "      \"datetime\": \"%s\",\n"
-          "      \"total_processes\": %d,\n"
-          "      \"total_ram_kb\": %d,\n"
-          "      \"total_ram_mb\": %.2f,\n"
-          "      \"top_process\": \"%s\",\n"
-          "      \"top_process_ram_kb\": %d,\n"
-          "      \"cpu_load\": %.2f,\n"
-          "      \"memory_usage_percent\": %.2f\n"
-          "    }%s\n",
-          snapshots[i].id, snapshots[i].timestamp,
-          ctime(&snapshots[i].timestamp), // This includes \n, but we'll trim it
-          snapshots[i].total_processes, snapshots[i].total_ram_kb,
-          (double)snapshots[i].total_ram_kb / 1024.0, snapshots[i].top_process,
-          snapshots[i].top_process_ram_kb, snapshots[i].cpu_load,
-          snapshots[i].memory_usage_percent, (i < count - 1) ? "," : "");
-
-      // Remove newline from ctime
-      char *nl = strstr(snapshot_json, "\\n");
-      while (nl) {
-        *nl = ' ';
-        *(nl + 1) = ' ';
-        nl = strstr(nl + 2, "\\n");
-      }
-
-      strcat(response, snapshot_json);
+      char datetime[32];
+      format_datetime(snapshots[i].timestamp, datetime, sizeof(datetime));
+
+      json_object_begin(&w);
+      json_kv_int(&w, "id", snapshots[i].id);
+      json_kv_int(&w, "timestamp", snapshots[i].timestamp);
+      json_kv_string(&w, "datetime", datetime);
+      json_kv_int(&w, "total_processes", snapshots[i].total_processes);
+      json_kv_int(&w, "total_ram_kb", snapshots[i].total_ram_kb);
+      json_kv_double(&w, "total_ram_mb",
+                     (double)snapshots[i].total_ram_kb / 1024.0, 2);
+      json_kv_string(&w, "top_process", snapshots[i].top_process);
+      json_kv_int(&w, "top_process_ram_kb", snapshots[i].top_process_ram_kb);
+      json_kv_double(&w, "cpu_load", snapshots[i].cpu_load, 2);
+      json_kv_double(&w, "memory_usage_percent",
+                     snapshots[i].memory_usage_percent, 2);
+      json_object_end(&w);
     }
 
-    strcat(response, "  ]\n}");
-    send_json_response(c, 200, response);
+    json_array_end(&w);
+    if (count > 0)
+      write_next_cursor(&w, more, snapshots[count - 1].timestamp,
+                        snapshots[count - 1].id);
+    else
+      write_next_cursor(&w, 0, 0, 0);
+    json_object_end(&w);
+    json_reply_end(&w);
 
-    free(response);
     free(snapshots);
   } else {
     send_error_response(c, 500, "Database Error",
@@ -188,72 +179,55 @@ static void handle_get_snapshots(struct mg_connection *c,
 
 // Handler for /api/database/events
 static void handle_get_events(struct mg_connection *c,
-                              struct mg_http_message *hm) {
-  int limit = 50;
-  int offset = 0;
-  char event_type_filter[64] = {0};
-
-  // Parse query parameters
-  char query[256] = {0};
-  if (hm->query.len > 0 && hm->query.len < 255) {
-    memcpy(query, hm->query.buf, hm->query.len);
-    query[hm->query.len] = '\0';
-
-    char *limit_param = strstr(query, "limit=");
-    if (limit_param)
-      sscanf(limit_param, "limit=%d", &limit);
+                              struct mg_http_message *hm,
+                              const route_params_t *params) {
+  db_page_t page;
+  if (parse_page(c, hm, 50, &page) != 0)
+    return;
 
-    char *offset_param = strstr(query, "offset=");
-    if (offset_param)
-      sscanf(offset_param, "offset=%d", &offset);
-
-    char *type_param = strstr(query, "type=");
-    if (type_param) {
-      sscanf(type_param, "type=%63s", event_type_filter);
-    }
-  }
+  // type stops at the next parameter, so it can be combined with the rest
+  char event_type_filter[64] = {0};
+  mg_http_get_var(&hm->query, "type", event_type_filter,
+                  sizeof(event_type_filter));
 
   system_event_t *events;
   const char *filter =
       (strlen(event_type_filter) > 0) ? event_type_filter : NULL;
-  int count = db_get_events(&events, limit, offset, filter);
+  int more;
+  int count = db_get_events(&events, &page, filter, &more);
 
   if (count >= 0) {
-    char *response = malloc(count * 400 + 1000);
-    sprintf(response,
-            "{\n  \"success\": true,\n  \"count\": %d,\n  \"events\": [\n",
-            count);
+    json_writer_t w;
+    json_reply_begin(&w, c, 200);
+    json_object_begin(&w);
+    json_kv_bool(&w, "success", 1);
+    json_kv_int(&w, "count", count);
+    json_key(&w, "events");
+    json_array_begin(&w);
 
     for (int i = 0; i < count; i++) {
-      char event_json[400];
-      char *datetime_str = ctime(&events[i].timestamp);
-      if (datetime_str) {
-        char *nl = strchr(datetime_str, '\n');
-        if (nl)
-          *nl = '\0';
-      }
-
-      snprintf(event_json, sizeof(event_json),
-               "    {\n"
-               "      \"id\": %d,\n"
-               "      \"timestamp\": %ld,\n"
-               "      \"datetime\": \"%s\",\n"
-               "      \"event_type\": \"%s\",\n"
-               "      \"description\": \"%s\",\n"
-               "      \"data\": \"%s\"\n"
-               "    }%s\n",
-               events[i].id, events[i].timestamp,
-               datetime_str ? datetime_str : "unknown", events[i].event_type,
-               events[i].description, events[i].data,
-               (i < count - 1) ? "," : "");
-
-      strcat(response, event_json);
+      char datetime[32];
+      format_datetime(events[i].timestamp, datetime, sizeof(datetime));
+
+      json_object_begin(&w);
+      json_kv_int(&w, "id", events[i].id);
+      json_kv_int(&w, "timestamp", events[i].timestamp);
+      json_kv_string(&w, "datetime", datetime);
+      json_kv_string(&w, "event_type", events[i].event_type);
+      json_kv_string(&w, "description", events[i].description);
+      json_kv_string(&w, "data", events[i].data);
+      json_object_end(&w);
     }
 
-    strcat(response, "  ]\n}");
-    send_json_response(c, 200, response);
+    json_array_end(&w);
+    if (count > 0)
+      write_next_cursor(&w, more, events[count - 1].timestamp,
+                        events[count - 1].id);
+    else
+      write_next_cursor(&w, 0, 0, 0);
+    json_object_end(&w);
+    json_reply_end(&w);
 
-    free(response);
     free(events);
   } else {
     send_error_response(c, 500, "Database Error", "Failed to retrieve events");
@@ -261,7 +235,8 @@ static void handle_get_events(struct mg_connection *c,
 }
 
 // Handler for /api/database/config (GET/POST)
-static void handle_config(struct mg_connection *c, struct mg_http_message *hm) {
+static void handle_config(struct mg_connection *c, struct mg_http_message *hm,
+                          const route_params_t *params) {
   if (strncmp(hm->method.buf, "GET", 3) == 0) {
     // GET - retrieve configuration
     char query[256] = {0};
@@ -281,15 +256,14 @@ static void handle_config(struct mg_connection *c, struct mg_http_message *hm) {
       // Get specific key
       char *value = db_get_config(key);
       if (value) {
-        char response[512];
-        snprintf(response, sizeof(response),
-                 "{"
-                 "\"success\": true,"
-                 "\"key\": \"%s\","
-                 "\"value\": \"%s\""
-                 "}",
-                 key, value);
-        send_json_response(c, 200, response);
+        json_writer_t w;
+        json_reply_begin(&w, c, 200);
+        json_object_begin(&w);
+        json_kv_bool(&w, "success", 1);
+        json_kv_string(&w, "key", key);
+        json_kv_string(&w, "value", value);
+        json_object_end(&w);
+        json_reply_end(&w);
         free(value);
       } else {
         send_error_response(c, 404, "Not Found", "Configuration key not found");
@@ -361,9 +335,22 @@ static void handle_config(struct mg_connection *c, struct mg_http_message *hm) {
   }
 }
 
+static const char *resolution_name(int resolution) {
+  switch (resolution) {
+  case DB_ROLLUP_MINUTE:
+    return "minute";
+  case DB_ROLLUP_HOUR:
+    return "hour";
+  case DB_ROLLUP_DAY:
+    return "day";
+  }
+  return "raw";
+}
+
 // Handler for /api/database/analytics/ram-trend
 static void handle_ram_trend(struct mg_connection *c,
-                             struct mg_http_message *hm) {
+                             struct mg_http_message *hm,
+                             const route_params_t *params) {
   int hours = 24; // Default 24 hours
 
   // Parse hours parameter
@@ -375,24 +362,110 @@ static void handle_ram_trend(struct mg_connection *c,
     char *hours_param = strstr(query, "hours=");
     if (hours_param) {
       sscanf(hours_param, "hours=%d", &hours);
-      if (hours > 168)
-        hours = 168; // Max 1 week
+      if (hours < 1)
+        hours = 1;
+      if (hours > DB_TREND_MAX_HOURS)
+        hours = DB_TREND_MAX_HOURS;
     }
   }
 
-  char *json_result;
-  if (db_get_ram_usage_trend(&json_result, hours) == 0) {
-    send_json_response(c, 200, json_result);
-    free(json_result);
+  // ?points=N caps the number of points. Longer series are downsampled
+  // with LTTB, from rollups when the raw window is too long to scan.
+  int points = DB_TREND_DEFAULT_POINTS;
+  char value[16];
+  if (mg_http_get_var(&hm->query, "points", value, sizeof(value)) > 0 &&
+      !mg_str_to_num(mg_str(value), 10, &points, sizeof(points))) {
+    send_error_response(c, 400, "Bad Request", "points must be a number");
+    return;
+  }
+  if (points < LTTB_MIN_POINTS)
+    points = LTTB_MIN_POINTS;
+  if (points > DB_TREND_MAX_POINTS)
+    points = DB_TREND_MAX_POINTS;
+
+  long long rows;
+  int resolution = db_trend_resolution(hours, &rows);
+  int downsample = rows > points;
+
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  json_kv_int(&w, "hours", hours);
+  json_kv_string(&w, "resolution", resolution_name(resolution));
+  json_kv_int(&w, "resolution_seconds", resolution);
+  json_kv_bool(&w, "downsampled", downsample);
+  json_key(&w, "data");
+  int written =
+      db_get_ram_usage_trend(&w, hours, resolution, downsample ? points : 0);
+  if (written >= 0) {
+    json_kv_int(&w, "points", written);
+    json_object_end(&w);
+    json_reply_end(&w);
   } else {
+    json_reply_abort(&w);
     send_error_response(c, 500, "Database Error",
                         "Failed to get RAM trend data");
   }
 }
 
+// Handler for /api/database/analytics/process/{name}
+static void handle_process_usage(struct mg_connection *c,
+                                 struct mg_http_message *hm,
+                                 const route_params_t *params) {
+  // Names are stored as the sampler read them, up to 63 bytes
+  char name[64];
+  struct mg_str param = api_get_param(params, "name");
+  int len = mg_url_decode(param.buf, param.len, name, sizeof(name), 0);
+  if (len <= 0) {
+    send_error_response(c, 400, "Bad Request", "Invalid process name");
+    return;
+  }
+
+  int days = 7;
+  char value[16];
+  if (mg_http_get_var(&hm->query, "days", value, sizeof(value)) > 0 &&
+      !mg_str_to_num(mg_str(value), 10, &days, sizeof(days))) {
+    send_error_response(c, 400, "Bad Request", "days must be a number");
+    return;
+  }
+  if (days < 1)
+    days = 1;
+  if (days > DB_PROCESS_USAGE_MAX_DAYS)
+    days = DB_PROCESS_USAGE_MAX_DAYS;
+
+  db_process_usage_t usage;
+  if (db_get_process_usage_stats(name, days, &usage) != 0) {
+    send_error_response(c, 500, "Database Error",
+                        "Failed to get process usage");
+    return;
+  }
+  if (usage.samples == 0) {
+    send_error_response(c, 404, "Not Found", "No samples for this process");
+    return;
+  }
+
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  json_kv_string(&w, "process_name", name);
+  json_kv_int(&w, "days", days);
+  json_kv_int(&w, "samples", usage.samples);
+  json_key(&w, "ram_kb");
+  json_object_begin(&w);
+  json_kv_int(&w, "min", usage.min_kb);
+  json_kv_double(&w, "avg", usage.avg_kb, 1);
+  json_kv_int(&w, "max", usage.max_kb);
+  json_kv_int(&w, "p95", usage.p95_kb);
+  json_object_end(&w);
+  json_object_end(&w);
+  json_reply_end(&w);
+}
+
 // Handler for /api/database/cleanup
-static void handle_cleanup(struct mg_connection *c,
-                           struct mg_http_message *hm) {
+static void handle_cleanup(struct mg_connection *c, struct mg_http_message *hm,
+                           const route_params_t *params) {
   int days_to_keep = 7; // Default keep 7 days
 
   // Parse days parameter
@@ -409,21 +482,25 @@ static void handle_cleanup(struct mg_connection *c,
     }
   }
 
-  if (db_cleanup_old_data(days_to_keep) == 0) {
+  // Runs on the database writer chunk by chunk, each in its own
+  // transaction, between other queued writes
+  int deleted = db_cleanup_old_data(days_to_keep);
+  if (deleted >= 0) {
     char desc[128];
-    snprintf(desc, sizeof(desc), "Cleaned up data older than %d days",
-             days_to_keep);
+    snprintf(desc, sizeof(desc),
+             "Cleaned up data older than %d days, %d rows deleted",
+             days_to_keep, deleted);
     db_log_event("MAINTENANCE", desc, NULL);
 
-    char response[256];
-    snprintf(response, sizeof(response),
-             "{"
-             "\"success\": true,"
-             "\"message\": \"Database cleanup completed\","
-             "\"days_kept\": %d"
-             "}",
-             days_to_keep);
-    send_json_response(c, 200, response);
+    json_writer_t w;
+    json_reply_begin(&w, c, 200);
+    json_object_begin(&w);
+    json_kv_bool(&w, "success", 1);
+    json_kv_string(&w, "message", "Database cleanup completed");
+    json_kv_int(&w, "days_kept", days_to_keep);
+    json_kv_int(&w, "rows_deleted", deleted);
+    json_object_end(&w);
+    json_reply_end(&w);
   } else {
     send_error_response(c, 500, "Database Error", "Failed to cleanup database");
   }
@@ -431,135 +508,159 @@ static void handle_cleanup(struct mg_connection *c,
 
 // Handler for /api/database/stats
 static void handle_database_stats(struct mg_connection *c,
-                                  struct mg_http_message *hm) {
-  int db_size = db_get_database_size();
-
-  // Get record counts
-  const char *count_sql =
-      "SELECT "
-      "(SELECT COUNT(*) FROM system_snapshots) as snapshots, "
-      "(SELECT COUNT(*) FROM process_records) as processes, "
-      "(SELECT COUNT(*) FROM system_events) as events, "
-      "(SELECT COUNT(*) FROM config_store) as configs";
-
-  sqlite3_stmt *stmt = db_prepare(count_sql);
-  int snapshots = 0, processes = 0, events = 0, configs = 0;
-
-  if (stmt && sqlite3_step(stmt) == SQLITE_ROW) {
-    snapshots = sqlite3_column_int(stmt, 0);
-    processes = sqlite3_column_int(stmt, 1);
-    events = sqlite3_column_int(stmt, 2);
-    configs = sqlite3_column_int(stmt, 3);
+                                  struct mg_http_message *hm,
+                                  const route_params_t *params) {
+  // Row counts come from trigger-maintained counters; sizes from a dbstat
+  // walk that is cached for DB_STORAGE_STATS_TTL_S
+  db_storage_stats_t storage;
+  if (db_get_storage_stats(&storage) != 0) {
+    send_error_response(c, 500, "Database Error",
+                        "Failed to read storage statistics");
+    return;
   }
-
-  if (stmt)
-    sqlite3_finalize(stmt);
-
-  char response[512];
-  snprintf(response, sizeof(response),
-           "{"
-           "\"success\": true,"
-           "\"database_stats\": {"
-           "\"size_bytes\": %d,"
-           "\"size_mb\": %.2f,"
-           "\"snapshots\": %d,"
-           "\"process_records\": %d,"
-           "\"events\": %d,"
-           "\"config_entries\": %d"
-           "}"
-           "}",
-           db_size, (double)db_size / (1024.0 * 1024.0), snapshots, processes,
-           events, configs);
-
-  send_json_response(c, 200, response);
-}
-
-// Helper function to get process list compatible with database format
-int get_process_list_for_db(process_record_t **processes) {
-  DIR *proc_dir = opendir("/proc");
-  if (!proc_dir)
-    return 0;
-
-  struct dirent *entry;
-  process_record_t *proc_list = malloc(1000 * sizeof(process_record_t));
-  int count = 0;
-
-  while ((entry = readdir(proc_dir)) != NULL && count < 1000) {
-    // Check if entry name is numeric (PID)
-    int is_pid = 1;
-    for (char *p = entry->d_name; *p; p++) {
-      if (*p < '0' || *p > '9') {
-        is_pid = 0;
-        break;
-      }
-    }
-    if (!is_pid)
-      continue;
-
-    int pid = atoi(entry->d_name);
-    char comm_path[64], status_path[64];
-    snprintf(comm_path, sizeof(comm_path), "/proc/%d/comm", pid);
-    snprintf(status_path, sizeof(status_path), "/proc/%d/status", pid);
-
-    FILE *comm_file = fopen(comm_path, "r");
-    FILE *status_file = fopen(status_path, "r");
-
-    if (comm_file && status_file) {
-      char name[64] = {0};
-      int rss_kb = 0;
-      char line[128];
-
-      // Get process name
-      if (fgets(name, sizeof(name), comm_file)) {
-        char *nl = strchr(name, '\n');
-        if (nl)
-          *nl = '\0';
-      }
-
-      // Get RSS from status file
-      while (fgets(line, sizeof(line), status_file)) {
-        if (sscanf(line, "VmRSS: %d kB", &rss_kb) == 1) {
-          break;
-        }
-      }
-
-      if (strlen(name) > 0 && rss_kb > 0) {
-        proc_list[count].pid = pid;
-        strncpy(proc_list[count].process_name, name, 63);
-        proc_list[count].process_name[63] = '\0';
-        proc_list[count].ram_kb = rss_kb;
-        count++;
-      }
-    }
-
-    if (comm_file)
-      fclose(comm_file);
-    if (status_file)
-      fclose(status_file);
+  const db_table_stats_t *tables = storage.tables;
+  long long db_size = storage.total_bytes;
+  long long snapshots = tables[DB_TABLE_SNAPSHOTS].rows;
+
+  db_writer_stats_t writer;
+  db_writer_get_stats(&writer);
+
+  db_persist_stats_t persist;
+  db_persist_get_stats(&persist);
+  snapshot_scheduler_stats_t sched;
+  snapshot_scheduler_get_stats(&sched);
+
+  // Without per-table sizes, the whole file is charged to snapshots
+  long long snapshot_total =
+      storage.per_table ? tables[DB_TABLE_SNAPSHOTS].bytes +
+                              tables[DB_TABLE_PROCESSES].bytes +
+                              tables[DB_TABLE_NAMES].bytes
+                        : storage.total_bytes;
+
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  json_key(&w, "database_stats");
+  json_object_begin(&w);
+  json_kv_int(&w, "size_bytes", db_size);
+  json_kv_double(&w, "size_mb", (double)db_size / (1024.0 * 1024.0), 2);
+  json_kv_int(&w, "snapshots", snapshots);
+  json_kv_int(&w, "process_records", tables[DB_TABLE_PROCESSES].rows);
+  json_kv_int(&w, "events", tables[DB_TABLE_EVENTS].rows);
+  json_kv_int(&w, "config_entries", tables[DB_TABLE_CONFIG].rows);
+  json_kv_int(&w, "process_names", tables[DB_TABLE_NAMES].rows);
+  json_object_end(&w);
+  json_key(&w, "storage");
+  json_object_begin(&w);
+  json_kv_bool(&w, "per_table", storage.per_table);
+  json_kv_int(&w, "measured", storage.measured);
+  json_kv_int(&w, "measured_age_s",
+              (long long)(time(NULL) - storage.measured));
+  json_kv_int(&w, "snapshot_bytes", tables[DB_TABLE_SNAPSHOTS].bytes);
+  json_kv_int(&w, "process_record_bytes", tables[DB_TABLE_PROCESSES].bytes);
+  json_kv_int(&w, "process_name_bytes", tables[DB_TABLE_NAMES].bytes);
+  json_kv_int(&w, "rollup_bytes", tables[DB_TABLE_ROLLUPS].bytes);
+  json_kv_int(&w, "bytes_per_snapshot",
+              snapshots > 0 ? snapshot_total / snapshots : 0);
+  json_key(&w, "tables");
+  json_object_begin(&w);
+  for (int i = 0; i < DB_TABLE_COUNT; i++) {
+    json_key(&w, tables[i].name);
+    json_object_begin(&w);
+    json_kv_int(&w, "rows", tables[i].rows);
+    json_kv_int(&w, "bytes", tables[i].bytes);
+    json_object_end(&w);
   }
+  json_object_end(&w);
+  json_object_end(&w);
+  json_key(&w, "writer");
+  json_object_begin(&w);
+  json_kv_bool(&w, "running", writer.running);
+  json_kv_int(&w, "flush_ms", writer.flush_ms);
+  json_kv_int(&w, "max_batch_rows", writer.max_batch_rows);
+  json_kv_int(&w, "queue_depth", writer.queue_depth);
+  json_kv_int(&w, "max_queue", writer.max_queue);
+  json_kv_uint(&w, "queued", writer.queued);
+  json_kv_uint(&w, "dropped", writer.dropped);
+  json_kv_uint(&w, "failed", writer.failed);
+  json_kv_uint(&w, "commits", writer.commits);
+  json_kv_uint(&w, "committed_rows", writer.committed_rows);
+  json_kv_double(&w, "last_commit_ms", writer.last_commit_ms, 3);
+  json_kv_double(&w, "avg_commit_ms", writer.avg_commit_ms, 3);
+  json_kv_double(&w, "max_commit_ms", writer.max_commit_ms, 3);
+  json_object_end(&w);
+  json_key(&w, "persistence");
+  json_object_begin(&w);
+  json_kv_bool(&w, "enabled", persist.enabled);
+  json_kv_bool(&w, "restored", persist.restored);
+  json_kv_bool(&w, "in_progress", persist.in_progress);
+  json_kv_int(&w, "interval_s", sched.checkpoint.interval_ms / 1000);
+  json_kv_uint(&w, "checkpoints", persist.checkpoints);
+  json_kv_uint(&w, "skipped", persist.skipped);
+  json_kv_uint(&w, "failures", persist.failures);
+  json_kv_int(&w, "last_checkpoint", persist.last_checkpoint);
+  json_kv_int(&w, "last_checkpoint_age_s",
+              persist.last_checkpoint
+                  ? (long long)(time(NULL) - persist.last_checkpoint)
+                  : -1);
+  json_kv_int(&w, "last_bytes_written", persist.last_bytes);
+  json_kv_int(&w, "total_bytes_written", persist.total_bytes);
+  json_kv_double(&w, "last_duration_ms", persist.last_duration_ms, 1);
+  json_object_end(&w);
+  json_object_end(&w);
+  json_reply_end(&w);
+}
 
-  closedir(proc_dir);
-
-  // Sort by RAM usage (descending)
-  for (int i = 0; i < count - 1; i++) {
-    for (int j = 0; j < count - i - 1; j++) {
-      if (proc_list[j].ram_kb < proc_list[j + 1].ram_kb) {
-        process_record_t temp = proc_list[j];
-        proc_list[j] = proc_list[j + 1];
-        proc_list[j + 1] = temp;
-      }
-    }
-  }
+static void write_job_stats(json_writer_t *w, const char *key,
+                            const scheduler_job_stats_t *job) {
+  json_key(w, key);
+  json_object_begin(w);
+  json_kv_bool(w, "enabled", job->enabled);
+  json_kv_int(w, "interval_ms", job->interval_ms);
+  json_kv_uint(w, "runs", job->runs);
+  json_kv_uint(w, "failures", job->failures);
+  json_kv_uint(w, "skipped", job->skipped);
+  json_kv_int(w, "last_run", job->last_run);
+  json_kv_int(w, "last_result", job->last_result);
+  json_kv_double(w, "last_duration_ms", job->last_duration_ms, 1);
+  json_kv_int(w, "last_drift_ms", job->last_drift_ms);
+  json_kv_int(w, "max_drift_ms", job->max_drift_ms);
+  json_kv_double(w, "avg_drift_ms", job->avg_drift_ms, 1);
+  json_kv_int(w, "next_run_in_ms", job->next_run_in_ms);
+  json_object_end(w);
+}
 
-  *processes = proc_list;
-  return count;
+// Handler for /api/database/scheduler
+static void handle_scheduler(struct mg_connection *c,
+                             struct mg_http_message *hm,
+                             const route_params_t *params) {
+  snapshot_scheduler_stats_t stats;
+  snapshot_scheduler_get_stats(&stats);
+
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  write_job_stats(&w, "snapshot", &stats.snapshot);
+  write_job_stats(&w, "cleanup", &stats.cleanup);
+  write_job_stats(&w, "checkpoint", &stats.checkpoint);
+  json_key(&w, "retention_days");
+  json_object_begin(&w);
+  json_kv_int(&w, "snapshots", stats.retention.snapshot_days);
+  json_kv_int(&w, "events", stats.retention.event_days);
+  json_kv_int(&w, "network", stats.retention.network_days);
+  json_kv_int(&w, "hourly_rollups", DB_ROLLUP_HOUR_KEEP_DAYS);
+  json_object_end(&w);
+  json_object_end(&w);
+  json_reply_end(&w);
 }
 
 // Register all database endpoints
 void register_database_endpoints(api_manager_t *manager) {
-  api_register_route(manager, "/api/database/save/snapshot", METHOD_POST,
-                     handle_save_snapshot,
-                     "Save current system snapshot to database");
+  api_register_blocking_route(manager, "/api/database/save/snapshot",
+                              METHOD_POST, handle_save_snapshot,
+                              "Save current system snapshot to database", 4);
 
   api_register_route(manager, "/api/database/snapshots", METHOD_GET,
                      handle_get_snapshots,
@@ -577,9 +678,17 @@ void register_database_endpoints(api_manager_t *manager) {
   api_register_route(manager, "/api/database/analytics/ram-trend", METHOD_GET,
                      handle_ram_trend, "Get RAM usage trend analytics");
 
-  api_register_route(manager, "/api/database/cleanup", METHOD_POST,
-                     handle_cleanup, "Cleanup old database records");
+  api_register_blocking_route(manager, "/api/database/analytics/process/{name}",
+                              METHOD_GET, handle_process_usage,
+                              "Get RSS statistics for a process", 2);
+
+  api_register_blocking_route(manager, "/api/database/cleanup", METHOD_POST,
+                              handle_cleanup, "Cleanup old database records",
+                              1);
 
   api_register_route(manager, "/api/database/stats", METHOD_GET,
                      handle_database_stats, "Get database statistics");
+
+  api_register_route(manager, "/api/database/scheduler", METHOD_GET,
+                     handle_scheduler, "Get snapshot scheduler status");
 }
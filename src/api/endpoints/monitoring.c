@@ -1,232 +1,161 @@
 #include "../api_manager.h"
+#include "../helpers/cpu_sampler.h"
+#include "../helpers/process_sampler.h"
 #include "../helpers/response.h"
 #include "../helpers/system_info.h"
-#include <ctype.h>
-#include <dirent.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-// Structure to hold process information
-typedef struct {
-  int pid;
-  char name[21];
-  int rss_kb;
-  double rss_mb;
-} process_info_t;
-
-// Compare function for qsort (descending order by RSS)
-static int compare_processes(const void *a, const void *b) {
-  const process_info_t *pa = (const process_info_t *)a;
-  const process_info_t *pb = (const process_info_t *)b;
-  return pb->rss_kb - pa->rss_kb; // Descending order
+// Convert kB to MB
+static double kb_to_mb(long long kb) { return (double)kb / 1024.0; }
+
+// Write one ranked process entry
+static void write_process(json_writer_t *w, int rank,
+                          const process_info_t *proc) {
+  json_object_begin(w);
+  json_kv_int(w, "rank", rank);
+  json_kv_int(w, "pid", proc->pid);
+  json_kv_string(w, "name", proc->name);
+  json_kv_int(w, "rss_kb", proc->rss_kb);
+  json_kv_double(w, "rss_mb", kb_to_mb(proc->rss_kb), 2);
+  json_kv_double(w, "cpu_percent", proc->cpu_percent, 1);
+  json_object_end(w);
 }
 
-// Check if string is a number (for PID validation)
-static int is_number(const char *str) {
-  if (!str || !*str)
-    return 0;
-  while (*str) {
-    if (!isdigit(*str))
-      return 0;
-    str++;
-  }
-  return 1;
+// Read ?sort=ram|cpu, defaulting to RAM. Sends 400 and returns -1 if the
+// value is not recognised.
+static int parse_sort(struct mg_connection *c, struct mg_http_message *hm) {
+  char sort[16];
+  int len = mg_http_get_var(&hm->query, "sort", sort, sizeof(sort));
+  if (len == 0 || len == -1 || len == -4) // Empty or absent
+    return PROCESS_SORT_RSS;
+  int key = len > 0 ? process_sort_from_name(sort, (size_t)len) : -1;
+  if (key < 0)
+    send_error_response(c, 400, "Bad Request", "sort must be ram or cpu");
+  return key;
 }
 
-// Convert kB to MB
-static double kb_to_mb(int kb) { return (double)kb / 1024.0; }
-
-// Get process information
-static int get_process_list(process_info_t **processes) {
-  DIR *proc_dir = opendir("/proc");
-  if (!proc_dir)
-    return 0;
-
-  struct dirent *entry;
-  process_info_t *proc_list = malloc(1000 * sizeof(process_info_t));
-  int count = 0;
-
-  while ((entry = readdir(proc_dir)) != NULL && count < 1000) {
-    if (!is_number(entry->d_name))
-      continue;
-
-    int pid = atoi(entry->d_name);
-    char comm_path[64], status_path[64];
-    snprintf(comm_path, sizeof(comm_path), "/proc/%d/comm", pid);
-    snprintf(status_path, sizeof(status_path), "/proc/%d/status", pid);
-
-    FILE *comm_file = fopen(comm_path, "r");
-    FILE *status_file = fopen(status_path, "r");
-
-    if (comm_file && status_file) {
-      char name[21] = {0};
-      int rss_kb = 0;
-      char line[128];
-
-      // Get process name
-      if (fgets(name, sizeof(name), comm_file)) {
-        // Remove newline
-        char *nl = strchr(name, '\n');
-        if (nl)
-          *nl = '\0';
-      }
-
-      // Get RSS from status file
-      while (fgets(line, sizeof(line), status_file)) {
-        if (sscanf(line, "VmRSS: %d kB", &rss_kb) == 1) {
-          break;
-        }
-      }
-
-      if (strlen(name) > 0 && rss_kb > 0) {
-        proc_list[count].pid = pid;
-        strncpy(proc_list[count].name, name, 20);
-        proc_list[count].name[20] = '\0';
-        proc_list[count].rss_kb = rss_kb;
-        proc_list[count].rss_mb = kb_to_mb(rss_kb);
-        count++;
-      }
-    }
-
-    if (comm_file)
-      fclose(comm_file);
-    if (status_file)
-      fclose(status_file);
-  }
-
-  closedir(proc_dir);
-
-  // Sort processes by RSS (descending)
-  qsort(proc_list, count, sizeof(process_info_t), compare_processes);
-
-  *processes = proc_list;
-  return count;
+// Write which sampler generation a reply was built from and how old it is
+static void write_sample_info(json_writer_t *w, const process_table_t *table) {
+  json_key(w, "sample");
+  json_object_begin(w);
+  json_kv_uint(w, "generation", table->generation);
+  json_kv_int(w, "sampled_at", table->sampled_at);
+  json_kv_int(w, "age_ms", process_table_age_ms(table));
+  json_kv_int(w, "interval_ms", process_sampler_interval_ms());
+  json_kv_int(w, "cpu_window_ms", table->cpu_window_ms);
+  json_object_end(w);
 }
 
 // Handler for /api/monitoring/processes
 static void handle_monitoring_processes(struct mg_connection *c,
-                                        struct mg_http_message *hm) {
-  process_info_t *processes;
-  int count = get_process_list(&processes);
+                                        struct mg_http_message *hm,
+                                        const route_params_t *params) {
+  int sort = parse_sort(c, hm);
+  if (sort < 0)
+    return;
 
-  if (count == 0) {
+  const process_table_t *table = process_table_acquire();
+  const process_info_t *processes =
+      table && table->ranked[sort] > 0 ? process_table_sorted(table, sort)
+                                       : NULL;
+
+  if (!processes) {
+    process_table_release(table);
     send_error_response(c, 500, "Internal Server Error",
                         "Failed to get process list");
     return;
   }
 
-  // Build JSON response
-  char *response = malloc(count * 200 + 1000); // Rough estimate
-  strcpy(response, "{\n  \"success\": true,\n  \"processes\": [\n");
-
-  for (int i = 0; i < count; i++) {
-    char proc_json[200];
-    snprintf(proc_json, sizeof(proc_json),
-             "    {\n"
-             "      \"rank\": %d,\n"
-             "      \"pid\": %d,\n"
-             "      \"name\": \"%s\",\n"
-             "      \"rss_kb\": %d,\n"
-             "      \"rss_mb\": %.2f\n"
-             "    }%s\n",
-             i + 1, processes[i].pid, processes[i].name, processes[i].rss_kb,
-             processes[i].rss_mb, (i < count - 1) ? "," : "");
-    strcat(response, proc_json);
-  }
-
-  // Calculate totals
-  int total_kb = 0;
-  for (int i = 0; i < count; i++) {
-    total_kb += processes[i].rss_kb;
-  }
-
-  char summary[300];
-  snprintf(summary, sizeof(summary),
-           "  ],\n"
-           "  \"summary\": {\n"
-           "    \"total_processes\": %d,\n"
-           "    \"total_ram_kb\": %d,\n"
-           "    \"total_ram_mb\": %.2f,\n"
-           "    \"highest_process\": \"%s\",\n"
-           "    \"highest_ram_kb\": %d,\n"
-           "    \"highest_ram_mb\": %.2f\n"
-           "  }\n}",
-           count, total_kb, kb_to_mb(total_kb),
-           count > 0 ? processes[0].name : "none",
-           count > 0 ? processes[0].rss_kb : 0,
-           count > 0 ? processes[0].rss_mb : 0.0);
-  strcat(response, summary);
-
-  send_json_response(c, 200, response);
-
-  free(response);
-  free(processes);
+  // Stream the listing straight into the connection's send buffer
+  const process_info_t *highest = table->top_count[PROCESS_SORT_RSS] > 0
+                                      ? &table->top[PROCESS_SORT_RSS][0]
+                                      : NULL;
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  json_kv_string(&w, "sort", process_sort_name(sort));
+  json_key(&w, "processes");
+  json_array_begin(&w);
+  for (int i = 0; i < table->ranked[sort]; i++)
+    write_process(&w, i + 1, &processes[i]);
+  json_array_end(&w);
+
+  json_key(&w, "summary");
+  json_object_begin(&w);
+  json_kv_int(&w, "total_processes", table->count);
+  json_kv_int(&w, "total_ram_kb", table->total_rss_kb);
+  json_kv_double(&w, "total_ram_mb", kb_to_mb(table->total_rss_kb), 2);
+  json_kv_string(&w, "highest_process", highest ? highest->name : "none");
+  json_kv_int(&w, "highest_ram_kb", highest ? highest->rss_kb : 0);
+  json_kv_double(&w, "highest_ram_mb", kb_to_mb(highest ? highest->rss_kb : 0),
+                 2);
+  json_object_end(&w);
+  write_sample_info(&w, table);
+  json_object_end(&w);
+  json_reply_end(&w);
+
+  process_table_release(table);
 }
 
 // Handler for /api/monitoring/processes/top/{N}
 static void handle_monitoring_top_processes(struct mg_connection *c,
-                                            struct mg_http_message *hm) {
-  // Extract number from URL path (simplified parsing)
-  char *path_copy = malloc(hm->uri.len + 1);
-  memcpy(path_copy, hm->uri.buf, hm->uri.len);
-  path_copy[hm->uri.len] = '\0';
-
+                                            struct mg_http_message *hm,
+                                            const route_params_t *params) {
+  // N comes from the {n} path parameter; /top alone means top 10
   int limit = 10; // default
-  char *last_slash = strrchr(path_copy, '/');
-  if (last_slash && is_number(last_slash + 1)) {
-    limit = atoi(last_slash + 1);
-    if (limit <= 0)
-      limit = 10;
-    if (limit > 100)
-      limit = 100; // Cap at 100
+  struct mg_str n = api_get_param(params, "n");
+  if (n.len > 0 && !mg_str_to_num(n, 10, &limit, sizeof(limit))) {
+    send_error_response(c, 400, "Bad Request", "N must be a number");
+    return;
   }
-  free(path_copy);
+  if (limit <= 0)
+    limit = 10;
+  if (limit > PROCESS_TOP_MAX)
+    limit = PROCESS_TOP_MAX;
+
+  int sort = parse_sort(c, hm);
+  if (sort < 0)
+    return;
 
-  process_info_t *processes;
-  int count = get_process_list(&processes);
+  const process_table_t *table = process_table_acquire();
 
-  if (count == 0) {
+  if (!table || table->count == 0) {
+    process_table_release(table);
     send_error_response(c, 500, "Internal Server Error",
                         "Failed to get process list");
     return;
   }
 
-  // Limit the count to requested number
+  // Served from the sampler's top list, no need to sort the full table
+  int count = table->top_count[sort];
   if (limit < count)
     count = limit;
 
-  // Build JSON response for top N processes
-  char *response = malloc(count * 200 + 1000);
-  sprintf(response,
-          "{\n  \"success\": true,\n  \"limit\": %d,\n  \"processes\": [\n",
-          limit);
-
-  for (int i = 0; i < count; i++) {
-    char proc_json[200];
-    snprintf(proc_json, sizeof(proc_json),
-             "    {\n"
-             "      \"rank\": %d,\n"
-             "      \"pid\": %d,\n"
-             "      \"name\": \"%s\",\n"
-             "      \"rss_kb\": %d,\n"
-             "      \"rss_mb\": %.2f\n"
-             "    }%s\n",
-             i + 1, processes[i].pid, processes[i].name, processes[i].rss_kb,
-             processes[i].rss_mb, (i < count - 1) ? "," : "");
-    strcat(response, proc_json);
-  }
-  strcat(response, "  ]\n}");
-
-  send_json_response(c, 200, response);
-
-  free(response);
-  free(processes);
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  json_kv_int(&w, "limit", limit);
+  json_kv_string(&w, "sort", process_sort_name(sort));
+  json_key(&w, "processes");
+  json_array_begin(&w);
+  for (int i = 0; i < count; i++)
+    write_process(&w, i + 1, &table->top[sort][i]);
+  json_array_end(&w);
+  write_sample_info(&w, table);
+  json_object_end(&w);
+  json_reply_end(&w);
+
+  process_table_release(table);
 }
 
 // Handler for /api/monitoring/memory/summary
 static void handle_memory_summary(struct mg_connection *c,
-                                  struct mg_http_message *hm) {
+                                  struct mg_http_message *hm,
+                                  const route_params_t *params) {
   FILE *meminfo = fopen("/proc/meminfo", "r");
   if (!meminfo) {
     send_error_response(c, 500, "Internal Server Error",
@@ -255,72 +184,137 @@ static void handle_memory_summary(struct mg_connection *c,
   int mem_used = mem_total - mem_free;
   double usage_percent = (double)mem_used / mem_total * 100.0;
 
-  char response[512];
-  snprintf(response, sizeof(response),
-           "{\n"
-           "  \"success\": true,\n"
-           "  \"memory\": {\n"
-           "    \"total_kb\": %d,\n"
-           "    \"total_mb\": %.2f,\n"
-           "    \"free_kb\": %d,\n"
-           "    \"free_mb\": %.2f,\n"
-           "    \"used_kb\": %d,\n"
-           "    \"used_mb\": %.2f,\n"
-           "    \"available_kb\": %d,\n"
-           "    \"available_mb\": %.2f,\n"
-           "    \"buffers_kb\": %d,\n"
-           "    \"cached_kb\": %d,\n"
-           "    \"usage_percent\": %.2f\n"
-           "  }\n}",
-           mem_total, kb_to_mb(mem_total), mem_free, kb_to_mb(mem_free),
-           mem_used, kb_to_mb(mem_used), mem_available, kb_to_mb(mem_available),
-           mem_buffers, mem_cached, usage_percent);
-
-  send_json_response(c, 200, response);
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  json_key(&w, "memory");
+  json_object_begin(&w);
+  json_kv_int(&w, "total_kb", mem_total);
+  json_kv_double(&w, "total_mb", kb_to_mb(mem_total), 2);
+  json_kv_int(&w, "free_kb", mem_free);
+  json_kv_double(&w, "free_mb", kb_to_mb(mem_free), 2);
+  json_kv_int(&w, "used_kb", mem_used);
+  json_kv_double(&w, "used_mb", kb_to_mb(mem_used), 2);
+  json_kv_int(&w, "available_kb", mem_available);
+  json_kv_double(&w, "available_mb", kb_to_mb(mem_available), 2);
+  json_kv_int(&w, "buffers_kb", mem_buffers);
+  json_kv_int(&w, "cached_kb", mem_cached);
+  json_kv_double(&w, "usage_percent", usage_percent, 2);
+  json_object_end(&w);
+  json_object_end(&w);
+  json_reply_end(&w);
 }
 
 // Handler for /api/monitoring/system/stats
 static void handle_system_stats(struct mg_connection *c,
-                                struct mg_http_message *hm) {
-  // Get system stats similar to the script
-  process_info_t *processes;
-  int proc_count = get_process_list(&processes);
-
-  int total_ram_kb = 0;
-  for (int i = 0; i < proc_count; i++) {
-    total_ram_kb += processes[i].rss_kb;
+                                struct mg_http_message *hm,
+                                const route_params_t *params) {
+  const process_table_t *table = process_table_acquire();
+  int proc_count = table ? table->count : 0;
+  const process_info_t *top = table && table->top_count[PROCESS_SORT_RSS] > 0
+                                  ? &table->top[PROCESS_SORT_RSS][0]
+                                  : NULL;
+
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  json_key(&w, "system_stats");
+  json_object_begin(&w);
+  json_kv_string(&w, "uptime_seconds", get_system_uptime());
+  json_kv_string(&w, "load_average", get_system_load());
+  json_kv_int(&w, "total_processes", proc_count);
+  json_kv_int(&w, "total_process_ram_kb", table ? table->total_rss_kb : 0);
+  json_kv_double(&w, "total_process_ram_mb",
+                 kb_to_mb(table ? table->total_rss_kb : 0), 2);
+  json_key(&w, "top_process");
+  json_object_begin(&w);
+  json_kv_string(&w, "name", top ? top->name : "none");
+  json_kv_int(&w, "pid", top ? top->pid : 0);
+  json_kv_int(&w, "ram_kb", top ? top->rss_kb : 0);
+  json_kv_double(&w, "ram_mb", kb_to_mb(top ? top->rss_kb : 0), 2);
+  json_object_end(&w);
+  json_object_end(&w);
+  if (table)
+    write_sample_info(&w, table);
+  json_object_end(&w);
+  json_reply_end(&w);
+
+  process_table_release(table);
+}
+
+// Write the per-state percentages of one CPU sample
+static void write_cpu_usage(json_writer_t *w, const cpu_usage_t *usage) {
+  json_kv_double(w, "user", usage->user, 1);
+  json_kv_double(w, "system", usage->system, 1);
+  json_kv_double(w, "iowait", usage->iowait, 1);
+  json_kv_double(w, "irq", usage->irq, 1);
+  json_kv_double(w, "softirq", usage->softirq, 1);
+  json_kv_double(w, "steal", usage->steal, 1);
+  json_kv_double(w, "idle", usage->idle, 1);
+  json_kv_double(w, "busy", 100.0 - usage->idle - usage->iowait, 1);
+}
+
+// Each sample lists the cores that were online when it was taken
+static void write_cpu_sample(json_writer_t *w, const cpu_sample_t *sample) {
+  json_object_begin(w);
+  json_kv_int(w, "timestamp", sample->timestamp);
+  json_key(w, "total");
+  json_object_begin(w);
+  write_cpu_usage(w, &sample->total);
+  json_object_end(w);
+  json_key(w, "cores");
+  json_array_begin(w);
+  for (int i = 0; i < sample->core_count; i++) {
+    json_object_begin(w);
+    json_kv_int(w, "core", sample->core_ids[i]);
+    write_cpu_usage(w, &sample->cores[i]);
+    json_object_end(w);
   }
+  json_array_end(w);
+  json_object_end(w);
+}
 
-  char *uptime = get_system_uptime();
-  char *load = get_system_load();
-
-  char response[1024];
-  snprintf(response, sizeof(response),
-           "{\n"
-           "  \"success\": true,\n"
-           "  \"system_stats\": {\n"
-           "    \"uptime_seconds\": \"%s\",\n"
-           "    \"load_average\": \"%s\",\n"
-           "    \"total_processes\": %d,\n"
-           "    \"total_process_ram_kb\": %d,\n"
-           "    \"total_process_ram_mb\": %.2f,\n"
-           "    \"top_process\": {\n"
-           "      \"name\": \"%s\",\n"
-           "      \"pid\": %d,\n"
-           "      \"ram_kb\": %d,\n"
-           "      \"ram_mb\": %.2f\n"
-           "    }\n"
-           "  }\n}",
-           uptime, load, proc_count, total_ram_kb, kb_to_mb(total_ram_kb),
-           proc_count > 0 ? processes[0].name : "none",
-           proc_count > 0 ? processes[0].pid : 0,
-           proc_count > 0 ? processes[0].rss_kb : 0,
-           proc_count > 0 ? processes[0].rss_mb : 0.0);
-
-  send_json_response(c, 200, response);
-
-  if (processes)
-    free(processes);
+// Handler for /api/monitoring/cpu
+static void handle_monitoring_cpu(struct mg_connection *c,
+                                  struct mg_http_message *hm,
+                                  const route_params_t *params) {
+  // ?samples=N selects how much history to return, newest first
+  int samples = 10;
+  char value[16];
+  if (mg_http_get_var(&hm->query, "samples", value, sizeof(value)) > 0 &&
+      !mg_str_to_num(mg_str(value), 10, &samples, sizeof(samples))) {
+    send_error_response(c, 400, "Bad Request", "samples must be a number");
+    return;
+  }
+  if (samples < 0)
+    samples = 0;
+  if (samples > cpu_sampler_count())
+    samples = cpu_sampler_count();
+
+  const cpu_sample_t *current = cpu_sampler_get(0);
+  if (!current) {
+    send_error_response(c, 503, "Service Unavailable",
+                        "CPU usage not sampled yet");
+    return;
+  }
+
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  json_kv_int(&w, "interval_ms", cpu_sampler_interval_ms());
+  json_kv_int(&w, "core_count", current->core_count);
+  json_key(&w, "current");
+  write_cpu_sample(&w, current);
+  json_key(&w, "history");
+  json_array_begin(&w);
+  for (int i = 0; i < samples; i++)
+    write_cpu_sample(&w, cpu_sampler_get(i));
+  json_array_end(&w);
+  json_object_end(&w);
+  json_reply_end(&w);
 }
 
 // Register all monitoring endpoints
@@ -331,7 +325,11 @@ void register_monitoring_endpoints(api_manager_t *manager) {
 
   api_register_route(manager, "/api/monitoring/processes/top", METHOD_GET,
                      handle_monitoring_top_processes,
-                     "Get top N processes by RAM usage (append /N to URL)");
+                     "Get top 10 processes by RAM usage");
+
+  api_register_route(manager, "/api/monitoring/processes/top/{n}", METHOD_GET,
+                     handle_monitoring_top_processes,
+                     "Get top N processes by RAM usage");
 
   api_register_route(manager, "/api/monitoring/memory/summary", METHOD_GET,
                      handle_memory_summary,
@@ -340,4 +338,8 @@ void register_monitoring_endpoints(api_manager_t *manager) {
   api_register_route(manager, "/api/monitoring/system/stats", METHOD_GET,
                      handle_system_stats,
                      "Get comprehensive system monitoring statistics");
+
+  api_register_route(manager, "/api/monitoring/cpu", METHOD_GET,
+                     handle_monitoring_cpu,
+                     "Get per-core CPU utilization and recent history");
 }
@@ -1,65 +1,355 @@
 #include "../api_manager.h"
+#include "../helpers/netdev_sampler.h"
+#include "../helpers/netlink.h"
 #include "../helpers/response.h"
 #include "../helpers/system_info.h"
+#include "../helpers/uci_config.h"
+#include <linux/rtnetlink.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Links and addresses are read into arrays first, so addresses can be
+// nested under their link and routes can name their interface
+typedef struct {
+  netlink_link_t *items;
+  int count;
+  int capacity;
+} link_list_t;
+
+typedef struct {
+  netlink_addr_t *items;
+  int count;
+  int capacity;
+} addr_list_t;
+
+// Grow an array by one slot; returns NULL when out of memory
+static void *list_slot(void **items, int *count, int *capacity, size_t size) {
+  if (*count == *capacity) {
+    int grown = *capacity ? *capacity * 2 : 16;
+    void *p = realloc(*items, grown * size);
+    if (!p)
+      return NULL;
+    *items = p;
+    *capacity = grown;
+  }
+  return (char *)*items + (*count)++ * size;
+}
+
+static int collect_link(const netlink_link_t *link, void *ctx) {
+  link_list_t *list = ctx;
+  netlink_link_t *slot = list_slot((void **)&list->items, &list->count,
+                                   &list->capacity, sizeof(*link));
+  if (!slot)
+    return 1;
+  *slot = *link;
+  return 0;
+}
+
+static int collect_addr(const netlink_addr_t *addr, void *ctx) {
+  addr_list_t *list = ctx;
+  netlink_addr_t *slot = list_slot((void **)&list->items, &list->count,
+                                   &list->capacity, sizeof(*addr));
+  if (!slot)
+    return 1;
+  *slot = *addr;
+  return 0;
+}
+
+// Name of the interface with an index, NULL if it is not in the list
+static const char *link_name(const link_list_t *links, int index) {
+  for (int i = 0; i < links->count; i++) {
+    if (links->items[i].index == index)
+      return links->items[i].name;
+  }
+  return NULL;
+}
+
+static void write_link(json_writer_t *w, const netlink_link_t *link,
+                       const link_list_t *links, const addr_list_t *addrs) {
+  json_object_begin(w);
+  json_kv_string(w, "name", link->name);
+  json_kv_int(w, "index", link->index);
+  json_kv_string(w, "mac", link->mac);
+  json_kv_int(w, "mtu", link->mtu);
+  json_kv_string(w, "operstate", netlink_operstate_name(link->operstate));
+  json_kv_bool(w, "up", (link->flags & IFF_UP) != 0);
+  json_kv_bool(w, "running", (link->flags & IFF_RUNNING) != 0);
+  json_kv_bool(w, "loopback", (link->flags & IFF_LOOPBACK) != 0);
+  const char *master = link->master ? link_name(links, link->master) : NULL;
+  if (master)
+    json_kv_string(w, "master", master);
+
+  json_key(w, "addresses");
+  json_array_begin(w);
+  for (int i = 0; i < addrs->count; i++) {
+    const netlink_addr_t *addr = &addrs->items[i];
+    if (addr->index != link->index)
+      continue;
+    json_object_begin(w);
+    json_kv_string(w, "family", netlink_family_name(addr->family));
+    json_kv_string(w, "address", addr->address);
+    json_kv_int(w, "prefixlen", addr->prefixlen);
+    json_kv_string(w, "scope", netlink_scope_name(addr->scope));
+    if (addr->label[0])
+      json_kv_string(w, "label", addr->label);
+    json_object_end(w);
+  }
+  json_array_end(w);
+
+  json_key(w, "statistics");
+  json_object_begin(w);
+  json_kv_uint(w, "rx_bytes", link->rx_bytes);
+  json_kv_uint(w, "tx_bytes", link->tx_bytes);
+  json_kv_uint(w, "rx_packets", link->rx_packets);
+  json_kv_uint(w, "tx_packets", link->tx_packets);
+  json_kv_uint(w, "rx_errors", link->rx_errors);
+  json_kv_uint(w, "tx_errors", link->tx_errors);
+  json_object_end(w);
+  json_object_end(w);
+}
 
 // Handler for /api/network/interfaces
 static void handle_network_interfaces(struct mg_connection *c,
-                                      struct mg_http_message *hm) {
-  char *interfaces = run_command(
-      "ip addr show | grep -E '^[0-9]+:' | awk '{print $2}' | tr -d ':'");
-  send_data_response(c, "interfaces", interfaces);
+                                      struct mg_http_message *hm,
+                                      const route_params_t *params) {
+  link_list_t links = {0};
+  addr_list_t addrs = {0};
+  int link_count = netlink_links(collect_link, &links);
+  int addr_count = netlink_addrs(AF_UNSPEC, collect_addr, &addrs);
+
+  // A callback only stops a dump when it runs out of memory
+  if (link_count < 0 || addr_count < 0 || link_count != links.count ||
+      addr_count != addrs.count) {
+    free(links.items);
+    free(addrs.items);
+    send_error_response(c, 500, "Internal Server Error",
+                        "Failed to read network interfaces");
+    return;
+  }
+
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  json_kv_int(&w, "count", links.count);
+  json_key(&w, "interfaces");
+  json_array_begin(&w);
+  for (int i = 0; i < links.count; i++)
+    write_link(&w, &links.items[i], &links, &addrs);
+  json_array_end(&w);
+  json_object_end(&w);
+  json_reply_end(&w);
+
+  free(links.items);
+  free(addrs.items);
+}
+
+typedef struct {
+  json_writer_t *w;
+  const link_list_t *links;
+  int all_tables;
+  int written;
+} route_out_t;
+
+static int write_route(const netlink_route_t *route, void *ctx) {
+  route_out_t *out = ctx;
+  if (!out->all_tables && route->table != RT_TABLE_MAIN)
+    return 0;
+
+  json_writer_t *w = out->w;
+  char dst[NETLINK_ADDR_LEN + 4];
+  if (route->dst_len == 0)
+    snprintf(dst, sizeof(dst), "default");
+  else
+    snprintf(dst, sizeof(dst), "%s/%d", route->dst, route->dst_len);
+
+  json_object_begin(w);
+  json_kv_string(w, "destination", dst);
+  json_kv_string(w, "family", netlink_family_name(route->family));
+  json_kv_string(w, "type", netlink_route_type_name(route->type));
+  if (route->gateway[0])
+    json_kv_string(w, "gateway", route->gateway);
+  const char *dev = route->oif ? link_name(out->links, route->oif) : NULL;
+  if (dev)
+    json_kv_string(w, "dev", dev);
+  if (route->prefsrc[0])
+    json_kv_string(w, "source", route->prefsrc);
+  json_kv_string(w, "protocol", netlink_protocol_name(route->protocol));
+  json_kv_string(w, "scope", netlink_scope_name(route->scope));
+  json_kv_int(w, "metric", route->metric);
+  json_kv_int(w, "table", route->table);
+  json_object_end(w);
+  out->written++;
+  return 0;
 }
 
 // Handler for /api/network/routes
 static void handle_network_routes(struct mg_connection *c,
-                                  struct mg_http_message *hm) {
-  char *routes = run_command("ip route show");
-  send_data_response(c, "routes", routes);
+                                  struct mg_http_message *hm,
+                                  const route_params_t *params) {
+  // ?family=inet|inet6 narrows the list, ?table=all adds the local and
+  // policy routing tables to the main one
+  int family = AF_UNSPEC;
+  char value[16];
+  if (mg_http_get_var(&hm->query, "family", value, sizeof(value)) > 0) {
+    if (strcmp(value, "inet") == 0) {
+      family = AF_INET;
+    } else if (strcmp(value, "inet6") == 0) {
+      family = AF_INET6;
+    } else {
+      send_error_response(c, 400, "Bad Request",
+                          "family must be inet or inet6");
+      return;
+    }
+  }
+  int all_tables = mg_http_get_var(&hm->query, "table", value,
+                                   sizeof(value)) > 0 &&
+                   strcmp(value, "all") == 0;
+
+  link_list_t links = {0};
+  if (netlink_links(collect_link, &links) < 0) {
+    free(links.items);
+    send_error_response(c, 500, "Internal Server Error",
+                        "Failed to read network interfaces");
+    return;
+  }
+
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  json_key(&w, "routes");
+  json_array_begin(&w);
+  route_out_t out = {&w, &links, all_tables, 0};
+  if (netlink_routes(family, write_route, &out) < 0) {
+    json_reply_abort(&w);
+    send_error_response(c, 500, "Internal Server Error",
+                        "Failed to read routing table");
+  } else {
+    json_array_end(&w);
+    json_kv_int(&w, "count", out.written);
+    json_object_end(&w);
+    json_reply_end(&w);
+  }
+  free(links.items);
 }
 
 // Handler for /api/network/wan
 static void handle_network_wan(struct mg_connection *c,
-                               struct mg_http_message *hm) {
-  char *wan_ip =
-      run_command("uci get network.wan.ipaddr 2>/dev/null || echo 'DHCP'");
-  char *wan_gateway =
-      run_command("ip route show default | awk '{print $3}' | head -1");
-
-  char response[512];
-  snprintf(response, sizeof(response),
-           "{"
-           "\"ip_address\": \"%s\","
-           "\"gateway\": \"%s\","
-           "\"status\": \"connected\""
-           "}",
-           wan_ip, wan_gateway);
-
-  send_json_response(c, 200, response);
+                               struct mg_http_message *hm,
+                               const route_params_t *params) {
+  char ipaddr[64];
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_string(&w, "ip_address",
+                 uci_config_get("network.wan.ipaddr", ipaddr,
+                                sizeof(ipaddr)) == 0
+                     ? ipaddr
+                     : "DHCP");
+  netlink_route_t gateway;
+  json_kv_string(&w, "gateway",
+                 netlink_default_route(&gateway) == 0 ? gateway.gateway : "");
+  json_kv_string(&w, "status", "connected");
+  json_object_end(&w);
+  json_reply_end(&w);
 }
 
 // Handler for /api/network/lan
 static void handle_network_lan(struct mg_connection *c,
-                               struct mg_http_message *hm) {
-  char *lan_ip =
-      run_command("uci get network.lan.ipaddr 2>/dev/null || echo 'unknown'");
-  char *lan_netmask =
-      run_command("uci get network.lan.netmask 2>/dev/null || echo 'unknown'");
-
-  char response[512];
-  snprintf(response, sizeof(response),
-           "{"
-           "\"ip_address\": \"%s\","
-           "\"netmask\": \"%s\","
-           "\"interface\": \"br-lan\""
-           "}",
-           lan_ip, lan_netmask);
-
-  send_json_response(c, 200, response);
+                               struct mg_http_message *hm,
+                               const route_params_t *params) {
+  char ipaddr[64], netmask[64];
+  if (uci_config_get("network.lan.ipaddr", ipaddr, sizeof(ipaddr)) != 0)
+    strcpy(ipaddr, "unknown");
+  if (uci_config_get("network.lan.netmask", netmask, sizeof(netmask)) != 0)
+    strcpy(netmask, "unknown");
+
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_string(&w, "ip_address", ipaddr);
+  json_kv_string(&w, "netmask", netmask);
+  json_kv_string(&w, "interface", "br-lan");
+  json_object_end(&w);
+  json_reply_end(&w);
+}
+
+static void write_throughput(json_writer_t *w, const netdev_stats_t *s) {
+  json_object_begin(w);
+  json_kv_string(w, "name", s->name);
+  json_kv_uint(w, "rx_bytes", s->rx_bytes);
+  json_kv_uint(w, "tx_bytes", s->tx_bytes);
+  json_kv_uint(w, "rx_packets", s->rx_packets);
+  json_kv_uint(w, "tx_packets", s->tx_packets);
+  json_kv_uint(w, "rx_errors", s->rx_errors);
+  json_kv_uint(w, "tx_errors", s->tx_errors);
+  json_kv_uint(w, "rx_dropped", s->rx_dropped);
+  json_kv_uint(w, "tx_dropped", s->tx_dropped);
+  json_kv_uint(w, "counter_wraps", s->wraps);
+  // Rates are null until two reads have been made
+  json_key(w, "rates");
+  if (!s->have_rates) {
+    json_null(w);
+  } else {
+    json_object_begin(w);
+    json_kv_double(w, "rx_bytes_per_s", s->rx_bytes_per_s, 1);
+    json_kv_double(w, "tx_bytes_per_s", s->tx_bytes_per_s, 1);
+    json_kv_double(w, "rx_packets_per_s", s->rx_packets_per_s, 1);
+    json_kv_double(w, "tx_packets_per_s", s->tx_packets_per_s, 1);
+    json_kv_double(w, "rx_bytes_per_s_last", s->rx_bytes_per_s_last, 1);
+    json_kv_double(w, "tx_bytes_per_s_last", s->tx_bytes_per_s_last, 1);
+    json_object_end(w);
+  }
+  json_object_end(w);
+}
+
+// Handler for /api/network/throughput
+static void handle_network_throughput(struct mg_connection *c,
+                                      struct mg_http_message *hm,
+                                      const route_params_t *params) {
+  if (netdev_sampler_updated() == 0) {
+    send_error_response(c, 503, "Service Unavailable",
+                        "Network counters not sampled yet");
+    return;
+  }
+
+  // ?interface=NAME narrows the list to one interface
+  char name[IF_NAMESIZE];
+  const netdev_stats_t *only = NULL;
+  if (mg_http_get_var(&hm->query, "interface", name, sizeof(name)) > 0) {
+    only = netdev_sampler_find(name);
+    if (!only) {
+      send_error_response(c, 404, "Not Found", "Interface not found");
+      return;
+    }
+  }
+
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  json_kv_int(&w, "interval_ms", netdev_sampler_interval_ms());
+  json_kv_double(&w, "smoothing_s", NETDEV_EWMA_TAU_MS / 1000.0, 1);
+  json_kv_int(&w, "history_interval_s", netdev_sampler_history_interval_s());
+  json_kv_int(&w, "updated", (long long)netdev_sampler_updated());
+  json_key(&w, "interfaces");
+  json_array_begin(&w);
+  if (only) {
+    write_throughput(&w, only);
+  } else {
+    for (int i = 0; i < netdev_sampler_count(); i++)
+      write_throughput(&w, netdev_sampler_get(i));
+  }
+  json_array_end(&w);
+  json_object_end(&w);
+  json_reply_end(&w);
 }
 
 // Handler for /api/network/dhcp/leases
 static void handle_dhcp_leases(struct mg_connection *c,
-                               struct mg_http_message *hm) {
+                               struct mg_http_message *hm,
+                               const route_params_t *params) {
   if (file_exists("/tmp/dhcp.leases")) {
     char *leases = read_file("/tmp/dhcp.leases");
     send_data_response(c, "dhcp_leases", leases);
@@ -70,7 +360,8 @@ static void handle_dhcp_leases(struct mg_connection *c,
 
 // Handler for /api/network/ping
 static void handle_network_ping(struct mg_connection *c,
-                                struct mg_http_message *hm) {
+                                struct mg_http_message *hm,
+                                const route_params_t *params) {
   // Extract target from query parameters (simplified)
   char *target = "8.8.8.8"; // Default target
 
@@ -92,8 +383,11 @@ void register_network_endpoints(api_manager_t *manager) {
                      handle_network_wan, "Get WAN interface information");
   api_register_route(manager, "/api/network/lan", METHOD_GET,
                      handle_network_lan, "Get LAN interface information");
+  api_register_route(manager, "/api/network/throughput", METHOD_GET,
+                     handle_network_throughput,
+                     "Get per-interface traffic counters and rates");
   api_register_route(manager, "/api/network/dhcp/leases", METHOD_GET,
                      handle_dhcp_leases, "Get DHCP lease information");
-  api_register_route(manager, "/api/network/ping", METHOD_GET,
-                     handle_network_ping, "Ping connectivity test");
+  api_register_blocking_route(manager, "/api/network/ping", METHOD_GET,
+                              handle_network_ping, "Ping connectivity test", 2);
 }
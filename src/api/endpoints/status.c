@@ -1,46 +1,74 @@
 #include "../api_manager.h"
 #include "../helpers/response.h"
 #include "../helpers/system_info.h"
+#include "../helpers/worker_pool.h"
 
 // Handler for /api/status
-static void handle_status(struct mg_connection *c, struct mg_http_message *hm) {
-  const char *kvp[] = {
-      "status",  "running", "message",  "OpenWrt API Server is working",
-      "version", "1.0",     "hostname", get_hostname()};
-
-  char *json = build_json_object(kvp, 8);
-  send_json_response(c, 200, json);
-  free_json_string(json);
+static void handle_status(struct mg_connection *c, struct mg_http_message *hm,
+                          const route_params_t *params) {
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_string(&w, "status", "running");
+  json_kv_string(&w, "message", "OpenWrt API Server is working");
+  json_kv_string(&w, "version", "1.0");
+  json_kv_string(&w, "hostname", get_hostname());
+  json_object_end(&w);
+  json_reply_end(&w);
 }
 
 // Handler for /api/health
-static void handle_health(struct mg_connection *c, struct mg_http_message *hm) {
-  char *uptime = get_system_uptime();
-  char *load = get_system_load();
-
-  char response[512];
-  snprintf(response, sizeof(response),
-           "{"
-           "\"status\": \"healthy\","
-           "\"uptime_seconds\": \"%s\","
-           "\"system_load\": \"%s\","
-           "\"timestamp\": \"%ld\""
-           "}",
-           uptime, load, time(NULL));
-
-  send_json_response(c, 200, response);
+static void handle_health(struct mg_connection *c, struct mg_http_message *hm,
+                          const route_params_t *params) {
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_string(&w, "status", "healthy");
+  json_kv_string(&w, "uptime_seconds", get_system_uptime());
+  json_kv_string(&w, "system_load", get_system_load());
+  json_kv_int(&w, "timestamp", time(NULL));
+  json_object_end(&w);
+  json_reply_end(&w);
 }
 
 // Handler for /api/version
-static void handle_version(struct mg_connection *c,
-                           struct mg_http_message *hm) {
-  const char *kvp[] = {"api_version",     "1.0",
-                       "openwrt_version", get_openwrt_version(),
-                       "kernel_version",  get_kernel_version()};
+static void handle_version(struct mg_connection *c, struct mg_http_message *hm,
+                           const route_params_t *params) {
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_string(&w, "api_version", "1.0");
+  json_kv_string(&w, "openwrt_version", get_openwrt_version());
+  json_kv_string(&w, "kernel_version", get_kernel_version());
+  json_object_end(&w);
+  json_reply_end(&w);
+}
+
+// Handler for /api/status/workers
+static void handle_worker_stats(struct mg_connection *c,
+                                struct mg_http_message *hm,
+                                const route_params_t *params) {
+  worker_pool_stats_t stats;
+  worker_pool_get_stats(&stats);
 
-  char *json = build_json_object(kvp, 6);
-  send_json_response(c, 200, json);
-  free_json_string(json);
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  json_key(&w, "workers");
+  json_object_begin(&w);
+  json_kv_bool(&w, "enabled", worker_pool_running());
+  json_kv_int(&w, "threads", stats.threads);
+  json_kv_int(&w, "queue_depth", stats.queue_depth);
+  json_kv_int(&w, "max_queue", stats.max_queue);
+  json_kv_int(&w, "running", stats.running);
+  json_kv_int(&w, "pending_replies", stats.pending);
+  json_kv_uint(&w, "completed", stats.completed);
+  json_kv_uint(&w, "rejected", stats.rejected);
+  json_kv_uint(&w, "orphaned", stats.orphaned);
+  json_object_end(&w);
+  json_object_end(&w);
+  json_reply_end(&w);
 }
 
 // Register all status endpoints
@@ -51,4 +79,6 @@ void register_status_endpoints(api_manager_t *manager) {
                      "Get system health information");
   api_register_route(manager, "/api/version", METHOD_GET, handle_version,
                      "Get version information");
+  api_register_route(manager, "/api/status/workers", METHOD_GET,
+                     handle_worker_stats, "Get blocking handler pool status");
 }
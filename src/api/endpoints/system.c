@@ -5,44 +5,46 @@
 
 // Handler for /api/system/info
 static void handle_system_info(struct mg_connection *c,
-                               struct mg_http_message *hm) {
-  char response[1024];
-  snprintf(response, sizeof(response),
-           "{"
-           "\"hostname\": \"%s\","
-           "\"uptime\": \"%s\","
-           "\"kernel\": \"%s\","
-           "\"cpu\": \"%s\","
-           "\"memory\": \"%s\","
-           "\"load\": \"%s\""
-           "}",
-           get_hostname(), get_system_uptime(), get_kernel_version(),
-           get_cpu_info(), get_memory_info(), get_system_load());
-
-  send_json_response(c, 200, response);
+                               struct mg_http_message *hm,
+                               const route_params_t *params) {
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_string(&w, "hostname", get_hostname());
+  json_kv_string(&w, "uptime", get_system_uptime());
+  json_kv_string(&w, "kernel", get_kernel_version());
+  json_kv_string(&w, "cpu", get_cpu_info());
+  json_kv_string(&w, "memory", get_memory_info());
+  json_kv_string(&w, "load", get_system_load());
+  json_object_end(&w);
+  json_reply_end(&w);
 }
 
 // Handler for /api/system/uptime
 static void handle_system_uptime(struct mg_connection *c,
-                                 struct mg_http_message *hm) {
+                                 struct mg_http_message *hm,
+                                 const route_params_t *params) {
   send_data_response(c, "uptime_seconds", get_system_uptime());
 }
 
 // Handler for /api/system/memory
 static void handle_system_memory(struct mg_connection *c,
-                                 struct mg_http_message *hm) {
+                                 struct mg_http_message *hm,
+                                 const route_params_t *params) {
   send_data_response(c, "memory_info", get_memory_info());
 }
 
 // Handler for /api/system/load
 static void handle_system_load(struct mg_connection *c,
-                               struct mg_http_message *hm) {
+                               struct mg_http_message *hm,
+                               const route_params_t *params) {
   send_data_response(c, "system_load", get_system_load());
 }
 
 // Handler for /api/system/reboot (POST)
 static void handle_system_reboot(struct mg_connection *c,
-                                 struct mg_http_message *hm) {
+                                 struct mg_http_message *hm,
+                                 const route_params_t *params) {
   // In a real implementation, you might want to add authentication here
   send_success_response(c, "Reboot scheduled", NULL);
 
@@ -52,22 +54,21 @@ static void handle_system_reboot(struct mg_connection *c,
 
 // Handler for /api/system/datetime
 static void handle_system_datetime(struct mg_connection *c,
-                                   struct mg_http_message *hm) {
+                                   struct mg_http_message *hm,
+                                   const route_params_t *params) {
   time_t now;
   time(&now);
   char *datetime = ctime(&now);
   trim_whitespace(datetime);
 
-  char response[256];
-  snprintf(response, sizeof(response),
-           "{"
-           "\"timestamp\": %ld,"
-           "\"datetime\": \"%s\","
-           "\"timezone\": \"UTC\""
-           "}",
-           now, datetime);
-
-  send_json_response(c, 200, response);
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_int(&w, "timestamp", now);
+  json_kv_string(&w, "datetime", datetime);
+  json_kv_string(&w, "timezone", "UTC");
+  json_object_end(&w);
+  json_reply_end(&w);
 }
 
 // Register all system endpoints
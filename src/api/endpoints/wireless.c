@@ -1,10 +1,14 @@
 #include "../api_manager.h"
+#include "../helpers/nl80211.h"
 #include "../helpers/response.h"
 #include "../helpers/system_info.h"
+#include "../helpers/uci_config.h"
+#include "../helpers/wifi_scan.h"
 
 // Handler for /api/wireless/status
 static void handle_wireless_status(struct mg_connection *c,
-                                   struct mg_http_message *hm) {
+                                   struct mg_http_message *hm,
+                                   const route_params_t *params) {
   char *status = run_command("wifi status");
   if (strlen(status) > 10) {
     send_data_response(c, "wireless_status", status);
@@ -14,50 +18,288 @@ static void handle_wireless_status(struct mg_connection *c,
   }
 }
 
-// Handler for /api/wireless/scan
+static int write_bss(const nl80211_bss_t *bss, void *ctx) {
+  json_writer_t *w = ctx;
+  json_object_begin(w);
+  json_kv_string(w, "ssid", bss->ssid);
+  json_kv_string(w, "bssid", bss->bssid);
+  json_kv_int(w, "frequency", bss->frequency);
+  json_kv_int(w, "channel", nl80211_frequency_channel(bss->frequency));
+  if (bss->signal_mbm)
+    json_kv_double(w, "signal_dbm", bss->signal_mbm / 100.0, 2);
+  json_kv_bool(w, "encrypted", bss->privacy);
+  json_kv_bool(w, "associated", bss->associated);
+  json_kv_uint(w, "seen_ms_ago", bss->seen_ms_ago);
+  json_kv_string(w, "interface", bss->ifname);
+  json_object_end(w);
+  return 0;
+}
+
+// Reply with scan job id, or with the latest completed scan when id is 0.
+// The networks are streamed while the job is read, under the job lock, so
+// the job's own fields are written after the results array.
+static void send_scan_job(struct mg_connection *c, unsigned id,
+                          const char *missing) {
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  json_key(&w, "results");
+  json_array_begin(&w);
+  wifi_scan_job_t job;
+  int rc = id ? wifi_scan_get(id, &job, write_bss, &w)
+              : wifi_scan_latest(&job, write_bss, &w);
+  if (rc != 0) {
+    json_reply_abort(&w);
+    send_error_response(c, 404, "Not Found", missing);
+    return;
+  }
+  json_array_end(&w);
+  json_kv_uint(&w, "id", job.id);
+  json_kv_string(&w, "status", wifi_scan_status_name(job.status));
+  json_kv_int(&w, "started", (long long)job.started);
+  if (job.status != WIFI_SCAN_RUNNING) {
+    json_kv_int(&w, "finished", (long long)job.finished);
+    json_kv_double(&w, "age_s", job.age_ms / 1000.0, 1);
+  }
+  json_kv_int(&w, "requests", job.requests);
+  json_kv_int(&w, "count", job.count);
+  if (job.status == WIFI_SCAN_FAILED)
+    json_kv_string(&w, "error", job.error);
+  json_object_end(&w);
+  json_reply_end(&w);
+}
+
+// Handler for POST /api/wireless/scan. Starts a scan in the background,
+// or joins the one already running, and returns its id at once.
+static void handle_wireless_scan_start(struct mg_connection *c,
+                                       struct mg_http_message *hm,
+                                       const route_params_t *params) {
+  int joined = 0;
+  unsigned id = wifi_scan_start(&joined);
+  if (id == 0) {
+    send_error_response(c, 503, "Service Unavailable",
+                        "Cannot start a wireless scan");
+    return;
+  }
+
+  char location[64];
+  snprintf(location, sizeof(location), "/api/wireless/scan/%u", id);
+  json_writer_t w;
+  json_reply_begin(&w, c, 202);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  json_kv_uint(&w, "id", id);
+  json_kv_string(&w, "status", wifi_scan_status_name(WIFI_SCAN_RUNNING));
+  json_kv_bool(&w, "coalesced", joined);
+  json_kv_string(&w, "location", location);
+  json_object_end(&w);
+  json_reply_end(&w);
+}
+
+// Handler for GET /api/wireless/scan/{id}
+static void handle_wireless_scan_job(struct mg_connection *c,
+                                     struct mg_http_message *hm,
+                                     const route_params_t *params) {
+  unsigned id = 0;
+  if (!mg_str_to_num(api_get_param(params, "id"), 10, &id, sizeof(id)) ||
+      id == 0) {
+    send_error_response(c, 400, "Bad Request", "id must be a scan job id");
+    return;
+  }
+  send_scan_job(c, id, "Scan job not found or expired");
+}
+
+// Handler for GET /api/wireless/scan: the latest completed scan
 static void handle_wireless_scan(struct mg_connection *c,
-                                 struct mg_http_message *hm) {
-  char *scan_result =
-      run_command("iwlist scan 2>/dev/null | grep ESSID | head -10");
-  send_data_response(c, "scan_results", scan_result);
+                                 struct mg_http_message *hm,
+                                 const route_params_t *params) {
+  send_scan_job(c, 0,
+                "No scan has completed; POST /api/wireless/scan to start one");
 }
 
 // Handler for /api/wireless/config
 static void handle_wireless_config(struct mg_connection *c,
-                                   struct mg_http_message *hm) {
-  char *ssid = run_command(
-      "uci get wireless.@wifi-iface[0].ssid 2>/dev/null || echo 'unknown'");
-  char *mode = run_command(
-      "uci get wireless.@wifi-iface[0].mode 2>/dev/null || echo 'unknown'");
-  char *channel =
-      run_command("uci get wireless.radio0.channel 2>/dev/null || echo 'auto'");
-  char *encryption = run_command(
-      "uci get wireless.@wifi-iface[0].encryption 2>/dev/null || echo 'none'");
-
-  char response[512];
-  snprintf(response, sizeof(response),
-           "{"
-           "\"ssid\": \"%s\","
-           "\"mode\": \"%s\","
-           "\"channel\": \"%s\","
-           "\"encryption\": \"%s\""
-           "}",
-           ssid, mode, channel, encryption);
-
-  send_json_response(c, 200, response);
+                                   struct mg_http_message *hm,
+                                   const route_params_t *params) {
+  // Option, and the value reported when it is not set
+  static const struct {
+    const char *key;
+    const char *path;
+    const char *fallback;
+  } fields[] = {
+      {"ssid", "wireless.@wifi-iface[0].ssid", "unknown"},
+      {"mode", "wireless.@wifi-iface[0].mode", "unknown"},
+      {"channel", "wireless.radio0.channel", "auto"},
+      {"encryption", "wireless.@wifi-iface[0].encryption", "none"},
+  };
+
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    char value[128];
+    json_kv_string(&w, fields[i].key,
+                   uci_config_get(fields[i].path, value, sizeof(value)) == 0
+                       ? value
+                       : fields[i].fallback);
+  }
+  json_object_end(&w);
+  json_reply_end(&w);
+}
+
+static int write_iface(const nl80211_iface_t *iface, void *ctx) {
+  json_writer_t *w = ctx;
+  json_object_begin(w);
+  json_kv_string(w, "name", iface->name);
+  json_kv_int(w, "index", iface->index);
+  json_kv_int(w, "wiphy", iface->wiphy);
+  json_kv_string(w, "type", nl80211_iftype_name(iface->iftype));
+  json_kv_string(w, "mac", iface->mac);
+  if (iface->ssid[0])
+    json_kv_string(w, "ssid", iface->ssid);
+  if (iface->frequency) {
+    json_kv_int(w, "frequency", iface->frequency);
+    json_kv_int(w, "channel", nl80211_frequency_channel(iface->frequency));
+  }
+  if (iface->tx_power_mbm)
+    json_kv_double(w, "tx_power_dbm", iface->tx_power_mbm / 100.0, 2);
+  json_object_end(w);
+  return 0;
+}
+
+// Handler for /api/wireless/interfaces
+static void handle_wireless_interfaces(struct mg_connection *c,
+                                       struct mg_http_message *hm,
+                                       const route_params_t *params) {
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  json_key(&w, "interfaces");
+  json_array_begin(&w);
+  int count = nl80211_interfaces(write_iface, &w);
+  if (count < 0) {
+    json_reply_abort(&w);
+    send_error_response(c, 503, "Service Unavailable",
+                        "Wireless interface not available");
+    return;
+  }
+  json_array_end(&w);
+  json_kv_int(&w, "count", count);
+  json_object_end(&w);
+  json_reply_end(&w);
+}
+
+typedef struct {
+  json_writer_t *w;
+  const char *only; // Interface name from ?interface=, or NULL
+  int written;
+} station_out_t;
+
+static int write_station(const nl80211_station_t *sta, void *ctx) {
+  station_out_t *out = ctx;
+  if (out->only && strcmp(out->only, sta->ifname) != 0)
+    return 0;
+  json_writer_t *w = out->w;
+  json_object_begin(w);
+  json_kv_string(w, "interface", sta->ifname);
+  json_kv_string(w, "mac", sta->mac);
+  if (sta->signal)
+    json_kv_int(w, "signal_dbm", sta->signal);
+  if (sta->signal_avg)
+    json_kv_int(w, "signal_avg_dbm", sta->signal_avg);
+  json_kv_double(w, "tx_bitrate_mbps", sta->tx_bitrate / 10.0, 1);
+  json_kv_double(w, "rx_bitrate_mbps", sta->rx_bitrate / 10.0, 1);
+  json_kv_uint(w, "rx_bytes", sta->rx_bytes);
+  json_kv_uint(w, "tx_bytes", sta->tx_bytes);
+  json_kv_uint(w, "rx_packets", sta->rx_packets);
+  json_kv_uint(w, "tx_packets", sta->tx_packets);
+  json_kv_uint(w, "tx_retries", sta->tx_retries);
+  json_kv_uint(w, "tx_failed", sta->tx_failed);
+  json_kv_uint(w, "inactive_ms", sta->inactive_ms);
+  json_kv_uint(w, "connected_s", sta->connected_s);
+  json_object_end(w);
+  out->written++;
+  return 0;
 }
 
 // Handler for /api/wireless/clients
 static void handle_wireless_clients(struct mg_connection *c,
-                                    struct mg_http_message *hm) {
-  char *clients =
-      run_command("iw dev wlan0 station dump | grep Station | wc -l");
-  send_data_response(c, "connected_clients", clients);
+                                    struct mg_http_message *hm,
+                                    const route_params_t *params) {
+  // ?interface=NAME keeps the stations of one interface
+  char name[IF_NAMESIZE];
+  int filtered =
+      mg_http_get_var(&hm->query, "interface", name, sizeof(name)) > 0;
+
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  json_key(&w, "clients");
+  json_array_begin(&w);
+  station_out_t out = {&w, filtered ? name : NULL, 0};
+  if (nl80211_stations(write_station, &out) < 0) {
+    json_reply_abort(&w);
+    send_error_response(c, 503, "Service Unavailable",
+                        "Wireless interface not available");
+    return;
+  }
+  json_array_end(&w);
+  json_kv_int(&w, "connected_clients", out.written);
+  json_object_end(&w);
+  json_reply_end(&w);
+}
+
+static int write_survey(const nl80211_survey_t *survey, void *ctx) {
+  json_writer_t *w = ctx;
+  json_object_begin(w);
+  json_kv_string(w, "interface", survey->ifname);
+  json_kv_int(w, "frequency", survey->frequency);
+  json_kv_int(w, "channel", nl80211_frequency_channel(survey->frequency));
+  json_kv_bool(w, "in_use", survey->in_use);
+  if (survey->noise)
+    json_kv_int(w, "noise_dbm", survey->noise);
+  json_kv_uint(w, "active_ms", survey->active_ms);
+  json_kv_uint(w, "busy_ms", survey->busy_ms);
+  json_kv_uint(w, "rx_ms", survey->rx_ms);
+  json_kv_uint(w, "tx_ms", survey->tx_ms);
+  if (survey->active_ms)
+    json_kv_double(w, "busy_percent",
+                   100.0 * (double)survey->busy_ms / (double)survey->active_ms,
+                   1);
+  json_object_end(w);
+  return 0;
+}
+
+// Handler for /api/wireless/survey
+static void handle_wireless_survey(struct mg_connection *c,
+                                   struct mg_http_message *hm,
+                                   const route_params_t *params) {
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  json_key(&w, "channels");
+  json_array_begin(&w);
+  int count = nl80211_surveys(write_survey, &w);
+  if (count < 0) {
+    json_reply_abort(&w);
+    send_error_response(c, 503, "Service Unavailable",
+                        "Wireless interface not available");
+    return;
+  }
+  json_array_end(&w);
+  json_kv_int(&w, "count", count);
+  json_object_end(&w);
+  json_reply_end(&w);
 }
 
 // Handler for /api/wireless/restart (POST)
 static void handle_wireless_restart(struct mg_connection *c,
-                                    struct mg_http_message *hm) {
+                                    struct mg_http_message *hm,
+                                    const route_params_t *params) {
   send_success_response(c, "Wireless restart initiated", NULL);
   system("wifi down && wifi up &");
 }
@@ -67,13 +309,23 @@ void register_wireless_endpoints(api_manager_t *manager) {
   api_register_route(manager, "/api/wireless/status", METHOD_GET,
                      handle_wireless_status, "Get wireless interface status");
   api_register_route(manager, "/api/wireless/scan", METHOD_GET,
-                     handle_wireless_scan,
-                     "Scan for available wireless networks");
+                     handle_wireless_scan, "Get the latest wireless scan");
+  api_register_route(manager, "/api/wireless/scan", METHOD_POST,
+                     handle_wireless_scan_start,
+                     "Start a wireless scan in the background");
+  api_register_route(manager, "/api/wireless/scan/{id}", METHOD_GET,
+                     handle_wireless_scan_job, "Get a wireless scan job");
   api_register_route(manager, "/api/wireless/config", METHOD_GET,
                      handle_wireless_config, "Get wireless configuration");
-  api_register_route(manager, "/api/wireless/clients", METHOD_GET,
-                     handle_wireless_clients,
-                     "Get number of connected wireless clients");
+  api_register_blocking_route(manager, "/api/wireless/interfaces", METHOD_GET,
+                              handle_wireless_interfaces,
+                              "Get wireless interfaces", 2);
+  api_register_blocking_route(manager, "/api/wireless/clients", METHOD_GET,
+                              handle_wireless_clients,
+                              "Get connected wireless clients", 2);
+  api_register_blocking_route(manager, "/api/wireless/survey", METHOD_GET,
+                              handle_wireless_survey,
+                              "Get channel survey data", 2);
   api_register_route(manager, "/api/wireless/restart", METHOD_POST,
                      handle_wireless_restart, "Restart wireless interface");
 }
@@ -0,0 +1,190 @@
+#include "cpu_sampler.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Enough for the cpu lines of CPU_MAX_CORES cores; the interrupt counters
+// that follow them are never needed
+#define CPU_STAT_BUF_SIZE 4096
+
+// Jiffy counters of one "cpu" line, in /proc/stat order
+enum {
+  CPU_USER,
+  CPU_NICE,
+  CPU_SYSTEM,
+  CPU_IDLE,
+  CPU_IOWAIT,
+  CPU_IRQ,
+  CPU_SOFTIRQ,
+  CPU_STEAL,
+  CPU_FIELDS
+};
+
+typedef struct {
+  unsigned long long ticks[CPU_FIELDS];
+} cpu_counters_t;
+
+static struct {
+  struct mg_timer *timer;
+  int fd;
+  int interval_ms;
+  int core_count;
+  int core_ids[CPU_MAX_CORES];
+  int have_baseline;
+  cpu_counters_t prev_total;
+  cpu_counters_t prev_cores[CPU_MAX_CORES];
+  cpu_sample_t history[CPU_HISTORY_LEN]; // Ring buffer
+  int head;                              // Next slot to write
+  int count;
+} cpu = {.fd = -1, .interval_ms = CPU_SAMPLE_INTERVAL_MS};
+
+// Parse the counters following "cpu" or "cpuN", return the line end
+static const char *parse_counters(const char *p, cpu_counters_t *out) {
+  memset(out, 0, sizeof(*out));
+  for (int i = 0; i < CPU_FIELDS; i++) {
+    while (*p == ' ')
+      p++;
+    if (*p < '0' || *p > '9')
+      break;
+    while (*p >= '0' && *p <= '9')
+      out->ticks[i] = out->ticks[i] * 10 + (unsigned long long)(*p++ - '0');
+  }
+  while (*p && *p != '\n')
+    p++;
+  return p;
+}
+
+static void compute_usage(const cpu_counters_t *now,
+                          const cpu_counters_t *prev, cpu_usage_t *usage) {
+  unsigned long long delta[CPU_FIELDS];
+  unsigned long long total = 0;
+  for (int i = 0; i < CPU_FIELDS; i++) {
+    // Counters can step backwards when a core goes offline
+    delta[i] = now->ticks[i] > prev->ticks[i] ? now->ticks[i] - prev->ticks[i]
+                                              : 0;
+    total += delta[i];
+  }
+
+  memset(usage, 0, sizeof(*usage));
+  if (total == 0)
+    return;
+
+  float scale = 100.0f / (float)total;
+  usage->user = (float)(delta[CPU_USER] + delta[CPU_NICE]) * scale;
+  usage->system = (float)delta[CPU_SYSTEM] * scale;
+  usage->iowait = (float)delta[CPU_IOWAIT] * scale;
+  usage->irq = (float)delta[CPU_IRQ] * scale;
+  usage->softirq = (float)delta[CPU_SOFTIRQ] * scale;
+  usage->steal = (float)delta[CPU_STEAL] * scale;
+  usage->idle = (float)delta[CPU_IDLE] * scale;
+}
+
+// Read /proc/stat once and push a sample against the previous read
+static void cpu_sample(void *arg) {
+  (void)arg;
+  char buf[CPU_STAT_BUF_SIZE];
+
+  ssize_t len = pread(cpu.fd, buf, sizeof(buf) - 1, 0);
+  if (len <= 0)
+    return;
+  buf[len] = '\0';
+
+  cpu_counters_t total;
+  cpu_counters_t cores[CPU_MAX_CORES];
+  int core_ids[CPU_MAX_CORES];
+  int core_count = 0;
+  int have_total = 0;
+
+  // Only whole lines count; a line cut off by the buffer is dropped
+  const char *p = buf;
+  while (strncmp(p, "cpu", 3) == 0) {
+    const char *eol = strchr(p, '\n');
+    if (!eol)
+      break;
+    if (p[3] == ' ') {
+      parse_counters(p + 3, &total);
+      have_total = 1;
+    } else if (core_count < CPU_MAX_CORES) {
+      const char *q = p + 3;
+      int id = 0;
+      while (*q >= '0' && *q <= '9')
+        id = id * 10 + (*q++ - '0');
+      core_ids[core_count] = id;
+      parse_counters(q, &cores[core_count++]);
+    }
+    p = eol + 1;
+  }
+  if (!have_total)
+    return;
+
+  // Per-core deltas need the same cores online at both reads
+  if (cpu.have_baseline && core_count == cpu.core_count &&
+      memcmp(core_ids, cpu.core_ids, core_count * sizeof(int)) == 0) {
+    cpu_sample_t *sample = &cpu.history[cpu.head];
+    sample->timestamp = time(NULL);
+    compute_usage(&total, &cpu.prev_total, &sample->total);
+    sample->core_count = core_count;
+    memcpy(sample->core_ids, core_ids, core_count * sizeof(int));
+    for (int i = 0; i < core_count; i++)
+      compute_usage(&cores[i], &cpu.prev_cores[i], &sample->cores[i]);
+
+    cpu.head = (cpu.head + 1) % CPU_HISTORY_LEN;
+    if (cpu.count < CPU_HISTORY_LEN)
+      cpu.count++;
+  }
+
+  // A change in online cores restarts the baseline
+  cpu.prev_total = total;
+  memcpy(cpu.prev_cores, cores, core_count * sizeof(cpu_counters_t));
+  memcpy(cpu.core_ids, core_ids, core_count * sizeof(int));
+  cpu.core_count = core_count;
+  cpu.have_baseline = 1;
+}
+
+int cpu_sampler_start(struct mg_mgr *mgr, int interval_ms) {
+  if (cpu.timer)
+    return 0;
+
+  cpu.fd = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+  if (cpu.fd < 0) {
+    fprintf(stderr, "CPU sampler: cannot open /proc/stat\n");
+    return -1;
+  }
+
+  if (interval_ms < 100)
+    interval_ms = 100;
+  cpu.interval_ms = interval_ms;
+  cpu.timer = mg_timer_add(mgr, (uint64_t)interval_ms,
+                           MG_TIMER_REPEAT | MG_TIMER_RUN_NOW, cpu_sample,
+                           NULL);
+  if (!cpu.timer) {
+    close(cpu.fd);
+    cpu.fd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+// The timer itself is released by mg_mgr_free()
+void cpu_sampler_stop(void) {
+  if (cpu.fd >= 0)
+    close(cpu.fd);
+  cpu.fd = -1;
+  cpu.timer = NULL;
+  cpu.count = cpu.head = 0;
+  cpu.have_baseline = 0;
+}
+
+int cpu_sampler_interval_ms(void) { return cpu.interval_ms; }
+
+int cpu_sampler_core_count(void) { return cpu.core_count; }
+
+int cpu_sampler_count(void) { return cpu.count; }
+
+const cpu_sample_t *cpu_sampler_get(int age) {
+  if (age < 0 || age >= cpu.count)
+    return NULL;
+  int index = (cpu.head - 1 - age + CPU_HISTORY_LEN) % CPU_HISTORY_LEN;
+  return &cpu.history[index];
+}
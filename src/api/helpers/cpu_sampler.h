@@ -0,0 +1,47 @@
+#ifndef CPU_SAMPLER_H
+#define CPU_SAMPLER_H
+
+#include "../../mongoose/mongoose.h"
+#include <time.h>
+
+// Sampling period and how many samples are kept
+#define CPU_SAMPLE_INTERVAL_MS 1000
+#define CPU_HISTORY_LEN 60
+
+// Cores beyond this are folded into the total only
+#define CPU_MAX_CORES 16
+
+// Share of time in each state over one interval, in percent
+typedef struct {
+  float user; // Includes nice
+  float system;
+  float iowait;
+  float irq;
+  float softirq;
+  float steal;
+  float idle;
+} cpu_usage_t;
+
+// Cores are the ones online when the sample was taken; core_ids holds
+// their N from "cpuN", which skips offline cores
+typedef struct {
+  time_t timestamp;
+  cpu_usage_t total;
+  int core_count;
+  int core_ids[CPU_MAX_CORES];
+  cpu_usage_t cores[CPU_MAX_CORES];
+} cpu_sample_t;
+
+// The sampler runs as a timer on the event loop, so readers on the event
+// loop need no locking. Samples start after the second read of /proc/stat.
+int cpu_sampler_start(struct mg_mgr *mgr, int interval_ms);
+void cpu_sampler_stop(void);
+int cpu_sampler_interval_ms(void);
+int cpu_sampler_core_count(void); // Online at the latest read
+
+// Number of samples held, and the sample taken age intervals ago (0 is the
+// newest). Returns NULL when age is out of range.
+int cpu_sampler_count(void);
+const cpu_sample_t *cpu_sampler_get(int age);
+
+#endif // CPU_SAMPLER_H
@@ -1,19 +1,451 @@
 #include "database.h"
+#include "db_writer.h"
+#include "lttb.h"
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 sqlite3 *db = NULL;
 
+// Busy wait for the other connection's write lock
+#define DB_BUSY_TIMEOUT_MS 2000
+
+// Process records are inserted DB_PROCESS_BATCH_ROWS at a time with one
+// multi-row INSERT; 16 rows of 6 columns stay well under SQLite's default
+// limit of 999 bound parameters. ROWS_16 must match the batch size. Names
+// are interned in process_names first, and each row looks its id up.
+#define ROWS_4(row) row ", " row ", " row ", " row
+#define ROWS_16(row)                                                           \
+  ROWS_4(row) ", " ROWS_4(row) ", " ROWS_4(row) ", " ROWS_4(row)
+#define PROCESS_ROW                                                            \
+  "(?, ?, (SELECT id FROM process_names WHERE name = ?), ?, ?, ?)"
+#define PROCESS_COLUMNS                                                        \
+  "INSERT INTO process_records "                                               \
+  "(snapshot_id, pid, name_id, ram_kb, cpu_percent, rank_position) VALUES "
+#define NAME_COLUMNS "INSERT OR IGNORE INTO process_names (name) VALUES "
+
+// Shared by db_init() and the migration from the old layout
+#define PROCESS_RECORDS_SCHEMA                                                 \
+  "  id INTEGER PRIMARY KEY,"                                                  \
+  "  snapshot_id INTEGER,"                                                     \
+  "  pid INTEGER,"                                                             \
+  "  name_id INTEGER REFERENCES process_names(id),"                            \
+  "  ram_kb INTEGER,"                                                          \
+  "  cpu_percent REAL DEFAULT 0,"                                              \
+  "  rank_position INTEGER,"                                                   \
+  "  FOREIGN KEY (snapshot_id) REFERENCES system_snapshots(id)"
+
+// Row payload the old process_records layout spent on the name text and
+// the timestamp (4 bytes plus a header byte), less the name_id varint
+#define LEGACY_TIMESTAMP_BYTES 5
+#define NAME_ID_BYTES 2
+
+// Statements used by the helpers below, one per call site. They are
+// prepared once in db_init() and reset after every use instead of being
+// re-prepared and finalized on each call.
+typedef enum {
+  STMT_SAVE_SNAPSHOT,
+  STMT_SAVE_PROCESS,
+  STMT_SAVE_PROCESS_BATCH,
+  STMT_SAVE_NAME,
+  STMT_SAVE_NAME_BATCH,
+  STMT_GET_SNAPSHOTS,
+  STMT_SNAPSHOT_PAGE_KEY,
+  STMT_LOG_EVENT,
+  STMT_GET_EVENTS,
+  STMT_GET_EVENTS_BY_TYPE,
+  STMT_EVENT_PAGE_KEY,
+  STMT_SET_CONFIG,
+  STMT_GET_CONFIG,
+  STMT_SAVE_NETWORK,
+  STMT_RAM_TREND,
+  STMT_ROLLUP_UPDATE,
+  STMT_ROLLUP_TREND,
+  STMT_ROLLUP_SAMPLES,
+  STMT_DATABASE_SIZE,
+  STMT_BEGIN,
+  STMT_COMMIT,
+  STMT_ROLLBACK,
+  STMT_SAVEPOINT,
+  STMT_RELEASE,
+  STMT_ROLLBACK_TO,
+  STMT_EXPIRE_PROCESSES,
+  STMT_EXPIRE_SNAPSHOTS,
+  STMT_EXPIRE_ORPHANS,
+  STMT_EXPIRE_EVENTS,
+  STMT_EXPIRE_NETWORK,
+  STMT_EXPIRE_ROLLUPS,
+  STMT_INCREMENTAL_VACUUM,
+  STMT_DATA_VERSION,
+  STMT_ROW_COUNTS,
+  STMT_PROCESS_USAGE,
+  STMT_COUNT
+} db_stmt_id_t;
+
+static const char *const stmt_sql[STMT_COUNT] = {
+    [STMT_SAVE_SNAPSHOT] =
+        "INSERT INTO system_snapshots "
+        "(timestamp, total_processes, total_ram_kb, top_process, "
+        "top_process_ram_kb, cpu_load, memory_total_kb, memory_free_kb, "
+        "memory_used_kb, memory_usage_percent) "
+        "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
+    [STMT_SAVE_PROCESS] = PROCESS_COLUMNS PROCESS_ROW,
+    [STMT_SAVE_PROCESS_BATCH] = PROCESS_COLUMNS ROWS_16(PROCESS_ROW),
+    [STMT_SAVE_NAME] = NAME_COLUMNS "(?)",
+    [STMT_SAVE_NAME_BATCH] = NAME_COLUMNS ROWS_16("(?)"),
+    [STMT_GET_SNAPSHOTS] =
+        "SELECT * FROM system_snapshots "
+        "WHERE (timestamp, id) < (?1, ?2) AND timestamp > ?3 "
+        "ORDER BY timestamp DESC, id DESC LIMIT ?4 OFFSET ?5",
+    [STMT_SNAPSHOT_PAGE_KEY] = "SELECT timestamp, id FROM system_snapshots "
+                               "WHERE id >= ? ORDER BY id LIMIT 1",
+    [STMT_LOG_EVENT] =
+        "INSERT INTO system_events (timestamp, event_type, description, data) "
+        "VALUES (?, ?, ?, ?)",
+    [STMT_GET_EVENTS] =
+        "SELECT * FROM system_events "
+        "WHERE (timestamp, id) < (?1, ?2) AND timestamp > ?3 "
+        "ORDER BY timestamp DESC, id DESC LIMIT ?4 OFFSET ?5",
+    [STMT_GET_EVENTS_BY_TYPE] =
+        "SELECT * FROM system_events WHERE event_type = ?6 "
+        "AND (timestamp, id) < (?1, ?2) AND timestamp > ?3 "
+        "ORDER BY timestamp DESC, id DESC LIMIT ?4 OFFSET ?5",
+    [STMT_EVENT_PAGE_KEY] = "SELECT timestamp, id FROM system_events "
+                            "WHERE id >= ? ORDER BY id LIMIT 1",
+    // An upsert rather than REPLACE, whose implicit delete would not fire
+    // the row count trigger
+    [STMT_SET_CONFIG] =
+        "INSERT INTO config_store (key, value, updated_at) VALUES (?, ?, ?) "
+        "ON CONFLICT (key) DO UPDATE SET value = excluded.value, "
+        "updated_at = excluded.updated_at",
+    [STMT_GET_CONFIG] = "SELECT value FROM config_store WHERE key = ?",
+    [STMT_SAVE_NETWORK] =
+        "INSERT INTO network_status "
+        "(timestamp, interface, status, ip_address, rx_bytes, tx_bytes) "
+        "VALUES (?, ?, ?, ?, ?, ?)",
+    [STMT_RAM_TREND] =
+        "SELECT timestamp, total_ram_kb, cpu_load, memory_usage_percent "
+        "FROM system_snapshots WHERE timestamp >= ? "
+        "ORDER BY timestamp",
+    [STMT_ROLLUP_UPDATE] =
+        "INSERT INTO snapshot_rollups VALUES "
+        "(?1, ?2 - ?2 % ?1, 1, ?3, ?3, ?3, ?4, ?4, ?4, ?5, ?5, ?5) "
+        "ON CONFLICT (resolution, bucket) DO UPDATE SET "
+        "samples = samples + 1, "
+        "ram_kb_min = min(ram_kb_min, excluded.ram_kb_min), "
+        "ram_kb_sum = ram_kb_sum + excluded.ram_kb_sum, "
+        "ram_kb_max = max(ram_kb_max, excluded.ram_kb_max), "
+        "load_min = min(load_min, excluded.load_min), "
+        "load_sum = load_sum + excluded.load_sum, "
+        "load_max = max(load_max, excluded.load_max), "
+        "memory_percent_min = "
+        "min(memory_percent_min, excluded.memory_percent_min), "
+        "memory_percent_sum = "
+        "memory_percent_sum + excluded.memory_percent_sum, "
+        "memory_percent_max = "
+        "max(memory_percent_max, excluded.memory_percent_max)",
+    [STMT_ROLLUP_TREND] =
+        "SELECT bucket, samples, ram_kb_sum / samples, ram_kb_min, "
+        "ram_kb_max, load_sum / samples, load_min, load_max, "
+        "memory_percent_sum / samples, memory_percent_min, "
+        "memory_percent_max FROM snapshot_rollups "
+        "WHERE resolution = ?1 AND bucket >= ?2 - ?2 % ?1 ORDER BY bucket",
+    [STMT_ROLLUP_SAMPLES] =
+        "SELECT count(*), coalesce(sum(samples), 0) FROM snapshot_rollups "
+        "WHERE resolution = ?1 AND bucket >= ?2 - ?2 % ?1",
+    [STMT_DATABASE_SIZE] =
+        "SELECT page_count * page_size as size FROM "
+        "pragma_page_count(), pragma_page_size()",
+    [STMT_BEGIN] = "BEGIN IMMEDIATE",
+    [STMT_COMMIT] = "COMMIT",
+    [STMT_ROLLBACK] = "ROLLBACK",
+    [STMT_SAVEPOINT] = "SAVEPOINT write_op",
+    [STMT_RELEASE] = "RELEASE write_op",
+    [STMT_ROLLBACK_TO] = "ROLLBACK TO write_op",
+
+    // Retention: ?1 is the cutoff time, ?2 the chunk size. Process records
+    // go before their snapshots; the oldest snapshots have the lowest ids.
+    // With foreign_keys on, deleting a snapshot that still has records
+    // fails the whole statement, so such a snapshot is left for the next
+    // step instead.
+    [STMT_EXPIRE_PROCESSES] =
+        "DELETE FROM process_records WHERE snapshot_id IN "
+        "(SELECT id FROM system_snapshots WHERE timestamp < ?1 "
+        "ORDER BY id LIMIT ?2)",
+    [STMT_EXPIRE_SNAPSHOTS] =
+        "DELETE FROM system_snapshots WHERE id IN "
+        "(SELECT id FROM system_snapshots WHERE timestamp < ?1 "
+        "ORDER BY id LIMIT ?2) AND NOT EXISTS "
+        "(SELECT 1 FROM process_records WHERE snapshot_id = system_snapshots.id)",
+    // Left behind by versions that deleted snapshots alone
+    [STMT_EXPIRE_ORPHANS] =
+        "DELETE FROM process_records WHERE id IN "
+        "(SELECT id FROM process_records WHERE snapshot_id < "
+        "(SELECT coalesce(min(id), ?1) FROM system_snapshots) LIMIT ?2)",
+    [STMT_EXPIRE_EVENTS] =
+        "DELETE FROM system_events WHERE id IN "
+        "(SELECT id FROM system_events WHERE timestamp < ?1 LIMIT ?2)",
+    [STMT_EXPIRE_NETWORK] =
+        "DELETE FROM network_status WHERE id IN "
+        "(SELECT id FROM network_status WHERE timestamp < ?1 LIMIT ?2)",
+    [STMT_EXPIRE_ROLLUPS] =
+        "DELETE FROM snapshot_rollups WHERE resolution = ?3 AND bucket IN "
+        "(SELECT bucket FROM snapshot_rollups WHERE resolution = ?3 "
+        "AND bucket < ?1 LIMIT ?2)",
+    // Returns at most 128 free pages to the filesystem per step
+    [STMT_INCREMENTAL_VACUUM] = "PRAGMA incremental_vacuum(128)",
+    [STMT_DATA_VERSION] = "PRAGMA data_version",
+    [STMT_ROW_COUNTS] = "SELECT name, rows FROM table_counts",
+    // Snapshot ids grow with time, so the window is the ids from the first
+    // snapshot inside it on, which idx_processes_name_snapshot covers
+    [STMT_PROCESS_USAGE] =
+        "SELECT ram_kb FROM process_records "
+        "WHERE name_id = (SELECT id FROM process_names WHERE name = ?1) "
+        "AND snapshot_id >= (SELECT id FROM system_snapshots "
+        "WHERE timestamp > ?2 ORDER BY timestamp, id LIMIT 1)",
+};
+
+// A connection with its own statement cache. The event loop uses the main
+// connection (db); the writer and each worker pool thread open a private
+// one with db_thread_open() so their transactions and statements stay
+// separate.
+typedef struct {
+  sqlite3 *handle;
+  sqlite3_stmt *stmts[STMT_COUNT];
+} db_conn_t;
+
+static db_conn_t main_conn;
+static __thread db_conn_t *thread_conn;
+static char *db_path_copy;
+static db_tuning_t db_tuning_copy;
+
+static db_conn_t *conn(void) { return thread_conn ? thread_conn : &main_conn; }
+
+static void db_persist_release(sqlite3 *source);
+
+// Fetch a cached statement, preparing it on first use
+static sqlite3_stmt *db_stmt(db_stmt_id_t id) {
+  db_conn_t *c = conn();
+  if (!c->stmts[id])
+    c->stmts[id] = db_prepare(stmt_sql[id]);
+  else
+    sqlite3_reset(c->stmts[id]);
+  return c->stmts[id];
+}
+
+// Hand a cached statement back; bindings may point at caller memory
+static void db_stmt_release(sqlite3_stmt *stmt) {
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+}
+
+static int db_prepare_statements(void) {
+  for (int i = 0; i < STMT_COUNT; i++) {
+    if (!db_stmt(i))
+      return -1;
+  }
+  return 0;
+}
+
+static void db_finalize_statements(void) {
+  db_conn_t *c = conn();
+  for (int i = 0; i < STMT_COUNT; i++) {
+    sqlite3_finalize(c->stmts[i]);
+    c->stmts[i] = NULL;
+  }
+}
+
+// Journal and cache settings, applied before any table is touched
+static void db_apply_tuning(const db_tuning_t *tuning) {
+  char sql[128];
+  sqlite3_busy_timeout(conn()->handle, DB_BUSY_TIMEOUT_MS);
+  sqlite3_stmt *stmt = db_prepare("PRAGMA journal_mode = WAL");
+  if (stmt) {
+    const char *mode = sqlite3_step(stmt) == SQLITE_ROW
+                           ? (const char *)sqlite3_column_text(stmt, 0)
+                           : NULL;
+    if (!mode || strcmp(mode, "wal") != 0)
+      fprintf(stderr, "Database: WAL unavailable, using %s journal\n",
+              mode ? mode : "default");
+    sqlite3_finalize(stmt);
+  }
+
+  // WAL keeps the database consistent without syncing on every commit
+  db_execute("PRAGMA synchronous = NORMAL");
+
+  // Negative cache_size is in KiB rather than pages
+  snprintf(sql, sizeof(sql), "PRAGMA cache_size = -%d", tuning->cache_size_kb);
+  db_execute(sql);
+  snprintf(sql, sizeof(sql), "PRAGMA mmap_size = %lld",
+           (long long)tuning->mmap_size_kb * 1024);
+  db_execute(sql);
+}
+
+// Check whether an existing table already has a column
+static int column_exists(const char *table, const char *column) {
+  sqlite3_stmt *stmt =
+      db_prepare("SELECT 1 FROM pragma_table_info(?) WHERE name = ?");
+  if (!stmt)
+    return 0;
+
+  sqlite3_bind_text(stmt, 1, table, -1, SQLITE_STATIC);
+  sqlite3_bind_text(stmt, 2, column, -1, SQLITE_STATIC);
+  int exists = sqlite3_step(stmt) == SQLITE_ROW;
+  sqlite3_finalize(stmt);
+  return exists;
+}
+
+// Rebuild a process_records table that still has the name and timestamp
+// on every row. The copy keeps the record ids.
+static int db_compact_process_records(void) {
+  int before = db_get_database_size();
+  if (db_execute("BEGIN IMMEDIATE;"
+                 "INSERT OR IGNORE INTO process_names (name) "
+                 "SELECT DISTINCT process_name FROM process_records "
+                 "WHERE process_name IS NOT NULL;"
+                 "CREATE TABLE process_records_new (" PROCESS_RECORDS_SCHEMA
+                 ");"
+                 "INSERT INTO process_records_new "
+                 "SELECT r.id, r.snapshot_id, r.pid, n.id, r.ram_kb, "
+                 "r.cpu_percent, r.rank_position FROM process_records r "
+                 "LEFT JOIN process_names n ON n.name = r.process_name;"
+                 "DROP TABLE process_records;"
+                 "ALTER TABLE process_records_new RENAME TO process_records;"
+                 "CREATE INDEX idx_processes_snapshot ON "
+                 "process_records(snapshot_id);"
+                 "COMMIT;") != 0) {
+    db_execute("ROLLBACK");
+    return -1;
+  }
+
+  // Hand the freed pages back once; the old rows were most of the file
+  db_execute("VACUUM");
+  printf("Database: compacted process_records, %d -> %d bytes\n", before,
+         db_get_database_size());
+  return 0;
+}
+
+// Tables counted in table_counts, in DB_TABLE_* order
+static const char *const counted_tables[DB_TABLE_COUNT] = {
+    "system_snapshots", "process_records", "process_names", "snapshot_rollups",
+    "system_events",    "config_store",    "network_status"};
+
+// Each counted table has an insert and a delete trigger that keep its row
+// in table_counts current. A table without them (new to this version, or
+// rebuilt by a migration) is counted once, in the same transaction that
+// adds them.
+static int db_init_row_counts(void) {
+  for (int i = 0; i < DB_TABLE_COUNT; i++) {
+    const char *t = counted_tables[i];
+    char sql[1024];
+    snprintf(sql, sizeof(sql),
+             "SELECT count(*) FROM sqlite_schema WHERE type = 'trigger' "
+             "AND name IN ('%s_count_insert', '%s_count_delete')",
+             t, t);
+    sqlite3_stmt *stmt = db_prepare(sql);
+    int triggers = stmt && sqlite3_step(stmt) == SQLITE_ROW
+                       ? sqlite3_column_int(stmt, 0)
+                       : -1;
+    if (stmt)
+      sqlite3_finalize(stmt);
+    if (triggers == 2)
+      continue;
+    if (triggers < 0)
+      return -1;
+
+    snprintf(sql, sizeof(sql),
+             "BEGIN IMMEDIATE;"
+             "CREATE TRIGGER IF NOT EXISTS %s_count_insert AFTER INSERT ON %s "
+             "BEGIN UPDATE table_counts SET rows = rows + 1 "
+             "WHERE name = '%s'; END;"
+             "CREATE TRIGGER IF NOT EXISTS %s_count_delete AFTER DELETE ON %s "
+             "BEGIN UPDATE table_counts SET rows = rows - 1 "
+             "WHERE name = '%s'; END;"
+             "INSERT OR REPLACE INTO table_counts "
+             "SELECT '%s', count(*) FROM %s;"
+             "COMMIT;",
+             t, t, t, t, t, t, t, t);
+    if (db_execute(sql) != 0) {
+      db_execute("ROLLBACK");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Bring databases created by older versions up to the current schema
+static int db_migrate(void) {
+  if (column_exists("process_records", "process_name")) {
+    if (!column_exists("process_records", "cpu_percent") &&
+        db_execute("ALTER TABLE process_records "
+                   "ADD COLUMN cpu_percent REAL DEFAULT 0") != 0)
+      return -1;
+    if (db_compact_process_records() != 0)
+      return -1;
+  }
+
+  // Indexes name_id, so it waits until the old layout is converted
+  if (db_execute("CREATE INDEX IF NOT EXISTS idx_processes_name_snapshot ON "
+                 "process_records(name_id, snapshot_id, ram_kb)") != 0)
+    return -1;
+
+  // Snapshots saved before rollups existed are folded in once
+  if (db_execute("INSERT INTO snapshot_rollups "
+                 "SELECT r.resolution, timestamp - timestamp % r.resolution, "
+                 "count(*), min(total_ram_kb), sum(total_ram_kb), "
+                 "max(total_ram_kb), min(cpu_load), sum(cpu_load), "
+                 "max(cpu_load), min(memory_usage_percent), "
+                 "sum(memory_usage_percent), max(memory_usage_percent) "
+                 "FROM system_snapshots, (SELECT 60 AS resolution "
+                 "UNION ALL SELECT 3600 UNION ALL SELECT 86400) r "
+                 "WHERE NOT EXISTS (SELECT 1 FROM snapshot_rollups) "
+                 "GROUP BY 1, 2") != 0)
+    return -1;
+  return db_init_row_counts();
+}
+
+// Retention frees pages in small steps, which needs auto_vacuum set to
+// INCREMENTAL. An existing file only switches over with a full VACUUM, done
+// once here.
+static int db_enable_incremental_vacuum(void) {
+  sqlite3_stmt *stmt = db_prepare("PRAGMA auto_vacuum");
+  int mode = stmt && sqlite3_step(stmt) == SQLITE_ROW
+                 ? sqlite3_column_int(stmt, 0)
+                 : -1;
+  if (stmt)
+    sqlite3_finalize(stmt);
+  if (mode == 2)
+    return 0;
+
+  if (db_execute("PRAGMA auto_vacuum = INCREMENTAL") != 0 ||
+      db_execute("VACUUM") != 0)
+    return -1;
+  printf("Database: switched to incremental vacuum\n");
+  return 0;
+}
+
 // Database initialization
-int db_init(const char *db_path) {
+int db_init(const char *db_path, const db_tuning_t *tuning) {
+  static const db_tuning_t defaults = {DB_DEFAULT_CACHE_SIZE_KB,
+                                       DB_DEFAULT_MMAP_SIZE_KB};
   int rc = sqlite3_open(db_path, &db);
+  main_conn.handle = db;
   if (rc != SQLITE_OK) {
     fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(db));
     return -1;
   }
 
+  // Kept for connections opened later by db_thread_open()
+  free(db_path_copy);
+  db_path_copy = strdup(db_path);
+  db_tuning_copy = tuning ? *tuning : defaults;
+  db_apply_tuning(&db_tuning_copy);
+
   // Enable foreign keys
   sqlite3_exec(db, "PRAGMA foreign_keys = ON;", NULL, NULL, NULL);
 
@@ -33,17 +465,40 @@ int db_init(const char *db_path) {
       "  memory_usage_percent REAL"
       ");"
 
+      // Names are stored once; records take their time from the snapshot
+      "CREATE TABLE IF NOT EXISTS process_names ("
+      "  id INTEGER PRIMARY KEY,"
+      "  name TEXT NOT NULL UNIQUE"
+      ");"
+
       "CREATE TABLE IF NOT EXISTS process_records ("
-      "  id INTEGER PRIMARY KEY AUTOINCREMENT,"
-      "  snapshot_id INTEGER,"
-      "  pid INTEGER,"
-      "  process_name TEXT,"
-      "  ram_kb INTEGER,"
-      "  rank_position INTEGER,"
-      "  timestamp INTEGER,"
-      "  FOREIGN KEY (snapshot_id) REFERENCES system_snapshots(id)"
+      PROCESS_RECORDS_SCHEMA
       ");"
 
+      // Per-minute, per-hour and per-day aggregates of system_snapshots,
+      // updated with every snapshot so long trends never scan raw rows
+      "CREATE TABLE IF NOT EXISTS snapshot_rollups ("
+      "  resolution INTEGER NOT NULL,"
+      "  bucket INTEGER NOT NULL,"
+      "  samples INTEGER NOT NULL,"
+      "  ram_kb_min INTEGER,"
+      "  ram_kb_sum INTEGER,"
+      "  ram_kb_max INTEGER,"
+      "  load_min REAL,"
+      "  load_sum REAL,"
+      "  load_max REAL,"
+      "  memory_percent_min REAL,"
+      "  memory_percent_sum REAL,"
+      "  memory_percent_max REAL,"
+      "  PRIMARY KEY (resolution, bucket)"
+      ") WITHOUT ROWID;"
+
+      // Row counts kept by triggers, see db_init_row_counts()
+      "CREATE TABLE IF NOT EXISTS table_counts ("
+      "  name TEXT PRIMARY KEY,"
+      "  rows INTEGER NOT NULL"
+      ") WITHOUT ROWID;"
+
       "CREATE TABLE IF NOT EXISTS system_events ("
       "  id INTEGER PRIMARY KEY AUTOINCREMENT,"
       "  timestamp INTEGER NOT NULL,"
@@ -74,6 +529,8 @@ int db_init(const char *db_path) {
       "process_records(snapshot_id);"
       "CREATE INDEX IF NOT EXISTS idx_events_type_time ON "
       "system_events(event_type, timestamp);"
+      "CREATE INDEX IF NOT EXISTS idx_events_time ON "
+      "system_events(timestamp);"
       "CREATE INDEX IF NOT EXISTS idx_network_interface_time ON "
       "network_status(interface, timestamp);";
 
@@ -83,20 +540,75 @@ int db_init(const char *db_path) {
     return -1;
   }
 
+  if (db_migrate() != 0) {
+    fprintf(stderr, "Database migration failed\n");
+    return -1;
+  }
+
+  if (db_enable_incremental_vacuum() != 0) {
+    fprintf(stderr, "Database: incremental vacuum unavailable\n");
+  }
+
+  if (db_prepare_statements() != 0) {
+    fprintf(stderr, "Failed to prepare database statements\n");
+    return -1;
+  }
+
   printf("Database initialized successfully at %s\n", db_path);
   return 0;
 }
 
 void db_close(void) {
   if (db) {
+    db_persist_release(db);
+    db_finalize_statements();
     sqlite3_close(db);
     db = NULL;
+    main_conn.handle = NULL;
+  }
+  free(db_path_copy);
+  db_path_copy = NULL;
+}
+
+int db_thread_open(void) {
+  if (thread_conn)
+    return 0;
+  if (!db_path_copy)
+    return -1;
+
+  db_conn_t *c = calloc(1, sizeof(db_conn_t));
+  if (!c)
+    return -1;
+  if (sqlite3_open(db_path_copy, &c->handle) != SQLITE_OK) {
+    fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(c->handle));
+    sqlite3_close(c->handle);
+    free(c);
+    return -1;
   }
+
+  thread_conn = c;
+  db_apply_tuning(&db_tuning_copy);
+  sqlite3_exec(c->handle, "PRAGMA foreign_keys = ON;", NULL, NULL, NULL);
+  if (db_prepare_statements() != 0) {
+    db_thread_close();
+    return -1;
+  }
+  return 0;
+}
+
+void db_thread_close(void) {
+  if (!thread_conn)
+    return;
+  db_persist_release(thread_conn->handle);
+  db_finalize_statements();
+  sqlite3_close(thread_conn->handle);
+  free(thread_conn);
+  thread_conn = NULL;
 }
 
 int db_execute(const char *sql) {
   char *err_msg = NULL;
-  int rc = sqlite3_exec(db, sql, NULL, NULL, &err_msg);
+  int rc = sqlite3_exec(conn()->handle, sql, NULL, NULL, &err_msg);
   if (rc != SQLITE_OK) {
     fprintf(stderr, "SQL error: %s\n", err_msg);
     sqlite3_free(err_msg);
@@ -107,9 +619,10 @@ int db_execute(const char *sql) {
 
 sqlite3_stmt *db_prepare(const char *sql) {
   sqlite3_stmt *stmt;
-  int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  sqlite3 *handle = conn()->handle;
+  int rc = sqlite3_prepare_v2(handle, sql, -1, &stmt, NULL);
   if (rc != SQLITE_OK) {
-    fprintf(stderr, "SQL prepare error: %s\n", sqlite3_errmsg(db));
+    fprintf(stderr, "SQL prepare error: %s\n", sqlite3_errmsg(handle));
     return NULL;
   }
   return stmt;
@@ -117,14 +630,7 @@ sqlite3_stmt *db_prepare(const char *sql) {
 
 // Save system snapshot
 int db_save_system_snapshot(const system_snapshot_t *snapshot) {
-  const char *sql =
-      "INSERT INTO system_snapshots "
-      "(timestamp, total_processes, total_ram_kb, top_process, "
-      "top_process_ram_kb, cpu_load, memory_total_kb, memory_free_kb, "
-      "memory_used_kb, memory_usage_percent) "
-      "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
-
-  sqlite3_stmt *stmt = db_prepare(sql);
+  sqlite3_stmt *stmt = db_stmt(STMT_SAVE_SNAPSHOT);
   if (!stmt)
     return -1;
 
@@ -142,58 +648,247 @@ int db_save_system_snapshot(const system_snapshot_t *snapshot) {
   int rc = sqlite3_step(stmt);
   int snapshot_id = -1;
   if (rc == SQLITE_DONE) {
-    snapshot_id = sqlite3_last_insert_rowid(db);
+    snapshot_id = sqlite3_last_insert_rowid(conn()->handle);
   }
 
-  sqlite3_finalize(stmt);
+  db_stmt_release(stmt);
   return snapshot_id;
 }
 
-// Save process records
+// Fold one snapshot into its minute, hour and day buckets
+static int db_update_rollups(const system_snapshot_t *snapshot) {
+  static const int resolutions[] = {DB_ROLLUP_MINUTE, DB_ROLLUP_HOUR,
+                                    DB_ROLLUP_DAY};
+  for (size_t i = 0; i < sizeof(resolutions) / sizeof(resolutions[0]); i++) {
+    sqlite3_stmt *stmt = db_stmt(STMT_ROLLUP_UPDATE);
+    if (!stmt)
+      return -1;
+    sqlite3_bind_int(stmt, 1, resolutions[i]);
+    sqlite3_bind_int64(stmt, 2, snapshot->timestamp);
+    sqlite3_bind_int(stmt, 3, snapshot->total_ram_kb);
+    sqlite3_bind_double(stmt, 4, snapshot->cpu_load);
+    sqlite3_bind_double(stmt, 5, snapshot->memory_usage_percent);
+    int rc = sqlite3_step(stmt);
+    db_stmt_release(stmt);
+    if (rc != SQLITE_DONE)
+      return -1;
+  }
+  return 0;
+}
+
+// Run a parameterless cached statement such as BEGIN or COMMIT
+static int db_step_once(db_stmt_id_t id) {
+  sqlite3_stmt *stmt = db_stmt(id);
+  if (!stmt)
+    return -1;
+  int rc = sqlite3_step(stmt);
+  db_stmt_release(stmt);
+  return rc == SQLITE_DONE ? 0 : -1;
+}
+
+// Bind one process row starting at parameter index first
+typedef void (*bind_row_fn)(sqlite3_stmt *stmt, int first, int snapshot_id,
+                            const process_record_t *proc);
+
+static void bind_name(sqlite3_stmt *stmt, int first, int snapshot_id,
+                      const process_record_t *proc) {
+  (void)snapshot_id;
+  sqlite3_bind_text(stmt, first, proc->process_name, -1, SQLITE_STATIC);
+}
+
+static void bind_process(sqlite3_stmt *stmt, int first, int snapshot_id,
+                         const process_record_t *proc) {
+  sqlite3_bind_int(stmt, first, snapshot_id);
+  sqlite3_bind_int(stmt, first + 1, proc->pid);
+  sqlite3_bind_text(stmt, first + 2, proc->process_name, -1, SQLITE_STATIC);
+  sqlite3_bind_int(stmt, first + 3, proc->ram_kb);
+  sqlite3_bind_double(stmt, first + 4, proc->cpu_percent);
+  sqlite3_bind_int(stmt, first + 5, proc->rank_position);
+}
+
+// Insert one row per record, full batches first and the remainder row by
+// row. Returns the number of rows, or -1 on the first failed insert.
+static int db_insert_rows(db_stmt_id_t batch_id, db_stmt_id_t single_id,
+                          int columns, bind_row_fn bind, int snapshot_id,
+                          const process_record_t *processes, int count) {
+  int written = 0;
+
+  if (count >= DB_PROCESS_BATCH_ROWS) {
+    sqlite3_stmt *batch = db_stmt(batch_id);
+    if (!batch)
+      return -1;
+    for (; count - written >= DB_PROCESS_BATCH_ROWS;
+         written += DB_PROCESS_BATCH_ROWS) {
+      for (int i = 0; i < DB_PROCESS_BATCH_ROWS; i++)
+        bind(batch, i * columns + 1, snapshot_id, &processes[written + i]);
+      int rc = sqlite3_step(batch);
+      sqlite3_reset(batch);
+      if (rc != SQLITE_DONE) {
+        db_stmt_release(batch);
+        return -1;
+      }
+    }
+    db_stmt_release(batch);
+  }
+
+  if (written < count) {
+    sqlite3_stmt *stmt = db_stmt(single_id);
+    if (!stmt)
+      return -1;
+    for (; written < count; written++) {
+      bind(stmt, 1, snapshot_id, &processes[written]);
+      int rc = sqlite3_step(stmt);
+      sqlite3_reset(stmt);
+      if (rc != SQLITE_DONE) {
+        db_stmt_release(stmt);
+        return -1;
+      }
+    }
+    db_stmt_release(stmt);
+  }
+
+  return written;
+}
+
+// Save process records, interning any new names first. Returns the number
+// of records written, or -1.
 int db_save_process_records(int snapshot_id, const process_record_t *processes,
                             int count) {
-  const char *sql =
-      "INSERT INTO process_records "
-      "(snapshot_id, pid, process_name, ram_kb, rank_position, timestamp) "
-      "VALUES (?, ?, ?, ?, ?, ?)";
+  if (db_insert_rows(STMT_SAVE_NAME_BATCH, STMT_SAVE_NAME, 1, bind_name,
+                     snapshot_id, processes, count) < 0)
+    return -1;
+  return db_insert_rows(STMT_SAVE_PROCESS_BATCH, STMT_SAVE_PROCESS, 6,
+                        bind_process, snapshot_id, processes, count);
+}
 
-  sqlite3_stmt *stmt = db_prepare(sql);
-  if (!stmt)
+int db_transaction_begin(void) { return db_step_once(STMT_BEGIN); }
+
+int db_transaction_commit(void) { return db_step_once(STMT_COMMIT); }
+
+int db_transaction_rollback(void) { return db_step_once(STMT_ROLLBACK); }
+
+// Save a snapshot row and all of its process records atomically. A
+// savepoint works both on its own and inside the writer's batch.
+int db_save_snapshot_now(const system_snapshot_t *snapshot,
+                         process_record_t *processes, int count,
+                         db_save_result_t *result) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  memset(result, 0, sizeof(*result));
+
+  if (db_step_once(STMT_SAVEPOINT) != 0) {
+    fprintf(stderr, "Cannot begin snapshot transaction: %s\n",
+            sqlite3_errmsg(conn()->handle));
+    return -1;
+  }
+
+  int snapshot_id = db_save_system_snapshot(snapshot);
+  int rows = -1;
+  if (snapshot_id > 0 && db_update_rollups(snapshot) == 0) {
+    for (int i = 0; i < count; i++)
+      processes[i].snapshot_id = snapshot_id;
+    rows = db_save_process_records(snapshot_id, processes, count);
+  }
+
+  if (rows < 0 || db_step_once(STMT_RELEASE) != 0) {
+    fprintf(stderr, "Snapshot transaction failed: %s\n",
+            sqlite3_errmsg(conn()->handle));
+    db_step_once(STMT_ROLLBACK_TO);
+    db_step_once(STMT_RELEASE);
     return -1;
+  }
 
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  result->snapshot_id = snapshot_id;
+  result->rows_written = rows + 1;
   for (int i = 0; i < count; i++) {
-    sqlite3_bind_int(stmt, 1, snapshot_id);
-    sqlite3_bind_int(stmt, 2, processes[i].pid);
-    sqlite3_bind_text(stmt, 3, processes[i].process_name, -1, SQLITE_STATIC);
-    sqlite3_bind_int(stmt, 4, processes[i].ram_kb);
-    sqlite3_bind_int(stmt, 5, processes[i].rank_position);
-    sqlite3_bind_int64(stmt, 6, processes[i].timestamp);
-
-    sqlite3_step(stmt);
-    sqlite3_reset(stmt);
+    result->bytes_saved += (long)strlen(processes[i].process_name) +
+                           LEGACY_TIMESTAMP_BYTES - NAME_ID_BYTES;
   }
+  result->elapsed_ms = (double)(end.tv_sec - start.tv_sec) * 1000.0 +
+                       (double)(end.tv_nsec - start.tv_nsec) / 1e6;
+  return snapshot_id;
+}
 
-  sqlite3_finalize(stmt);
-  return 0;
+// Goes through the database writer when it runs, so this may block until
+// the writer's next group commit
+int db_save_snapshot(const system_snapshot_t *snapshot,
+                     process_record_t *processes, int count,
+                     db_save_result_t *result) {
+  return db_writer_save_snapshot_wait(snapshot, processes, count, result);
 }
 
 // Get system snapshots
-int db_get_system_snapshots(system_snapshot_t **snapshots, int limit,
-                            int offset) {
-  const char *sql = "SELECT * FROM system_snapshots "
-                    "ORDER BY timestamp DESC LIMIT ? OFFSET ?";
+void db_page_cursor_format(const db_page_key_t *key, char *buf, size_t len) {
+  snprintf(buf, len, "%llx-%x", (unsigned long long)key->timestamp,
+           (unsigned)key->id);
+}
 
-  sqlite3_stmt *stmt = db_prepare(sql);
-  if (!stmt)
+int db_page_cursor_parse(const char *cursor, db_page_key_t *key) {
+  unsigned long long timestamp;
+  unsigned id;
+  char extra;
+  if (sscanf(cursor, "%llx-%x%c", &timestamp, &id, &extra) != 2 ||
+      timestamp > INT64_MAX || id > INT32_MAX)
     return -1;
+  key->timestamp = (long long)timestamp;
+  key->id = (int)id;
+  return 0;
+}
 
-  sqlite3_bind_int(stmt, 1, limit);
-  sqlite3_bind_int(stmt, 2, offset);
+// Bind the page's bounds to a listing statement. before_id is turned into
+// the key of the oldest row still at or above it, so a row removed by
+// retention still pages from the right place.
+static int db_bind_page(sqlite3_stmt *stmt, const db_page_t *page,
+                        db_stmt_id_t key_stmt) {
+  db_page_key_t start = {INT64_MAX, INT32_MAX};
+  if (page->has_cursor) {
+    start = page->cursor;
+  } else if (page->before_id > 0) {
+    sqlite3_stmt *key = db_stmt(key_stmt);
+    if (!key)
+      return -1;
+    sqlite3_bind_int(key, 1, page->before_id);
+    int rc = sqlite3_step(key);
+    if (rc == SQLITE_ROW) {
+      start.timestamp = sqlite3_column_int64(key, 0);
+      start.id = sqlite3_column_int(key, 1);
+    }
+    db_stmt_release(key);
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE)
+      return -1;
+  }
 
-  system_snapshot_t *results = malloc(limit * sizeof(system_snapshot_t));
+  sqlite3_bind_int64(stmt, 1, start.timestamp);
+  sqlite3_bind_int(stmt, 2, start.id);
+  sqlite3_bind_int64(stmt, 3,
+                     page->after_ts > 0 ? page->after_ts : INT64_MIN);
+  // One row past the page tells whether another page follows
+  sqlite3_bind_int(stmt, 4, page->limit + 1);
+  sqlite3_bind_int(stmt, 5, page->offset);
+  return 0;
+}
+
+int db_get_system_snapshots(system_snapshot_t **snapshots,
+                            const db_page_t *page, int *more) {
+  sqlite3_stmt *stmt = db_stmt(STMT_GET_SNAPSHOTS);
+  if (!stmt)
+    return -1;
+  if (db_bind_page(stmt, page, STMT_SNAPSHOT_PAGE_KEY) != 0) {
+    db_stmt_release(stmt);
+    return -1;
+  }
+
+  int limit = page->limit;
+  *more = 0;
+  system_snapshot_t *results = calloc(limit, sizeof(system_snapshot_t));
   int count = 0;
 
-  while (sqlite3_step(stmt) == SQLITE_ROW && count < limit) {
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    if (count == limit) {
+      *more = 1;
+      break;
+    }
     results[count].id = sqlite3_column_int(stmt, 0);
     results[count].timestamp = sqlite3_column_int64(stmt, 1);
     results[count].total_processes = sqlite3_column_int(stmt, 2);
@@ -212,7 +907,7 @@ int db_get_system_snapshots(system_snapshot_t **snapshots, int limit,
     count++;
   }
 
-  sqlite3_finalize(stmt);
+  db_stmt_release(stmt);
   *snapshots = results;
   return count;
 }
@@ -220,11 +915,15 @@ int db_get_system_snapshots(system_snapshot_t **snapshots, int limit,
 // Log system event
 int db_log_event(const char *event_type, const char *description,
                  const char *data) {
-  const char *sql =
-      "INSERT INTO system_events (timestamp, event_type, description, data) "
-      "VALUES (?, ?, ?, ?)";
+  int rc = db_writer_log_event(event_type, description, data);
+  if (rc != DB_WRITER_INLINE)
+    return rc == DB_WRITER_QUEUED ? 0 : -1;
+  return db_log_event_now(event_type, description, data);
+}
 
-  sqlite3_stmt *stmt = db_prepare(sql);
+int db_log_event_now(const char *event_type, const char *description,
+                     const char *data) {
+  sqlite3_stmt *stmt = db_stmt(STMT_LOG_EVENT);
   if (!stmt)
     return -1;
 
@@ -234,33 +933,35 @@ int db_log_event(const char *event_type, const char *description,
   sqlite3_bind_text(stmt, 4, data ? data : "", -1, SQLITE_STATIC);
 
   int rc = sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  db_stmt_release(stmt);
 
   return (rc == SQLITE_DONE) ? 0 : -1;
 }
 
 // Get events
-int db_get_events(system_event_t **events, int limit, int offset,
-                  const char *event_type) {
-  const char *sql = event_type ? "SELECT * FROM system_events WHERE event_type "
-                                 "= ? ORDER BY timestamp DESC LIMIT ? OFFSET ?"
-                               : "SELECT * FROM system_events ORDER BY "
-                                 "timestamp DESC LIMIT ? OFFSET ?";
-
-  sqlite3_stmt *stmt = db_prepare(sql);
+int db_get_events(system_event_t **events, const db_page_t *page,
+                  const char *event_type, int *more) {
+  sqlite3_stmt *stmt =
+      db_stmt(event_type ? STMT_GET_EVENTS_BY_TYPE : STMT_GET_EVENTS);
   if (!stmt)
     return -1;
-
-  int param = 1;
+  if (db_bind_page(stmt, page, STMT_EVENT_PAGE_KEY) != 0) {
+    db_stmt_release(stmt);
+    return -1;
+  }
   if (event_type)
-    sqlite3_bind_text(stmt, param++, event_type, -1, SQLITE_STATIC);
-  sqlite3_bind_int(stmt, param++, limit);
-  sqlite3_bind_int(stmt, param, offset);
+    sqlite3_bind_text(stmt, 6, event_type, -1, SQLITE_STATIC);
 
-  system_event_t *results = malloc(limit * sizeof(system_event_t));
+  int limit = page->limit;
+  *more = 0;
+  system_event_t *results = calloc(limit, sizeof(system_event_t));
   int count = 0;
 
-  while (sqlite3_step(stmt) == SQLITE_ROW && count < limit) {
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    if (count == limit) {
+      *more = 1;
+      break;
+    }
     results[count].id = sqlite3_column_int(stmt, 0);
     results[count].timestamp = sqlite3_column_int64(stmt, 1);
 
@@ -278,18 +979,21 @@ int db_get_events(system_event_t **events, int limit, int offset,
     count++;
   }
 
-  sqlite3_finalize(stmt);
+  db_stmt_release(stmt);
   *events = results;
   return count;
 }
 
 // Configuration storage
 int db_set_config(const char *key, const char *value) {
-  const char *sql =
-      "INSERT OR REPLACE INTO config_store (key, value, updated_at) "
-      "VALUES (?, ?, ?)";
+  int rc = db_writer_set_config(key, value);
+  if (rc != DB_WRITER_INLINE)
+    return rc == DB_WRITER_QUEUED ? 0 : -1;
+  return db_set_config_now(key, value);
+}
 
-  sqlite3_stmt *stmt = db_prepare(sql);
+int db_set_config_now(const char *key, const char *value) {
+  sqlite3_stmt *stmt = db_stmt(STMT_SET_CONFIG);
   if (!stmt)
     return -1;
 
@@ -298,15 +1002,46 @@ int db_set_config(const char *key, const char *value) {
   sqlite3_bind_int64(stmt, 3, time(NULL));
 
   int rc = sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  db_stmt_release(stmt);
 
   return (rc == SQLITE_DONE) ? 0 : -1;
 }
 
-char *db_get_config(const char *key) {
-  const char *sql = "SELECT value FROM config_store WHERE key = ?";
+// Network monitoring
+int db_save_network_status(const db_network_status_t *rows, int count) {
+  int rc = db_writer_save_network_status(rows, count);
+  if (rc != DB_WRITER_INLINE)
+    return rc == DB_WRITER_QUEUED ? 0 : -1;
+  return db_save_network_status_now(rows, count);
+}
 
-  sqlite3_stmt *stmt = db_prepare(sql);
+int db_save_network_status_now(const db_network_status_t *rows, int count) {
+  sqlite3_stmt *stmt = db_stmt(STMT_SAVE_NETWORK);
+  if (!stmt)
+    return -1;
+
+  int rc = SQLITE_DONE;
+  for (int i = 0; i < count && rc == SQLITE_DONE; i++) {
+    const db_network_status_t *row = &rows[i];
+    sqlite3_bind_int64(stmt, 1, row->timestamp);
+    sqlite3_bind_text(stmt, 2, row->interface, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, row->status, -1, SQLITE_STATIC);
+    if (row->ip_address[0])
+      sqlite3_bind_text(stmt, 4, row->ip_address, -1, SQLITE_STATIC);
+    else
+      sqlite3_bind_null(stmt, 4);
+    sqlite3_bind_int64(stmt, 5, row->rx_bytes);
+    sqlite3_bind_int64(stmt, 6, row->tx_bytes);
+    rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  db_stmt_release(stmt);
+
+  return (rc == SQLITE_DONE) ? 0 : -1;
+}
+
+char *db_get_config(const char *key) {
+  sqlite3_stmt *stmt = db_stmt(STMT_GET_CONFIG);
   if (!stmt)
     return NULL;
 
@@ -321,75 +1056,421 @@ char *db_get_config(const char *key) {
     }
   }
 
-  sqlite3_finalize(stmt);
+  db_stmt_release(stmt);
   return result;
 }
 
-// Cleanup old data
-int db_cleanup_old_data(int days_to_keep) {
-  time_t cutoff_time = time(NULL) - (days_to_keep * 24 * 60 * 60);
+// Delete one chunk with an STMT_EXPIRE_* statement. Returns the rows
+// deleted, or -1; *more is set when the chunk was full.
+static int db_expire_chunk(db_stmt_id_t id, time_t cutoff, int limit,
+                           int resolution, int *more) {
+  sqlite3_stmt *stmt = db_stmt(id);
+  if (!stmt)
+    return -1;
+  sqlite3_bind_int64(stmt, 1, cutoff);
+  sqlite3_bind_int(stmt, 2, limit);
+  if (id == STMT_EXPIRE_ROLLUPS)
+    sqlite3_bind_int(stmt, 3, resolution);
 
-  char sql[256];
-  snprintf(sql, sizeof(sql),
-           "DELETE FROM system_snapshots WHERE timestamp < %ld", cutoff_time);
+  int rc = sqlite3_step(stmt);
+  db_stmt_release(stmt);
+  if (rc != SQLITE_DONE)
+    return -1;
 
-  int rc1 = db_execute(sql);
+  // Snapshots are counted by their own limit, not by their records
+  int deleted = sqlite3_changes(conn()->handle);
+  if (deleted >= limit && id != STMT_EXPIRE_PROCESSES)
+    *more = 1;
+  return deleted;
+}
 
-  snprintf(sql, sizeof(sql), "DELETE FROM system_events WHERE timestamp < %ld",
-           cutoff_time);
+int db_retention_step(const db_retention_t *policy, int *more) {
+  time_t now = time(NULL);
+  int total = 0;
+  *more = 0;
+
+  struct {
+    db_stmt_id_t id;
+    int days;
+    int limit;
+    int resolution;
+  } steps[] = {
+      {STMT_EXPIRE_PROCESSES, policy->snapshot_days,
+       DB_RETENTION_CHUNK_SNAPSHOTS, 0},
+      {STMT_EXPIRE_SNAPSHOTS, policy->snapshot_days,
+       DB_RETENTION_CHUNK_SNAPSHOTS, 0},
+      {STMT_EXPIRE_ROLLUPS, policy->snapshot_days, DB_RETENTION_CHUNK_ROWS,
+       DB_ROLLUP_MINUTE},
+      {STMT_EXPIRE_ROLLUPS, DB_ROLLUP_HOUR_KEEP_DAYS, DB_RETENTION_CHUNK_ROWS,
+       DB_ROLLUP_HOUR},
+      {STMT_EXPIRE_EVENTS, policy->event_days, DB_RETENTION_CHUNK_ROWS, 0},
+      {STMT_EXPIRE_NETWORK, policy->network_days, DB_RETENTION_CHUNK_ROWS, 0},
+  };
+
+  for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+    if (steps[i].days <= 0)
+      continue;
+    time_t cutoff = now - (time_t)steps[i].days * 24 * 60 * 60;
+    int n = db_expire_chunk(steps[i].id, cutoff, steps[i].limit,
+                            steps[i].resolution, more);
+    if (n < 0)
+      return -1;
+    total += n;
+  }
 
-  int rc2 = db_execute(sql);
+  // Orphans are keyed by snapshot id; with no snapshots left, all of them
+  int n = db_expire_chunk(STMT_EXPIRE_ORPHANS, INT64_MAX,
+                          DB_RETENTION_CHUNK_ROWS, 0, more);
+  if (n < 0)
+    return -1;
+  total += n;
+
+  // The pragma yields a row per page it frees, so it has to be stepped
+  // through to the end
+  sqlite3_stmt *stmt = total > 0 ? db_stmt(STMT_INCREMENTAL_VACUUM) : NULL;
+  if (stmt) {
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+      ;
+    db_stmt_release(stmt);
+  }
+  return total;
+}
 
-  return (rc1 == 0 && rc2 == 0) ? 0 : -1;
+int db_retention_run(const db_retention_t *policy) {
+  int total = 0, more = 1;
+  while (more) {
+    if (db_transaction_begin() != 0)
+      return -1;
+    int n = db_retention_step(policy, &more);
+    if (n < 0 || db_transaction_commit() != 0) {
+      db_transaction_rollback();
+      return -1;
+    }
+    total += n;
+  }
+  return total;
 }
 
-// Get RAM usage trend
-int db_get_ram_usage_trend(char **json_result, int hours) {
-  time_t since = time(NULL) - (hours * 60 * 60);
+// Steps go through the writer's queue like any other write, so they take
+// turns with snapshots instead of competing for the write lock
+int db_cleanup_old_data(int days_to_keep) {
+  db_retention_t policy = {days_to_keep, days_to_keep, days_to_keep};
+  return db_writer_retention_wait(&policy);
+}
 
-  const char *sql = "SELECT timestamp, total_ram_kb, memory_usage_percent "
-                    "FROM system_snapshots WHERE timestamp >= ? "
-                    "ORDER BY timestamp";
+// Number of buckets and of raw snapshots at one resolution since a time
+static int db_rollup_samples(int resolution, time_t since, long long *buckets,
+                             long long *samples) {
+  sqlite3_stmt *stmt = db_stmt(STMT_ROLLUP_SAMPLES);
+  if (!stmt)
+    return -1;
+  sqlite3_bind_int(stmt, 1, resolution);
+  sqlite3_bind_int64(stmt, 2, since);
+  int rc = sqlite3_step(stmt);
+  if (rc == SQLITE_ROW) {
+    *buckets = sqlite3_column_int64(stmt, 0);
+    *samples = sqlite3_column_int64(stmt, 1);
+  }
+  db_stmt_release(stmt);
+  return rc == SQLITE_ROW ? 0 : -1;
+}
 
-  sqlite3_stmt *stmt = db_prepare(sql);
+// The hourly rollups give the exact raw and hourly row counts from a few
+// hundred rows at most. Every minute bucket holds at least one snapshot, so
+// there are never more minute rows than raw rows or minutes in the window.
+int db_trend_resolution(int hours, long long *rows) {
+  time_t since = time(NULL) - (time_t)hours * 3600;
+  long long hour_buckets = 0, raw = 0;
+  *rows = 0;
+  if (db_rollup_samples(DB_ROLLUP_HOUR, since, &hour_buckets, &raw) != 0)
+    return DB_ROLLUP_RAW;
+
+  long long minutes = (long long)hours * 60;
+  if (minutes > raw)
+    minutes = raw;
+
+  if (raw <= DB_TREND_MAX_SCAN_ROWS) {
+    *rows = raw;
+    return DB_ROLLUP_RAW;
+  }
+  if (minutes <= DB_TREND_MAX_SCAN_ROWS) {
+    *rows = minutes;
+    return DB_ROLLUP_MINUTE;
+  }
+  if (hour_buckets <= DB_TREND_MAX_SCAN_ROWS) {
+    *rows = hour_buckets;
+    return DB_ROLLUP_HOUR;
+  }
+  *rows = (hours + 23) / 24;
+  return DB_ROLLUP_DAY;
+}
+
+// One trend point. Raw snapshots only fill the averages.
+typedef struct {
+  long long timestamp;
+  int samples;
+  int ram_kb, ram_kb_min, ram_kb_max;
+  double load, load_min, load_max;
+  double memory_percent, memory_percent_min, memory_percent_max;
+} db_trend_point_t;
+
+typedef struct {
+  json_writer_t *w;
+  int rollup;
+  int written;
+} db_trend_out_t;
+
+// Rollup points carry the bucket average under the raw field names, plus
+// the bucket's min and max
+static void db_write_trend_point(const void *row, void *arg) {
+  const db_trend_point_t *p = row;
+  db_trend_out_t *out = arg;
+  json_writer_t *w = out->w;
+
+  json_object_begin(w);
+  json_kv_int(w, "timestamp", p->timestamp);
+  if (out->rollup)
+    json_kv_int(w, "samples", p->samples);
+  json_kv_int(w, "ram_kb", p->ram_kb);
+  if (out->rollup) {
+    json_kv_int(w, "ram_kb_min", p->ram_kb_min);
+    json_kv_int(w, "ram_kb_max", p->ram_kb_max);
+  }
+  json_kv_double(w, "load", p->load, 2);
+  if (out->rollup) {
+    json_kv_double(w, "load_min", p->load_min, 2);
+    json_kv_double(w, "load_max", p->load_max, 2);
+  }
+  json_kv_double(w, "memory_percent", p->memory_percent, 2);
+  if (out->rollup) {
+    json_kv_double(w, "memory_percent_min", p->memory_percent_min, 2);
+    json_kv_double(w, "memory_percent_max", p->memory_percent_max, 2);
+  }
+  json_object_end(w);
+  out->written++;
+}
+
+static void db_read_trend_point(sqlite3_stmt *stmt, int rollup,
+                                db_trend_point_t *p) {
+  p->timestamp = sqlite3_column_int64(stmt, 0);
+  if (!rollup) {
+    p->ram_kb = sqlite3_column_int(stmt, 1);
+    p->load = sqlite3_column_double(stmt, 2);
+    p->memory_percent = sqlite3_column_double(stmt, 3);
+    return;
+  }
+  p->samples = sqlite3_column_int(stmt, 1);
+  p->ram_kb = sqlite3_column_int(stmt, 2);
+  p->ram_kb_min = sqlite3_column_int(stmt, 3);
+  p->ram_kb_max = sqlite3_column_int(stmt, 4);
+  p->load = sqlite3_column_double(stmt, 5);
+  p->load_min = sqlite3_column_double(stmt, 6);
+  p->load_max = sqlite3_column_double(stmt, 7);
+  p->memory_percent = sqlite3_column_double(stmt, 8);
+  p->memory_percent_min = sqlite3_column_double(stmt, 9);
+  p->memory_percent_max = sqlite3_column_double(stmt, 10);
+}
+
+// Rows go from the cursor straight to the writer, through LTTB on ram_kb
+// when downsampling, so the full series is never held
+int db_get_ram_usage_trend(json_writer_t *w, int hours, int resolution,
+                           int max_points) {
+  time_t now = time(NULL);
+  time_t since = now - (time_t)hours * 3600;
+  int rollup = resolution != DB_ROLLUP_RAW;
+  sqlite3_stmt *stmt = db_stmt(rollup ? STMT_ROLLUP_TREND : STMT_RAM_TREND);
   if (!stmt)
     return -1;
 
-  sqlite3_bind_int64(stmt, 1, since);
+  if (rollup) {
+    sqlite3_bind_int(stmt, 1, resolution);
+    sqlite3_bind_int64(stmt, 2, since);
+  } else {
+    sqlite3_bind_int64(stmt, 1, since);
+  }
 
-  char *result = malloc(8192);
-  strcpy(result, "{\"success\":true,\"data\":[");
+  db_trend_out_t out = {w, rollup, 0};
+  lttb_t lttb;
+  if (max_points > 0)
+    lttb_init(&lttb, max_points, (double)now, sizeof(db_trend_point_t),
+              db_write_trend_point, &out);
 
-  int first = 1;
+  int rc = 0;
+  json_array_begin(w);
   while (sqlite3_step(stmt) == SQLITE_ROW) {
-    if (!first)
-      strcat(result, ",");
+    db_trend_point_t point = {0};
+    db_read_trend_point(stmt, rollup, &point);
+    if (max_points <= 0) {
+      db_write_trend_point(&point, &out);
+    } else if (lttb_push(&lttb, (double)point.timestamp, point.ram_kb,
+                         &point) != 0) {
+      rc = -1;
+      break;
+    }
+  }
+  if (max_points > 0) {
+    if (rc == 0)
+      lttb_finish(&lttb);
+    else
+      lttb_free(&lttb);
+  }
+  json_array_end(w);
 
-    char entry[256];
-    snprintf(entry, sizeof(entry),
-             "{\"timestamp\":%lld,\"ram_kb\":%d,\"memory_percent\":%.2f}",
-             sqlite3_column_int64(stmt, 0), sqlite3_column_int(stmt, 1),
-             sqlite3_column_double(stmt, 2));
+  db_stmt_release(stmt);
+  return rc == 0 ? out.written : -1;
+}
 
-    strcat(result, entry);
-    first = 0;
+// Value that would be at index k if values were sorted (quickselect)
+static int select_kth(int *values, long long count, long long k) {
+  long long lo = 0, hi = count - 1;
+  while (lo < hi) {
+    int pivot = values[lo + (hi - lo) / 2];
+    long long i = lo, j = hi;
+    while (i <= j) {
+      while (values[i] < pivot)
+        i++;
+      while (values[j] > pivot)
+        j--;
+      if (i <= j) {
+        int tmp = values[i];
+        values[i++] = values[j];
+        values[j--] = tmp;
+      }
+    }
+    if (k <= j)
+      hi = j;
+    else if (k >= i)
+      lo = i;
+    else
+      break;
   }
+  return values[k];
+}
 
-  strcat(result, "]}");
-  sqlite3_finalize(stmt);
+int db_get_process_usage_stats(const char *process_name, int days,
+                               db_process_usage_t *usage) {
+  memset(usage, 0, sizeof(*usage));
+  sqlite3_stmt *stmt = db_stmt(STMT_PROCESS_USAGE);
+  if (!stmt)
+    return -1;
+  sqlite3_bind_text(stmt, 1, process_name, -1, SQLITE_STATIC);
+  sqlite3_bind_int64(stmt, 2, time(NULL) - (time_t)days * 86400);
+
+  // One pass over the index; the values are kept for the percentile
+  int *values = NULL;
+  long long count = 0, capacity = 0, sum = 0;
+  int rc;
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if (count == capacity) {
+      long long grown = capacity ? capacity * 2 : 256;
+      int *p = realloc(values, grown * sizeof(int));
+      if (!p) {
+        rc = SQLITE_NOMEM;
+        break;
+      }
+      values = p;
+      capacity = grown;
+    }
+    int ram_kb = sqlite3_column_int(stmt, 0);
+    if (count == 0 || ram_kb < usage->min_kb)
+      usage->min_kb = ram_kb;
+    if (count == 0 || ram_kb > usage->max_kb)
+      usage->max_kb = ram_kb;
+    sum += ram_kb;
+    values[count++] = ram_kb;
+  }
+  db_stmt_release(stmt);
 
-  *json_result = result;
-  return 0;
+  if (rc == SQLITE_DONE && count > 0) {
+    // Nearest rank: the smallest value at or above 95% of the samples
+    usage->samples = count;
+    usage->avg_kb = (double)sum / count;
+    usage->p95_kb = select_kth(values, count, (count * 95 + 99) / 100 - 1);
+  }
+  free(values);
+  return rc == SQLITE_DONE ? 0 : -1;
 }
 
 // Database maintenance
 int db_vacuum(void) { return db_execute("VACUUM;"); }
 
-int db_get_database_size(void) {
-  const char *sql = "SELECT page_count * page_size as size FROM "
-                    "pragma_page_count(), pragma_page_size()";
+// Per-table sizes from the last dbstat walk
+static struct {
+  pthread_mutex_t lock;
+  int per_table;
+  time_t measured;
+  long long bytes[DB_TABLE_COUNT];
+} storage_cache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static int db_table_index(const char *name) {
+  for (int i = 0; i < DB_TABLE_COUNT; i++) {
+    if (strcmp(name, counted_tables[i]) == 0)
+      return i;
+  }
+  return -1;
+}
+
+static void db_measure_tables(void) {
+  long long bytes[DB_TABLE_COUNT] = {0};
 
-  sqlite3_stmt *stmt = db_prepare(sql);
+  // Prepared directly: a build without dbstat is not an error worth logging
+  sqlite3_stmt *stmt;
+  int per_table = sqlite3_prepare_v2(
+                      conn()->handle,
+                      "SELECT tbl_name, sum(pgsize) FROM dbstat "
+                      "JOIN sqlite_schema USING (name) GROUP BY tbl_name",
+                      -1, &stmt, NULL) == SQLITE_OK;
+  if (per_table) {
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      const char *table = (const char *)sqlite3_column_text(stmt, 0);
+      int i = table ? db_table_index(table) : -1;
+      if (i >= 0)
+        bytes[i] = sqlite3_column_int64(stmt, 1);
+    }
+    sqlite3_finalize(stmt);
+  }
+
+  pthread_mutex_lock(&storage_cache.lock);
+  storage_cache.per_table = per_table;
+  storage_cache.measured = time(NULL);
+  memcpy(storage_cache.bytes, bytes, sizeof(bytes));
+  pthread_mutex_unlock(&storage_cache.lock);
+}
+
+int db_get_storage_stats(db_storage_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->total_bytes = db_get_database_size();
+  for (int i = 0; i < DB_TABLE_COUNT; i++)
+    stats->tables[i].name = counted_tables[i];
+
+  sqlite3_stmt *stmt = db_stmt(STMT_ROW_COUNTS);
+  if (!stmt)
+    return -1;
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    const char *table = (const char *)sqlite3_column_text(stmt, 0);
+    int i = table ? db_table_index(table) : -1;
+    if (i >= 0)
+      stats->tables[i].rows = sqlite3_column_int64(stmt, 1);
+  }
+  db_stmt_release(stmt);
+
+  pthread_mutex_lock(&storage_cache.lock);
+  int stale = time(NULL) - storage_cache.measured >= DB_STORAGE_STATS_TTL_S;
+  pthread_mutex_unlock(&storage_cache.lock);
+  if (stale)
+    db_measure_tables();
+
+  pthread_mutex_lock(&storage_cache.lock);
+  stats->per_table = storage_cache.per_table;
+  stats->measured = storage_cache.measured;
+  for (int i = 0; i < DB_TABLE_COUNT; i++)
+    stats->tables[i].bytes = storage_cache.bytes[i];
+  pthread_mutex_unlock(&storage_cache.lock);
+  return 0;
+}
+
+int db_get_database_size(void) {
+  sqlite3_stmt *stmt = db_stmt(STMT_DATABASE_SIZE);
   if (!stmt)
     return -1;
 
@@ -398,6 +1479,248 @@ int db_get_database_size(void) {
     size = sqlite3_column_int(stmt, 0);
   }
 
-  sqlite3_finalize(stmt);
+  db_stmt_release(stmt);
   return size;
 }
+
+// Copy a whole database with the backup API, into a temporary file that is
+// renamed over dest_path once complete
+static long long db_copy(sqlite3 *source, const char *dest_path) {
+  char tmp_path[512];
+  snprintf(tmp_path, sizeof(tmp_path), "%s-tmp", dest_path);
+  unlink(tmp_path);
+
+  sqlite3 *dest;
+  if (sqlite3_open(tmp_path, &dest) != SQLITE_OK) {
+    fprintf(stderr, "Cannot open %s: %s\n", tmp_path, sqlite3_errmsg(dest));
+    sqlite3_close(dest);
+    return -1;
+  }
+  sqlite3_backup *backup = sqlite3_backup_init(dest, "main", source, "main");
+  int rc = backup ? sqlite3_backup_step(backup, -1) : SQLITE_ERROR;
+  sqlite3_backup_finish(backup);
+  sqlite3_close(dest);
+
+  struct stat st;
+  if (rc != SQLITE_DONE || stat(tmp_path, &st) != 0 ||
+      rename(tmp_path, dest_path) != 0) {
+    unlink(tmp_path);
+    return -1;
+  }
+  return (long long)st.st_size;
+}
+
+int db_backup(const char *backup_path) {
+  return db_copy(conn()->handle, backup_path) < 0 ? -1 : 0;
+}
+
+// Hybrid RAM/flash mode. A checkpoint is one backup, taken a bounded number
+// of pages per step and renamed over the persistent copy when complete.
+// Steps run on the writer's connection: pages the writer changes mid-copy
+// are updated in the backup as they are written, where a write from any
+// other connection restarts it.
+static struct {
+  pthread_mutex_t lock; // Guards stats; steps run on one thread at a time
+  char *path;
+  char tmp_path[512];
+  sqlite3 *dest;
+  sqlite3_backup *backup;
+  sqlite3 *source;
+  struct timespec started;
+  // Change counters of the source when the copy began, and when the last
+  // completed copy began
+  sqlite3 *version_source;
+  long long version[2];
+  long long done_version[2];
+  db_persist_stats_t stats;
+} persist = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+int db_persist_init(const char *db_path, const char *persist_path) {
+  free(persist.path);
+  persist.path = strdup(persist_path);
+  if (!persist.path)
+    return -1;
+  snprintf(persist.tmp_path, sizeof(persist.tmp_path), "%s-tmp",
+           persist_path);
+  unlink(persist.tmp_path); // Left over from a checkpoint cut short
+  persist.stats.enabled = 1;
+
+  // A live database that survived (a service restart, not a reboot) is
+  // newer than the copy
+  if (access(db_path, F_OK) == 0 || access(persist_path, F_OK) != 0)
+    return 0;
+
+  // immutable=1 reads the copy without creating WAL files next to it
+  char uri[600];
+  snprintf(uri, sizeof(uri), "file:%s?immutable=1", persist_path);
+  sqlite3 *source;
+  long long bytes = -1;
+  if (sqlite3_open_v2(uri, &source, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI,
+                      NULL) == SQLITE_OK)
+    bytes = db_copy(source, db_path);
+  sqlite3_close(source);
+  if (bytes < 0) {
+    fprintf(stderr, "Database: cannot restore %s from %s\n", db_path,
+            persist_path);
+    return -1;
+  }
+
+  persist.stats.restored = 1;
+  printf("Database: restored %s from %s (%lld bytes)\n", db_path,
+         persist_path, bytes);
+  return 0;
+}
+
+static void db_persist_abort(void) {
+  sqlite3_backup_finish(persist.backup);
+  sqlite3_close(persist.dest);
+  unlink(persist.tmp_path);
+  persist.backup = NULL;
+  persist.dest = NULL;
+  persist.source = NULL;
+  pthread_mutex_lock(&persist.lock);
+  persist.stats.in_progress = 0;
+  pthread_mutex_unlock(&persist.lock);
+}
+
+// A backup must be finished before its source connection is closed
+static void db_persist_release(sqlite3 *source) {
+  if (persist.backup && persist.source == source)
+    db_persist_abort();
+  if (persist.version_source == source)
+    persist.version_source = NULL;
+}
+
+static void db_data_version(sqlite3 *source, long long version[2]) {
+  version[0] = -1;
+  sqlite3_stmt *stmt = db_stmt(STMT_DATA_VERSION);
+  if (stmt) {
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+      version[0] = sqlite3_column_int64(stmt, 0);
+    db_stmt_release(stmt);
+  }
+  version[1] = sqlite3_total_changes(source);
+}
+
+// Start a copy. Returns 1 when nothing changed since the last one:
+// data_version counts commits by other connections, total_changes those
+// made on this one.
+static int db_persist_begin(sqlite3 *source) {
+  db_data_version(source, persist.version);
+  if (persist.version_source == source &&
+      persist.version[0] == persist.done_version[0] &&
+      persist.version[1] == persist.done_version[1]) {
+    pthread_mutex_lock(&persist.lock);
+    persist.stats.skipped++;
+    pthread_mutex_unlock(&persist.lock);
+    return 1;
+  }
+
+  unlink(persist.tmp_path);
+  if (sqlite3_open(persist.tmp_path, &persist.dest) != SQLITE_OK) {
+    fprintf(stderr, "Checkpoint: cannot open %s: %s\n", persist.tmp_path,
+            sqlite3_errmsg(persist.dest));
+    sqlite3_close(persist.dest);
+    persist.dest = NULL;
+    return -1;
+  }
+  // The copy only replaces the old one once complete, so it needs no
+  // journal of its own
+  sqlite3_exec(persist.dest, "PRAGMA journal_mode = OFF", NULL, NULL, NULL);
+  persist.backup = sqlite3_backup_init(persist.dest, "main", source, "main");
+  if (!persist.backup) {
+    fprintf(stderr, "Checkpoint: %s\n", sqlite3_errmsg(persist.dest));
+    db_persist_abort();
+    return -1;
+  }
+
+  persist.source = source;
+  clock_gettime(CLOCK_MONOTONIC, &persist.started);
+  pthread_mutex_lock(&persist.lock);
+  persist.stats.in_progress = 1;
+  pthread_mutex_unlock(&persist.lock);
+  return 0;
+}
+
+static int db_persist_complete(void) {
+  sqlite3_backup_finish(persist.backup);
+  persist.backup = NULL;
+  int rc = sqlite3_close(persist.dest);
+  persist.dest = NULL;
+
+  struct stat st;
+  if (rc != SQLITE_OK || stat(persist.tmp_path, &st) != 0 ||
+      rename(persist.tmp_path, persist.path) != 0) {
+    fprintf(stderr, "Checkpoint: cannot replace %s\n", persist.path);
+    db_persist_abort();
+    return -1;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double ms = (double)(now.tv_sec - persist.started.tv_sec) * 1000.0 +
+              (double)(now.tv_nsec - persist.started.tv_nsec) / 1e6;
+
+  persist.version_source = persist.source;
+  persist.done_version[0] = persist.version[0];
+  persist.done_version[1] = persist.version[1];
+  persist.source = NULL;
+
+  pthread_mutex_lock(&persist.lock);
+  persist.stats.in_progress = 0;
+  persist.stats.checkpoints++;
+  persist.stats.last_checkpoint = time(NULL);
+  persist.stats.last_bytes = (long long)st.st_size;
+  persist.stats.total_bytes += (long long)st.st_size;
+  persist.stats.last_duration_ms = ms;
+  pthread_mutex_unlock(&persist.lock);
+  return 0;
+}
+
+int db_persist_step(int max_pages, int *more) {
+  *more = 0;
+  if (!persist.path)
+    return 0;
+
+  // A copy begun on another connection cannot be continued from this one
+  sqlite3 *source = conn()->handle;
+  if (persist.backup && persist.source != source)
+    db_persist_abort();
+  int rc = persist.backup ? 0 : db_persist_begin(source);
+  if (rc > 0)
+    return 0;
+
+  if (rc == 0) {
+    rc = sqlite3_backup_step(persist.backup, max_pages);
+    if (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+      *more = 1;
+      return 0;
+    }
+    if (rc == SQLITE_DONE && db_persist_complete() == 0)
+      return 0;
+    if (rc != SQLITE_DONE) {
+      fprintf(stderr, "Checkpoint: %s\n", sqlite3_errstr(rc));
+      db_persist_abort();
+    }
+  }
+
+  pthread_mutex_lock(&persist.lock);
+  persist.stats.failures++;
+  pthread_mutex_unlock(&persist.lock);
+  return -1;
+}
+
+int db_persist_checkpoint(void) {
+  int more = 1;
+  while (more) {
+    if (db_persist_step(-1, &more) != 0)
+      return -1;
+  }
+  return 0;
+}
+
+void db_persist_get_stats(db_persist_stats_t *stats) {
+  pthread_mutex_lock(&persist.lock);
+  *stats = persist.stats;
+  pthread_mutex_unlock(&persist.lock);
+}
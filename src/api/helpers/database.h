@@ -1,14 +1,45 @@
 #ifndef DATABASE_H
 #define DATABASE_H
 
+#include "json_writer.h"
 #include <sqlite3.h>
 #include <time.h>
 
 // Database connection
 extern sqlite3 *db;
 
-// Database init and cleanup
-int db_init(const char *db_path);
+// Page cache and memory-map sizes, from cache_size/mmap_size in UCI
+#define DB_DEFAULT_CACHE_SIZE_KB 512
+#define DB_DEFAULT_MMAP_SIZE_KB 1024
+
+// Rollup resolutions kept next to the raw snapshots, in seconds. Buckets
+// are aligned to UTC.
+#define DB_ROLLUP_RAW 0
+#define DB_ROLLUP_MINUTE 60
+#define DB_ROLLUP_HOUR 3600
+#define DB_ROLLUP_DAY 86400
+
+// Trend query limits
+#define DB_TREND_DEFAULT_POINTS 300
+#define DB_TREND_MAX_POINTS 2000
+#define DB_TREND_MAX_HOURS (24 * 366)
+
+// Most rows a trend reads and downsamples; longer windows read a coarser
+// rollup instead
+#define DB_TREND_MAX_SCAN_ROWS 20000
+
+typedef struct {
+  int cache_size_kb;
+  int mmap_size_kb;
+} db_tuning_t;
+
+// Database init and cleanup. tuning may be NULL for the defaults.
+int db_init(const char *db_path, const db_tuning_t *tuning);
+
+// Give the calling thread its own connection and statement cache; helpers
+// called on that thread use it instead of the main connection
+int db_thread_open(void);
+void db_thread_close(void);
 void db_close(void);
 int db_execute(const char *sql);
 sqlite3_stmt *db_prepare(const char *sql);
@@ -34,8 +65,9 @@ typedef struct {
   int pid;
   char process_name[64];
   int ram_kb;
+  double cpu_percent;
   int rank_position;
-  time_t timestamp;
+  time_t timestamp; // Not stored; comes from the parent snapshot
 } process_record_t;
 
 typedef struct {
@@ -46,41 +78,222 @@ typedef struct {
   char data[512];
 } system_event_t;
 
+// One row of network_status: an interface's counters at a point in time
+typedef struct {
+  time_t timestamp;
+  char interface[16];
+  char status[16];
+  char ip_address[46];
+  long long rx_bytes;
+  long long tx_bytes;
+} db_network_status_t;
+
+// Rows per multi-row INSERT when saving process records
+#define DB_PROCESS_BATCH_ROWS 16
+
+// Outcome of db_save_snapshot()
+typedef struct {
+  int snapshot_id;
+  int rows_written; // Snapshot row plus process records
+  long bytes_saved; // Estimated, against storing names and times per row
+  double elapsed_ms;
+} db_save_result_t;
+
 // System monitoring functions
 int db_save_system_snapshot(const system_snapshot_t *snapshot);
 int db_save_process_records(int snapshot_id, const process_record_t *processes,
                             int count);
-int db_get_system_snapshots(system_snapshot_t **snapshots, int limit,
-                            int offset);
+int db_save_snapshot(const system_snapshot_t *snapshot,
+                     process_record_t *processes, int count,
+                     db_save_result_t *result);
+
+// Writes below go through the database writer thread when it is running
+// (see db_writer.h). The _now variants write on the calling thread's
+// connection and are what the writer itself uses.
+int db_save_snapshot_now(const system_snapshot_t *snapshot,
+                         process_record_t *processes, int count,
+                         db_save_result_t *result);
+int db_log_event_now(const char *event_type, const char *description,
+                     const char *data);
+int db_set_config_now(const char *key, const char *value);
+int db_save_network_status_now(const db_network_status_t *rows, int count);
+int db_transaction_begin(void);
+int db_transaction_commit(void);
+int db_transaction_rollback(void);
+
+// Keyset pagination for the snapshot and event listings, newest first. A
+// page starts below a (timestamp, id) key and is a range scan on the
+// timestamp indexes, so it costs the same at any depth.
+#define DB_PAGE_MAX_LIMIT 1000
+#define DB_PAGE_CURSOR_LEN 32
+
+typedef struct {
+  long long timestamp;
+  int id;
+} db_page_key_t;
+
+typedef struct {
+  int limit;
+  int offset;           // Rows skipped after the start, each one read
+  int before_id;        // Start below this row; 0 starts at the newest
+  int has_cursor;       // Set when cursor is to be used
+  db_page_key_t cursor; // Start below this key instead of before_id
+  long long after_ts;   // Only rows newer than this; 0 for no bound
+} db_page_t;
+
+// The key as an opaque next_cursor string, and back. Parse returns -1 for
+// a string that is not a cursor.
+void db_page_cursor_format(const db_page_key_t *key, char *buf, size_t len);
+int db_page_cursor_parse(const char *cursor, db_page_key_t *key);
+
+// Return the rows on the page, or -1. *more is set when rows follow it.
+int db_get_system_snapshots(system_snapshot_t **snapshots,
+                            const db_page_t *page, int *more);
 int db_get_process_records(int snapshot_id, process_record_t **processes);
+
+// Days of data kept per table; 0 keeps that table forever. Minute rollups
+// follow the snapshots, hourly rollups cover the longest trend window and
+// daily rollups are never deleted.
+typedef struct {
+  int snapshot_days; // Snapshots, their process records, minute rollups
+  int event_days;
+  int network_days;
+} db_retention_t;
+
+// Bounds on one retention step, which runs in one short transaction
+#define DB_RETENTION_CHUNK_ROWS 512
+#define DB_RETENTION_CHUNK_SNAPSHOTS 32
+#define DB_ROLLUP_HOUR_KEEP_DAYS (DB_TREND_MAX_HOURS / 24)
+
+// Delete at most one chunk from every table and reclaim freed pages.
+// Returns the rows deleted, or -1; *more is set while expired rows remain.
+int db_retention_step(const db_retention_t *policy, int *more);
+
+// Run retention steps until nothing expired is left, each in a transaction
+// of its own on the calling thread's connection. Returns the rows deleted,
+// or -1.
+int db_retention_run(const db_retention_t *policy);
+
+// The same for every table at once, run by the database writer when it is
+// running. Blocks until the last step is committed, so it must not be
+// called from the event loop.
 int db_cleanup_old_data(int days_to_keep);
 
 // Event logging functions
 int db_log_event(const char *event_type, const char *description,
                  const char *data);
-int db_get_events(system_event_t **events, int limit, int offset,
-                  const char *event_type);
+int db_get_events(system_event_t **events, const db_page_t *page,
+                  const char *event_type, int *more);
 
 // Configuration storage functions
 int db_set_config(const char *key, const char *value);
 char *db_get_config(const char *key);
 int db_delete_config(const char *key);
 
-// Network monitoring functions
-int db_save_network_status(const char *interface, const char *status,
-                           const char *ip, int rx_bytes, int tx_bytes);
+// Network monitoring functions. Rows are copied.
+int db_save_network_status(const db_network_status_t *rows, int count);
 int db_get_network_history(const char *interface, char **json_result,
                            int hours);
 
 // Statistics and analytics
-int db_get_ram_usage_trend(char **json_result, int hours);
-int db_get_process_usage_stats(const char *process_name, char **json_result,
-                               int days);
+// Source for a trend over the last hours: the finest resolution with at
+// most DB_TREND_MAX_SCAN_ROWS rows. *rows gets its row count (an upper
+// bound for minute and day rollups).
+int db_trend_resolution(int hours, long long *rows);
+
+// Write the trend at a resolution as an array of points. With max_points
+// > 0 the series is downsampled with LTTB as it is read. Returns the points
+// written, or -1.
+int db_get_ram_usage_trend(json_writer_t *w, int hours, int resolution,
+                           int max_points);
+
+// Longest window /api/database/analytics/process/{name} covers
+#define DB_PROCESS_USAGE_MAX_DAYS 90
+
+typedef struct {
+  long long samples;
+  int min_kb;
+  int max_kb;
+  int p95_kb;
+  double avg_kb;
+} db_process_usage_t;
+
+// RSS of one process over the last days, read from the covering index on
+// process_records alone. No samples leaves usage zeroed. Returns 0 or -1.
+int db_get_process_usage_stats(const char *process_name, int days,
+                               db_process_usage_t *usage);
 int db_get_system_summary_stats(char **json_result);
 
+// Tables reported by /api/database/stats. Their rows are counted by
+// triggers into table_counts, so reading a count never scans the table.
+enum {
+  DB_TABLE_SNAPSHOTS,
+  DB_TABLE_PROCESSES,
+  DB_TABLE_NAMES,
+  DB_TABLE_ROLLUPS,
+  DB_TABLE_EVENTS,
+  DB_TABLE_CONFIG,
+  DB_TABLE_NETWORK,
+  DB_TABLE_COUNT
+};
+
+// Per-table sizes walk every page through dbstat, so they are measured at
+// most once per DB_STORAGE_STATS_TTL_S
+#define DB_STORAGE_STATS_TTL_S 60
+
+typedef struct {
+  const char *name;
+  long long rows;
+  long long bytes; // Indexes included
+} db_table_stats_t;
+
+// Row counts are always current. Sizes need SQLite's dbstat table; without
+// it only total_bytes is filled in and per_table is 0.
+typedef struct {
+  int per_table;
+  time_t measured; // When the per-table sizes were read
+  long long total_bytes;
+  db_table_stats_t tables[DB_TABLE_COUNT];
+} db_storage_stats_t;
+
+int db_get_storage_stats(db_storage_stats_t *stats);
+
 // Database maintenance
 int db_vacuum(void);
 int db_get_database_size(void);
 int db_backup(const char *backup_path);
 
+// Hybrid RAM/flash mode: the live database sits on tmpfs and checkpoints
+// copy it to a persistent path, DB_PERSIST_STEP_PAGES pages per writer
+// batch so the copy never holds up other writes for long
+#define DB_PERSIST_STEP_PAGES 128
+#define DB_PERSIST_INTERVAL_S 3600
+
+typedef struct {
+  int enabled;
+  int restored; // Live database was restored from the copy at startup
+  int in_progress;
+  unsigned long checkpoints;
+  unsigned long skipped; // Nothing had changed since the last checkpoint
+  unsigned long failures;
+  time_t last_checkpoint;
+  long long last_bytes;
+  long long total_bytes;
+  double last_duration_ms;
+} db_persist_stats_t;
+
+// Call before db_init(). Restores db_path from persist_path when db_path
+// is missing, as it is on tmpfs after a reboot.
+int db_persist_init(const char *db_path, const char *persist_path);
+
+// Copy up to max_pages pages (-1 for all) of the checkpoint in progress on
+// the calling thread's connection, starting one if needed. *more stays set
+// until the copy has replaced the old one. Returns -1 on failure.
+int db_persist_step(int max_pages, int *more);
+
+// Take a whole checkpoint at once, as at shutdown
+int db_persist_checkpoint(void);
+
+void db_persist_get_stats(db_persist_stats_t *stats);
+
 #endif // !DATABASE_H
@@ -0,0 +1,540 @@
+#include "db_writer.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef enum {
+  WRITE_EVENT,
+  WRITE_CONFIG,
+  WRITE_NETWORK,
+  WRITE_SNAPSHOT,
+  WRITE_RETENTION,
+  WRITE_CHECKPOINT
+} write_kind_t;
+
+// One queued write, from submission until its batch is committed
+typedef struct write_op {
+  write_kind_t kind;
+  int rows;
+  char *text[3]; // Event type/description/data, or config key/value
+  db_network_status_t *network;
+  int network_count;
+  system_snapshot_t snapshot;
+  process_record_t *processes;
+  int process_count;
+  int owns_processes;
+  db_retention_t retention;
+  int more; // Retention or checkpoint has steps left
+  db_write_done_fn done;
+  void *done_arg;
+  int status;
+  db_save_result_t result;
+  struct write_op *next;
+} write_op_t;
+
+// Completion state for the db_writer_*_wait() calls
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int finished;
+  int status;
+  db_save_result_t result;
+} write_wait_t;
+
+static struct {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  write_op_t *head;
+  write_op_t *tail;
+  int depth;
+  int rows; // Rows waiting in the queue
+  int flush_ms;
+  int max_batch_rows;
+  int max_queue;
+  int running;
+  int stopping;
+  int ready;     // Thread has tried to open its connection
+  int open_rc;
+  unsigned long queued;
+  unsigned long dropped;
+  unsigned long failed;
+  unsigned long commits;
+  unsigned long committed_ops;
+  unsigned long committed_rows;
+  double last_commit_ms;
+  double max_commit_ms;
+  double total_commit_ms;
+} writer = {.lock = PTHREAD_MUTEX_INITIALIZER,
+            .cond = PTHREAD_COND_INITIALIZER};
+
+// Held by a caller writing a snapshot or running retention itself because
+// the writer is down. Such callers can be several worker threads at once,
+// and without it their transactions and statement bindings would
+// interleave.
+static pthread_mutex_t inline_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double elapsed_ms(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)(now.tv_sec - start->tv_sec) * 1000.0 +
+         (double)(now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void free_op(write_op_t *op) {
+  for (int i = 0; i < 3; i++)
+    free(op->text[i]);
+  free(op->network);
+  if (op->owns_processes)
+    free(op->processes);
+  free(op);
+}
+
+// Add op to the queue, or drop it when the writer is full
+static int enqueue(write_op_t *op) {
+  pthread_mutex_lock(&writer.lock);
+  if (!writer.running || writer.stopping) {
+    pthread_mutex_unlock(&writer.lock);
+    return DB_WRITER_INLINE;
+  }
+  if (writer.depth >= writer.max_queue) {
+    writer.dropped++;
+    pthread_mutex_unlock(&writer.lock);
+    return DB_WRITER_DROPPED;
+  }
+
+  if (writer.tail)
+    writer.tail->next = op;
+  else
+    writer.head = op;
+  writer.tail = op;
+  writer.depth++;
+  writer.rows += op->rows;
+  writer.queued++;
+  pthread_cond_signal(&writer.cond);
+  pthread_mutex_unlock(&writer.lock);
+  return DB_WRITER_QUEUED;
+}
+
+static int apply_op(write_op_t *op) {
+  switch (op->kind) {
+  case WRITE_EVENT:
+    return db_log_event_now(op->text[0], op->text[1], op->text[2]);
+  case WRITE_CONFIG:
+    return db_set_config_now(op->text[0], op->text[1]);
+  case WRITE_NETWORK:
+    return db_save_network_status_now(op->network, op->network_count);
+  case WRITE_SNAPSHOT:
+    return db_save_snapshot_now(&op->snapshot, op->processes,
+                                op->process_count, &op->result) > 0
+               ? 0
+               : -1;
+  case WRITE_RETENTION: {
+    int deleted = db_retention_step(&op->retention, &op->more);
+    if (deleted < 0)
+      return -1;
+    op->result.rows_written += deleted;
+    return 0;
+  }
+  case WRITE_CHECKPOINT:
+    return db_persist_step(DB_PERSIST_STEP_PAGES, &op->more);
+  }
+  return -1;
+}
+
+// Write a batch in one transaction. A failing insert only undoes itself and
+// snapshots run inside a savepoint, so one bad op does not cost the rest of
+// the batch.
+static void commit_batch(write_op_t *batch) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  int ops = 0, rows = 0, failed = 0;
+  int in_transaction = db_transaction_begin() == 0;
+  for (write_op_t *op = batch; op; op = op->next) {
+    if (op->kind == WRITE_CHECKPOINT)
+      continue;
+    op->status = apply_op(op);
+    if (op->status == 0) {
+      ops++;
+      rows += op->rows;
+    } else {
+      failed++;
+    }
+  }
+
+  if (in_transaction && db_transaction_commit() != 0) {
+    fprintf(stderr, "Database writer: commit failed, batch of %d lost\n",
+            ops);
+    db_transaction_rollback();
+    for (write_op_t *op = batch; op; op = op->next)
+      op->status = -1;
+    failed += ops;
+    ops = rows = 0;
+  }
+
+  // A backup cannot step while its source is in a write transaction
+  for (write_op_t *op = batch; op; op = op->next) {
+    if (op->kind != WRITE_CHECKPOINT)
+      continue;
+    op->status = apply_op(op);
+    if (op->status == 0)
+      ops++;
+    else
+      failed++;
+  }
+
+  double ms = elapsed_ms(&start);
+  pthread_mutex_lock(&writer.lock);
+  writer.commits++;
+  writer.committed_ops += ops;
+  writer.committed_rows += rows;
+  writer.failed += failed;
+  writer.last_commit_ms = ms;
+  writer.total_commit_ms += ms;
+  if (ms > writer.max_commit_ms)
+    writer.max_commit_ms = ms;
+  pthread_mutex_unlock(&writer.lock);
+
+  while (batch) {
+    write_op_t *next = batch->next;
+
+    // An unfinished retention run or checkpoint goes to the back of the
+    // queue, so other writes get in between its steps
+    if ((batch->kind == WRITE_RETENTION || batch->kind == WRITE_CHECKPOINT) &&
+        batch->status == 0 && batch->more) {
+      batch->next = NULL;
+      batch->more = 0;
+      if (enqueue(batch) == DB_WRITER_QUEUED) {
+        batch = next;
+        continue;
+      }
+    }
+
+    if (batch->done)
+      batch->done(batch->status, &batch->result, batch->done_arg);
+    free_op(batch);
+    batch = next;
+  }
+}
+
+static void *writer_main(void *arg) {
+  (void)arg;
+
+  // The writer needs its own connection so its transactions do not mix
+  // with reads on the event loop
+  int rc = db_thread_open();
+  pthread_mutex_lock(&writer.lock);
+  writer.open_rc = rc;
+  writer.ready = 1;
+  pthread_cond_broadcast(&writer.cond);
+  pthread_mutex_unlock(&writer.lock);
+  if (rc != 0)
+    return NULL;
+
+  for (;;) {
+    pthread_mutex_lock(&writer.lock);
+    while (!writer.stopping && writer.head == NULL)
+      pthread_cond_wait(&writer.cond, &writer.lock);
+    if (writer.head == NULL) {
+      pthread_mutex_unlock(&writer.lock);
+      break; // Stopping with nothing left to write
+    }
+
+    // Give the batch until the flush deadline to fill up
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += writer.flush_ms / 1000;
+    deadline.tv_nsec += (long)(writer.flush_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    while (!writer.stopping && writer.rows < writer.max_batch_rows) {
+      if (pthread_cond_timedwait(&writer.cond, &writer.lock, &deadline) != 0)
+        break;
+    }
+
+    // Take at most max_batch_rows rows, but always at least one op
+    write_op_t *batch = writer.head;
+    write_op_t *last = batch;
+    int rows = last->rows;
+    int taken = 1;
+    while (last->next && rows + last->next->rows <= writer.max_batch_rows) {
+      last = last->next;
+      rows += last->rows;
+      taken++;
+    }
+    writer.head = last->next;
+    if (writer.head == NULL)
+      writer.tail = NULL;
+    last->next = NULL;
+    writer.depth -= taken;
+    writer.rows -= rows;
+    pthread_mutex_unlock(&writer.lock);
+
+    commit_batch(batch);
+  }
+
+  db_thread_close();
+  return NULL;
+}
+
+int db_writer_start(int flush_ms, int max_batch_rows, int max_queue) {
+  if (writer.running)
+    return 0;
+
+  writer.flush_ms = flush_ms > 0 ? flush_ms : DB_WRITER_FLUSH_MS;
+  writer.max_batch_rows =
+      max_batch_rows > 0 ? max_batch_rows : DB_WRITER_MAX_BATCH_ROWS;
+  writer.max_queue = max_queue > 0 ? max_queue : DB_WRITER_MAX_QUEUE;
+  writer.stopping = 0;
+  writer.ready = 0;
+
+  if (pthread_create(&writer.thread, NULL, writer_main, NULL) != 0) {
+    fprintf(stderr, "Database writer: cannot start thread\n");
+    return -1;
+  }
+
+  pthread_mutex_lock(&writer.lock);
+  while (!writer.ready)
+    pthread_cond_wait(&writer.cond, &writer.lock);
+  int rc = writer.open_rc;
+  writer.running = rc == 0;
+  pthread_mutex_unlock(&writer.lock);
+  if (rc != 0) {
+    pthread_join(writer.thread, NULL);
+    fprintf(stderr, "Database writer: cannot open a connection\n");
+    return -1;
+  }
+
+  printf("Database writer started, flush every %d ms or %d rows\n",
+         writer.flush_ms, writer.max_batch_rows);
+  return 0;
+}
+
+void db_writer_stop(void) {
+  if (!writer.running)
+    return;
+
+  pthread_mutex_lock(&writer.lock);
+  writer.stopping = 1;
+  pthread_cond_signal(&writer.cond);
+  pthread_mutex_unlock(&writer.lock);
+  pthread_join(writer.thread, NULL);
+
+  pthread_mutex_lock(&writer.lock);
+  writer.running = 0;
+  pthread_mutex_unlock(&writer.lock);
+}
+
+int db_writer_running(void) {
+  pthread_mutex_lock(&writer.lock);
+  int running = writer.running && !writer.stopping;
+  pthread_mutex_unlock(&writer.lock);
+  return running;
+}
+
+static int submit_text(write_kind_t kind, const char *a, const char *b,
+                       const char *c) {
+  if (!db_writer_running())
+    return DB_WRITER_INLINE;
+
+  write_op_t *op = calloc(1, sizeof(write_op_t));
+  if (!op)
+    return DB_WRITER_DROPPED;
+  op->kind = kind;
+  op->rows = 1;
+  const char *text[3] = {a, b, c};
+  for (int i = 0; i < 3; i++) {
+    if (text[i] && !(op->text[i] = strdup(text[i]))) {
+      free_op(op);
+      return DB_WRITER_DROPPED;
+    }
+  }
+
+  int rc = enqueue(op);
+  if (rc != DB_WRITER_QUEUED)
+    free_op(op);
+  return rc;
+}
+
+int db_writer_log_event(const char *event_type, const char *description,
+                        const char *data) {
+  return submit_text(WRITE_EVENT, event_type, description, data);
+}
+
+int db_writer_set_config(const char *key, const char *value) {
+  return submit_text(WRITE_CONFIG, key, value, NULL);
+}
+
+int db_writer_save_network_status(const db_network_status_t *rows,
+                                  int count) {
+  if (!db_writer_running())
+    return DB_WRITER_INLINE;
+
+  write_op_t *op = calloc(1, sizeof(write_op_t));
+  if (!op || !(op->network = malloc(count * sizeof(*rows)))) {
+    free(op);
+    return DB_WRITER_DROPPED;
+  }
+  op->kind = WRITE_NETWORK;
+  op->rows = count;
+  memcpy(op->network, rows, count * sizeof(*rows));
+  op->network_count = count;
+
+  int rc = enqueue(op);
+  if (rc != DB_WRITER_QUEUED)
+    free_op(op);
+  return rc;
+}
+
+static int submit_snapshot(const system_snapshot_t *snapshot,
+                           process_record_t *processes, int count,
+                           int owns_processes, db_write_done_fn done,
+                           void *arg) {
+  write_op_t *op = calloc(1, sizeof(write_op_t));
+  if (!op)
+    return DB_WRITER_DROPPED;
+  op->kind = WRITE_SNAPSHOT;
+  op->rows = 1 + count;
+  op->snapshot = *snapshot;
+  op->processes = processes;
+  op->process_count = count;
+  op->owns_processes = owns_processes;
+  op->done = done;
+  op->done_arg = arg;
+
+  int rc = enqueue(op);
+  if (rc != DB_WRITER_QUEUED) {
+    op->owns_processes = 0; // Caller keeps the records on failure
+    free_op(op);
+  }
+  return rc;
+}
+
+int db_writer_save_snapshot(const system_snapshot_t *snapshot,
+                            process_record_t *processes, int count,
+                            db_write_done_fn done, void *arg) {
+  return submit_snapshot(snapshot, processes, count, 1, done, arg);
+}
+
+int db_writer_retention(const db_retention_t *policy, db_write_done_fn done,
+                        void *arg) {
+  if (!db_writer_running())
+    return DB_WRITER_INLINE;
+
+  write_op_t *op = calloc(1, sizeof(write_op_t));
+  if (!op)
+    return DB_WRITER_DROPPED;
+  op->kind = WRITE_RETENTION;
+  // A step is a transaction's worth of deletes on its own, so it fills the
+  // batch and is committed without waiting out the flush deadline
+  op->rows = writer.max_batch_rows;
+  op->retention = *policy;
+  op->done = done;
+  op->done_arg = arg;
+
+  int rc = enqueue(op);
+  if (rc != DB_WRITER_QUEUED)
+    free_op(op);
+  return rc;
+}
+
+int db_writer_checkpoint(db_write_done_fn done, void *arg) {
+  if (!db_writer_running())
+    return DB_WRITER_INLINE;
+
+  write_op_t *op = calloc(1, sizeof(write_op_t));
+  if (!op)
+    return DB_WRITER_DROPPED;
+  op->kind = WRITE_CHECKPOINT;
+  op->rows = 1; // Steps are paced by the flush deadline
+  op->done = done;
+  op->done_arg = arg;
+
+  int rc = enqueue(op);
+  if (rc != DB_WRITER_QUEUED)
+    free_op(op);
+  return rc;
+}
+
+static void wake_waiter(int status, const db_save_result_t *result,
+                        void *arg) {
+  write_wait_t *wait = arg;
+  pthread_mutex_lock(&wait->lock);
+  wait->status = status;
+  wait->result = *result;
+  wait->finished = 1;
+  pthread_cond_signal(&wait->cond);
+  pthread_mutex_unlock(&wait->lock);
+}
+
+int db_writer_save_snapshot_wait(const system_snapshot_t *snapshot,
+                                 process_record_t *processes, int count,
+                                 db_save_result_t *result) {
+  write_wait_t wait = {.lock = PTHREAD_MUTEX_INITIALIZER,
+                       .cond = PTHREAD_COND_INITIALIZER};
+  memset(result, 0, sizeof(*result));
+
+  int rc = submit_snapshot(snapshot, processes, count, 0, wake_waiter, &wait);
+  if (rc == DB_WRITER_INLINE) {
+    pthread_mutex_lock(&inline_lock);
+    rc = db_save_snapshot_now(snapshot, processes, count, result);
+    pthread_mutex_unlock(&inline_lock);
+    return rc;
+  }
+  if (rc != DB_WRITER_QUEUED)
+    return -1;
+
+  pthread_mutex_lock(&wait.lock);
+  while (!wait.finished)
+    pthread_cond_wait(&wait.cond, &wait.lock);
+  pthread_mutex_unlock(&wait.lock);
+
+  *result = wait.result;
+  return wait.status == 0 ? result->snapshot_id : -1;
+}
+
+int db_writer_retention_wait(const db_retention_t *policy) {
+  write_wait_t wait = {.lock = PTHREAD_MUTEX_INITIALIZER,
+                       .cond = PTHREAD_COND_INITIALIZER};
+
+  int rc = db_writer_retention(policy, wake_waiter, &wait);
+  if (rc == DB_WRITER_INLINE) {
+    pthread_mutex_lock(&inline_lock);
+    rc = db_retention_run(policy);
+    pthread_mutex_unlock(&inline_lock);
+    return rc;
+  }
+  if (rc != DB_WRITER_QUEUED)
+    return -1;
+
+  pthread_mutex_lock(&wait.lock);
+  while (!wait.finished)
+    pthread_cond_wait(&wait.cond, &wait.lock);
+  pthread_mutex_unlock(&wait.lock);
+  return wait.status == 0 ? wait.result.rows_written : -1;
+}
+
+void db_writer_get_stats(db_writer_stats_t *stats) {
+  pthread_mutex_lock(&writer.lock);
+  stats->running = writer.running && !writer.stopping;
+  stats->flush_ms = writer.flush_ms;
+  stats->max_batch_rows = writer.max_batch_rows;
+  stats->max_queue = writer.max_queue;
+  stats->queue_depth = writer.depth;
+  stats->queued = writer.queued;
+  stats->dropped = writer.dropped;
+  stats->failed = writer.failed;
+  stats->commits = writer.commits;
+  stats->committed_ops = writer.committed_ops;
+  stats->committed_rows = writer.committed_rows;
+  stats->last_commit_ms = writer.last_commit_ms;
+  stats->max_commit_ms = writer.max_commit_ms;
+  stats->avg_commit_ms =
+      writer.commits ? writer.total_commit_ms / writer.commits : 0.0;
+  pthread_mutex_unlock(&writer.lock);
+}
@@ -0,0 +1,85 @@
+#ifndef DB_WRITER_H
+#define DB_WRITER_H
+
+#include "database.h"
+
+// Group commit: a batch is committed once it holds DB_WRITER_MAX_BATCH_ROWS
+// rows or its oldest write has waited DB_WRITER_FLUSH_MS
+#define DB_WRITER_FLUSH_MS 200
+#define DB_WRITER_MAX_BATCH_ROWS 256
+#define DB_WRITER_MAX_QUEUE 128
+
+// Submission results
+#define DB_WRITER_QUEUED 0
+#define DB_WRITER_INLINE 1   // Writer not running: caller writes directly
+#define DB_WRITER_DROPPED -1 // Queue full or out of memory
+
+// Called on the writer thread once a queued snapshot is committed or has
+// failed (status -1)
+typedef void (*db_write_done_fn)(int status, const db_save_result_t *result,
+                                 void *arg);
+
+typedef struct {
+  int running;
+  int flush_ms;
+  int max_batch_rows;
+  int max_queue;
+  int queue_depth;
+  unsigned long queued;
+  unsigned long dropped;
+  unsigned long failed;
+  unsigned long commits;
+  unsigned long committed_ops;
+  unsigned long committed_rows;
+  double last_commit_ms;
+  double max_commit_ms;
+  double avg_commit_ms;
+} db_writer_stats_t;
+
+// Lifecycle. db_init() must have run; the writer opens its own connection.
+// Stop commits whatever is still queued.
+int db_writer_start(int flush_ms, int max_batch_rows, int max_queue);
+void db_writer_stop(void);
+int db_writer_running(void);
+
+// Queue a write. Strings are copied.
+int db_writer_log_event(const char *event_type, const char *description,
+                        const char *data);
+int db_writer_set_config(const char *key, const char *value);
+
+// Queue network_status rows; they are copied and written as one op
+int db_writer_save_network_status(const db_network_status_t *rows,
+                                  int count);
+
+// Queue a snapshot. The writer takes ownership of processes and frees it.
+int db_writer_save_snapshot(const system_snapshot_t *snapshot,
+                            process_record_t *processes, int count,
+                            db_write_done_fn done, void *arg);
+
+// Queue a retention run. Each batch runs one db_retention_step() and the
+// op requeues itself until nothing expired is left; done (which may be
+// NULL) then gets the rows deleted in result->rows_written.
+int db_writer_retention(const db_retention_t *policy, db_write_done_fn done,
+                        void *arg);
+
+// Queue a retention run and block until its last step is committed. Must
+// not be called from the event loop. When the writer is not running the
+// caller runs db_retention_run() instead, one caller at a time. Returns the
+// rows deleted, or -1.
+int db_writer_retention_wait(const db_retention_t *policy);
+
+// Queue a checkpoint of the hybrid RAM/flash mode. Each batch copies one
+// db_persist_step() outside the batch's transaction, and the op requeues
+// itself until the copy is in place.
+int db_writer_checkpoint(db_write_done_fn done, void *arg);
+
+// Queue a snapshot and block until it is committed. Must not be called from
+// the event loop. When the writer is not running the caller writes it
+// instead, one caller at a time. Returns the snapshot id, or -1.
+int db_writer_save_snapshot_wait(const system_snapshot_t *snapshot,
+                                 process_record_t *processes, int count,
+                                 db_save_result_t *result);
+
+void db_writer_get_stats(db_writer_stats_t *stats);
+
+#endif // DB_WRITER_H
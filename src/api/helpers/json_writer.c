@@ -0,0 +1,301 @@
+#include "json_writer.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define JSON_MIN_CAPACITY 256
+
+// Make room for n more bytes plus a terminating NUL. Capacity doubles so
+// that building a response of n bytes costs O(n) overall.
+static int reserve(json_writer_t *w, size_t n) {
+  struct mg_iobuf *io = w->out;
+  size_t needed = io->len + n + 1;
+  if (w->failed)
+    return 0;
+  if (needed <= io->size)
+    return 1;
+
+  size_t capacity = io->size * 2;
+  if (capacity < JSON_MIN_CAPACITY)
+    capacity = JSON_MIN_CAPACITY;
+  if (capacity < needed)
+    capacity = needed;
+
+  if (!mg_iobuf_resize(io, capacity) || io->size < needed) {
+    w->failed = 1;
+    return 0;
+  }
+  return 1;
+}
+
+static void append(json_writer_t *w, const char *s, size_t len) {
+  if (!reserve(w, len))
+    return;
+  memcpy(w->out->buf + w->out->len, s, len);
+  w->out->len += len;
+}
+
+static void append_char(json_writer_t *w, char ch) {
+  if (!reserve(w, 1))
+    return;
+  w->out->buf[w->out->len++] = (unsigned char)ch;
+}
+
+// Emit the separator owed before a new value
+static void begin_value(json_writer_t *w) {
+  if (w->after_key) {
+    w->after_key = 0;
+    return;
+  }
+  if (w->depth > 0) {
+    if (w->has_items[w->depth - 1])
+      append_char(w, ',');
+    w->has_items[w->depth - 1] = 1;
+  }
+}
+
+static void write_escaped(json_writer_t *w, const char *s, size_t len) {
+  static const char hex[] = "0123456789abcdef";
+  size_t run = 0; // Start of the pending unescaped run
+
+  append_char(w, '"');
+  for (size_t i = 0; i < len; i++) {
+    unsigned char ch = (unsigned char)s[i];
+    const char *esc = NULL;
+    char ubuf[6];
+
+    switch (ch) {
+    case '"':
+      esc = "\\\"";
+      break;
+    case '\\':
+      esc = "\\\\";
+      break;
+    case '\n':
+      esc = "\\n";
+      break;
+    case '\r':
+      esc = "\\r";
+      break;
+    case '\t':
+      esc = "\\t";
+      break;
+    default:
+      if (ch >= 0x20)
+        continue;
+      ubuf[0] = '\\';
+      ubuf[1] = 'u';
+      ubuf[2] = '0';
+      ubuf[3] = '0';
+      ubuf[4] = hex[ch >> 4];
+      ubuf[5] = hex[ch & 0xf];
+      break;
+    }
+
+    append(w, s + run, i - run);
+    if (esc)
+      append(w, esc, 2);
+    else
+      append(w, ubuf, 6);
+    run = i + 1;
+  }
+  append(w, s + run, len - run);
+  append_char(w, '"');
+}
+
+// Write digits of v right-aligned into the end of buf, return start
+static char *format_uint(char *end, unsigned long long v) {
+  char *p = end;
+  do {
+    *--p = (char)('0' + v % 10);
+    v /= 10;
+  } while (v > 0);
+  return p;
+}
+
+void json_writer_init(json_writer_t *w) {
+  memset(w, 0, sizeof(*w));
+  w->out = &w->own;
+}
+
+void json_writer_init_iobuf(json_writer_t *w, struct mg_iobuf *io) {
+  memset(w, 0, sizeof(*w));
+  w->out = io;
+}
+
+void json_writer_free(json_writer_t *w) { mg_iobuf_free(&w->own); }
+
+const char *json_writer_str(json_writer_t *w) {
+  if (!reserve(w, 0))
+    return NULL;
+  w->out->buf[w->out->len] = '\0';
+  return (const char *)w->out->buf;
+}
+
+size_t json_writer_len(const json_writer_t *w) { return w->out->len; }
+
+// Hand the owned buffer to the caller, release with free_json_string()
+char *json_writer_detach(json_writer_t *w) {
+  if (w->out != &w->own || json_writer_str(w) == NULL) {
+    json_writer_free(w);
+    return NULL;
+  }
+  char *result = (char *)w->own.buf;
+  memset(&w->own, 0, sizeof(w->own));
+  return result;
+}
+
+void json_object_begin(json_writer_t *w) {
+  begin_value(w);
+  append_char(w, '{');
+  if (w->depth < JSON_MAX_DEPTH)
+    w->has_items[w->depth++] = 0;
+  else
+    w->failed = 1;
+}
+
+void json_object_end(json_writer_t *w) {
+  if (w->depth > 0)
+    w->depth--;
+  append_char(w, '}');
+}
+
+void json_array_begin(json_writer_t *w) {
+  begin_value(w);
+  append_char(w, '[');
+  if (w->depth < JSON_MAX_DEPTH)
+    w->has_items[w->depth++] = 0;
+  else
+    w->failed = 1;
+}
+
+void json_array_end(json_writer_t *w) {
+  if (w->depth > 0)
+    w->depth--;
+  append_char(w, ']');
+}
+
+void json_key(json_writer_t *w, const char *key) {
+  begin_value(w);
+  write_escaped(w, key, strlen(key));
+  append_char(w, ':');
+  w->after_key = 1;
+}
+
+void json_string(json_writer_t *w, const char *s) {
+  if (!s) {
+    json_null(w);
+    return;
+  }
+  json_string_n(w, s, strlen(s));
+}
+
+void json_string_n(json_writer_t *w, const char *s, size_t len) {
+  begin_value(w);
+  write_escaped(w, s, len);
+}
+
+void json_int(json_writer_t *w, long long value) {
+  char buf[24];
+  char *end = buf + sizeof(buf);
+  unsigned long long magnitude =
+      value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+  char *p = format_uint(end, magnitude);
+  if (value < 0)
+    *--p = '-';
+  begin_value(w);
+  append(w, p, end - p);
+}
+
+void json_uint(json_writer_t *w, unsigned long long value) {
+  char buf[24];
+  char *end = buf + sizeof(buf);
+  char *p = format_uint(end, value);
+  begin_value(w);
+  append(w, p, end - p);
+}
+
+// Fixed-point formatting equivalent to "%.*f" for the magnitudes we report.
+// Non-finite values become null, since JSON has no representation for them.
+void json_double(json_writer_t *w, double value, int decimals) {
+  static const double scales[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+  if (value != value || value > 1e15 || value < -1e15) {
+    json_null(w);
+    return;
+  }
+  if (decimals < 0)
+    decimals = 0;
+  if (decimals > 6)
+    decimals = 6;
+
+  int negative = value < 0;
+  double scaled = (negative ? -value : value) * scales[decimals] + 0.5;
+  unsigned long long fixed = (unsigned long long)scaled;
+  unsigned long long whole = fixed / (unsigned long long)scales[decimals];
+  unsigned long long frac = fixed % (unsigned long long)scales[decimals];
+
+  char buf[48];
+  char *end = buf + sizeof(buf);
+  char *p = end;
+  if (decimals > 0) {
+    for (int i = 0; i < decimals; i++) {
+      *--p = (char)('0' + frac % 10);
+      frac /= 10;
+    }
+    *--p = '.';
+  }
+  p = format_uint(p, whole);
+  if (negative && fixed > 0)
+    *--p = '-';
+
+  begin_value(w);
+  append(w, p, end - p);
+}
+
+void json_bool(json_writer_t *w, int value) {
+  begin_value(w);
+  if (value)
+    append(w, "true", 4);
+  else
+    append(w, "false", 5);
+}
+
+void json_null(json_writer_t *w) {
+  begin_value(w);
+  append(w, "null", 4);
+}
+
+void json_raw(json_writer_t *w, const char *json) {
+  begin_value(w);
+  append(w, json, strlen(json));
+}
+
+void json_kv_string(json_writer_t *w, const char *key, const char *value) {
+  json_key(w, key);
+  json_string(w, value);
+}
+
+void json_kv_int(json_writer_t *w, const char *key, long long value) {
+  json_key(w, key);
+  json_int(w, value);
+}
+
+void json_kv_uint(json_writer_t *w, const char *key, unsigned long long value) {
+  json_key(w, key);
+  json_uint(w, value);
+}
+
+void json_kv_double(json_writer_t *w, const char *key, double value,
+                    int decimals) {
+  json_key(w, key);
+  json_double(w, value, decimals);
+}
+
+void json_kv_bool(json_writer_t *w, const char *key, int value) {
+  json_key(w, key);
+  json_bool(w, value);
+}
+
+void json_kv_raw(json_writer_t *w, const char *key, const char *json) {
+  json_key(w, key);
+  json_raw(w, json);
+}
@@ -0,0 +1,60 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include "../../mongoose/mongoose.h"
+
+// Maximum nesting of objects/arrays
+#define JSON_MAX_DEPTH 32
+
+// Append-only JSON writer. Output goes either to a buffer owned by the
+// writer or straight into an existing mg_iobuf such as c->send. Commas
+// between members are inserted automatically.
+typedef struct {
+  struct mg_iobuf *out; // Buffer being appended to
+  struct mg_iobuf own;  // Backing store for json_writer_init()
+  int depth;
+  unsigned char has_items[JSON_MAX_DEPTH];
+  int after_key;
+  int failed; // Allocation failed, output is incomplete
+
+  // Streaming reply bookkeeping, see json_reply_begin()
+  struct mg_connection *conn;
+  size_t reply_start;
+  size_t body_start;
+} json_writer_t;
+
+// Lifecycle
+void json_writer_init(json_writer_t *w);
+void json_writer_init_iobuf(json_writer_t *w, struct mg_iobuf *io);
+void json_writer_free(json_writer_t *w);
+const char *json_writer_str(json_writer_t *w);
+size_t json_writer_len(const json_writer_t *w);
+char *json_writer_detach(json_writer_t *w);
+
+// Structure
+void json_object_begin(json_writer_t *w);
+void json_object_end(json_writer_t *w);
+void json_array_begin(json_writer_t *w);
+void json_array_end(json_writer_t *w);
+void json_key(json_writer_t *w, const char *key);
+
+// Values
+void json_string(json_writer_t *w, const char *s);
+void json_string_n(json_writer_t *w, const char *s, size_t len);
+void json_int(json_writer_t *w, long long value);
+void json_uint(json_writer_t *w, unsigned long long value);
+void json_double(json_writer_t *w, double value, int decimals);
+void json_bool(json_writer_t *w, int value);
+void json_null(json_writer_t *w);
+void json_raw(json_writer_t *w, const char *json);
+
+// Key/value shorthands for object members
+void json_kv_string(json_writer_t *w, const char *key, const char *value);
+void json_kv_int(json_writer_t *w, const char *key, long long value);
+void json_kv_uint(json_writer_t *w, const char *key, unsigned long long value);
+void json_kv_double(json_writer_t *w, const char *key, double value,
+                    int decimals);
+void json_kv_bool(json_writer_t *w, const char *key, int value);
+void json_kv_raw(json_writer_t *w, const char *key, const char *json);
+
+#endif // JSON_WRITER_H
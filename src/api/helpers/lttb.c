@@ -0,0 +1,139 @@
+#include "lttb.h"
+#include <stdlib.h>
+#include <string.h>
+
+void lttb_init(lttb_t *lttb, int points, double x_end, size_t row_size,
+               lttb_emit_fn emit, void *arg) {
+  memset(lttb, 0, sizeof(*lttb));
+  if (points < LTTB_MIN_POINTS)
+    points = LTTB_MIN_POINTS;
+  lttb->buckets = points - 2;
+  lttb->last_bucket = points - 3;
+  lttb->x_end = x_end;
+  lttb->row_size = row_size;
+  lttb->emit = emit;
+  lttb->arg = arg;
+}
+
+static int bucket_add(lttb_bucket_t *bucket, size_t row_size, double x,
+                      double y, const void *row) {
+  if (bucket->count == bucket->capacity) {
+    int capacity = bucket->capacity ? bucket->capacity * 2 : 16;
+    double *xs = realloc(bucket->x, capacity * sizeof(double));
+    if (xs)
+      bucket->x = xs;
+    double *ys = realloc(bucket->y, capacity * sizeof(double));
+    if (ys)
+      bucket->y = ys;
+    unsigned char *rows = realloc(bucket->rows, capacity * row_size);
+    if (rows)
+      bucket->rows = rows;
+    if (!xs || !ys || !rows)
+      return -1;
+    bucket->capacity = capacity;
+  }
+
+  bucket->x[bucket->count] = x;
+  bucket->y[bucket->count] = y;
+  memcpy(bucket->rows + bucket->count * row_size, row, row_size);
+  bucket->count++;
+  bucket->sum_x += x;
+  bucket->sum_y += y;
+  return 0;
+}
+
+// Keep the row of the bucket that spans the largest triangle with the last
+// kept point and (next_x, next_y)
+static void bucket_select(lttb_t *lttb, lttb_bucket_t *bucket, double next_x,
+                          double next_y) {
+  int best = 0;
+  double best_area = -1.0;
+  for (int i = 0; i < bucket->count; i++) {
+    double area = (lttb->prev_x - next_x) * (bucket->y[i] - lttb->prev_y) -
+                  (lttb->prev_x - bucket->x[i]) * (next_y - lttb->prev_y);
+    if (area < 0)
+      area = -area;
+    if (area > best_area) {
+      best_area = area;
+      best = i;
+    }
+  }
+
+  lttb->prev_x = bucket->x[best];
+  lttb->prev_y = bucket->y[best];
+  lttb->emit(bucket->rows + best * lttb->row_size, lttb->arg);
+  bucket->count = 0;
+  bucket->sum_x = bucket->sum_y = 0;
+}
+
+int lttb_push(lttb_t *lttb, double x, double y, const void *row) {
+  if (!lttb->have_first) {
+    // Buckets cover what the series actually spans, not the whole window
+    lttb->have_first = 1;
+    lttb->x_start = x;
+    lttb->bucket_width = (lttb->x_end - x) / lttb->buckets;
+    lttb->prev_x = x;
+    lttb->prev_y = y;
+    lttb->emit(row, lttb->arg);
+    return 0;
+  }
+
+  long index = 0;
+  if (lttb->bucket_width > 0 && x > lttb->x_start)
+    index = (long)((x - lttb->x_start) / lttb->bucket_width);
+  if (index > lttb->last_bucket)
+    index = lttb->last_bucket;
+
+  lttb_bucket_t *current = &lttb->current;
+  if (current->count > 0 && index != current->index) {
+    // The current bucket is complete, which decides the pending one
+    if (lttb->pending.count > 0)
+      bucket_select(lttb, &lttb->pending, current->sum_x / current->count,
+                    current->sum_y / current->count);
+    lttb_bucket_t done = lttb->pending;
+    lttb->pending = *current;
+    *current = done;
+  }
+  if (current->count == 0)
+    current->index = index;
+  return bucket_add(current, lttb->row_size, x, y, row);
+}
+
+void lttb_finish(lttb_t *lttb) {
+  lttb_bucket_t *pending = &lttb->pending;
+  lttb_bucket_t *current = &lttb->current;
+
+  // The newest row is always kept, so it closes the series instead of
+  // competing in its bucket
+  if (current->count > 0) {
+    int last = --current->count;
+    double last_x = current->x[last];
+    double last_y = current->y[last];
+    current->sum_x -= last_x;
+    current->sum_y -= last_y;
+
+    if (pending->count > 0) {
+      if (current->count > 0)
+        bucket_select(lttb, pending, current->sum_x / current->count,
+                      current->sum_y / current->count);
+      else
+        bucket_select(lttb, pending, last_x, last_y);
+    }
+    if (current->count > 0)
+      bucket_select(lttb, current, last_x, last_y);
+    lttb->emit(current->rows + last * lttb->row_size, lttb->arg);
+  }
+  lttb_free(lttb);
+}
+
+static void bucket_free(lttb_bucket_t *bucket) {
+  free(bucket->x);
+  free(bucket->y);
+  free(bucket->rows);
+  memset(bucket, 0, sizeof(*bucket));
+}
+
+void lttb_free(lttb_t *lttb) {
+  bucket_free(&lttb->pending);
+  bucket_free(&lttb->current);
+}
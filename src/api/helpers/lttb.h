@@ -0,0 +1,59 @@
+#ifndef LTTB_H
+#define LTTB_H
+
+#include <stddef.h>
+
+// Fewest points a downsampled series can have: the first, the last and one
+// bucket in between
+#define LTTB_MIN_POINTS 3
+
+// Receives each point that is kept, in order
+typedef void (*lttb_emit_fn)(const void *row, void *arg);
+
+// A bucket of rows: their x and y for the area test, and the caller's row
+// so the kept one can be passed on unchanged
+typedef struct {
+  long index;
+  int count;
+  int capacity;
+  double sum_x;
+  double sum_y;
+  double *x;
+  double *y;
+  unsigned char *rows;
+} lttb_bucket_t;
+
+// Largest-Triangle-Three-Buckets over a stream sorted by x. The range from
+// the first row to x_end is cut into points - 2 buckets of equal width and
+// one row is kept per bucket, plus the first and last rows. A bucket is
+// decided once the next one is complete, so only two buckets are held at a
+// time.
+typedef struct {
+  int buckets;
+  double x_start;
+  double x_end;
+  double bucket_width;
+  long last_bucket;
+  size_t row_size;
+  lttb_emit_fn emit;
+  void *arg;
+  int have_first;
+  double prev_x; // Last kept point
+  double prev_y;
+  lttb_bucket_t pending; // Waiting for the next bucket to complete
+  lttb_bucket_t current;
+} lttb_t;
+
+void lttb_init(lttb_t *lttb, int points, double x_end, size_t row_size,
+               lttb_emit_fn emit, void *arg);
+
+// Feed one row; row_size bytes are copied. Returns -1 when out of memory.
+int lttb_push(lttb_t *lttb, double x, double y, const void *row);
+
+// Emit the remaining points and free the buckets
+void lttb_finish(lttb_t *lttb);
+
+// Free the buckets without emitting anything
+void lttb_free(lttb_t *lttb);
+
+#endif // LTTB_H
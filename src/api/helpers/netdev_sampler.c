@@ -0,0 +1,316 @@
+#include "netdev_sampler.h"
+#include "database.h"
+#include "netlink.h"
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Two header lines and a line of up to ~200 bytes per interface
+#define NETDEV_BUF_SIZE 8192
+
+// Counters of one /proc/net/dev line, in column order
+enum {
+  RX_BYTES,
+  RX_PACKETS,
+  RX_ERRS,
+  RX_DROP,
+  RX_FIFO,
+  RX_FRAME,
+  RX_COMPRESSED,
+  RX_MULTICAST,
+  TX_BYTES,
+  TX_PACKETS,
+  TX_ERRS,
+  TX_DROP,
+  TX_FIFO,
+  TX_COLLS,
+  TX_CARRIER,
+  TX_COMPRESSED,
+  NETDEV_FIELDS
+};
+
+typedef struct {
+  netdev_stats_t stats;
+  unsigned long long raw[NETDEV_FIELDS]; // As last read, for the deltas
+} netdev_entry_t;
+
+static struct {
+  struct mg_timer *timer;
+  int fd;
+  int interval_ms;
+  int history_interval_s;
+  uint64_t last_read_ms;
+  uint64_t last_history_ms;
+  time_t updated;
+  netdev_entry_t entries[NETDEV_MAX_INTERFACES];
+  int count;
+} netdev = {.fd = -1, .interval_ms = NETDEV_SAMPLE_INTERVAL_MS};
+
+// Parse the counters after "name:", return the line end
+static const char *parse_counters(const char *p, unsigned long long *out) {
+  memset(out, 0, NETDEV_FIELDS * sizeof(*out));
+  for (int i = 0; i < NETDEV_FIELDS; i++) {
+    while (*p == ' ')
+      p++;
+    if (*p < '0' || *p > '9')
+      break;
+    while (*p >= '0' && *p <= '9')
+      out[i] = out[i] * 10 + (unsigned long long)(*p++ - '0');
+  }
+  while (*p && *p != '\n')
+    p++;
+  return p;
+}
+
+// Growth of a counter since the last read. A counter that went down either
+// wrapped at 32 bits (old kernels and some drivers) or restarted with the
+// interface; only one that was in the top half of the 32-bit range is
+// taken to have wrapped.
+static unsigned long long counter_delta(unsigned long long now,
+                                        unsigned long long prev, int *wrapped) {
+  if (now >= prev)
+    return now - prev;
+  if (prev <= 0xffffffffULL && prev > 0x7fffffffULL) {
+    (*wrapped)++;
+    return now + 0x100000000ULL - prev;
+  }
+  return now;
+}
+
+// Move the smoothed rate towards this interval's rate by the share of the
+// time constant that elapsed, so a late timer does not skew it
+static double ewma(double rate, double sample, double alpha) {
+  return rate + alpha * (sample - rate);
+}
+
+static void update_entry(netdev_entry_t *entry,
+                         const unsigned long long *raw, double seconds,
+                         int have_prev) {
+  netdev_stats_t *s = &entry->stats;
+  unsigned long long delta[NETDEV_FIELDS];
+  int wrapped = 0;
+  for (int i = 0; i < NETDEV_FIELDS; i++)
+    delta[i] = have_prev ? counter_delta(raw[i], entry->raw[i], &wrapped)
+                         : raw[i];
+  memcpy(entry->raw, raw, sizeof(entry->raw));
+
+  s->rx_bytes += delta[RX_BYTES];
+  s->tx_bytes += delta[TX_BYTES];
+  s->rx_packets += delta[RX_PACKETS];
+  s->tx_packets += delta[TX_PACKETS];
+  s->rx_errors += delta[RX_ERRS];
+  s->tx_errors += delta[TX_ERRS];
+  s->rx_dropped += delta[RX_DROP];
+  s->tx_dropped += delta[TX_DROP];
+  s->wraps += wrapped;
+  if (!have_prev || seconds <= 0)
+    return;
+
+  double rx_bytes = (double)delta[RX_BYTES] / seconds;
+  double tx_bytes = (double)delta[TX_BYTES] / seconds;
+  double rx_packets = (double)delta[RX_PACKETS] / seconds;
+  double tx_packets = (double)delta[TX_PACKETS] / seconds;
+  s->rx_bytes_per_s_last = rx_bytes;
+  s->tx_bytes_per_s_last = tx_bytes;
+
+  if (!s->have_rates) {
+    // The first interval seeds the average instead of ramping up from 0
+    s->rx_bytes_per_s = rx_bytes;
+    s->tx_bytes_per_s = tx_bytes;
+    s->rx_packets_per_s = rx_packets;
+    s->tx_packets_per_s = tx_packets;
+    s->have_rates = 1;
+    return;
+  }
+  double alpha = 1.0 - exp(-seconds * 1000.0 / NETDEV_EWMA_TAU_MS);
+  s->rx_bytes_per_s = ewma(s->rx_bytes_per_s, rx_bytes, alpha);
+  s->tx_bytes_per_s = ewma(s->tx_bytes_per_s, tx_bytes, alpha);
+  s->rx_packets_per_s = ewma(s->rx_packets_per_s, rx_packets, alpha);
+  s->tx_packets_per_s = ewma(s->tx_packets_per_s, tx_packets, alpha);
+}
+
+// Rows for network_status and the link index of each, which is how
+// addresses refer to their interface
+typedef struct {
+  db_network_status_t rows[NETDEV_MAX_INTERFACES];
+  int index[NETDEV_MAX_INTERFACES];
+  int count;
+} history_t;
+
+// /proc/net/dev has no index, so links are matched by name
+static int history_link(const netlink_link_t *link, void *ctx) {
+  history_t *h = ctx;
+  for (int i = 0; i < h->count; i++) {
+    if (strcmp(h->rows[i].interface, link->name) == 0) {
+      snprintf(h->rows[i].status, sizeof(h->rows[i].status), "%s",
+               netlink_operstate_name(link->operstate));
+      h->index[i] = link->index;
+    }
+  }
+  return 0;
+}
+
+// The first IPv4 address of each link is recorded
+static int history_addr(const netlink_addr_t *addr, void *ctx) {
+  history_t *h = ctx;
+  for (int i = 0; i < h->count; i++) {
+    db_network_status_t *row = &h->rows[i];
+    if (h->index[i] == addr->index && !row->ip_address[0])
+      snprintf(row->ip_address, sizeof(row->ip_address), "%s",
+               addr->address);
+  }
+  return 0;
+}
+
+// Queue the current counters, with each link's state and address
+static void save_history(void) {
+  history_t h;
+  memset(&h, 0, sizeof(h));
+  h.count = netdev.count;
+  for (int i = 0; i < netdev.count; i++) {
+    const netdev_stats_t *s = &netdev.entries[i].stats;
+    db_network_status_t *row = &h.rows[i];
+    row->timestamp = netdev.updated;
+    snprintf(row->interface, sizeof(row->interface), "%s", s->name);
+    snprintf(row->status, sizeof(row->status), "unknown");
+    row->rx_bytes = (long long)s->rx_bytes;
+    row->tx_bytes = (long long)s->tx_bytes;
+  }
+  if (h.count == 0)
+    return;
+
+  netlink_links(history_link, &h);
+  netlink_addrs(AF_INET, history_addr, &h);
+  if (db_save_network_status(h.rows, h.count) != 0)
+    fprintf(stderr, "Network sampler: history write dropped\n");
+}
+
+// Read /proc/net/dev once and update every interface against its last read
+static void netdev_sample(void *arg) {
+  (void)arg;
+  char buf[NETDEV_BUF_SIZE];
+
+  ssize_t len = pread(netdev.fd, buf, sizeof(buf) - 1, 0);
+  if (len <= 0)
+    return;
+  buf[len] = '\0';
+
+  uint64_t now = mg_millis();
+  double seconds = netdev.last_read_ms
+                       ? (double)(now - netdev.last_read_ms) / 1000.0
+                       : 0.0;
+  netdev.last_read_ms = now;
+  netdev.updated = time(NULL);
+
+  // Interfaces are rebuilt in file order; ones that went away are dropped
+  // and new ones start from their current counters
+  netdev_entry_t entries[NETDEV_MAX_INTERFACES];
+  int count = 0;
+  const char *p = buf;
+  for (int line = 0; *p && count < NETDEV_MAX_INTERFACES; line++) {
+    const char *eol = strchr(p, '\n');
+    if (!eol)
+      break; // Only whole lines count
+    const char *colon = memchr(p, ':', (size_t)(eol - p));
+    if (line >= 2 && colon) {
+      const char *name = p;
+      while (*name == ' ')
+        name++;
+      size_t name_len = (size_t)(colon - name);
+      if (name_len > 0 && name_len < sizeof(entries[0].stats.name)) {
+        unsigned long long raw[NETDEV_FIELDS];
+        parse_counters(colon + 1, raw);
+
+        netdev_entry_t *entry = &entries[count++];
+        const netdev_entry_t *prev = NULL;
+        for (int i = 0; i < netdev.count; i++) {
+          if (strncmp(netdev.entries[i].stats.name, name, name_len) == 0 &&
+              netdev.entries[i].stats.name[name_len] == '\0')
+            prev = &netdev.entries[i];
+        }
+        if (prev) {
+          *entry = *prev;
+        } else {
+          memset(entry, 0, sizeof(*entry));
+          memcpy(entry->stats.name, name, name_len);
+        }
+        update_entry(entry, raw, seconds, prev != NULL);
+      }
+    }
+    p = eol + 1;
+  }
+  memcpy(netdev.entries, entries, count * sizeof(netdev_entry_t));
+  netdev.count = count;
+
+  if (netdev.history_interval_s > 0 &&
+      now - netdev.last_history_ms >=
+          (uint64_t)netdev.history_interval_s * 1000) {
+    netdev.last_history_ms = now;
+    save_history();
+  }
+}
+
+int netdev_sampler_start(struct mg_mgr *mgr, int interval_ms,
+                         int history_interval_s) {
+  if (netdev.timer)
+    return 0;
+
+  netdev.fd = open("/proc/net/dev", O_RDONLY | O_CLOEXEC);
+  if (netdev.fd < 0) {
+    fprintf(stderr, "Network sampler: cannot open /proc/net/dev\n");
+    return -1;
+  }
+
+  if (interval_ms < 100)
+    interval_ms = 100;
+  netdev.interval_ms = interval_ms;
+  netdev.history_interval_s = history_interval_s > 0 ? history_interval_s : 0;
+  // The first history row waits for a full period of rates
+  netdev.last_history_ms = mg_millis();
+  netdev.timer = mg_timer_add(mgr, (uint64_t)interval_ms,
+                              MG_TIMER_REPEAT | MG_TIMER_RUN_NOW,
+                              netdev_sample, NULL);
+  if (!netdev.timer) {
+    close(netdev.fd);
+    netdev.fd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+// The timer itself is released by mg_mgr_free()
+void netdev_sampler_stop(void) {
+  if (netdev.fd >= 0)
+    close(netdev.fd);
+  netdev.fd = -1;
+  netdev.timer = NULL;
+  netdev.count = 0;
+  netdev.last_read_ms = 0;
+  netdev.updated = 0;
+}
+
+int netdev_sampler_interval_ms(void) { return netdev.interval_ms; }
+
+int netdev_sampler_history_interval_s(void) {
+  return netdev.history_interval_s;
+}
+
+int netdev_sampler_count(void) { return netdev.count; }
+
+const netdev_stats_t *netdev_sampler_get(int index) {
+  if (index < 0 || index >= netdev.count)
+    return NULL;
+  return &netdev.entries[index].stats;
+}
+
+const netdev_stats_t *netdev_sampler_find(const char *name) {
+  for (int i = 0; i < netdev.count; i++) {
+    if (strcmp(netdev.entries[i].stats.name, name) == 0)
+      return &netdev.entries[i].stats;
+  }
+  return NULL;
+}
+
+time_t netdev_sampler_updated(void) { return netdev.updated; }
@@ -0,0 +1,60 @@
+#ifndef NETDEV_SAMPLER_H
+#define NETDEV_SAMPLER_H
+
+#include "../../mongoose/mongoose.h"
+#include <time.h>
+
+// Sampling period of /proc/net/dev
+#define NETDEV_SAMPLE_INTERVAL_MS 1000
+
+// Time constant of the smoothed rates: a step in traffic shows up as 63%
+// of its size after this long
+#define NETDEV_EWMA_TAU_MS 5000
+
+// How often every interface's counters are written to network_status
+#define NETDEV_HISTORY_INTERVAL_S 60
+
+// Interfaces beyond this are ignored
+#define NETDEV_MAX_INTERFACES 32
+
+// Counters of one interface. Totals are 64-bit and keep counting across
+// a 32-bit counter wrapping; rates are per second.
+typedef struct {
+  char name[16];
+  unsigned long long rx_bytes;
+  unsigned long long tx_bytes;
+  unsigned long long rx_packets;
+  unsigned long long tx_packets;
+  unsigned long long rx_errors;
+  unsigned long long tx_errors;
+  unsigned long long rx_dropped;
+  unsigned long long tx_dropped;
+  int have_rates; // Rates need two reads
+  double rx_bytes_per_s; // Smoothed
+  double tx_bytes_per_s;
+  double rx_packets_per_s;
+  double tx_packets_per_s;
+  double rx_bytes_per_s_last; // Over the last interval only
+  double tx_bytes_per_s_last;
+  unsigned long wraps;
+} netdev_stats_t;
+
+// The sampler runs as a timer on the event loop, so readers on the event
+// loop need no locking. With history_interval_s > 0 it also queues one
+// network_status row per interface at that period.
+int netdev_sampler_start(struct mg_mgr *mgr, int interval_ms,
+                         int history_interval_s);
+void netdev_sampler_stop(void);
+int netdev_sampler_interval_ms(void);
+int netdev_sampler_history_interval_s(void);
+
+// Interfaces in /proc/net/dev order as of the last read. Returns NULL when
+// index is out of range, or when name is not found.
+int netdev_sampler_count(void);
+const netdev_stats_t *netdev_sampler_get(int index);
+const netdev_stats_t *netdev_sampler_find(const char *name);
+
+// When the counters were last read, 0 before the first read
+time_t netdev_sampler_updated(void);
+
+#endif // NETDEV_SAMPLER_H
@@ -0,0 +1,422 @@
+#include "netlink.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Returned by a parser for a message that is not an entry of the dump
+#define NETLINK_SKIP -1
+
+// Turns one reply message into an entry and hands it to the caller's
+// callback. Returns NETLINK_SKIP, or the callback's result.
+typedef int (*netlink_parse_fn)(const struct nlmsghdr *h, void *arg);
+
+// Send a dump request and feed every reply to parse until the kernel says
+// it is done. Returns the number of entries, or -1.
+static int netlink_dump(int type, int family, netlink_parse_fn parse,
+                        void *arg) {
+  int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (fd < 0)
+    return -1;
+  struct timeval tv = {NETLINK_TIMEOUT_MS / 1000,
+                       (NETLINK_TIMEOUT_MS % 1000) * 1000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  // Every request header starts with its address family
+  struct {
+    struct nlmsghdr h;
+    union {
+      struct ifinfomsg link;
+      struct ifaddrmsg addr;
+      struct rtmsg route;
+    } body;
+  } req;
+  memset(&req, 0, sizeof(req));
+  size_t body_len;
+  switch (type) {
+  case RTM_GETLINK:
+    req.body.link.ifi_family = family;
+    body_len = sizeof(req.body.link);
+    break;
+  case RTM_GETADDR:
+    req.body.addr.ifa_family = family;
+    body_len = sizeof(req.body.addr);
+    break;
+  default:
+    req.body.route.rtm_family = family;
+    body_len = sizeof(req.body.route);
+    break;
+  }
+  req.h.nlmsg_len = NLMSG_LENGTH(body_len);
+  req.h.nlmsg_type = type;
+  req.h.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  req.h.nlmsg_seq = 1;
+
+  struct sockaddr_nl kernel = {.nl_family = AF_NETLINK};
+  char *buf = malloc(NETLINK_BUF_SIZE);
+  if (!buf || sendto(fd, &req, req.h.nlmsg_len, 0, (struct sockaddr *)&kernel,
+                     sizeof(kernel)) < 0) {
+    free(buf);
+    close(fd);
+    return -1;
+  }
+
+  int count = 0;
+  int rc = 0;
+  for (int done = 0; !done;) {
+    struct sockaddr_nl from;
+    socklen_t from_len = sizeof(from);
+    ssize_t n = recvfrom(fd, buf, NETLINK_BUF_SIZE, 0,
+                         (struct sockaddr *)&from, &from_len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      rc = -1;
+      break;
+    }
+    if (from.nl_pid != 0)
+      continue;
+
+    size_t len = (size_t)n;
+    for (const struct nlmsghdr *h = (const struct nlmsghdr *)buf;
+         NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+      if (h->nlmsg_seq != req.h.nlmsg_seq)
+        continue;
+      if (h->nlmsg_type == NLMSG_DONE) {
+        done = 1;
+        break;
+      }
+      if (h->nlmsg_type == NLMSG_ERROR) {
+        rc = -1;
+        done = 1;
+        break;
+      }
+      int result = parse(h, arg);
+      if (result == NETLINK_SKIP)
+        continue;
+      count++;
+      if (result != 0) {
+        done = 1;
+        break;
+      }
+    }
+  }
+
+  free(buf);
+  close(fd);
+  return rc == 0 ? count : -1;
+}
+
+// Attribute payloads are only 4-byte aligned, so they are copied out
+static uint32_t rta_u32(const struct rtattr *rta) {
+  uint32_t value = 0;
+  if (RTA_PAYLOAD(rta) >= sizeof(value))
+    memcpy(&value, RTA_DATA(rta), sizeof(value));
+  return value;
+}
+
+static void rta_string(const struct rtattr *rta, char *out, size_t size) {
+  size_t len = RTA_PAYLOAD(rta);
+  if (len >= size)
+    len = size - 1;
+  memcpy(out, RTA_DATA(rta), len);
+  out[len] = '\0';
+}
+
+static void rta_address(const struct rtattr *rta, int family, char *out) {
+  size_t need = family == AF_INET6 ? 16 : 4;
+  if ((family != AF_INET && family != AF_INET6) || RTA_PAYLOAD(rta) < need ||
+      !inet_ntop(family, RTA_DATA(rta), out, NETLINK_ADDR_LEN))
+    out[0] = '\0';
+}
+
+typedef struct {
+  netlink_link_fn fn;
+  void *ctx;
+} link_dump_t;
+
+static int parse_link(const struct nlmsghdr *h, void *arg) {
+  if (h->nlmsg_type != RTM_NEWLINK ||
+      h->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg)))
+    return NETLINK_SKIP;
+  const struct ifinfomsg *ifi = NLMSG_DATA(h);
+
+  netlink_link_t link;
+  memset(&link, 0, sizeof(link));
+  link.index = ifi->ifi_index;
+  link.flags = ifi->ifi_flags;
+
+  int have_stats64 = 0;
+  int len = IFLA_PAYLOAD(h);
+  for (const struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len);
+       rta = RTA_NEXT(rta, len)) {
+    switch (rta->rta_type) {
+    case IFLA_IFNAME:
+      rta_string(rta, link.name, sizeof(link.name));
+      break;
+    case IFLA_MTU:
+      link.mtu = (int)rta_u32(rta);
+      break;
+    case IFLA_OPERSTATE:
+      if (RTA_PAYLOAD(rta) >= 1)
+        link.operstate = *(const unsigned char *)RTA_DATA(rta);
+      break;
+    case IFLA_MASTER:
+      link.master = (int)rta_u32(rta);
+      break;
+    case IFLA_ADDRESS:
+      if (RTA_PAYLOAD(rta) == 6) {
+        const unsigned char *mac = RTA_DATA(rta);
+        snprintf(link.mac, sizeof(link.mac), "%02x:%02x:%02x:%02x:%02x:%02x",
+                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+      }
+      break;
+    case IFLA_STATS64:
+      if (RTA_PAYLOAD(rta) >= sizeof(struct rtnl_link_stats64)) {
+        struct rtnl_link_stats64 stats;
+        memcpy(&stats, RTA_DATA(rta), sizeof(stats));
+        link.rx_bytes = stats.rx_bytes;
+        link.tx_bytes = stats.tx_bytes;
+        link.rx_packets = stats.rx_packets;
+        link.tx_packets = stats.tx_packets;
+        link.rx_errors = stats.rx_errors;
+        link.tx_errors = stats.tx_errors;
+        have_stats64 = 1;
+      }
+      break;
+    case IFLA_STATS:
+      // Older kernels only send the 32-bit counters
+      if (!have_stats64 &&
+          RTA_PAYLOAD(rta) >= sizeof(struct rtnl_link_stats)) {
+        struct rtnl_link_stats stats;
+        memcpy(&stats, RTA_DATA(rta), sizeof(stats));
+        link.rx_bytes = stats.rx_bytes;
+        link.tx_bytes = stats.tx_bytes;
+        link.rx_packets = stats.rx_packets;
+        link.tx_packets = stats.tx_packets;
+        link.rx_errors = stats.rx_errors;
+        link.tx_errors = stats.tx_errors;
+      }
+      break;
+    }
+  }
+
+  const link_dump_t *dump = arg;
+  return dump->fn(&link, dump->ctx);
+}
+
+int netlink_links(netlink_link_fn fn, void *ctx) {
+  link_dump_t dump = {fn, ctx};
+  return netlink_dump(RTM_GETLINK, AF_UNSPEC, parse_link, &dump);
+}
+
+typedef struct {
+  netlink_addr_fn fn;
+  void *ctx;
+} addr_dump_t;
+
+static int parse_addr(const struct nlmsghdr *h, void *arg) {
+  if (h->nlmsg_type != RTM_NEWADDR ||
+      h->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifaddrmsg)))
+    return NETLINK_SKIP;
+  const struct ifaddrmsg *ifa = NLMSG_DATA(h);
+  if (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6)
+    return NETLINK_SKIP;
+
+  netlink_addr_t addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.index = (int)ifa->ifa_index;
+  addr.family = ifa->ifa_family;
+  addr.prefixlen = ifa->ifa_prefixlen;
+  addr.scope = ifa->ifa_scope;
+
+  // On point-to-point links IFA_ADDRESS is the peer and IFA_LOCAL the
+  // interface's own address
+  int have_local = 0;
+  int len = IFA_PAYLOAD(h);
+  for (const struct rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, len);
+       rta = RTA_NEXT(rta, len)) {
+    switch (rta->rta_type) {
+    case IFA_LOCAL:
+      rta_address(rta, addr.family, addr.address);
+      have_local = 1;
+      break;
+    case IFA_ADDRESS:
+      if (!have_local)
+        rta_address(rta, addr.family, addr.address);
+      break;
+    case IFA_LABEL:
+      rta_string(rta, addr.label, sizeof(addr.label));
+      break;
+    }
+  }
+
+  const addr_dump_t *dump = arg;
+  return dump->fn(&addr, dump->ctx);
+}
+
+int netlink_addrs(int family, netlink_addr_fn fn, void *ctx) {
+  addr_dump_t dump = {fn, ctx};
+  return netlink_dump(RTM_GETADDR, family, parse_addr, &dump);
+}
+
+typedef struct {
+  netlink_route_fn fn;
+  void *ctx;
+} route_dump_t;
+
+static int parse_route(const struct nlmsghdr *h, void *arg) {
+  if (h->nlmsg_type != RTM_NEWROUTE ||
+      h->nlmsg_len < NLMSG_LENGTH(sizeof(struct rtmsg)))
+    return NETLINK_SKIP;
+  const struct rtmsg *rtm = NLMSG_DATA(h);
+  if (rtm->rtm_flags & RTM_F_CLONED)
+    return NETLINK_SKIP;
+
+  netlink_route_t route;
+  memset(&route, 0, sizeof(route));
+  route.family = rtm->rtm_family;
+  route.table = rtm->rtm_table;
+  route.protocol = rtm->rtm_protocol;
+  route.scope = rtm->rtm_scope;
+  route.type = rtm->rtm_type;
+  route.dst_len = rtm->rtm_dst_len;
+
+  int len = RTM_PAYLOAD(h);
+  for (const struct rtattr *rta = RTM_RTA(rtm); RTA_OK(rta, len);
+       rta = RTA_NEXT(rta, len)) {
+    switch (rta->rta_type) {
+    case RTA_DST:
+      rta_address(rta, route.family, route.dst);
+      break;
+    case RTA_GATEWAY:
+      rta_address(rta, route.family, route.gateway);
+      break;
+    case RTA_PREFSRC:
+      rta_address(rta, route.family, route.prefsrc);
+      break;
+    case RTA_OIF:
+      route.oif = (int)rta_u32(rta);
+      break;
+    case RTA_PRIORITY:
+      route.metric = (long)rta_u32(rta);
+      break;
+    case RTA_TABLE:
+      // Tables above 255 only fit in the attribute
+      route.table = (int)rta_u32(rta);
+      break;
+    }
+  }
+
+  const route_dump_t *dump = arg;
+  return dump->fn(&route, dump->ctx);
+}
+
+int netlink_routes(int family, netlink_route_fn fn, void *ctx) {
+  route_dump_t dump = {fn, ctx};
+  return netlink_dump(RTM_GETROUTE, family, parse_route, &dump);
+}
+
+static int find_default_route(const netlink_route_t *route, void *ctx) {
+  if (route->dst_len != 0 || route->table != RT_TABLE_MAIN ||
+      route->type != RTN_UNICAST || route->gateway[0] == '\0')
+    return 0;
+  *(netlink_route_t *)ctx = *route;
+  return 1;
+}
+
+int netlink_default_route(netlink_route_t *route) {
+  memset(route, 0, sizeof(*route));
+  if (netlink_routes(AF_INET, find_default_route, route) < 0)
+    return -1;
+  return route->gateway[0] ? 0 : -1;
+}
+
+const char *netlink_operstate_name(int operstate) {
+  // RFC 2863 states, in IF_OPER_* order
+  static const char *const names[] = {
+      "unknown", "notpresent", "down", "lowerlayerdown",
+      "testing", "dormant",    "up"};
+  if (operstate < 0 || operstate >= (int)(sizeof(names) / sizeof(names[0])))
+    return "unknown";
+  return names[operstate];
+}
+
+const char *netlink_scope_name(int scope) {
+  switch (scope) {
+  case RT_SCOPE_UNIVERSE:
+    return "global";
+  case RT_SCOPE_SITE:
+    return "site";
+  case RT_SCOPE_LINK:
+    return "link";
+  case RT_SCOPE_HOST:
+    return "host";
+  case RT_SCOPE_NOWHERE:
+    return "nowhere";
+  }
+  return "unknown";
+}
+
+const char *netlink_protocol_name(int protocol) {
+  switch (protocol) {
+  case RTPROT_UNSPEC:
+    return "unspec";
+  case RTPROT_REDIRECT:
+    return "redirect";
+  case RTPROT_KERNEL:
+    return "kernel";
+  case RTPROT_BOOT:
+    return "boot";
+  case RTPROT_STATIC:
+    return "static";
+  case RTPROT_RA:
+    return "ra";
+  case RTPROT_DHCP:
+    return "dhcp";
+  }
+  return "unknown";
+}
+
+const char *netlink_route_type_name(int type) {
+  switch (type) {
+  case RTN_UNICAST:
+    return "unicast";
+  case RTN_LOCAL:
+    return "local";
+  case RTN_BROADCAST:
+    return "broadcast";
+  case RTN_ANYCAST:
+    return "anycast";
+  case RTN_MULTICAST:
+    return "multicast";
+  case RTN_BLACKHOLE:
+    return "blackhole";
+  case RTN_UNREACHABLE:
+    return "unreachable";
+  case RTN_PROHIBIT:
+    return "prohibit";
+  case RTN_THROW:
+    return "throw";
+  case RTN_NAT:
+    return "nat";
+  }
+  return "unknown";
+}
+
+const char *netlink_family_name(int family) {
+  switch (family) {
+  case AF_INET:
+    return "inet";
+  case AF_INET6:
+    return "inet6";
+  }
+  return "unknown";
+}
@@ -0,0 +1,87 @@
+#ifndef NETLINK_H
+#define NETLINK_H
+
+#include <net/if.h>
+#include <netinet/in.h>
+
+// Large enough for an IPv6 address in text form
+#define NETLINK_ADDR_LEN INET6_ADDRSTRLEN
+
+// Receive buffer for dump replies. The kernel fills batches up to the
+// largest read it has seen, capped at 32 KB, so a batch always fits.
+#define NETLINK_BUF_SIZE 32768
+
+// How long a dump may take before it is abandoned, so a stuck kernel
+// reply cannot hold the event loop
+#define NETLINK_TIMEOUT_MS 1000
+
+// One interface from RTM_GETLINK
+typedef struct {
+  int index;
+  char name[IF_NAMESIZE];
+  unsigned flags; // IFF_*
+  int mtu;
+  int operstate; // IF_OPER_*
+  int master;    // Index of the bridge or bond it belongs to, or 0
+  char mac[18];  // Empty when the link has no hardware address
+  unsigned long long rx_bytes;
+  unsigned long long tx_bytes;
+  unsigned long long rx_packets;
+  unsigned long long tx_packets;
+  unsigned long long rx_errors;
+  unsigned long long tx_errors;
+} netlink_link_t;
+
+// One address from RTM_GETADDR
+typedef struct {
+  int index;
+  int family; // AF_INET or AF_INET6
+  int prefixlen;
+  int scope; // RT_SCOPE_*
+  char address[NETLINK_ADDR_LEN];
+  char label[IF_NAMESIZE]; // IPv4 only, may be empty
+} netlink_addr_t;
+
+// One route from RTM_GETROUTE. Empty strings stand for absent attributes;
+// dst is empty for a default route.
+typedef struct {
+  int family;
+  int table;
+  int protocol; // RTPROT_*
+  int scope;
+  int type; // RTN_*
+  int dst_len;
+  int oif; // Output interface index, or 0
+  long metric;
+  char dst[NETLINK_ADDR_LEN];
+  char gateway[NETLINK_ADDR_LEN];
+  char prefsrc[NETLINK_ADDR_LEN];
+} netlink_route_t;
+
+// Return nonzero to stop the dump early
+typedef int (*netlink_link_fn)(const netlink_link_t *link, void *ctx);
+typedef int (*netlink_addr_fn)(const netlink_addr_t *addr, void *ctx);
+typedef int (*netlink_route_fn)(const netlink_route_t *route, void *ctx);
+
+// Dump the kernel's tables over a NETLINK_ROUTE socket, calling fn once per
+// entry. Each call opens its own socket, so they are safe from any thread.
+// family is AF_UNSPEC for all. Returns the number of entries visited, or
+// -1.
+int netlink_links(netlink_link_fn fn, void *ctx);
+int netlink_addrs(int family, netlink_addr_fn fn, void *ctx);
+
+// Routes cloned into the cache are skipped, as `ip route show` does
+int netlink_routes(int family, netlink_route_fn fn, void *ctx);
+
+// First IPv4 default route in the main table. Returns 0, or -1 if there is
+// none.
+int netlink_default_route(netlink_route_t *route);
+
+// Names as `ip` prints them; unknown values give "unknown"
+const char *netlink_operstate_name(int operstate);
+const char *netlink_scope_name(int scope);
+const char *netlink_protocol_name(int protocol);
+const char *netlink_route_type_name(int type);
+const char *netlink_family_name(int family);
+
+#endif // NETLINK_H
@@ -0,0 +1,982 @@
+#include "nl80211.h"
+#include <errno.h>
+#include <linux/genetlink.h>
+#include <linux/nl80211.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+// A generic netlink request with room for a few attributes
+typedef struct {
+  struct nlmsghdr h;
+  struct genlmsghdr g;
+  char attrs[64];
+} request_t;
+
+static void request_init(request_t *req, int cmd, int dump) {
+  memset(req, 0, sizeof(*req));
+  req->h.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+  req->h.nlmsg_flags = NLM_F_REQUEST | (dump ? NLM_F_DUMP : NLM_F_ACK);
+  req->g.cmd = (uint8_t)cmd;
+  req->g.version = 1;
+}
+
+static void request_put(request_t *req, int type, const void *data,
+                        size_t len) {
+  struct nlattr *a = (struct nlattr *)((char *)req + req->h.nlmsg_len);
+  a->nla_type = (uint16_t)type;
+  a->nla_len = (uint16_t)(NLA_HDRLEN + len);
+  memcpy((char *)a + NLA_HDRLEN, data, len);
+  req->h.nlmsg_len += NLA_ALIGN(a->nla_len);
+}
+
+static void request_put_u32(request_t *req, int type, uint32_t value) {
+  request_put(req, type, &value, sizeof(value));
+}
+
+// Index the attributes in data by type; types above max are ignored
+static void parse_attrs(const void *data, int len, const struct nlattr **tb,
+                        int max) {
+  memset(tb, 0, (size_t)(max + 1) * sizeof(*tb));
+  const struct nlattr *a = data;
+  while (len >= NLA_HDRLEN && a->nla_len >= NLA_HDRLEN && a->nla_len <= len) {
+    int type = a->nla_type & NLA_TYPE_MASK;
+    if (type <= max)
+      tb[type] = a;
+    len -= NLA_ALIGN(a->nla_len);
+    a = (const struct nlattr *)((const char *)a + NLA_ALIGN(a->nla_len));
+  }
+}
+
+static const void *attr_data(const struct nlattr *a) {
+  return (const char *)a + NLA_HDRLEN;
+}
+
+static int attr_len(const struct nlattr *a) { return a->nla_len - NLA_HDRLEN; }
+
+static void parse_nested(const struct nlattr *a, const struct nlattr **tb,
+                         int max) {
+  parse_attrs(attr_data(a), attr_len(a), tb, max);
+}
+
+// Payloads are only 4-byte aligned, so they are copied out
+static uint32_t attr_u32(const struct nlattr *a) {
+  uint32_t value = 0;
+  if (attr_len(a) >= (int)sizeof(value))
+    memcpy(&value, attr_data(a), sizeof(value));
+  return value;
+}
+
+static uint64_t attr_u64(const struct nlattr *a) {
+  uint64_t value = 0;
+  if (attr_len(a) >= (int)sizeof(value))
+    memcpy(&value, attr_data(a), sizeof(value));
+  return value;
+}
+
+static uint16_t attr_u16(const struct nlattr *a) {
+  uint16_t value = 0;
+  if (attr_len(a) >= (int)sizeof(value))
+    memcpy(&value, attr_data(a), sizeof(value));
+  return value;
+}
+
+static int attr_s8(const struct nlattr *a) {
+  return attr_len(a) >= 1 ? *(const int8_t *)attr_data(a) : 0;
+}
+
+static void attr_string(const struct nlattr *a, char *out, size_t size) {
+  size_t len = attr_len(a) > 0 ? (size_t)attr_len(a) : 0;
+  if (len >= size)
+    len = size - 1;
+  memcpy(out, attr_data(a), len);
+  out[len] = '\0';
+}
+
+static void attr_mac(const struct nlattr *a, char *out) {
+  if (attr_len(a) != 6) {
+    out[0] = '\0';
+    return;
+  }
+  const unsigned char *mac = attr_data(a);
+  snprintf(out, 18, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2],
+           mac[3], mac[4], mac[5]);
+}
+
+// Attributes of a generic netlink reply, or -1 if it is not a cmd reply
+static int reply_attrs(const struct nlmsghdr *h, int cmd,
+                       const struct nlattr **tb, int max) {
+  if (h->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+    return -1;
+  const struct genlmsghdr *g = NLMSG_DATA(h);
+  if (g->cmd != cmd)
+    return -1;
+  parse_attrs((const char *)g + GENL_HDRLEN,
+              (int)(h->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN)), tb, max);
+  return 0;
+}
+
+// Send req on fd and pass the replies to fn until the kernel sends DONE,
+// an ACK or an error. Returns 0, or a negative errno.
+static int genl_exchange(int fd, char *buf, struct nlmsghdr *req,
+                         nl80211_reply_fn fn, void *arg) {
+  static const struct sockaddr_nl kernel = {.nl_family = AF_NETLINK};
+  if (sendto(fd, req, req->nlmsg_len, 0, (const struct sockaddr *)&kernel,
+             sizeof(kernel)) < 0)
+    return -errno;
+
+  int rc = 0;
+  int stopped = 0;
+  for (int done = 0; !done;) {
+    struct sockaddr_nl from;
+    socklen_t from_len = sizeof(from);
+    ssize_t n = recvfrom(fd, buf, NL80211_BUF_SIZE, 0,
+                         (struct sockaddr *)&from, &from_len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return n < 0 ? -errno : -EIO;
+    if (from.nl_pid != 0)
+      continue;
+
+    size_t len = (size_t)n;
+    for (const struct nlmsghdr *h = (const struct nlmsghdr *)buf;
+         NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+      if (h->nlmsg_seq != req->nlmsg_seq)
+        continue;
+      if (h->nlmsg_type == NLMSG_DONE) {
+        done = 1;
+        break;
+      }
+      if (h->nlmsg_type == NLMSG_ERROR) {
+        // An error code of 0 is the ACK that ends a plain request
+        const struct nlmsgerr *err = NLMSG_DATA(h);
+        rc = h->nlmsg_len >= NLMSG_LENGTH(sizeof(*err)) ? err->error : -EIO;
+        done = 1;
+        break;
+      }
+      // After fn asks to stop the rest is read and dropped, so the
+      // socket is left at a message boundary
+      if (!stopped && fn(h, arg) != 0)
+        stopped = 1;
+    }
+  }
+  return rc;
+}
+
+typedef struct {
+  int family;
+  const char *group; // Multicast group to look up, or NULL
+  int group_id;
+} family_t;
+
+static int parse_family(const struct nlmsghdr *h, void *arg) {
+  family_t *family = arg;
+  const struct nlattr *tb[CTRL_ATTR_MAX + 1];
+  if (reply_attrs(h, CTRL_CMD_NEWFAMILY, tb, CTRL_ATTR_MAX) != 0)
+    return 0;
+  if (tb[CTRL_ATTR_FAMILY_ID])
+    family->family = attr_u16(tb[CTRL_ATTR_FAMILY_ID]);
+  if (!family->group || !tb[CTRL_ATTR_MCAST_GROUPS])
+    return 0;
+
+  // The groups are a nested list of (name, id) pairs
+  const struct nlattr *groups = tb[CTRL_ATTR_MCAST_GROUPS];
+  const struct nlattr *g = attr_data(groups);
+  for (int len = attr_len(groups);
+       len >= NLA_HDRLEN && g->nla_len >= NLA_HDRLEN && g->nla_len <= len;
+       len -= NLA_ALIGN(g->nla_len),
+           g = (const struct nlattr *)((const char *)g +
+                                       NLA_ALIGN(g->nla_len))) {
+    const struct nlattr *grp[CTRL_ATTR_MCAST_GRP_MAX + 1];
+    parse_nested(g, grp, CTRL_ATTR_MCAST_GRP_MAX);
+    char name[GENL_NAMSIZ];
+    if (!grp[CTRL_ATTR_MCAST_GRP_NAME] || !grp[CTRL_ATTR_MCAST_GRP_ID])
+      continue;
+    attr_string(grp[CTRL_ATTR_MCAST_GRP_NAME], name, sizeof(name));
+    if (strcmp(name, family->group) == 0)
+      family->group_id = (int)attr_u32(grp[CTRL_ATTR_MCAST_GRP_ID]);
+  }
+  return 0;
+}
+
+// Open a genetlink socket and look up the nl80211 family, joining group
+// when one is given. The family is looked up for every socket; it only
+// costs a round trip and survives cfg80211 being reloaded. Returns the
+// socket, or a negative errno.
+static int genl_open(char *buf, const char *group, int *family) {
+  int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+  if (fd < 0)
+    return -errno;
+  struct timeval tv = {NL80211_TIMEOUT_MS / 1000,
+                       (NL80211_TIMEOUT_MS % 1000) * 1000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  request_t lookup;
+  request_init(&lookup, CTRL_CMD_GETFAMILY, 0);
+  lookup.h.nlmsg_type = GENL_ID_CTRL;
+  lookup.h.nlmsg_seq = 1;
+  request_put(&lookup, CTRL_ATTR_FAMILY_NAME, NL80211_GENL_NAME,
+              sizeof(NL80211_GENL_NAME));
+  family_t found = {0, group, 0};
+  int rc = genl_exchange(fd, buf, &lookup.h, parse_family, &found);
+  if (rc == 0 && (found.family == 0 || (group && found.group_id == 0)))
+    rc = -ENOENT;
+  if (rc == 0 && group &&
+      setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &found.group_id,
+                 sizeof(found.group_id)) < 0)
+    rc = -errno;
+  if (rc != 0) {
+    close(fd);
+    return rc;
+  }
+  *family = found.family;
+  return fd;
+}
+
+// The default transport: one genetlink socket per request, so requests
+// are safe from any thread
+static int socket_exchange(void *ctx, struct nlmsghdr *req,
+                           nl80211_reply_fn fn, void *arg) {
+  (void)ctx;
+  char *buf = malloc(NL80211_BUF_SIZE);
+  if (!buf)
+    return -ENOMEM;
+  int family;
+  int fd = genl_open(buf, NULL, &family);
+  int rc = fd;
+  if (fd >= 0) {
+    req->nlmsg_type = (uint16_t)family;
+    req->nlmsg_seq = 2;
+    rc = genl_exchange(fd, buf, req, fn, arg);
+    close(fd);
+  }
+  free(buf);
+  return rc;
+}
+
+static int ignore_reply(const struct nlmsghdr *h, void *arg) {
+  (void)h;
+  (void)arg;
+  return 0;
+}
+
+static int socket_exchange_wait(void *ctx, struct nlmsghdr *req,
+                                const char *group, nl80211_reply_fn fn,
+                                void *arg, int timeout_ms) {
+  (void)ctx;
+  char *buf = malloc(NL80211_BUF_SIZE);
+  if (!buf)
+    return -ENOMEM;
+  // The group is joined before the request goes out, so an event that
+  // follows it quickly cannot be missed
+  int family;
+  int fd = genl_open(buf, group, &family);
+  if (fd < 0) {
+    free(buf);
+    return fd;
+  }
+  req->nlmsg_type = (uint16_t)family;
+  req->nlmsg_seq = 2;
+  int rc = genl_exchange(fd, buf, req, ignore_reply, NULL);
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int done = rc != 0; !done;) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long left = timeout_ms - ((now.tv_sec - start.tv_sec) * 1000 +
+                              (now.tv_nsec - start.tv_nsec) / 1000000);
+    if (left <= 0) {
+      rc = -ETIMEDOUT;
+      break;
+    }
+    struct timeval tv = {left / 1000, (left % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    struct sockaddr_nl from;
+    socklen_t from_len = sizeof(from);
+    ssize_t n = recvfrom(fd, buf, NL80211_BUF_SIZE, 0,
+                         (struct sockaddr *)&from, &from_len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      rc = n < 0 && errno != EAGAIN ? -errno : -ETIMEDOUT;
+      break;
+    }
+    if (from.nl_pid != 0)
+      continue;
+    size_t len = (size_t)n;
+    for (const struct nlmsghdr *h = (const struct nlmsghdr *)buf;
+         NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+      if (h->nlmsg_type == family && fn(h, arg) != 0) {
+        done = 1;
+        break;
+      }
+    }
+  }
+
+  close(fd);
+  free(buf);
+  return rc;
+}
+
+static struct {
+  pthread_mutex_t lock; // Guards everything below
+  nl80211_transport_t transport;
+  char dir[256]; // Of the recording or replay transport
+  int out_of_memory; // A parser could not store an entry; fails a refresh
+  struct {
+    void *items;
+    int count;
+    int capacity;
+    int valid;
+    uint64_t fetched_ms;
+  } ifaces, stations, surveys;
+} nl = {.lock = PTHREAD_MUTEX_INITIALIZER,
+        .transport = {socket_exchange, socket_exchange_wait, NULL}};
+
+// File of the recorded replies to req: "<dir>/<command>[.<ifindex>]"
+static int replay_path(const char *dir, const struct nlmsghdr *req,
+                       char *path, size_t size) {
+  const struct genlmsghdr *g = NLMSG_DATA(req);
+  const char *command;
+  char other[16];
+  switch (g->cmd) {
+  case NL80211_CMD_GET_INTERFACE:
+    command = "get_interface";
+    break;
+  case NL80211_CMD_GET_STATION:
+    command = "get_station";
+    break;
+  case NL80211_CMD_GET_SURVEY:
+    command = "get_survey";
+    break;
+  case NL80211_CMD_TRIGGER_SCAN:
+    command = "trigger_scan";
+    break;
+  case NL80211_CMD_GET_SCAN:
+    command = "get_scan";
+    break;
+  default:
+    snprintf(other, sizeof(other), "cmd%d", g->cmd);
+    command = other;
+    break;
+  }
+
+  const struct nlattr *tb[NL80211_ATTR_IFINDEX + 1];
+  parse_attrs((const char *)g + GENL_HDRLEN,
+              (int)(req->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN)), tb,
+              NL80211_ATTR_IFINDEX);
+  int len = tb[NL80211_ATTR_IFINDEX]
+                ? snprintf(path, size, "%s/%s.%u", dir, command,
+                           attr_u32(tb[NL80211_ATTR_IFINDEX]))
+                : snprintf(path, size, "%s/%s", dir, command);
+  return len > 0 && (size_t)len < size ? 0 : -1;
+}
+
+typedef struct {
+  FILE *out;
+  nl80211_reply_fn fn;
+  void *arg;
+} record_t;
+
+static int record_reply(const struct nlmsghdr *h, void *arg) {
+  record_t *rec = arg;
+  fwrite(h, 1, NLMSG_ALIGN(h->nlmsg_len), rec->out);
+  return rec->fn(h, rec->arg);
+}
+
+// Ask the kernel, and keep a copy of every reply for replay_exchange()
+static int record_exchange(void *ctx, struct nlmsghdr *req,
+                           nl80211_reply_fn fn, void *arg) {
+  char path[512];
+  if (replay_path(ctx, req, path, sizeof(path)) != 0)
+    return -ENAMETOOLONG;
+  record_t rec = {fopen(path, "wb"), fn, arg};
+  if (!rec.out)
+    return socket_exchange(NULL, req, fn, arg);
+  int rc = socket_exchange(NULL, req, record_reply, &rec);
+  fclose(rec.out);
+  if (rc != 0)
+    remove(path); // Replayed as a missing file, i.e. an error
+  return rc;
+}
+
+static int record_exchange_wait(void *ctx, struct nlmsghdr *req,
+                                const char *group, nl80211_reply_fn fn,
+                                void *arg, int timeout_ms) {
+  char path[512];
+  if (replay_path(ctx, req, path, sizeof(path)) != 0)
+    return -ENAMETOOLONG;
+  record_t rec = {fopen(path, "wb"), fn, arg};
+  if (!rec.out)
+    return socket_exchange_wait(NULL, req, group, fn, arg, timeout_ms);
+  int rc = socket_exchange_wait(NULL, req, group, record_reply, &rec,
+                                timeout_ms);
+  fclose(rec.out);
+  if (rc != 0)
+    remove(path);
+  return rc;
+}
+
+// Pass the messages recorded for req to fn. Returns 0 if fn stopped them,
+// 1 if it saw them all, or a negative errno; a request with nothing
+// recorded fails as if the kernel had no such device.
+static int replay(const char *dir, const struct nlmsghdr *req,
+                  nl80211_reply_fn fn, void *arg) {
+  char path[512];
+  if (replay_path(dir, req, path, sizeof(path)) != 0)
+    return -ENAMETOOLONG;
+  FILE *in = fopen(path, "rb");
+  if (!in)
+    return -ENODEV;
+  fseek(in, 0, SEEK_END);
+  long size = ftell(in);
+  rewind(in);
+  char *buf = size > 0 ? malloc((size_t)size) : NULL;
+  size_t len = buf ? fread(buf, 1, (size_t)size, in) : 0;
+  fclose(in);
+  if (!buf)
+    return size == 0 ? 1 : -ENOMEM;
+
+  int rc = 1;
+  for (const struct nlmsghdr *h = (const struct nlmsghdr *)buf;
+       NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+    if (fn(h, arg) != 0) {
+      rc = 0;
+      break;
+    }
+  }
+  free(buf);
+  return rc;
+}
+
+static int replay_exchange(void *ctx, struct nlmsghdr *req,
+                           nl80211_reply_fn fn, void *arg) {
+  int rc = replay(ctx, req, fn, arg);
+  return rc < 0 ? rc : 0;
+}
+
+// Events that were recorded without the one being waited for replay as a
+// timeout, at once
+static int replay_exchange_wait(void *ctx, struct nlmsghdr *req,
+                                const char *group, nl80211_reply_fn fn,
+                                void *arg, int timeout_ms) {
+  (void)group;
+  (void)timeout_ms;
+  int rc = replay(ctx, req, fn, arg);
+  return rc == 1 ? -ETIMEDOUT : rc;
+}
+
+static void invalidate_locked(void) {
+  nl.ifaces.valid = 0;
+  nl.stations.valid = 0;
+  nl.surveys.valid = 0;
+}
+
+void nl80211_set_transport(const nl80211_transport_t *transport) {
+  pthread_mutex_lock(&nl.lock);
+  if (transport) {
+    nl.transport = *transport;
+  } else {
+    nl.transport.exchange = socket_exchange;
+    nl.transport.exchange_wait = socket_exchange_wait;
+    nl.transport.ctx = NULL;
+  }
+  invalidate_locked();
+  pthread_mutex_unlock(&nl.lock);
+}
+
+// The recording and replay transports, with ctx set to nl.dir
+static const nl80211_transport_t record_transport = {
+    record_exchange, record_exchange_wait, NULL};
+static const nl80211_transport_t replay_transport = {
+    replay_exchange, replay_exchange_wait, NULL};
+
+static int set_dir_transport(const char *dir,
+                             const nl80211_transport_t *transport) {
+  if (!dir) {
+    nl80211_set_transport(NULL);
+    return 0;
+  }
+  if (strlen(dir) >= sizeof(nl.dir))
+    return -1;
+  pthread_mutex_lock(&nl.lock);
+  snprintf(nl.dir, sizeof(nl.dir), "%s", dir);
+  nl.transport = *transport;
+  nl.transport.ctx = nl.dir;
+  invalidate_locked();
+  pthread_mutex_unlock(&nl.lock);
+  return 0;
+}
+
+int nl80211_record_dir(const char *dir) {
+  return set_dir_transport(dir, &record_transport);
+}
+
+int nl80211_replay_dir(const char *dir) {
+  return set_dir_transport(dir, &replay_transport);
+}
+
+void nl80211_invalidate(void) {
+  pthread_mutex_lock(&nl.lock);
+  invalidate_locked();
+  pthread_mutex_unlock(&nl.lock);
+}
+
+// Next free entry of a cached list, growing it as needed
+#define LIST_SLOT(list, type)                                                 \
+  ((type *)list_slot(&(list).items, &(list).count, &(list).capacity,          \
+                     sizeof(type)))
+
+static void *list_slot(void **items, int *count, int *capacity, size_t size) {
+  if (*count == *capacity) {
+    int grown = *capacity ? *capacity * 2 : 8;
+    void *bigger = realloc(*items, (size_t)grown * size);
+    if (!bigger)
+      return NULL;
+    *items = bigger;
+    *capacity = grown;
+  }
+  void *slot = (char *)*items + (size_t)(*count)++ * size;
+  memset(slot, 0, size);
+  return slot;
+}
+
+static uint64_t monotonic_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static int parse_iface(const struct nlmsghdr *h, void *arg) {
+  (void)arg;
+  const struct nlattr *tb[NL80211_ATTR_MAX + 1];
+  if (reply_attrs(h, NL80211_CMD_NEW_INTERFACE, tb, NL80211_ATTR_MAX) != 0 ||
+      !tb[NL80211_ATTR_IFINDEX])
+    return 0; // Wireless devices without a netdev have no index
+  nl80211_iface_t *iface = LIST_SLOT(nl.ifaces, nl80211_iface_t);
+  if (!iface) {
+    nl.out_of_memory = 1;
+    return 1;
+  }
+
+  iface->index = (int)attr_u32(tb[NL80211_ATTR_IFINDEX]);
+  if (tb[NL80211_ATTR_IFNAME])
+    attr_string(tb[NL80211_ATTR_IFNAME], iface->name, sizeof(iface->name));
+  if (tb[NL80211_ATTR_WIPHY])
+    iface->wiphy = (int)attr_u32(tb[NL80211_ATTR_WIPHY]);
+  if (tb[NL80211_ATTR_IFTYPE])
+    iface->iftype = (int)attr_u32(tb[NL80211_ATTR_IFTYPE]);
+  if (tb[NL80211_ATTR_MAC])
+    attr_mac(tb[NL80211_ATTR_MAC], iface->mac);
+  if (tb[NL80211_ATTR_SSID])
+    attr_string(tb[NL80211_ATTR_SSID], iface->ssid, sizeof(iface->ssid));
+  if (tb[NL80211_ATTR_WIPHY_FREQ])
+    iface->frequency = (int)attr_u32(tb[NL80211_ATTR_WIPHY_FREQ]);
+  if (tb[NL80211_ATTR_CHANNEL_WIDTH])
+    iface->channel_width = (int)attr_u32(tb[NL80211_ATTR_CHANNEL_WIDTH]);
+  if (tb[NL80211_ATTR_WIPHY_TX_POWER_LEVEL])
+    iface->tx_power_mbm = (int)attr_u32(tb[NL80211_ATTR_WIPHY_TX_POWER_LEVEL]);
+  return 0;
+}
+
+// Bitrate of a nested rate info in 100 kbit/s; the 16-bit attribute
+// overflows above 6.5 Gbit/s and is left out by the kernel then
+static unsigned rate_info_bitrate(const struct nlattr *a) {
+  const struct nlattr *tb[NL80211_RATE_INFO_MAX + 1];
+  parse_nested(a, tb, NL80211_RATE_INFO_MAX);
+  if (tb[NL80211_RATE_INFO_BITRATE32])
+    return attr_u32(tb[NL80211_RATE_INFO_BITRATE32]);
+  if (tb[NL80211_RATE_INFO_BITRATE])
+    return attr_u16(tb[NL80211_RATE_INFO_BITRATE]);
+  return 0;
+}
+
+static int parse_station(const struct nlmsghdr *h, void *arg) {
+  const nl80211_iface_t *iface = arg;
+  const struct nlattr *tb[NL80211_ATTR_MAX + 1];
+  if (reply_attrs(h, NL80211_CMD_NEW_STATION, tb, NL80211_ATTR_MAX) != 0 ||
+      !tb[NL80211_ATTR_STA_INFO])
+    return 0;
+  nl80211_station_t *sta = LIST_SLOT(nl.stations, nl80211_station_t);
+  if (!sta) {
+    nl.out_of_memory = 1;
+    return 1;
+  }
+
+  sta->ifindex = iface->index;
+  memcpy(sta->ifname, iface->name, sizeof(sta->ifname));
+  if (tb[NL80211_ATTR_MAC])
+    attr_mac(tb[NL80211_ATTR_MAC], sta->mac);
+
+  const struct nlattr *info[NL80211_STA_INFO_MAX + 1];
+  parse_nested(tb[NL80211_ATTR_STA_INFO], info, NL80211_STA_INFO_MAX);
+  if (info[NL80211_STA_INFO_SIGNAL])
+    sta->signal = attr_s8(info[NL80211_STA_INFO_SIGNAL]);
+  if (info[NL80211_STA_INFO_SIGNAL_AVG])
+    sta->signal_avg = attr_s8(info[NL80211_STA_INFO_SIGNAL_AVG]);
+  if (info[NL80211_STA_INFO_TX_BITRATE])
+    sta->tx_bitrate = rate_info_bitrate(info[NL80211_STA_INFO_TX_BITRATE]);
+  if (info[NL80211_STA_INFO_RX_BITRATE])
+    sta->rx_bitrate = rate_info_bitrate(info[NL80211_STA_INFO_RX_BITRATE]);
+  // The 64-bit byte counters are preferred; the 32-bit ones wrap at 4 GB
+  if (info[NL80211_STA_INFO_RX_BYTES64])
+    sta->rx_bytes = attr_u64(info[NL80211_STA_INFO_RX_BYTES64]);
+  else if (info[NL80211_STA_INFO_RX_BYTES])
+    sta->rx_bytes = attr_u32(info[NL80211_STA_INFO_RX_BYTES]);
+  if (info[NL80211_STA_INFO_TX_BYTES64])
+    sta->tx_bytes = attr_u64(info[NL80211_STA_INFO_TX_BYTES64]);
+  else if (info[NL80211_STA_INFO_TX_BYTES])
+    sta->tx_bytes = attr_u32(info[NL80211_STA_INFO_TX_BYTES]);
+  if (info[NL80211_STA_INFO_RX_PACKETS])
+    sta->rx_packets = attr_u32(info[NL80211_STA_INFO_RX_PACKETS]);
+  if (info[NL80211_STA_INFO_TX_PACKETS])
+    sta->tx_packets = attr_u32(info[NL80211_STA_INFO_TX_PACKETS]);
+  if (info[NL80211_STA_INFO_TX_RETRIES])
+    sta->tx_retries = attr_u32(info[NL80211_STA_INFO_TX_RETRIES]);
+  if (info[NL80211_STA_INFO_TX_FAILED])
+    sta->tx_failed = attr_u32(info[NL80211_STA_INFO_TX_FAILED]);
+  if (info[NL80211_STA_INFO_INACTIVE_TIME])
+    sta->inactive_ms = attr_u32(info[NL80211_STA_INFO_INACTIVE_TIME]);
+  if (info[NL80211_STA_INFO_CONNECTED_TIME])
+    sta->connected_s = attr_u32(info[NL80211_STA_INFO_CONNECTED_TIME]);
+  return 0;
+}
+
+static int parse_survey(const struct nlmsghdr *h, void *arg) {
+  const nl80211_iface_t *iface = arg;
+  const struct nlattr *tb[NL80211_ATTR_MAX + 1];
+  if (reply_attrs(h, NL80211_CMD_NEW_SURVEY_RESULTS, tb, NL80211_ATTR_MAX) !=
+          0 ||
+      !tb[NL80211_ATTR_SURVEY_INFO])
+    return 0;
+  const struct nlattr *info[NL80211_SURVEY_INFO_MAX + 1];
+  parse_nested(tb[NL80211_ATTR_SURVEY_INFO], info, NL80211_SURVEY_INFO_MAX);
+  if (!info[NL80211_SURVEY_INFO_FREQUENCY])
+    return 0;
+  nl80211_survey_t *survey = LIST_SLOT(nl.surveys, nl80211_survey_t);
+  if (!survey) {
+    nl.out_of_memory = 1;
+    return 1;
+  }
+
+  survey->ifindex = iface->index;
+  memcpy(survey->ifname, iface->name, sizeof(survey->ifname));
+  survey->frequency = (int)attr_u32(info[NL80211_SURVEY_INFO_FREQUENCY]);
+  if (info[NL80211_SURVEY_INFO_NOISE])
+    survey->noise = attr_s8(info[NL80211_SURVEY_INFO_NOISE]);
+  survey->in_use = info[NL80211_SURVEY_INFO_IN_USE] != NULL;
+  if (info[NL80211_SURVEY_INFO_TIME])
+    survey->active_ms = attr_u64(info[NL80211_SURVEY_INFO_TIME]);
+  if (info[NL80211_SURVEY_INFO_TIME_BUSY])
+    survey->busy_ms = attr_u64(info[NL80211_SURVEY_INFO_TIME_BUSY]);
+  if (info[NL80211_SURVEY_INFO_TIME_RX])
+    survey->rx_ms = attr_u64(info[NL80211_SURVEY_INFO_TIME_RX]);
+  if (info[NL80211_SURVEY_INFO_TIME_TX])
+    survey->tx_ms = attr_u64(info[NL80211_SURVEY_INFO_TIME_TX]);
+  return 0;
+}
+
+// The refresh functions run with nl.lock held, so callers that arrive
+// while one is dumping wait and then share its result
+
+static int refresh_ifaces(uint64_t now) {
+  if (nl.ifaces.valid && now - nl.ifaces.fetched_ms < NL80211_CACHE_TTL_MS)
+    return 0;
+  nl.ifaces.valid = 0;
+  nl.ifaces.count = 0;
+  nl.out_of_memory = 0;
+
+  request_t req;
+  request_init(&req, NL80211_CMD_GET_INTERFACE, 1);
+  if (nl.transport.exchange(nl.transport.ctx, &req.h, parse_iface, NULL) !=
+          0 ||
+      nl.out_of_memory)
+    return -1;
+  nl.ifaces.valid = 1;
+  nl.ifaces.fetched_ms = now;
+  return 0;
+}
+
+// Whether ifaces[i] is the first interface listed on its radio
+static int first_of_wiphy(const nl80211_iface_t *ifaces, int i) {
+  for (int j = 0; j < i; j++) {
+    if (ifaces[j].wiphy == ifaces[i].wiphy)
+      return 0;
+  }
+  return 1;
+}
+
+// Dump cmd for each interface into the list that parse fills. An
+// interface that cannot answer (down, or a driver without surveys) adds
+// nothing. With per_wiphy, only the first interface of each radio is
+// asked, for data that belongs to the radio.
+static int refresh_per_iface(int cmd, nl80211_reply_fn parse, int per_wiphy) {
+  const nl80211_iface_t *ifaces = nl.ifaces.items;
+  for (int i = 0; i < nl.ifaces.count; i++) {
+    if (per_wiphy && !first_of_wiphy(ifaces, i))
+      continue;
+
+    request_t req;
+    request_init(&req, cmd, 1);
+    request_put_u32(&req, NL80211_ATTR_IFINDEX, (uint32_t)ifaces[i].index);
+    nl.out_of_memory = 0;
+    nl.transport.exchange(nl.transport.ctx, &req.h, parse,
+                          (void *)&ifaces[i]);
+    if (nl.out_of_memory)
+      return -1;
+  }
+  return 0;
+}
+
+static int refresh_stations(uint64_t now) {
+  if (refresh_ifaces(now) != 0)
+    return -1;
+  if (nl.stations.valid &&
+      now - nl.stations.fetched_ms < NL80211_CACHE_TTL_MS)
+    return 0;
+  nl.stations.valid = 0;
+  nl.stations.count = 0;
+  if (refresh_per_iface(NL80211_CMD_GET_STATION, parse_station, 0) != 0)
+    return -1;
+  nl.stations.valid = 1;
+  nl.stations.fetched_ms = now;
+  return 0;
+}
+
+static int refresh_surveys(uint64_t now) {
+  if (refresh_ifaces(now) != 0)
+    return -1;
+  if (nl.surveys.valid && now - nl.surveys.fetched_ms < NL80211_CACHE_TTL_MS)
+    return 0;
+  nl.surveys.valid = 0;
+  nl.surveys.count = 0;
+  if (refresh_per_iface(NL80211_CMD_GET_SURVEY, parse_survey, 1) != 0)
+    return -1;
+  nl.surveys.valid = 1;
+  nl.surveys.fetched_ms = now;
+  return 0;
+}
+
+int nl80211_interfaces(nl80211_iface_fn fn, void *ctx) {
+  pthread_mutex_lock(&nl.lock);
+  int visited = -1;
+  if (refresh_ifaces(monotonic_ms()) == 0) {
+    const nl80211_iface_t *items = nl.ifaces.items;
+    for (visited = 0; visited < nl.ifaces.count;)
+      if (fn(&items[visited++], ctx) != 0)
+        break;
+  }
+  pthread_mutex_unlock(&nl.lock);
+  return visited;
+}
+
+int nl80211_stations(nl80211_station_fn fn, void *ctx) {
+  pthread_mutex_lock(&nl.lock);
+  int visited = -1;
+  if (refresh_stations(monotonic_ms()) == 0) {
+    const nl80211_station_t *items = nl.stations.items;
+    for (visited = 0; visited < nl.stations.count;)
+      if (fn(&items[visited++], ctx) != 0)
+        break;
+  }
+  pthread_mutex_unlock(&nl.lock);
+  return visited;
+}
+
+int nl80211_surveys(nl80211_survey_fn fn, void *ctx) {
+  pthread_mutex_lock(&nl.lock);
+  int visited = -1;
+  if (refresh_surveys(monotonic_ms()) == 0) {
+    const nl80211_survey_t *items = nl.surveys.items;
+    for (visited = 0; visited < nl.surveys.count;)
+      if (fn(&items[visited++], ctx) != 0)
+        break;
+  }
+  pthread_mutex_unlock(&nl.lock);
+  return visited;
+}
+
+// Accept the event that ends the scan on the interface at arg, whether it
+// finished or was aborted
+static int scan_event(const struct nlmsghdr *h, void *arg) {
+  int ifindex = *(const int *)arg;
+  const struct nlattr *tb[NL80211_ATTR_IFINDEX + 1];
+  if (h->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+    return 0;
+  int cmd = ((const struct genlmsghdr *)NLMSG_DATA(h))->cmd;
+  if ((cmd != NL80211_CMD_NEW_SCAN_RESULTS &&
+       cmd != NL80211_CMD_SCAN_ABORTED) ||
+      reply_attrs(h, cmd, tb, NL80211_ATTR_IFINDEX) != 0 ||
+      !tb[NL80211_ATTR_IFINDEX] ||
+      (int)attr_u32(tb[NL80211_ATTR_IFINDEX]) != ifindex)
+    return 0;
+  return 1;
+}
+
+// SSID from the information elements, a list of (id, length, data)
+static void ie_ssid(const struct nlattr *a, char *out, size_t size) {
+  const unsigned char *ie = attr_data(a);
+  out[0] = '\0';
+  for (int len = attr_len(a); len >= 2 && ie[1] + 2 <= len;
+       len -= ie[1] + 2, ie += ie[1] + 2) {
+    if (ie[0] == 0) {
+      size_t n = ie[1] < size ? ie[1] : size - 1;
+      memcpy(out, ie + 2, n);
+      out[n] = '\0';
+      return;
+    }
+  }
+}
+
+typedef struct {
+  const nl80211_iface_t *iface;
+  nl80211_bss_fn fn;
+  void *ctx;
+  int visited;
+  int stopped;
+} bss_dump_t;
+
+static int parse_bss(const struct nlmsghdr *h, void *arg) {
+  bss_dump_t *dump = arg;
+  const struct nlattr *tb[NL80211_ATTR_MAX + 1];
+  if (reply_attrs(h, NL80211_CMD_NEW_SCAN_RESULTS, tb, NL80211_ATTR_MAX) !=
+          0 ||
+      !tb[NL80211_ATTR_BSS])
+    return 0;
+  const struct nlattr *info[NL80211_BSS_MAX + 1];
+  parse_nested(tb[NL80211_ATTR_BSS], info, NL80211_BSS_MAX);
+  if (!info[NL80211_BSS_BSSID])
+    return 0;
+
+  nl80211_bss_t bss;
+  memset(&bss, 0, sizeof(bss));
+  bss.ifindex = dump->iface->index;
+  memcpy(bss.ifname, dump->iface->name, sizeof(bss.ifname));
+  attr_mac(info[NL80211_BSS_BSSID], bss.bssid);
+  if (info[NL80211_BSS_INFORMATION_ELEMENTS])
+    ie_ssid(info[NL80211_BSS_INFORMATION_ELEMENTS], bss.ssid,
+            sizeof(bss.ssid));
+  if (info[NL80211_BSS_FREQUENCY])
+    bss.frequency = (int)attr_u32(info[NL80211_BSS_FREQUENCY]);
+  if (info[NL80211_BSS_SIGNAL_MBM])
+    bss.signal_mbm = (int)attr_u32(info[NL80211_BSS_SIGNAL_MBM]);
+  if (info[NL80211_BSS_CAPABILITY])
+    bss.privacy = (attr_u16(info[NL80211_BSS_CAPABILITY]) & 0x0010) != 0;
+  if (info[NL80211_BSS_STATUS])
+    bss.associated =
+        attr_u32(info[NL80211_BSS_STATUS]) == NL80211_BSS_STATUS_ASSOCIATED;
+  if (info[NL80211_BSS_SEEN_MS_AGO])
+    bss.seen_ms_ago = attr_u32(info[NL80211_BSS_SEEN_MS_AGO]);
+
+  dump->visited++;
+  if (dump->fn(&bss, dump->ctx) != 0) {
+    dump->stopped = 1;
+    return 1;
+  }
+  return 0;
+}
+
+int nl80211_scan(nl80211_bss_fn fn, void *ctx) {
+  // The interface list and transport are copied so the lock is not held
+  // for the seconds a scan takes
+  pthread_mutex_lock(&nl.lock);
+  nl80211_transport_t transport = nl.transport;
+  nl80211_iface_t *ifaces = NULL;
+  int count = -1;
+  if (refresh_ifaces(monotonic_ms()) == 0) {
+    count = nl.ifaces.count;
+    ifaces = malloc((size_t)(count ? count : 1) * sizeof(*ifaces));
+    if (ifaces)
+      memcpy(ifaces, nl.ifaces.items, (size_t)count * sizeof(*ifaces));
+    else
+      count = -1;
+  }
+  pthread_mutex_unlock(&nl.lock);
+
+  bss_dump_t dump = {NULL, fn, ctx, 0, 0};
+  int answered = 0;
+  for (int i = 0; i < count && !dump.stopped; i++) {
+    if (!first_of_wiphy(ifaces, i))
+      continue;
+    uint32_t index = (uint32_t)ifaces[i].index;
+
+    // The trigger's result does not matter: a radio that is already
+    // scanning, or will not, still has the results of its last scan
+    if (transport.exchange_wait) {
+      request_t trigger;
+      request_init(&trigger, NL80211_CMD_TRIGGER_SCAN, 0);
+      request_put_u32(&trigger, NL80211_ATTR_IFINDEX, index);
+      // An access point only scans when allowed off its channel
+      if (ifaces[i].iftype == NL80211_IFTYPE_AP)
+        request_put_u32(&trigger, NL80211_ATTR_SCAN_FLAGS,
+                        NL80211_SCAN_FLAG_AP);
+      int ifindex = ifaces[i].index;
+      transport.exchange_wait(transport.ctx, &trigger.h,
+                              NL80211_MULTICAST_GROUP_SCAN, scan_event,
+                              &ifindex, NL80211_SCAN_TIMEOUT_MS);
+    }
+
+    request_t req;
+    request_init(&req, NL80211_CMD_GET_SCAN, 1);
+    request_put_u32(&req, NL80211_ATTR_IFINDEX, index);
+    dump.iface = &ifaces[i];
+    if (transport.exchange(transport.ctx, &req.h, parse_bss, &dump) == 0)
+      answered++;
+  }
+  free(ifaces);
+  return answered ? dump.visited : -1;
+}
+
+const char *nl80211_iftype_name(int iftype) {
+  switch (iftype) {
+  case NL80211_IFTYPE_ADHOC:
+    return "IBSS";
+  case NL80211_IFTYPE_STATION:
+    return "managed";
+  case NL80211_IFTYPE_AP:
+    return "AP";
+  case NL80211_IFTYPE_AP_VLAN:
+    return "AP/VLAN";
+  case NL80211_IFTYPE_WDS:
+    return "WDS";
+  case NL80211_IFTYPE_MONITOR:
+    return "monitor";
+  case NL80211_IFTYPE_MESH_POINT:
+    return "mesh point";
+  case NL80211_IFTYPE_P2P_CLIENT:
+    return "P2P-client";
+  case NL80211_IFTYPE_P2P_GO:
+    return "P2P-GO";
+  case NL80211_IFTYPE_P2P_DEVICE:
+    return "P2P-device";
+  default:
+    return "unknown";
+  }
+}
+
+int nl80211_frequency_channel(int frequency) {
+  if (frequency == 2484)
+    return 14;
+  if (frequency >= 2412 && frequency < 2484)
+    return (frequency - 2407) / 5;
+  if (frequency >= 4910 && frequency <= 4980)
+    return (frequency - 4000) / 5;
+  if (frequency == 5935) // 6 GHz channel 2 sits below the band's grid
+    return 2;
+  if (frequency >= 5000 && frequency < 5950)
+    return (frequency - 5000) / 5;
+  if (frequency > 5950 && frequency <= 7115)
+    return (frequency - 5950) / 5;
+  if (frequency >= 58320 && frequency <= 70200)
+    return (frequency - 56160) / 2160;
+  return 0;
+}
@@ -0,0 +1,149 @@
+#ifndef NL80211_H
+#define NL80211_H
+
+#include <linux/netlink.h>
+#include <net/if.h>
+
+// Receive buffer for replies; a station with all its attributes is well
+// under 1 KB, and the kernel batches dumps to fit the largest read
+#define NL80211_BUF_SIZE 32768
+
+// How long one request may take before it is abandoned
+#define NL80211_TIMEOUT_MS 1000
+
+// How long a triggered scan may run before its radio is given up on
+#define NL80211_SCAN_TIMEOUT_MS 10000
+
+// How long interfaces, stations and survey data are served from memory
+// before the kernel is asked again
+#define NL80211_CACHE_TTL_MS 2000
+
+// One wireless interface from NL80211_CMD_GET_INTERFACE
+typedef struct {
+  int index;
+  char name[IF_NAMESIZE];
+  int wiphy;     // Index of the radio it belongs to
+  int iftype;    // NL80211_IFTYPE_*
+  char mac[18];
+  char ssid[33]; // Empty unless the interface is up as an AP or client
+  int frequency; // MHz, or 0 when it is not on a channel
+  int channel_width; // NL80211_CHAN_WIDTH_*, valid with frequency
+  int tx_power_mbm;  // 0 when not reported
+} nl80211_iface_t;
+
+// One associated station from NL80211_CMD_GET_STATION. Signals are in
+// dBm and 0 when the driver does not report them; bitrates are in
+// 100 kbit/s, as the kernel gives them.
+typedef struct {
+  int ifindex;
+  char ifname[IF_NAMESIZE];
+  char mac[18];
+  int signal;
+  int signal_avg;
+  unsigned tx_bitrate;
+  unsigned rx_bitrate;
+  unsigned long long rx_bytes;
+  unsigned long long tx_bytes;
+  unsigned rx_packets;
+  unsigned tx_packets;
+  unsigned tx_retries;
+  unsigned tx_failed;
+  unsigned inactive_ms;
+  unsigned connected_s;
+} nl80211_station_t;
+
+// One channel from NL80211_CMD_GET_SURVEY. Times are the radio's
+// cumulative counters in ms; noise is in dBm and 0 when not reported.
+typedef struct {
+  int ifindex;
+  char ifname[IF_NAMESIZE];
+  int frequency;
+  int noise;
+  int in_use; // The channel the interface is on
+  unsigned long long active_ms;
+  unsigned long long busy_ms;
+  unsigned long long rx_ms;
+  unsigned long long tx_ms;
+} nl80211_survey_t;
+
+// One network seen by a scan, from NL80211_CMD_GET_SCAN
+typedef struct {
+  int ifindex; // Interface that scanned
+  char ifname[IF_NAMESIZE];
+  char bssid[18];
+  char ssid[33]; // Empty for a hidden network
+  int frequency;
+  int signal_mbm; // 1/100 dBm, 0 when the driver does not report it
+  int privacy;    // Encryption is required
+  int associated; // The interface is connected to it
+  unsigned seen_ms_ago;
+} nl80211_bss_t;
+
+// Return nonzero to stop early
+typedef int (*nl80211_iface_fn)(const nl80211_iface_t *iface, void *ctx);
+typedef int (*nl80211_station_fn)(const nl80211_station_t *sta, void *ctx);
+typedef int (*nl80211_survey_fn)(const nl80211_survey_t *survey, void *ctx);
+typedef int (*nl80211_bss_fn)(const nl80211_bss_t *bss, void *ctx);
+
+// Visit every wireless interface, every station on them, or every
+// surveyed channel. Results come from a cache that is refreshed at most
+// once per NL80211_CACHE_TTL_MS; concurrent callers wait for one refresh
+// instead of each dumping. fn runs under the cache lock and must not call
+// back into this module. Safe from any thread. Returns the number of
+// entries visited, or -1 if nl80211 is not available.
+int nl80211_interfaces(nl80211_iface_fn fn, void *ctx);
+int nl80211_stations(nl80211_station_fn fn, void *ctx);
+int nl80211_surveys(nl80211_survey_fn fn, void *ctx);
+
+// Scan on every radio, wait for the scans to finish, and visit what they
+// found. A radio that cannot scan now (busy, or refusing to) still gives
+// the results of its last scan. Takes seconds, so it belongs on a thread
+// of its own; the cache lock is not held meanwhile. Returns the number of
+// networks visited, or -1 if no radio gave results.
+int nl80211_scan(nl80211_bss_fn fn, void *ctx);
+
+// Drop cached results, so the next call asks the kernel
+void nl80211_invalidate(void);
+
+// Called with every reply message of a request. Return nonzero to stop.
+typedef int (*nl80211_reply_fn)(const struct nlmsghdr *h, void *arg);
+
+// What carries requests to the kernel. exchange() sends req, a generic
+// netlink message whose nlmsg_type the transport sets to the nl80211
+// family, and passes each reply message other than DONE and ACK to fn.
+// Returns 0, or a negative errno from the kernel or the transport.
+//
+// exchange_wait() is for requests that the kernel answers later with an
+// event: it joins the named nl80211 multicast group, sends req, and once
+// it is acknowledged passes events to fn until fn returns nonzero. Returns
+// 0, the request's error, or -ETIMEDOUT after timeout_ms. May be NULL in
+// a transport that cannot scan.
+typedef struct {
+  int (*exchange)(void *ctx, struct nlmsghdr *req, nl80211_reply_fn fn,
+                  void *arg);
+  int (*exchange_wait)(void *ctx, struct nlmsghdr *req, const char *group,
+                       nl80211_reply_fn fn, void *arg, int timeout_ms);
+  void *ctx;
+} nl80211_transport_t;
+
+// Route requests through another transport, such as one that plays back
+// recorded replies; NULL restores the genetlink socket. Drops the cache.
+void nl80211_set_transport(const nl80211_transport_t *transport);
+
+// Record every reply the socket transport receives into dir, one file per
+// request, or play such files back instead of asking the kernel. Files
+// are named after the command and interface index ("get_station.5") and
+// hold the raw reply messages, or for a scan trigger the events it
+// waited for. NULL turns recording or playback off.
+// Returns 0, or -1 if the path does not fit.
+int nl80211_record_dir(const char *dir);
+int nl80211_replay_dir(const char *dir);
+
+// Names as `iw` prints them ("AP", "managed", ...); unknown values give
+// "unknown"
+const char *nl80211_iftype_name(int iftype);
+
+// Channel number of a frequency in MHz, or 0 if it is on no known band
+int nl80211_frequency_channel(int frequency);
+
+#endif // NL80211_H
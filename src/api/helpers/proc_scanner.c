@@ -0,0 +1,155 @@
+#include "proc_scanner.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+// Parse a decimal PID from a directory name, 0 if it is not one
+static int parse_pid(const char *name) {
+  int pid = 0;
+  if (*name == '\0')
+    return 0;
+  for (; *name; name++) {
+    if (*name < '0' || *name > '9' || pid > 99999999)
+      return 0;
+    pid = pid * 10 + (*name - '0');
+  }
+  return pid;
+}
+
+// Skip n space-separated fields, return the start of the next one
+static char *skip_fields(char *p, int n) {
+  while (n-- > 0) {
+    while (*p && *p != ' ')
+      p++;
+    while (*p == ' ')
+      p++;
+  }
+  return p;
+}
+
+static unsigned long long parse_ull(const char *p) {
+  unsigned long long value = 0;
+  while (*p >= '0' && *p <= '9')
+    value = value * 10 + (unsigned long long)(*p++ - '0');
+  return value;
+}
+
+static long parse_long(const char *p) {
+  long value = 0;
+  int negative = *p == '-';
+  if (negative)
+    p++;
+  while (*p >= '0' && *p <= '9')
+    value = value * 10 + (*p++ - '0');
+  return negative ? -value : value;
+}
+
+// Format: "pid (comm) state ppid ... utime stime ... starttime vsize rss",
+// see proc(5). comm may itself contain spaces and parentheses, so it ends
+// at the last ')' in the line.
+int proc_parse_stat(char *buf, size_t len, long page_kb, proc_stat_t *stat) {
+  char *open = memchr(buf, '(', len);
+  char *close = strrchr(buf, ')');
+  if (!open || !close || close < open || close[1] != ' ')
+    return -1;
+
+  size_t name_len = (size_t)(close - open - 1);
+  if (name_len >= sizeof(stat->name))
+    name_len = sizeof(stat->name) - 1;
+  memcpy(stat->name, open + 1, name_len);
+  stat->name[name_len] = '\0';
+  stat->pid = (int)parse_long(buf);
+
+  // Fields after comm start at 3 (state)
+  char *p = skip_fields(close + 2, 14 - 3);
+  stat->utime = parse_ull(p);
+  p = skip_fields(p, 1);
+  stat->stime = parse_ull(p);
+  p = skip_fields(p, 22 - 15);
+  stat->starttime = parse_ull(p);
+  p = skip_fields(p, 24 - 22);
+  if (*p == '\0')
+    return -1;
+  stat->rss_kb = parse_long(p) * page_kb;
+  return 0;
+}
+
+// One read() of /proc/<pid>/stat into the scanner's buffer
+static int read_stat(proc_scanner_t *scanner, const char *pid_name,
+                     proc_stat_t *stat) {
+  char path[32];
+  size_t n = strlen(pid_name);
+  if (n + sizeof("/stat") > sizeof(path))
+    return -1;
+  memcpy(path, pid_name, n);
+  memcpy(path + n, "/stat", sizeof("/stat"));
+
+  int fd = openat(scanner->proc_fd, path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  ssize_t len;
+  do {
+    len = read(fd, scanner->buf, sizeof(scanner->buf) - 1);
+  } while (len < 0 && errno == EINTR);
+  close(fd);
+  if (len <= 0)
+    return -1;
+
+  scanner->buf[len] = '\0';
+  return proc_parse_stat(scanner->buf, (size_t)len, scanner->page_kb, stat);
+}
+
+int proc_scanner_open(proc_scanner_t *scanner, const char *root) {
+  memset(scanner, 0, sizeof(*scanner));
+  scanner->proc_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (scanner->proc_fd < 0)
+    return -1;
+
+  // fdopendir() takes ownership, so keep a separate fd for openat()
+  int dir_fd = dup(scanner->proc_fd);
+  scanner->dir = dir_fd >= 0 ? fdopendir(dir_fd) : NULL;
+  if (!scanner->dir) {
+    if (dir_fd >= 0)
+      close(dir_fd);
+    close(scanner->proc_fd);
+    scanner->proc_fd = -1;
+    return -1;
+  }
+
+  long page_size = sysconf(_SC_PAGESIZE);
+  scanner->page_kb = page_size > 0 ? page_size / 1024 : 4;
+  return 0;
+}
+
+void proc_scanner_close(proc_scanner_t *scanner) {
+  if (scanner->dir)
+    closedir(scanner->dir);
+  if (scanner->proc_fd >= 0)
+    close(scanner->proc_fd);
+  scanner->dir = NULL;
+  scanner->proc_fd = -1;
+}
+
+int proc_scanner_each(proc_scanner_t *scanner, proc_scan_fn fn, void *ctx) {
+  if (!scanner->dir)
+    return -1;
+
+  // /proc is regenerated on every pass, rewinding sees new PIDs
+  rewinddir(scanner->dir);
+
+  struct dirent *entry;
+  proc_stat_t stat;
+  int count = 0;
+  while ((entry = readdir(scanner->dir)) != NULL) {
+    if (parse_pid(entry->d_name) == 0)
+      continue;
+    if (read_stat(scanner, entry->d_name, &stat) != 0)
+      continue; // Exited since readdir()
+    count++;
+    if (fn(&stat, ctx) != 0)
+      break;
+  }
+  return count;
+}
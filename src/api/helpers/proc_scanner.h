@@ -0,0 +1,44 @@
+#ifndef PROC_SCANNER_H
+#define PROC_SCANNER_H
+
+#include <dirent.h>
+#include <stddef.h>
+
+// Large enough for any /proc/<pid>/stat line
+#define PROC_STAT_BUF_SIZE 1024
+
+// Fields parsed from one /proc/<pid>/stat
+typedef struct {
+  int pid;
+  char name[32];
+  long rss_kb;
+  unsigned long long utime;     // Clock ticks in user mode
+  unsigned long long stime;     // Clock ticks in kernel mode
+  unsigned long long starttime; // Ticks after boot; tells reused PIDs apart
+} proc_stat_t;
+
+// A /proc walker that keeps the directory open between scans. Per-process
+// files are opened relative to the directory fd and read with a single
+// read() into buf, so a scan allocates nothing.
+typedef struct {
+  int proc_fd;
+  DIR *dir;
+  long page_kb;
+  char buf[PROC_STAT_BUF_SIZE];
+} proc_scanner_t;
+
+// Return nonzero to stop the scan early
+typedef int (*proc_scan_fn)(const proc_stat_t *stat, void *ctx);
+
+// root is normally "/proc"; another path points the scanner at a copy
+int proc_scanner_open(proc_scanner_t *scanner, const char *root);
+void proc_scanner_close(proc_scanner_t *scanner);
+
+// Call fn for every process whose stat file could be read. Processes that
+// exit mid-scan are skipped. Returns the number visited, or -1.
+int proc_scanner_each(proc_scanner_t *scanner, proc_scan_fn fn, void *ctx);
+
+// Parse a stat line in place; buf must be NUL-terminated
+int proc_parse_stat(char *buf, size_t len, long page_kb, proc_stat_t *stat);
+
+#endif // PROC_SCANNER_H
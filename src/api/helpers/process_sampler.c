@@ -0,0 +1,426 @@
+#include "process_sampler.h"
+#include "../../mongoose/mongoose.h"
+#include "proc_scanner.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// CPU time of one process at the previous scan
+typedef struct {
+  int pid;
+  unsigned long long starttime;
+  unsigned long long ticks;
+} cpu_history_t;
+
+// Two tables: readers only ever see the published one, the sampler thread
+// fills the other and swaps them once no reader still holds it.
+static struct {
+  process_table_t tables[2];
+  process_table_t *published;
+  pthread_mutex_t lock;
+  pthread_mutex_t scan_lock; // Serializes sample_once(), guards below
+  pthread_mutex_t sort_lock; // Guards process_table_sorted()
+  pthread_cond_t released;   // A reader let go of a table
+  pthread_cond_t wake;       // Interrupts the sleep on shutdown
+  pthread_t thread;
+  proc_scanner_t scanner;
+  int scanner_open;
+  int interval_ms;
+  int running;
+  int stopping;
+
+  // CPU times from the previous scan (sorted by PID) and the current one
+  cpu_history_t *prev_cpu;
+  int prev_cpu_count;
+  int prev_cpu_capacity;
+  cpu_history_t *next_cpu;
+  int next_cpu_count;
+  int next_cpu_capacity;
+  uint64_t prev_scan_ms;
+  double ticks_per_ms;
+  long window_ms;
+} sampler = {.lock = PTHREAD_MUTEX_INITIALIZER,
+             .scan_lock = PTHREAD_MUTEX_INITIALIZER,
+             .sort_lock = PTHREAD_MUTEX_INITIALIZER,
+             .released = PTHREAD_COND_INITIALIZER,
+             .wake = PTHREAD_COND_INITIALIZER,
+             .interval_ms = PROCESS_SAMPLE_INTERVAL_MS};
+
+static const char *sort_names[PROCESS_SORT_COUNT] = {"ram", "cpu"};
+
+static double sort_value(const process_info_t *proc, process_sort_t key) {
+  return key == PROCESS_SORT_CPU ? proc->cpu_percent : (double)proc->rss_kb;
+}
+
+// Kernel threads rank by CPU, but with no user memory not by RSS
+static int ranked_by(const process_info_t *proc, process_sort_t key) {
+  return key != PROCESS_SORT_RSS || proc->rss_kb > 0;
+}
+
+// qsort comparators, descending by key
+static int compare_rss(const void *a, const void *b) {
+  const process_info_t *pa = (const process_info_t *)a;
+  const process_info_t *pb = (const process_info_t *)b;
+  return pb->rss_kb - pa->rss_kb;
+}
+
+static int compare_cpu(const void *a, const void *b) {
+  const process_info_t *pa = (const process_info_t *)a;
+  const process_info_t *pb = (const process_info_t *)b;
+  if (pa->cpu_percent != pb->cpu_percent)
+    return pa->cpu_percent < pb->cpu_percent ? 1 : -1;
+  return pb->rss_kb - pa->rss_kb;
+}
+
+static int compare_history(const void *a, const void *b) {
+  return ((const cpu_history_t *)a)->pid - ((const cpu_history_t *)b)->pid;
+}
+
+// Restore the min-heap property downwards from i
+static void heap_sift_down(process_info_t *heap, int count, int i,
+                           process_sort_t key) {
+  for (;;) {
+    int smallest = i;
+    int left = 2 * i + 1;
+    int right = left + 1;
+    if (left < count &&
+        sort_value(&heap[left], key) < sort_value(&heap[smallest], key))
+      smallest = left;
+    if (right < count &&
+        sort_value(&heap[right], key) < sort_value(&heap[smallest], key))
+      smallest = right;
+    if (smallest == i)
+      return;
+    process_info_t tmp = heap[i];
+    heap[i] = heap[smallest];
+    heap[smallest] = tmp;
+    i = smallest;
+  }
+}
+
+// Offer a process to the bounded min-heap of the largest PROCESS_TOP_MAX.
+// The root is the smallest kept entry, so most processes are rejected
+// with a single comparison once the heap is full.
+static void top_offer(process_info_t *heap, int count,
+                      const process_info_t *proc, process_sort_t key) {
+  if (count < PROCESS_TOP_MAX) {
+    int i = count;
+    heap[i] = *proc;
+    while (i > 0) {
+      int parent = (i - 1) / 2;
+      if (sort_value(&heap[parent], key) <= sort_value(&heap[i], key))
+        break;
+      process_info_t tmp = heap[i];
+      heap[i] = heap[parent];
+      heap[parent] = tmp;
+      i = parent;
+    }
+    return;
+  }
+
+  if (sort_value(proc, key) <= sort_value(&heap[0], key))
+    return;
+  heap[0] = *proc;
+  heap_sift_down(heap, count, 0, key);
+}
+
+// Turn a min-heap into a list sorted descending by key, in place
+static void top_finish(process_info_t *heap, int count, process_sort_t key) {
+  for (int n = count - 1; n > 0; n--) {
+    process_info_t tmp = heap[0];
+    heap[0] = heap[n];
+    heap[n] = tmp;
+    heap_sift_down(heap, n, 0, key);
+  }
+}
+
+// CPU share since the previous scan. A PID whose starttime changed has
+// been reused by a new process, which counts as first seen.
+static double cpu_percent(const proc_stat_t *stat) {
+  unsigned long long ticks = stat->utime + stat->stime;
+
+  if (sampler.next_cpu_count == sampler.next_cpu_capacity) {
+    int capacity =
+        sampler.next_cpu_capacity ? sampler.next_cpu_capacity * 2 : 256;
+    cpu_history_t *list =
+        realloc(sampler.next_cpu, capacity * sizeof(cpu_history_t));
+    if (list) {
+      sampler.next_cpu = list;
+      sampler.next_cpu_capacity = capacity;
+    }
+  }
+  if (sampler.next_cpu_count < sampler.next_cpu_capacity) {
+    cpu_history_t *h = &sampler.next_cpu[sampler.next_cpu_count++];
+    h->pid = stat->pid;
+    h->starttime = stat->starttime;
+    h->ticks = ticks;
+  }
+
+  if (sampler.window_ms <= 0)
+    return 0.0;
+
+  cpu_history_t key = {.pid = stat->pid};
+  const cpu_history_t *prev =
+      bsearch(&key, sampler.prev_cpu, sampler.prev_cpu_count,
+              sizeof(cpu_history_t), compare_history);
+  if (!prev || prev->starttime != stat->starttime || ticks < prev->ticks)
+    return 0.0;
+
+  return (double)(ticks - prev->ticks) * 100.0 /
+         (sampler.ticks_per_ms * (double)sampler.window_ms);
+}
+
+// Append one scanned process, growing the table as needed
+static int add_process(const proc_stat_t *stat, void *ctx) {
+  process_table_t *table = ctx;
+
+  if (stat->name[0] == '\0')
+    return 0;
+
+  if (table->count == table->capacity) {
+    int capacity = table->capacity ? table->capacity * 2 : 256;
+    process_info_t *list =
+        realloc(table->processes, capacity * sizeof(process_info_t));
+    if (!list)
+      return 1;
+    table->processes = list;
+    table->capacity = capacity;
+  }
+
+  process_info_t *proc = &table->processes[table->count++];
+  proc->pid = stat->pid;
+  memcpy(proc->name, stat->name, sizeof(proc->name));
+  proc->rss_kb = (int)stat->rss_kb;
+  proc->cpu_percent = cpu_percent(stat);
+  table->total_rss_kb += stat->rss_kb;
+  for (int key = 0; key < PROCESS_SORT_COUNT; key++) {
+    if (!ranked_by(proc, key))
+      continue;
+    table->ranked[key]++;
+    top_offer(table->top[key], table->top_count[key], proc, key);
+    if (table->top_count[key] < PROCESS_TOP_MAX)
+      table->top_count[key]++;
+  }
+  return 0;
+}
+
+// Scan /proc into table, reusing its storage. Caller holds scan_lock.
+static int scan_processes(process_table_t *table) {
+  if (!sampler.scanner_open) {
+    if (proc_scanner_open(&sampler.scanner, "/proc") != 0)
+      return -1;
+    sampler.scanner_open = 1;
+    long hz = sysconf(_SC_CLK_TCK);
+    sampler.ticks_per_ms = (hz > 0 ? hz : 100) / 1000.0;
+  }
+
+  uint64_t now = mg_millis();
+  sampler.window_ms =
+      sampler.prev_scan_ms ? (long)(now - sampler.prev_scan_ms) : 0;
+  sampler.next_cpu_count = 0;
+
+  table->count = 0;
+  memset(table->top_count, 0, sizeof(table->top_count));
+  memset(table->ranked, 0, sizeof(table->ranked));
+  table->total_rss_kb = 0;
+  memset(table->sorted_valid, 0, sizeof(table->sorted_valid));
+  if (proc_scanner_each(&sampler.scanner, add_process, table) < 0)
+    return -1;
+  for (int key = 0; key < PROCESS_SORT_COUNT; key++)
+    top_finish(table->top[key], table->top_count[key], key);
+  table->cpu_window_ms = sampler.window_ms;
+
+  // This scan becomes the baseline for the next one
+  qsort(sampler.next_cpu, sampler.next_cpu_count, sizeof(cpu_history_t),
+        compare_history);
+  cpu_history_t *list = sampler.prev_cpu;
+  int capacity = sampler.prev_cpu_capacity;
+  sampler.prev_cpu = sampler.next_cpu;
+  sampler.prev_cpu_count = sampler.next_cpu_count;
+  sampler.prev_cpu_capacity = sampler.next_cpu_capacity;
+  sampler.next_cpu = list;
+  sampler.next_cpu_capacity = capacity;
+  sampler.prev_scan_ms = now;
+
+  table->sampled_at = time(NULL);
+  table->sampled_at_ms = now;
+  return 0;
+}
+
+// Fill the unpublished table and publish it
+static void sample_once(void) {
+  pthread_mutex_lock(&sampler.scan_lock);
+  pthread_mutex_lock(&sampler.lock);
+  process_table_t *back = sampler.published == &sampler.tables[0]
+                              ? &sampler.tables[1]
+                              : &sampler.tables[0];
+  while (back->readers > 0)
+    pthread_cond_wait(&sampler.released, &sampler.lock);
+  unsigned long generation =
+      sampler.published ? sampler.published->generation + 1 : 1;
+  pthread_mutex_unlock(&sampler.lock);
+
+  // Readers cannot reach the back table, so scan without the lock
+  if (scan_processes(back) == 0) {
+    back->generation = generation;
+    pthread_mutex_lock(&sampler.lock);
+    sampler.published = back;
+    pthread_mutex_unlock(&sampler.lock);
+  }
+  pthread_mutex_unlock(&sampler.scan_lock);
+}
+
+static void *sampler_main(void *arg) {
+  (void)arg;
+
+  for (;;) {
+    pthread_mutex_lock(&sampler.lock);
+    if (!sampler.stopping) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += sampler.interval_ms / 1000;
+      deadline.tv_nsec += (long)(sampler.interval_ms % 1000) * 1000000L;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&sampler.wake, &sampler.lock, &deadline);
+    }
+    int stopping = sampler.stopping;
+    pthread_mutex_unlock(&sampler.lock);
+
+    if (stopping)
+      break;
+    sample_once();
+  }
+
+  return NULL;
+}
+
+int process_sampler_start(int interval_ms) {
+  if (sampler.running)
+    return 0;
+
+  if (interval_ms < PROCESS_SAMPLE_MIN_INTERVAL_MS)
+    interval_ms = PROCESS_SAMPLE_MIN_INTERVAL_MS;
+  sampler.interval_ms = interval_ms;
+  sampler.stopping = 0;
+
+  sample_once();
+
+  if (pthread_create(&sampler.thread, NULL, sampler_main, NULL) != 0) {
+    fprintf(stderr, "Process sampler: cannot start thread\n");
+    return -1;
+  }
+
+  sampler.running = 1;
+  printf("Process sampler started, interval %d ms\n", interval_ms);
+  return 0;
+}
+
+void process_sampler_stop(void) {
+  if (sampler.running) {
+    pthread_mutex_lock(&sampler.lock);
+    sampler.stopping = 1;
+    pthread_cond_signal(&sampler.wake);
+    pthread_mutex_unlock(&sampler.lock);
+    pthread_join(sampler.thread, NULL);
+    sampler.running = 0;
+  }
+
+  pthread_mutex_lock(&sampler.scan_lock);
+  if (sampler.scanner_open) {
+    proc_scanner_close(&sampler.scanner);
+    sampler.scanner_open = 0;
+  }
+  free(sampler.prev_cpu);
+  free(sampler.next_cpu);
+  sampler.prev_cpu = sampler.next_cpu = NULL;
+  sampler.prev_cpu_count = sampler.prev_cpu_capacity = 0;
+  sampler.next_cpu_count = sampler.next_cpu_capacity = 0;
+  sampler.prev_scan_ms = 0;
+  pthread_mutex_unlock(&sampler.scan_lock);
+
+  for (int i = 0; i < 2; i++) {
+    free(sampler.tables[i].processes);
+    for (int key = 0; key < PROCESS_SORT_COUNT; key++)
+      free(sampler.tables[i].sorted[key]);
+    memset(&sampler.tables[i], 0, sizeof(sampler.tables[i]));
+  }
+  sampler.published = NULL;
+}
+
+int process_sampler_interval_ms(void) { return sampler.interval_ms; }
+
+const process_table_t *process_table_acquire(void) {
+  // Without the background thread, every reader refreshes the table itself
+  if (!sampler.running)
+    sample_once();
+
+  pthread_mutex_lock(&sampler.lock);
+  process_table_t *table = sampler.published;
+  if (table)
+    table->readers++;
+  pthread_mutex_unlock(&sampler.lock);
+  return table;
+}
+
+void process_table_release(const process_table_t *table) {
+  if (!table)
+    return;
+  pthread_mutex_lock(&sampler.lock);
+  ((process_table_t *)table)->readers--;
+  pthread_cond_broadcast(&sampler.released);
+  pthread_mutex_unlock(&sampler.lock);
+}
+
+long process_table_age_ms(const process_table_t *table) {
+  if (!table)
+    return -1;
+  return (long)(mg_millis() - table->sampled_at_ms);
+}
+
+const process_info_t *process_table_sorted(const process_table_t *table,
+                                           process_sort_t key) {
+  process_table_t *t = (process_table_t *)table;
+  process_info_t *sorted = NULL;
+
+  // The sampler never touches a table with readers, so only concurrent
+  // readers of the same generation can race here
+  pthread_mutex_lock(&sampler.sort_lock);
+  int n = t->ranked[key];
+  if (!t->sorted_valid[key] && t->sorted_capacity[key] < n) {
+    process_info_t *list = realloc(t->sorted[key], n * sizeof(process_info_t));
+    if (list) {
+      t->sorted[key] = list;
+      t->sorted_capacity[key] = n;
+    }
+  }
+  if (!t->sorted_valid[key] && t->sorted_capacity[key] >= n) {
+    int kept = 0;
+    for (int i = 0; i < t->count && kept < n; i++) {
+      if (ranked_by(&t->processes[i], key))
+        t->sorted[key][kept++] = t->processes[i];
+    }
+    qsort(t->sorted[key], kept, sizeof(process_info_t),
+          key == PROCESS_SORT_CPU ? compare_cpu : compare_rss);
+    t->sorted_valid[key] = 1;
+  }
+  if (t->sorted_valid[key])
+    sorted = t->sorted[key];
+  pthread_mutex_unlock(&sampler.sort_lock);
+  return sorted;
+}
+
+int process_sort_from_name(const char *name, size_t len) {
+  for (int key = 0; key < PROCESS_SORT_COUNT; key++) {
+    if (strlen(sort_names[key]) == len &&
+        strncmp(sort_names[key], name, len) == 0)
+      return key;
+  }
+  return -1;
+}
+
+const char *process_sort_name(process_sort_t key) { return sort_names[key]; }
@@ -0,0 +1,77 @@
+#ifndef PROCESS_SAMPLER_H
+#define PROCESS_SAMPLER_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Default interval between /proc scans
+#define PROCESS_SAMPLE_INTERVAL_MS 5000
+#define PROCESS_SAMPLE_MIN_INTERVAL_MS 500
+
+// Largest N served by the top-N list kept with every sample
+#define PROCESS_TOP_MAX 100
+
+// Orderings kept for every sample
+typedef enum {
+  PROCESS_SORT_RSS,
+  PROCESS_SORT_CPU,
+  PROCESS_SORT_COUNT
+} process_sort_t;
+
+// Structure to hold process information
+typedef struct {
+  int pid;
+  char name[32];
+  int rss_kb;
+  double cpu_percent; // Of one core, averaged since the previous sample
+} process_info_t;
+
+// One published generation of the process table. processes is in /proc
+// order; top[key] holds the PROCESS_TOP_MAX largest processes by that key,
+// sorted descending. Kernel threads have no user memory: they are in
+// processes and the CPU ordering but left out of the RSS one, so each
+// ordering has its own length.
+typedef struct {
+  process_info_t *processes;
+  int count;
+  int capacity;
+  process_info_t top[PROCESS_SORT_COUNT][PROCESS_TOP_MAX];
+  int top_count[PROCESS_SORT_COUNT];
+  int ranked[PROCESS_SORT_COUNT]; // Processes in each ordering
+  long long total_rss_kb;
+  long cpu_window_ms; // Time covered by cpu_percent, 0 on the first sample
+
+  // Full sorted copies, built on demand by process_table_sorted()
+  process_info_t *sorted[PROCESS_SORT_COUNT];
+  int sorted_capacity[PROCESS_SORT_COUNT];
+  int sorted_valid[PROCESS_SORT_COUNT];
+
+  unsigned long generation;
+  time_t sampled_at;
+  uint64_t sampled_at_ms; // Monotonic, for age reporting
+  int readers;            // Guarded by the sampler lock
+} process_table_t;
+
+// Sampler lifecycle. Start takes one sample synchronously so the table is
+// never empty once the server is accepting requests.
+int process_sampler_start(int interval_ms);
+void process_sampler_stop(void);
+int process_sampler_interval_ms(void);
+
+// Borrow the latest published table. Every acquire must be paired with a
+// release; keep the table only for the duration of one request.
+const process_table_t *process_table_acquire(void);
+void process_table_release(const process_table_t *table);
+long process_table_age_ms(const process_table_t *table);
+
+// The full ordering by key, table->ranked[key] entries sorted descending.
+// Sorting happens once per generation and key, on the first call, so only
+// full listings pay for it. Returns NULL if the copy cannot be allocated.
+const process_info_t *process_table_sorted(const process_table_t *table,
+                                           process_sort_t key);
+
+// Parse a ?sort= value ("ram" or "cpu"), -1 if unknown
+int process_sort_from_name(const char *name, size_t len);
+const char *process_sort_name(process_sort_t key);
+
+#endif // PROCESS_SAMPLER_H
@@ -5,92 +5,101 @@
 
 void send_json_response(struct mg_connection *c, int status,
                         const char *json_data) {
-  mg_http_reply(c, status,
-                "Content-Type: application/json\r\n"
-                "Access-Control-Allow-Origin: *\r\n"
-                "Access-Control-Allow-Headers: Content-Type, Authorization\r\n",
-                "%s", json_data);
+  mg_http_reply(c, status, JSON_RESPONSE_HEADERS, "%s", json_data);
 }
 
 void send_success_response(struct mg_connection *c, const char *message,
                            const char *data) {
-  char response[1024];
-  if (data) {
-    snprintf(response, sizeof(response),
-             "{"
-             "\"success\": true,"
-             "\"message\": \"%s\","
-             "\"data\": %s"
-             "}",
-             message, data);
-  } else {
-    snprintf(response, sizeof(response),
-             "{"
-             "\"success\": true,"
-             "\"message\": \"%s\""
-             "}",
-             message);
-  }
-  send_json_response(c, 200, response);
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  json_kv_string(&w, "message", message);
+  if (data)
+    json_kv_raw(&w, "data", data);
+  json_object_end(&w);
+  json_reply_end(&w);
 }
 
 void send_error_response(struct mg_connection *c, int status, const char *error,
                          const char *message) {
-  char response[512];
-  snprintf(response, sizeof(response),
-           "{"
-           "\"success\": false,"
-           "\"error\": \"%s\","
-           "\"message\": \"%s\""
-           "}",
-           error, message);
-  send_json_response(c, status, response);
+  json_writer_t w;
+  json_reply_begin(&w, c, status);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 0);
+  json_kv_string(&w, "error", error);
+  json_kv_string(&w, "message", message);
+  json_object_end(&w);
+  json_reply_end(&w);
 }
 
 void send_data_response(struct mg_connection *c, const char *key,
                         const char *value) {
-  char response[512];
-  snprintf(response, sizeof(response),
-           "{"
-           "\"success\": true,"
-           "\"%s\": \"%s\""
-           "}",
-           key, value);
-  send_json_response(c, 200, response);
+  json_writer_t w;
+  json_reply_begin(&w, c, 200);
+  json_object_begin(&w);
+  json_kv_bool(&w, "success", 1);
+  json_kv_string(&w, key, value);
+  json_object_end(&w);
+  json_reply_end(&w);
 }
 
-char *build_json_object(const char *key_value_pairs[], int count) {
-  char *json = malloc(2048);
-  strcpy(json, "{");
+void json_reply_begin(json_writer_t *w, struct mg_connection *c, int status) {
+  size_t start = c->send.len;
+  // Let Mongoose write the status line and a blank Content-Length field
+  mg_http_reply(c, status, JSON_RESPONSE_HEADERS, "%s", "");
+  json_writer_init_iobuf(w, &c->send);
+  w->conn = c;
+  w->reply_start = start;
+  w->body_start = c->send.len;
+}
 
-  for (int i = 0; i < count; i += 2) {
-    if (i > 0)
-      strcat(json, ",");
-    strcat(json, "\"");
-    strcat(json, key_value_pairs[i]);
-    strcat(json, "\":\"");
-    strcat(json, key_value_pairs[i + 1]);
-    strcat(json, "\"");
+void json_reply_end(json_writer_t *w) {
+  struct mg_connection *c = w->conn;
+  if (w->failed) {
+    json_reply_abort(w);
+    mg_http_reply(c, 500, "", "Internal Server Error: Out of memory");
+    return;
   }
 
-  strcat(json, "}");
-  return json;
+  // The 10-character length field sits right before "\r\n\r\n", at the same
+  // offset mg_http_reply() patches it
+  char digits[24];
+  char *end = digits + sizeof(digits);
+  char *p = end;
+  unsigned long len = (unsigned long)(c->send.len - w->body_start);
+  do {
+    *--p = (char)('0' + len % 10);
+    len /= 10;
+  } while (len > 0);
+
+  char *field = (char *)c->send.buf + w->body_start - 15;
+  memset(field, ' ', 10);
+  memcpy(field, p, end - p);
 }
 
-char *build_json_array(const char *items[], int count) {
-  char *json = malloc(1024);
-  strcpy(json, "[");
+void json_reply_abort(json_writer_t *w) {
+  w->conn->send.len = w->reply_start;
+}
 
-  for (int i = 0; i < count; i++) {
-    if (i > 0)
-      strcat(json, ",");
-    strcat(json, "\"");
-    strcat(json, items[i]);
-    strcat(json, "\"");
-  }
+char *build_json_object(const char *key_value_pairs[], int count) {
+  json_writer_t w;
+  json_writer_init(&w);
+  json_object_begin(&w);
+  for (int i = 0; i + 1 < count; i += 2)
+    json_kv_string(&w, key_value_pairs[i], key_value_pairs[i + 1]);
+  json_object_end(&w);
+  return json_writer_detach(&w);
+}
 
-  strcat(json, "]");
-  return json;
+char *build_json_array(const char *items[], int count) {
+  json_writer_t w;
+  json_writer_init(&w);
+  json_array_begin(&w);
+  for (int i = 0; i < count; i++)
+    json_string(&w, items[i]);
+  json_array_end(&w);
+  return json_writer_detach(&w);
 }
 
 void free_json_string(char *json_str) {
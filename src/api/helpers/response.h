@@ -2,6 +2,13 @@
 #define RESPONSE_H
 
 #include "../../mongoose/mongoose.h"
+#include "json_writer.h"
+
+// Headers sent with every JSON response
+#define JSON_RESPONSE_HEADERS                                                  \
+  "Content-Type: application/json\r\n"                                         \
+  "Access-Control-Allow-Origin: *\r\n"                                         \
+  "Access-Control-Allow-Headers: Content-Type, Authorization\r\n"
 
 // Response helper functions
 void send_json_response(struct mg_connection *c, int status,
@@ -13,6 +20,13 @@ void send_error_response(struct mg_connection *c, int status, const char *error,
 void send_data_response(struct mg_connection *c, const char *key,
                         const char *value);
 
+// Streaming responses: the writer appends directly to c->send and
+// json_reply_end() fills in Content-Length. json_reply_abort() discards
+// everything written since json_reply_begin() so an error can be sent.
+void json_reply_begin(json_writer_t *w, struct mg_connection *c, int status);
+void json_reply_end(json_writer_t *w);
+void json_reply_abort(json_writer_t *w);
+
 // Response builders
 char *build_json_object(const char *key_value_pairs[], int count);
 char *build_json_array(const char *items[], int count);
@@ -0,0 +1,343 @@
+#include "snapshot_scheduler.h"
+#include "db_writer.h"
+#include "process_sampler.h"
+#include "system_info.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// One periodic job. Runs start on the event loop and finish on the writer
+// thread, so the counters are guarded by the scheduler lock.
+typedef struct {
+  struct mg_timer *timer;
+  uint64_t interval_ms;
+  uint64_t due_ms;     // When the next run should fire
+  uint64_t started_ms; // When the run in flight fired
+  int in_flight;
+  unsigned long fires;
+  unsigned long runs;
+  unsigned long failures;
+  unsigned long skipped;
+  time_t last_run;
+  long last_result;
+  double last_duration_ms;
+  long last_drift_ms;
+  long max_drift_ms;
+  double total_drift_ms;
+} job_t;
+
+static struct {
+  pthread_mutex_t lock;
+  job_t snapshot;
+  job_t cleanup;
+  job_t checkpoint;
+  db_retention_t retention;
+} sched = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+int snapshot_collect(system_snapshot_t *snapshot,
+                     process_record_t **processes, long *sample_age_ms) {
+  memset(snapshot, 0, sizeof(*snapshot));
+  snapshot->timestamp = time(NULL);
+  *processes = NULL;
+  *sample_age_ms = -1;
+
+  // Parse load average (first value)
+  char *load_str = get_system_load();
+  if (load_str)
+    sscanf(load_str, "%lf", &snapshot->cpu_load);
+
+  // Get memory information from /proc/meminfo
+  FILE *meminfo = fopen("/proc/meminfo", "r");
+  if (meminfo) {
+    char line[128];
+    while (fgets(line, sizeof(line), meminfo)) {
+      if (sscanf(line, "MemTotal: %d kB", &snapshot->memory_total_kb))
+        continue;
+      if (sscanf(line, "MemFree: %d kB", &snapshot->memory_free_kb))
+        continue;
+    }
+    fclose(meminfo);
+  }
+
+  snapshot->memory_used_kb =
+      snapshot->memory_total_kb - snapshot->memory_free_kb;
+  if (snapshot->memory_total_kb > 0) {
+    snapshot->memory_usage_percent = (double)snapshot->memory_used_kb /
+                                     snapshot->memory_total_kb * 100.0;
+  }
+
+  // Get process information from the sampler's latest table
+  process_record_t *records = NULL;
+  int count = 0;
+  const process_table_t *table = process_table_acquire();
+
+  if (table && table->ranked[PROCESS_SORT_RSS] > 0) {
+    // Records are stored with their rank, so this needs the full order.
+    // Kernel threads are not in it; they have no RSS to record.
+    const process_info_t *sorted =
+        process_table_sorted(table, PROCESS_SORT_RSS);
+    if (sorted)
+      records = calloc(table->ranked[PROCESS_SORT_RSS],
+                       sizeof(process_record_t));
+    if (records) {
+      count = table->ranked[PROCESS_SORT_RSS];
+      for (int i = 0; i < count; i++) {
+        records[i].pid = sorted[i].pid;
+        snprintf(records[i].process_name, sizeof(records[i].process_name),
+                 "%s", sorted[i].name);
+        records[i].ram_kb = sorted[i].rss_kb;
+        records[i].cpu_percent = sorted[i].cpu_percent;
+        records[i].rank_position = i + 1;
+      }
+
+      snapshot->total_processes = count;
+      snapshot->total_ram_kb = (int)table->total_rss_kb;
+      strncpy(snapshot->top_process, sorted[0].name, 63);
+      snapshot->top_process_ram_kb = sorted[0].rss_kb;
+    }
+    *sample_age_ms = process_table_age_ms(table);
+  }
+  process_table_release(table);
+
+  *processes = records;
+  return count;
+}
+
+// Record how late the timer fired. Mongoose has already moved the timer to
+// its next expiry, which stays phase-locked unless a whole period was
+// missed. Returns 0 if the job may run now.
+static int begin_run(job_t *job) {
+  uint64_t now = mg_millis();
+  uint64_t due = job->due_ms ? job->due_ms : job->timer->expire -
+                                                 job->interval_ms;
+  job->due_ms = job->timer->expire;
+
+  long drift = (long)((int64_t)now - (int64_t)due);
+  job->fires++;
+  job->last_drift_ms = drift;
+  job->total_drift_ms += drift;
+  if (drift > job->max_drift_ms)
+    job->max_drift_ms = drift;
+
+  if (job->in_flight) {
+    job->skipped++;
+    return -1;
+  }
+  job->in_flight = 1;
+  job->started_ms = now;
+  return 0;
+}
+
+static void finish_run(job_t *job, int status, long result) {
+  pthread_mutex_lock(&sched.lock);
+  job->in_flight = 0;
+  job->runs++;
+  job->last_run = time(NULL);
+  job->last_duration_ms = (double)(mg_millis() - job->started_ms);
+  if (status == 0)
+    job->last_result = result;
+  else
+    job->failures++;
+  pthread_mutex_unlock(&sched.lock);
+}
+
+static void snapshot_done(int status, const db_save_result_t *result,
+                          void *arg) {
+  (void)arg;
+  if (status != 0)
+    fprintf(stderr, "Scheduled snapshot failed\n");
+  finish_run(&sched.snapshot, status, status == 0 ? result->snapshot_id : 0);
+}
+
+static void run_snapshot(void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&sched.lock);
+  int rc = begin_run(&sched.snapshot);
+  pthread_mutex_unlock(&sched.lock);
+  if (rc != 0)
+    return;
+
+  system_snapshot_t snapshot;
+  process_record_t *processes;
+  long sample_age_ms;
+  int count = snapshot_collect(&snapshot, &processes, &sample_age_ms);
+
+  // The writer frees processes once the snapshot is committed
+  db_save_result_t result = {0};
+  rc = db_writer_save_snapshot(&snapshot, processes, count, snapshot_done,
+                               NULL);
+  if (rc == DB_WRITER_QUEUED)
+    return;
+
+  int status = -1;
+  if (rc == DB_WRITER_INLINE &&
+      db_save_snapshot_now(&snapshot, processes, count, &result) > 0)
+    status = 0;
+  free(processes);
+  snapshot_done(status, &result, NULL);
+}
+
+static void cleanup_done(int status, const db_save_result_t *result,
+                         void *arg) {
+  (void)arg;
+  int deleted = result->rows_written;
+  if (status == 0 && deleted > 0) {
+    char desc[128];
+    snprintf(desc, sizeof(desc), "Retention deleted %d rows", deleted);
+    db_log_event("MAINTENANCE", desc, NULL);
+  } else if (status != 0) {
+    fprintf(stderr, "Scheduled cleanup failed\n");
+  }
+  finish_run(&sched.cleanup, status, deleted);
+}
+
+static void run_cleanup(void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&sched.lock);
+  int rc = begin_run(&sched.cleanup);
+  pthread_mutex_unlock(&sched.lock);
+  if (rc != 0)
+    return;
+
+  rc = db_writer_retention(&sched.retention, cleanup_done, NULL);
+  if (rc == DB_WRITER_QUEUED)
+    return;
+
+  // Without the writer, steps run back to back on the event loop
+  db_save_result_t result = {0};
+  int deleted = rc == DB_WRITER_INLINE ? db_retention_run(&sched.retention)
+                                       : -1;
+  if (deleted > 0)
+    result.rows_written = deleted;
+  cleanup_done(deleted < 0 ? -1 : 0, &result, NULL);
+}
+
+static void checkpoint_done(int status, const db_save_result_t *result,
+                            void *arg) {
+  (void)result;
+  (void)arg;
+  db_persist_stats_t stats;
+  db_persist_get_stats(&stats);
+  if (status != 0)
+    fprintf(stderr, "Scheduled checkpoint failed\n");
+  finish_run(&sched.checkpoint, status, (long)stats.last_bytes);
+}
+
+static void run_checkpoint(void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&sched.lock);
+  int rc = begin_run(&sched.checkpoint);
+  pthread_mutex_unlock(&sched.lock);
+  if (rc != 0)
+    return;
+
+  rc = db_writer_checkpoint(checkpoint_done, NULL);
+  if (rc == DB_WRITER_QUEUED)
+    return;
+
+  int status = rc == DB_WRITER_INLINE ? db_persist_checkpoint() : -1;
+  checkpoint_done(status, NULL, NULL);
+}
+
+static int add_job(struct mg_mgr *mgr, job_t *job, int interval_s,
+                   unsigned flags, void (*fn)(void *)) {
+  job->interval_ms = (uint64_t)interval_s * 1000;
+  job->timer = mg_timer_add(mgr, job->interval_ms, MG_TIMER_REPEAT | flags,
+                            fn, NULL);
+  return job->timer ? 0 : -1;
+}
+
+int snapshot_scheduler_start(struct mg_mgr *mgr, int snapshot_interval_s,
+                             int cleanup_interval_s,
+                             const db_retention_t *retention,
+                             int checkpoint_interval_s) {
+  if (snapshot_interval_s > 0) {
+    if (snapshot_interval_s < SNAPSHOT_MIN_INTERVAL_S)
+      snapshot_interval_s = SNAPSHOT_MIN_INTERVAL_S;
+    if (add_job(mgr, &sched.snapshot, snapshot_interval_s, 0,
+                run_snapshot) != 0)
+      return -1;
+    printf("Snapshot scheduler: every %d s\n", snapshot_interval_s);
+  }
+
+  // Retention is applied once at startup, then on its own period
+  if (cleanup_interval_s > 0 &&
+      (retention->snapshot_days > 0 || retention->event_days > 0 ||
+       retention->network_days > 0)) {
+    sched.retention = *retention;
+    if (add_job(mgr, &sched.cleanup, cleanup_interval_s, MG_TIMER_RUN_NOW,
+                run_cleanup) != 0)
+      return -1;
+    printf("Snapshot scheduler: keep snapshots %d, events %d, network %d "
+           "days, cleanup every %d s\n",
+           retention->snapshot_days, retention->event_days,
+           retention->network_days, cleanup_interval_s);
+  }
+
+  db_persist_stats_t persist;
+  db_persist_get_stats(&persist);
+  if (checkpoint_interval_s > 0 && persist.enabled) {
+    if (add_job(mgr, &sched.checkpoint, checkpoint_interval_s, 0,
+                run_checkpoint) != 0)
+      return -1;
+    printf("Snapshot scheduler: checkpoint every %d s\n",
+           checkpoint_interval_s);
+  }
+  return 0;
+}
+
+void snapshot_scheduler_stop(void) {
+  pthread_mutex_lock(&sched.lock);
+  memset(&sched.snapshot, 0, sizeof(sched.snapshot));
+  memset(&sched.cleanup, 0, sizeof(sched.cleanup));
+  memset(&sched.checkpoint, 0, sizeof(sched.checkpoint));
+  memset(&sched.retention, 0, sizeof(sched.retention));
+  pthread_mutex_unlock(&sched.lock);
+}
+
+// Timers are only touched on the event loop, so expire needs no lock
+static long until_due_ms(const job_t *job, uint64_t now) {
+  if (!job->timer || job->timer->expire == 0)
+    return -1;
+  return job->timer->expire > now ? (long)(job->timer->expire - now) : 0;
+}
+
+int snapshot_scheduler_poll_ms(int max_ms) {
+  uint64_t now = mg_millis();
+  long due[3] = {until_due_ms(&sched.snapshot, now),
+                 until_due_ms(&sched.cleanup, now),
+                 until_due_ms(&sched.checkpoint, now)};
+  for (int i = 0; i < 3; i++) {
+    if (due[i] >= 0 && due[i] < max_ms)
+      max_ms = (int)due[i];
+  }
+  return max_ms;
+}
+
+static void job_stats(const job_t *job, uint64_t now,
+                      scheduler_job_stats_t *stats) {
+  stats->enabled = job->timer != NULL;
+  stats->interval_ms = (long)job->interval_ms;
+  stats->runs = job->runs;
+  stats->failures = job->failures;
+  stats->skipped = job->skipped;
+  stats->last_run = job->last_run;
+  stats->last_result = job->last_result;
+  stats->last_duration_ms = job->last_duration_ms;
+  stats->last_drift_ms = job->last_drift_ms;
+  stats->max_drift_ms = job->max_drift_ms;
+  stats->avg_drift_ms =
+      job->fires ? job->total_drift_ms / (double)job->fires : 0.0;
+  stats->next_run_in_ms = until_due_ms(job, now);
+}
+
+void snapshot_scheduler_get_stats(snapshot_scheduler_stats_t *stats) {
+  uint64_t now = mg_millis();
+  pthread_mutex_lock(&sched.lock);
+  job_stats(&sched.snapshot, now, &stats->snapshot);
+  job_stats(&sched.cleanup, now, &stats->cleanup);
+  job_stats(&sched.checkpoint, now, &stats->checkpoint);
+  stats->retention = sched.retention;
+  pthread_mutex_unlock(&sched.lock);
+}
@@ -0,0 +1,62 @@
+#ifndef SNAPSHOT_SCHEDULER_H
+#define SNAPSHOT_SCHEDULER_H
+
+#include "../../mongoose/mongoose.h"
+#include "database.h"
+#include <time.h>
+
+// Retention runs every five minutes unless configured otherwise; each run
+// only has the data that expired since the last one to delete
+#define SNAPSHOT_CLEANUP_INTERVAL_S 300
+
+// Shortest snapshot period accepted
+#define SNAPSHOT_MIN_INTERVAL_S 1
+
+typedef struct {
+  int enabled;
+  long interval_ms;
+  unsigned long runs;
+  unsigned long failures;
+  unsigned long skipped; // Previous run still in the writer queue
+  time_t last_run;
+  long last_result; // Snapshot id, rows deleted, or checkpoint bytes
+  double last_duration_ms;
+  long last_drift_ms;
+  long max_drift_ms;
+  double avg_drift_ms;
+  long next_run_in_ms;
+} scheduler_job_stats_t;
+
+typedef struct {
+  scheduler_job_stats_t snapshot;
+  scheduler_job_stats_t cleanup;
+  scheduler_job_stats_t checkpoint;
+  db_retention_t retention;
+} snapshot_scheduler_stats_t;
+
+// Capture the current system state and the latest process table, ranked by
+// RSS. *processes is malloc'd and NULL when no table is available. Returns
+// the number of process records.
+int snapshot_collect(system_snapshot_t *snapshot,
+                     process_record_t **processes, long *sample_age_ms);
+
+// Take a snapshot every snapshot_interval_s seconds, apply the retention
+// policy every cleanup_interval_s seconds and, when db_persist_init() has
+// set up a persistent copy, checkpoint every checkpoint_interval_s
+// seconds. 0 turns a job off, as does a policy that keeps everything. The
+// jobs run as timers on the event loop and hand their work to the database
+// writer.
+int snapshot_scheduler_start(struct mg_mgr *mgr, int snapshot_interval_s,
+                             int cleanup_interval_s,
+                             const db_retention_t *retention,
+                             int checkpoint_interval_s);
+
+// Forget the timers, which mg_mgr_free() releases
+void snapshot_scheduler_stop(void);
+
+// Poll timeout that wakes the event loop in time for the next due job
+int snapshot_scheduler_poll_ms(int max_ms);
+
+void snapshot_scheduler_get_stats(snapshot_scheduler_stats_t *stats);
+
+#endif // SNAPSHOT_SCHEDULER_H
@@ -1,4 +1,5 @@
 #include "system_info.h"
+#include "uci_config.h"
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -6,7 +7,8 @@
 
 char *get_system_uptime(void) {
   FILE *fp = fopen("/proc/uptime", "r");
-  static char uptime[64];
+  // Per-thread, like run_command()'s buffer
+  static __thread char uptime[64];
   if (fp) {
     fscanf(fp, "%s", uptime);
     fclose(fp);
@@ -17,7 +19,9 @@ char *get_system_uptime(void) {
 
 char *get_system_load(void) {
   FILE *fp = fopen("/proc/loadavg", "r");
-  static char load[128];
+  // Per-thread: snapshots read it on the worker pool while the event loop
+  // serves /api/system/load
+  static __thread char load[128];
   if (fp) {
     fgets(load, sizeof(load), fp);
     fclose(fp);
@@ -29,7 +33,8 @@ char *get_system_load(void) {
 
 char *get_memory_info(void) {
   FILE *fp = fopen("/proc/meminfo", "r");
-  static char mem_info[512];
+  // Per-thread, like run_command()'s buffer
+  static __thread char mem_info[512];
   char line[128];
   int total = 0, free = 0, available = 0;
 
@@ -85,7 +90,8 @@ char *get_hostname(void) {
 
 char *run_command(const char *command) {
   FILE *fp = popen(command, "r");
-  static char result[512];
+  // Per-thread so blocking handlers on the worker pool do not clobber it
+  static __thread char result[512];
 
   if (fp) {
     fgets(result, sizeof(result), fp);
@@ -105,9 +111,11 @@ char *get_openwrt_version(void) {
 }
 
 char *get_uci_config(const char *config_name) {
-  char command[128];
-  snprintf(command, sizeof(command), "uci show %s 2>/dev/null", config_name);
-  return run_command(command);
+  // Per-thread, like run_command()'s buffer
+  static __thread char result[4096];
+  if (uci_config_show(config_name, result, sizeof(result)) < 0)
+    return "";
+  return result;
 }
 
 int file_exists(const char *filename) {
@@ -1,7 +1,8 @@
 #ifndef SYSTEM_INFO_H
 #define SYSTEM_INFO_H
 
-// System information functions
+// System information functions. The uptime, load and memory strings live in
+// per-thread buffers, valid until the same thread calls again.
 char *get_system_uptime(void);
 char *get_system_load(void);
 char *get_memory_info(void);
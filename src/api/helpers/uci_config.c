@@ -0,0 +1,518 @@
+#include "uci_config.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+  char *name;
+  char **values; // One for an option, one per item for a list
+  int count;
+  int is_list;
+} uci_option_t;
+
+typedef struct {
+  char *type;
+  char *name; // NULL for an anonymous section
+  uci_option_t *options;
+  int option_count;
+} uci_section_t;
+
+// A parsed package. Missing files are cached as well, so endpoints that
+// fall back to a default do not retry the open on every request.
+typedef struct {
+  char name[64];
+  int loaded;
+  int exists;
+  unsigned long last_used;
+  struct stat stamp; // Compared on each read when inotify is unavailable
+  uci_section_t *sections;
+  int section_count;
+} uci_package_t;
+
+static struct {
+  pthread_mutex_t lock;
+  char dir[256];
+  int watching; // inotify has been tried for dir
+  int inotify_fd;
+  unsigned long clock;
+  uci_package_t packages[UCI_CONFIG_MAX_PACKAGES];
+} uci = {.lock = PTHREAD_MUTEX_INITIALIZER,
+         .dir = UCI_CONFIG_DIR,
+         .inotify_fd = -1};
+
+static void package_free(uci_package_t *pkg) {
+  for (int i = 0; i < pkg->section_count; i++) {
+    uci_section_t *section = &pkg->sections[i];
+    for (int j = 0; j < section->option_count; j++) {
+      uci_option_t *option = &section->options[j];
+      for (int k = 0; k < option->count; k++)
+        free(option->values[k]);
+      free(option->values);
+      free(option->name);
+    }
+    free(section->options);
+    free(section->type);
+    free(section->name);
+  }
+  free(pkg->sections);
+  memset(pkg, 0, sizeof(*pkg));
+}
+
+static void invalidate(const char *name) {
+  for (int i = 0; i < UCI_CONFIG_MAX_PACKAGES; i++) {
+    uci_package_t *pkg = &uci.packages[i];
+    if (pkg->loaded && (!name || strcmp(pkg->name, name) == 0))
+      package_free(pkg);
+  }
+}
+
+static void unwatch(void) {
+  if (uci.inotify_fd >= 0)
+    close(uci.inotify_fd);
+  uci.inotify_fd = -1;
+}
+
+// Watch the directory rather than each file: uci commits by renaming a
+// new file over the old one, which a watch on the file would miss
+static void watch_start(void) {
+  if (uci.watching)
+    return;
+  uci.watching = 1;
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0)
+    return;
+  if (inotify_add_watch(fd, uci.dir,
+                        IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                            IN_CREATE | IN_DELETE | IN_DELETE_SELF |
+                            IN_MOVE_SELF) < 0) {
+    close(fd);
+    return;
+  }
+  uci.inotify_fd = fd;
+}
+
+// Drop the packages whose files changed since the last read
+static void drain_events(void) {
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t n;
+  while (uci.inotify_fd >= 0 &&
+         (n = read(uci.inotify_fd, buf, sizeof(buf))) > 0) {
+    for (char *p = buf; p < buf + n;) {
+      const struct inotify_event *ev = (const struct inotify_event *)p;
+      p += sizeof(*ev) + ev->len;
+      if (ev->mask & IN_Q_OVERFLOW) {
+        invalidate(NULL);
+      } else if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+        // The directory itself went away; fall back to stat()
+        invalidate(NULL);
+        unwatch();
+        break;
+      } else if (ev->len > 0) {
+        invalidate(ev->name);
+      }
+    }
+  }
+}
+
+static int is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+// Read one token, unquoting it in place. Quoted and bare parts run
+// together until whitespace, as in uci's own parser. Returns NULL at the
+// end of the line or at a comment.
+static char *next_token(char **p) {
+  char *s = *p;
+  while (is_space(*s))
+    s++;
+  if (*s == '\0' || *s == '#') {
+    *p = s;
+    return NULL;
+  }
+
+  char *start = s;
+  char *out = s;
+  while (*s && !is_space(*s)) {
+    if (*s == '\'') {
+      for (s++; *s && *s != '\''; s++)
+        *out++ = *s;
+      if (*s)
+        s++;
+    } else if (*s == '"') {
+      for (s++; *s && *s != '"'; s++) {
+        if (*s == '\\' && s[1])
+          s++;
+        *out++ = *s;
+      }
+      if (*s)
+        s++;
+    } else {
+      if (*s == '\\' && s[1])
+        s++;
+      *out++ = *s++;
+    }
+  }
+  *p = *s ? s + 1 : s;
+  *out = '\0';
+  return start;
+}
+
+static uci_section_t *add_section(uci_package_t *pkg, const char *type,
+                                  const char *name) {
+  // A named section that appears again is merged into the first one
+  for (int i = 0; name && i < pkg->section_count; i++) {
+    uci_section_t *section = &pkg->sections[i];
+    if (section->name && strcmp(section->name, name) == 0) {
+      char *copy = strdup(type);
+      if (!copy)
+        return NULL;
+      free(section->type);
+      section->type = copy;
+      return section;
+    }
+  }
+
+  uci_section_t *sections = realloc(
+      pkg->sections, (pkg->section_count + 1) * sizeof(uci_section_t));
+  if (!sections)
+    return NULL;
+  pkg->sections = sections;
+  uci_section_t *section = &sections[pkg->section_count];
+  memset(section, 0, sizeof(*section));
+  section->type = strdup(type);
+  section->name = name ? strdup(name) : NULL;
+  if (!section->type || (name && !section->name)) {
+    free(section->type);
+    free(section->name);
+    return NULL;
+  }
+  pkg->section_count++;
+  return section;
+}
+
+static int set_option(uci_section_t *section, const char *name,
+                      const char *value, int is_list) {
+  uci_option_t *option = NULL;
+  for (int i = 0; i < section->option_count; i++) {
+    if (strcmp(section->options[i].name, name) == 0)
+      option = &section->options[i];
+  }
+
+  if (!option) {
+    uci_option_t *options =
+        realloc(section->options,
+                (section->option_count + 1) * sizeof(uci_option_t));
+    if (!options)
+      return -1;
+    section->options = options;
+    option = &options[section->option_count];
+    memset(option, 0, sizeof(*option));
+    option->name = strdup(name);
+    if (!option->name)
+      return -1;
+    section->option_count++;
+  }
+
+  // An option replaces whatever was there; a list item appends to a list
+  if (!is_list || !option->is_list) {
+    for (int i = 0; i < option->count; i++)
+      free(option->values[i]);
+    option->count = 0;
+  }
+  option->is_list = is_list;
+
+  char **values =
+      realloc(option->values, (option->count + 1) * sizeof(char *));
+  if (!values)
+    return -1;
+  option->values = values;
+  values[option->count] = strdup(value);
+  if (!values[option->count])
+    return -1;
+  option->count++;
+  return 0;
+}
+
+static int parse_package(uci_package_t *pkg, char *text) {
+  uci_section_t *section = NULL;
+  for (char *line = text; line;) {
+    char *next = strchr(line, '\n');
+    if (next)
+      *next++ = '\0';
+
+    char *p = line;
+    const char *keyword = next_token(&p);
+    if (keyword && strcmp(keyword, "config") == 0) {
+      const char *type = next_token(&p);
+      const char *name = type ? next_token(&p) : NULL;
+      section = type ? add_section(pkg, type, name) : NULL;
+      if (type && !section)
+        return -1;
+    } else if (keyword && section &&
+               (strcmp(keyword, "option") == 0 ||
+                strcmp(keyword, "list") == 0)) {
+      const char *name = next_token(&p);
+      const char *value = name ? next_token(&p) : NULL;
+      if (value && set_option(section, name, value, keyword[0] == 'l') != 0)
+        return -1;
+    }
+    line = next;
+  }
+  return 0;
+}
+
+static int package_load(uci_package_t *pkg, const char *name) {
+  memset(pkg, 0, sizeof(*pkg));
+  snprintf(pkg->name, sizeof(pkg->name), "%s", name);
+  pkg->loaded = 1;
+  pkg->last_used = ++uci.clock;
+
+  char path[sizeof(uci.dir) + sizeof(pkg->name) + 1];
+  snprintf(path, sizeof(path), "%s/%s", uci.dir, name);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return 0;
+
+  char *text = NULL;
+  int rc = -1;
+  if (fstat(fd, &pkg->stamp) == 0 &&
+      (text = malloc((size_t)pkg->stamp.st_size + 1)) != NULL) {
+    ssize_t n = read(fd, text, (size_t)pkg->stamp.st_size);
+    if (n >= 0) {
+      text[n] = '\0';
+      pkg->exists = 1;
+      rc = parse_package(pkg, text);
+    }
+  }
+  free(text);
+  close(fd);
+  if (rc != 0)
+    package_free(pkg);
+  return rc;
+}
+
+// Without inotify, a cached package is only good while its file is the
+// same one, unchanged
+static int package_stale(const uci_package_t *pkg) {
+  char path[sizeof(uci.dir) + sizeof(pkg->name) + 1];
+  snprintf(path, sizeof(path), "%s/%s", uci.dir, pkg->name);
+  struct stat st;
+  int exists = stat(path, &st) == 0;
+  if (exists != pkg->exists)
+    return 1;
+  return exists && (st.st_ino != pkg->stamp.st_ino ||
+                    st.st_size != pkg->stamp.st_size ||
+                    st.st_mtim.tv_sec != pkg->stamp.st_mtim.tv_sec ||
+                    st.st_mtim.tv_nsec != pkg->stamp.st_mtim.tv_nsec);
+}
+
+// The parsed package, or NULL if there is no such file. Called with the
+// lock held; the result is only valid until it is released.
+static const uci_package_t *package_get(const char *name) {
+  // Package names are file names inside the directory, nothing more
+  if (!*name || *name == '.' || strchr(name, '/') ||
+      strlen(name) >= sizeof(uci.packages[0].name))
+    return NULL;
+
+  watch_start();
+  drain_events();
+
+  uci_package_t *slot = &uci.packages[0];
+  for (int i = 0; i < UCI_CONFIG_MAX_PACKAGES; i++) {
+    uci_package_t *pkg = &uci.packages[i];
+    if (pkg->loaded && strcmp(pkg->name, name) == 0) {
+      if (uci.inotify_fd < 0 && package_stale(pkg)) {
+        package_free(pkg);
+        slot = pkg;
+        break;
+      }
+      pkg->last_used = ++uci.clock;
+      return pkg->exists ? pkg : NULL;
+    }
+    // Otherwise load into a free slot, or the least recently used one
+    if (slot->loaded && (!pkg->loaded || pkg->last_used < slot->last_used))
+      slot = pkg;
+  }
+
+  package_free(slot);
+  if (package_load(slot, name) != 0)
+    return NULL;
+  return slot->exists ? slot : NULL;
+}
+
+// Resolve "name" or "@type[index]"; a negative index counts from the end
+static const uci_section_t *find_section(const uci_package_t *pkg,
+                                         const char *ref) {
+  if (*ref != '@') {
+    for (int i = 0; i < pkg->section_count; i++) {
+      const uci_section_t *section = &pkg->sections[i];
+      if (section->name && strcmp(section->name, ref) == 0)
+        return section;
+    }
+    return NULL;
+  }
+
+  char type[64];
+  int index = 0;
+  const char *bracket = strchr(ref, '[');
+  size_t type_len = bracket ? (size_t)(bracket - ref - 1) : strlen(ref + 1);
+  if (type_len == 0 || type_len >= sizeof(type) ||
+      (bracket && sscanf(bracket, "[%d]", &index) != 1))
+    return NULL;
+  memcpy(type, ref + 1, type_len);
+  type[type_len] = '\0';
+
+  int matches = 0;
+  for (int i = 0; i < pkg->section_count; i++)
+    matches += strcmp(pkg->sections[i].type, type) == 0;
+  if (index < 0)
+    index += matches;
+  if (index < 0 || index >= matches)
+    return NULL;
+
+  for (int i = 0; i < pkg->section_count; i++) {
+    const uci_section_t *section = &pkg->sections[i];
+    if (strcmp(section->type, type) == 0 && index-- == 0)
+      return section;
+  }
+  return NULL;
+}
+
+// Append n bytes to a NUL-terminated buffer, truncating at size
+static void append_n(char *out, size_t size, size_t *len, const char *s,
+                     size_t n) {
+  if (n > size - *len - 1)
+    n = size - *len - 1;
+  memcpy(out + *len, s, n);
+  *len += n;
+  out[*len] = '\0';
+}
+
+static void append(char *out, size_t size, size_t *len, const char *s) {
+  append_n(out, size, len, s, strlen(s));
+}
+
+int uci_config_get(const char *path, char *value, size_t size) {
+  char ref[256];
+  if (size == 0 || strlen(path) >= sizeof(ref))
+    return -1;
+  strcpy(ref, path);
+
+  // package.section[.option]; section names never contain dots
+  char *section_ref = strchr(ref, '.');
+  if (!section_ref)
+    return -1;
+  *section_ref++ = '\0';
+  char *option_name = strchr(section_ref, '.');
+  if (option_name)
+    *option_name++ = '\0';
+
+  int rc = -1;
+  pthread_mutex_lock(&uci.lock);
+  const uci_package_t *pkg = package_get(ref);
+  const uci_section_t *section = pkg ? find_section(pkg, section_ref) : NULL;
+  if (section && !option_name) {
+    snprintf(value, size, "%s", section->type);
+    rc = 0;
+  }
+  for (int i = 0; section && option_name && i < section->option_count; i++) {
+    const uci_option_t *option = &section->options[i];
+    if (strcmp(option->name, option_name) != 0)
+      continue;
+    size_t len = 0;
+    value[0] = '\0';
+    for (int j = 0; j < option->count; j++) {
+      if (j > 0)
+        append(value, size, &len, " ");
+      append(value, size, &len, option->values[j]);
+    }
+    rc = 0;
+    break;
+  }
+  pthread_mutex_unlock(&uci.lock);
+  return rc;
+}
+
+// Quote a value as uci show does, closing the quotes around a '
+static void append_quoted(char *out, size_t size, size_t *len,
+                          const char *value) {
+  append(out, size, len, "'");
+  for (const char *q; (q = strchr(value, '\'')) != NULL; value = q + 1) {
+    append_n(out, size, len, value, (size_t)(q - value));
+    append(out, size, len, "'\\''");
+  }
+  append(out, size, len, value);
+  append(out, size, len, "'");
+}
+
+int uci_config_show(const char *package, char *out, size_t size) {
+  if (size == 0)
+    return -1;
+  out[0] = '\0';
+
+  pthread_mutex_lock(&uci.lock);
+  const uci_package_t *pkg = package_get(package);
+  if (!pkg) {
+    pthread_mutex_unlock(&uci.lock);
+    return -1;
+  }
+
+  size_t len = 0;
+  int lines = 0;
+  for (int i = 0; i < pkg->section_count; i++) {
+    const uci_section_t *section = &pkg->sections[i];
+
+    // Anonymous sections are shown by their position among their type
+    char label[128];
+    if (section->name) {
+      snprintf(label, sizeof(label), "%s", section->name);
+    } else {
+      int index = 0;
+      for (int j = 0; j < i; j++)
+        index += strcmp(pkg->sections[j].type, section->type) == 0;
+      snprintf(label, sizeof(label), "@%s[%d]", section->type, index);
+    }
+
+    append(out, size, &len, pkg->name);
+    append(out, size, &len, ".");
+    append(out, size, &len, label);
+    append(out, size, &len, "=");
+    append(out, size, &len, section->type);
+    append(out, size, &len, "\n");
+    lines++;
+
+    for (int j = 0; j < section->option_count; j++) {
+      const uci_option_t *option = &section->options[j];
+      append(out, size, &len, pkg->name);
+      append(out, size, &len, ".");
+      append(out, size, &len, label);
+      append(out, size, &len, ".");
+      append(out, size, &len, option->name);
+      append(out, size, &len, "=");
+      for (int k = 0; k < option->count; k++) {
+        if (k > 0)
+          append(out, size, &len, " ");
+        append_quoted(out, size, &len, option->values[k]);
+      }
+      append(out, size, &len, "\n");
+      lines++;
+    }
+  }
+  pthread_mutex_unlock(&uci.lock);
+  return lines;
+}
+
+int uci_config_set_dir(const char *dir) {
+  if (strlen(dir) >= sizeof(uci.dir))
+    return -1;
+  pthread_mutex_lock(&uci.lock);
+  snprintf(uci.dir, sizeof(uci.dir), "%s", dir);
+  invalidate(NULL);
+  unwatch();
+  uci.watching = 0;
+  pthread_mutex_unlock(&uci.lock);
+  return 0;
+}
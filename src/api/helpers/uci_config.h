@@ -0,0 +1,32 @@
+#ifndef UCI_CONFIG_H
+#define UCI_CONFIG_H
+
+#include <stddef.h>
+
+// Where OpenWrt keeps its UCI packages
+#define UCI_CONFIG_DIR "/etc/config"
+
+// Packages held in memory at once; loading another evicts the least
+// recently read one
+#define UCI_CONFIG_MAX_PACKAGES 16
+
+// Read UCI packages from another directory, such as a copy of /etc/config
+// used as a fixture. Drops everything cached. Returns 0, or -1 if the path
+// does not fit.
+int uci_config_set_dir(const char *dir);
+
+// Look up a value the way `uci get` does: "network.lan.ipaddr",
+// "wireless.@wifi-iface[0].ssid" or "network.lan" for a section's type.
+// List items are joined with spaces. Returns 0 with the value copied to
+// value (truncated to size), or -1 if it is not set.
+//
+// Packages are parsed once and kept until inotify reports that their file
+// changed; without inotify the file's stat() is checked on every read.
+int uci_config_get(const char *path, char *value, size_t size);
+
+// Write a package the way `uci show` does, one line per section and
+// option, into out (truncated to size). Returns the number of lines, or -1
+// if the package does not exist.
+int uci_config_show(const char *package, char *out, size_t size);
+
+#endif // UCI_CONFIG_H
@@ -0,0 +1,195 @@
+#include "wifi_scan.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  wifi_scan_job_t info;
+  uint64_t finished_ms; // Monotonic, for age reporting
+  nl80211_bss_t *results;
+} job_t;
+
+static struct {
+  pthread_mutex_t lock;           // Guards everything below
+  job_t jobs[WIFI_SCAN_MAX_JOBS]; // Job id lives at id % WIFI_SCAN_MAX_JOBS
+  unsigned last_id;
+  unsigned running; // Id of the job in flight, or 0
+  unsigned latest;  // Id of the newest completed job, or 0
+  pthread_t thread;
+  int joinable; // The last job's thread has not been joined
+} scans = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static uint64_t monotonic_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+typedef struct {
+  nl80211_bss_t *items;
+  int count;
+  int capacity;
+} bss_list_t;
+
+static int collect_bss(const nl80211_bss_t *bss, void *ctx) {
+  bss_list_t *list = ctx;
+  if (list->count == WIFI_SCAN_MAX_RESULTS)
+    return 1;
+  if (list->count == list->capacity) {
+    int grown = list->capacity ? list->capacity * 2 : 32;
+    nl80211_bss_t *bigger = realloc(list->items, grown * sizeof(*bigger));
+    if (!bigger)
+      return 1;
+    list->items = bigger;
+    list->capacity = grown;
+  }
+  list->items[list->count++] = *bss;
+  return 0;
+}
+
+// Strongest first; networks without a signal reading go last
+static int compare_signal(const void *a, const void *b) {
+  int sa = ((const nl80211_bss_t *)a)->signal_mbm;
+  int sb = ((const nl80211_bss_t *)b)->signal_mbm;
+  if (sa == 0 || sb == 0)
+    return (sa == 0) - (sb == 0);
+  return (sa < sb) - (sa > sb);
+}
+
+static void *scan_main(void *arg) {
+  unsigned id = (unsigned)(uintptr_t)arg;
+  bss_list_t list = {NULL, 0, 0};
+  int found = nl80211_scan(collect_bss, &list);
+  if (found >= 0)
+    qsort(list.items, (size_t)list.count, sizeof(*list.items),
+          compare_signal);
+
+  pthread_mutex_lock(&scans.lock);
+  job_t *job = &scans.jobs[id % WIFI_SCAN_MAX_JOBS];
+  job->info.finished = time(NULL);
+  job->finished_ms = monotonic_ms();
+  if (found < 0) {
+    job->info.status = WIFI_SCAN_FAILED;
+    snprintf(job->info.error, sizeof(job->info.error),
+             "No wireless radio could scan");
+    free(list.items);
+  } else {
+    job->info.status = WIFI_SCAN_DONE;
+    job->info.count = list.count;
+    job->results = list.items;
+    scans.latest = id;
+  }
+  scans.running = 0;
+  pthread_mutex_unlock(&scans.lock);
+  return NULL;
+}
+
+unsigned wifi_scan_start(int *joined) {
+  pthread_mutex_lock(&scans.lock);
+  if (scans.running) {
+    scans.jobs[scans.running % WIFI_SCAN_MAX_JOBS].info.requests++;
+    *joined = 1;
+    unsigned id = scans.running;
+    pthread_mutex_unlock(&scans.lock);
+    return id;
+  }
+  *joined = 0;
+
+  // The previous job's thread has returned, or is about to
+  if (scans.joinable) {
+    pthread_join(scans.thread, NULL);
+    scans.joinable = 0;
+  }
+
+  unsigned id = ++scans.last_id;
+  if (id == 0)
+    id = ++scans.last_id;
+  // The slot's previous job is forgotten, even if it is the latest result
+  job_t *job = &scans.jobs[id % WIFI_SCAN_MAX_JOBS];
+  if (scans.latest && job->info.id == scans.latest)
+    scans.latest = 0;
+  free(job->results);
+  memset(job, 0, sizeof(*job));
+  job->info.id = id;
+  job->info.status = WIFI_SCAN_RUNNING;
+  job->info.started = time(NULL);
+  job->info.requests = 1;
+
+  if (pthread_create(&scans.thread, NULL, scan_main, (void *)(uintptr_t)id) !=
+      0) {
+    job->info.id = 0;
+    pthread_mutex_unlock(&scans.lock);
+    return 0;
+  }
+  scans.joinable = 1;
+  scans.running = id;
+  pthread_mutex_unlock(&scans.lock);
+  return id;
+}
+
+static void read_job(const job_t *job, wifi_scan_job_t *out,
+                     nl80211_bss_fn fn, void *ctx) {
+  *out = job->info;
+  out->age_ms = job->info.status == WIFI_SCAN_RUNNING
+                    ? -1
+                    : (long long)(monotonic_ms() - job->finished_ms);
+  if (!fn || job->info.status != WIFI_SCAN_DONE)
+    return;
+  for (int i = 0; i < job->info.count; i++) {
+    if (fn(&job->results[i], ctx) != 0)
+      break;
+  }
+}
+
+int wifi_scan_get(unsigned id, wifi_scan_job_t *job, nl80211_bss_fn fn,
+                  void *ctx) {
+  pthread_mutex_lock(&scans.lock);
+  const job_t *found = &scans.jobs[id % WIFI_SCAN_MAX_JOBS];
+  int rc = -1;
+  if (id != 0 && found->info.id == id) {
+    read_job(found, job, fn, ctx);
+    rc = 0;
+  }
+  pthread_mutex_unlock(&scans.lock);
+  return rc;
+}
+
+int wifi_scan_latest(wifi_scan_job_t *job, nl80211_bss_fn fn, void *ctx) {
+  pthread_mutex_lock(&scans.lock);
+  int rc = -1;
+  if (scans.latest) {
+    read_job(&scans.jobs[scans.latest % WIFI_SCAN_MAX_JOBS], job, fn, ctx);
+    rc = 0;
+  }
+  pthread_mutex_unlock(&scans.lock);
+  return rc;
+}
+
+void wifi_scan_stop(void) {
+  pthread_mutex_lock(&scans.lock);
+  int joinable = scans.joinable;
+  scans.joinable = 0;
+  pthread_mutex_unlock(&scans.lock);
+  if (joinable)
+    pthread_join(scans.thread, NULL);
+
+  pthread_mutex_lock(&scans.lock);
+  for (int i = 0; i < WIFI_SCAN_MAX_JOBS; i++)
+    free(scans.jobs[i].results);
+  memset(scans.jobs, 0, sizeof(scans.jobs));
+  scans.running = 0;
+  scans.latest = 0;
+  pthread_mutex_unlock(&scans.lock);
+}
+
+const char *wifi_scan_status_name(wifi_scan_status_t status) {
+  switch (status) {
+  case WIFI_SCAN_RUNNING:
+    return "running";
+  case WIFI_SCAN_DONE:
+    return "done";
+  default:
+    return "failed";
+  }
+}
@@ -0,0 +1,52 @@
+#ifndef WIFI_SCAN_H
+#define WIFI_SCAN_H
+
+#include "nl80211.h"
+#include <stdint.h>
+#include <time.h>
+
+// Finished jobs kept for lookup by id; older ones are forgotten
+#define WIFI_SCAN_MAX_JOBS 8
+
+// Networks kept per scan, strongest first
+#define WIFI_SCAN_MAX_RESULTS 256
+
+typedef enum {
+  WIFI_SCAN_RUNNING,
+  WIFI_SCAN_DONE,
+  WIFI_SCAN_FAILED
+} wifi_scan_status_t;
+
+// A scan job as seen by a reader
+typedef struct {
+  unsigned id;
+  wifi_scan_status_t status;
+  time_t started;
+  time_t finished;      // 0 while running
+  long long age_ms;     // Since it finished, -1 while running
+  int requests;         // Start requests it served, coalesced ones included
+  int count;            // Networks found
+  char error[64];       // Set when it failed
+} wifi_scan_job_t;
+
+// Start a scan on a thread of its own, or join the one in flight, which
+// sets *joined. Returns the job id, or 0 if no thread could be started.
+unsigned wifi_scan_start(int *joined);
+
+// Copy out a job and visit its networks, strongest first; nothing is
+// visited until the job is done. fn runs under the job lock. Returns 0,
+// or -1 if no such job is kept.
+int wifi_scan_get(unsigned id, wifi_scan_job_t *job, nl80211_bss_fn fn,
+                  void *ctx);
+
+// Same for the most recent scan that completed. Returns -1 if there is
+// none.
+int wifi_scan_latest(wifi_scan_job_t *job, nl80211_bss_fn fn, void *ctx);
+
+// Wait for a scan in flight (at most NL80211_SCAN_TIMEOUT_MS per radio)
+// and free all results
+void wifi_scan_stop(void);
+
+const char *wifi_scan_status_name(wifi_scan_status_t status);
+
+#endif // WIFI_SCAN_H
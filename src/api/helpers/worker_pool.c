@@ -0,0 +1,348 @@
+#include "worker_pool.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum { JOB_QUEUED, JOB_RUNNING, JOB_DONE } job_state_t;
+
+// One blocking request, from submission until its reply is sent
+typedef struct worker_job {
+  unsigned long id;
+  unsigned long conn_id;
+  route_t *route;
+  char *request; // Private copy of the raw HTTP message
+  size_t request_len;
+  route_params_t params; // Values point into request
+  int close_after;       // Client sent "Connection: close"
+  int orphaned;          // Connection closed while the job was running
+  job_state_t state;
+  struct mg_iobuf response;
+  struct worker_job *next;
+} worker_job_t;
+
+static struct {
+  struct mg_mgr *mgr;
+  pthread_t *threads;
+  int thread_count;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  worker_job_t *queue_head; // Waiting for a thread
+  worker_job_t *queue_tail;
+  worker_job_t *active; // Running, or finished and waiting for MG_EV_WAKEUP
+  int max_queue;
+  int queue_depth;
+  int running;
+  int pending;
+  unsigned long next_id;
+  unsigned long completed;
+  unsigned long rejected;
+  unsigned long orphaned;
+  int stopping;
+  int started;
+  worker_thread_fn thread_start;
+  worker_thread_fn thread_stop;
+} pool = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+
+static void free_job(worker_job_t *job) {
+  mg_iobuf_free(&job->response);
+  free(job->request);
+  free(job);
+}
+
+// Remove job from a singly linked list, return 1 if it was found
+static int unlink_job(worker_job_t **list, worker_job_t *job) {
+  for (worker_job_t **p = list; *p; p = &(*p)->next) {
+    if (*p == job) {
+      *p = job->next;
+      job->next = NULL;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Run the route handler against a detached connection. Response helpers
+// only append to c->send, so the reply is captured there and handed back
+// to the event loop as raw bytes.
+static void run_job(worker_job_t *job) {
+  struct mg_http_message hm;
+  struct mg_connection stub;
+  memset(&stub, 0, sizeof(stub));
+  stub.id = job->conn_id;
+  stub.is_accepted = 1;
+
+  if (mg_http_parse(job->request, job->request_len, &hm) <= 0) {
+    mg_http_reply(&stub, 500, "", "Internal Server Error: bad request copy");
+  } else {
+    job->route->handler(&stub, &hm, &job->params);
+  }
+
+  job->response = stub.send;
+}
+
+static void *worker_main(void *arg) {
+  (void)arg;
+
+  if (pool.thread_start)
+    pool.thread_start();
+
+  for (;;) {
+    pthread_mutex_lock(&pool.lock);
+    while (!pool.stopping && pool.queue_head == NULL)
+      pthread_cond_wait(&pool.cond, &pool.lock);
+    if (pool.stopping) {
+      pthread_mutex_unlock(&pool.lock);
+      break;
+    }
+
+    worker_job_t *job = pool.queue_head;
+    pool.queue_head = job->next;
+    if (pool.queue_head == NULL)
+      pool.queue_tail = NULL;
+    pool.queue_depth--;
+    pool.running++;
+    job->state = JOB_RUNNING;
+    job->next = pool.active;
+    pool.active = job;
+    pthread_mutex_unlock(&pool.lock);
+
+    run_job(job);
+
+    pthread_mutex_lock(&pool.lock);
+    pool.running--;
+    pool.completed++;
+    job->route->in_flight--;
+    if (job->orphaned) {
+      unlink_job(&pool.active, job);
+      pool.orphaned++;
+      pthread_mutex_unlock(&pool.lock);
+      free_job(job);
+      continue;
+    }
+    job->state = JOB_DONE;
+    pool.pending++;
+    unsigned long id = job->id;
+    unsigned long conn_id = job->conn_id;
+    pthread_mutex_unlock(&pool.lock);
+
+    // Only the job id crosses the wakeup pipe; the job itself stays on the
+    // active list so a connection close can still reclaim it.
+    if (!mg_wakeup(pool.mgr, conn_id, &id, sizeof(id))) {
+      fprintf(stderr, "Worker pool: cannot wake up connection %lu\n",
+              conn_id);
+    }
+  }
+
+  if (pool.thread_stop)
+    pool.thread_stop();
+  return NULL;
+}
+
+void worker_pool_set_thread_hooks(worker_thread_fn start,
+                                  worker_thread_fn stop) {
+  pool.thread_start = start;
+  pool.thread_stop = stop;
+}
+
+int worker_pool_init(struct mg_mgr *mgr, int threads, int max_queue) {
+  if (pool.started)
+    return 0;
+
+  pool.threads = calloc(threads, sizeof(pthread_t));
+  if (!pool.threads)
+    return -1;
+
+  pool.mgr = mgr;
+  pool.max_queue = max_queue;
+  pool.stopping = 0;
+
+  for (int i = 0; i < threads; i++) {
+    if (pthread_create(&pool.threads[i], NULL, worker_main, NULL) != 0) {
+      fprintf(stderr, "Worker pool: cannot start thread %d\n", i);
+      break;
+    }
+    pool.thread_count++;
+  }
+
+  if (pool.thread_count == 0) {
+    free(pool.threads);
+    pool.threads = NULL;
+    return -1;
+  }
+
+  pool.started = 1;
+  printf("Worker pool started with %d threads\n", pool.thread_count);
+  return 0;
+}
+
+void worker_pool_shutdown(void) {
+  if (!pool.started)
+    return;
+
+  pthread_mutex_lock(&pool.lock);
+  pool.stopping = 1;
+  pthread_cond_broadcast(&pool.cond);
+  pthread_mutex_unlock(&pool.lock);
+
+  for (int i = 0; i < pool.thread_count; i++)
+    pthread_join(pool.threads[i], NULL);
+
+  worker_job_t *lists[] = {pool.queue_head, pool.active};
+  for (int i = 0; i < 2; i++) {
+    while (lists[i]) {
+      worker_job_t *next = lists[i]->next;
+      free_job(lists[i]);
+      lists[i] = next;
+    }
+  }
+
+  free(pool.threads);
+  pool.threads = NULL;
+  pool.thread_count = 0;
+  pool.queue_head = pool.queue_tail = pool.active = NULL;
+  pool.queue_depth = pool.running = pool.pending = 0;
+  pool.started = 0;
+}
+
+int worker_pool_running(void) { return pool.started; }
+
+int worker_pool_submit(struct mg_connection *c, struct mg_http_message *hm,
+                       route_t *route, const route_params_t *params) {
+  if (!pool.started)
+    return WORKER_SUBMIT_FAILED;
+
+  worker_job_t *job = calloc(1, sizeof(worker_job_t));
+  if (!job)
+    return WORKER_SUBMIT_FAILED;
+
+  job->request = malloc(hm->message.len);
+  if (!job->request) {
+    free(job);
+    return WORKER_SUBMIT_FAILED;
+  }
+  memcpy(job->request, hm->message.buf, hm->message.len);
+  job->request_len = hm->message.len;
+  job->conn_id = c->id;
+  job->route = route;
+  job->state = JOB_QUEUED;
+
+  // Rebase captured parameters onto the private copy of the request
+  job->params = *params;
+  for (int i = 0; i < params->count; i++) {
+    size_t offset = (size_t)(params->items[i].value.buf - hm->message.buf);
+    job->params.items[i].value.buf = job->request + offset;
+  }
+
+  struct mg_str *cc = mg_http_get_header(hm, "Connection");
+  job->close_after = cc != NULL && mg_strcasecmp(*cc, mg_str("close")) == 0;
+
+  pthread_mutex_lock(&pool.lock);
+  int rc = WORKER_SUBMIT_OK;
+  if (route->max_concurrent > 0 && route->in_flight >= route->max_concurrent) {
+    rc = WORKER_SUBMIT_ROUTE_BUSY;
+  } else if (pool.queue_depth >= pool.max_queue) {
+    rc = WORKER_SUBMIT_QUEUE_FULL;
+  }
+
+  if (rc != WORKER_SUBMIT_OK) {
+    pool.rejected++;
+    pthread_mutex_unlock(&pool.lock);
+    free_job(job);
+    return rc;
+  }
+
+  job->id = ++pool.next_id;
+  route->in_flight++;
+  if (pool.queue_tail)
+    pool.queue_tail->next = job;
+  else
+    pool.queue_head = job;
+  pool.queue_tail = job;
+  pool.queue_depth++;
+  pthread_cond_signal(&pool.cond);
+  pthread_mutex_unlock(&pool.lock);
+
+  return WORKER_SUBMIT_OK;
+}
+
+void worker_pool_deliver(struct mg_connection *c, struct mg_str *data) {
+  unsigned long id;
+  if (data->len != sizeof(id))
+    return;
+  memcpy(&id, data->buf, sizeof(id));
+
+  pthread_mutex_lock(&pool.lock);
+  worker_job_t *job = pool.active;
+  while (job && !(job->id == id && job->state == JOB_DONE))
+    job = job->next;
+  if (job) {
+    unlink_job(&pool.active, job);
+    pool.pending--;
+  }
+  pthread_mutex_unlock(&pool.lock);
+
+  if (!job)
+    return;
+
+  mg_send(c, job->response.buf, job->response.len);
+  c->is_resp = 0; // Let Mongoose read the next pipelined request
+  if (job->close_after)
+    c->is_draining = 1;
+  free_job(job);
+}
+
+void worker_pool_cancel(struct mg_connection *c) {
+  if (!pool.started)
+    return;
+
+  pthread_mutex_lock(&pool.lock);
+
+  // Drop queued jobs outright
+  worker_job_t **p = &pool.queue_head;
+  pool.queue_tail = NULL;
+  while (*p) {
+    worker_job_t *job = *p;
+    if (job->conn_id == c->id) {
+      *p = job->next;
+      job->route->in_flight--;
+      pool.queue_depth--;
+      pool.orphaned++;
+      free_job(job);
+      continue;
+    }
+    pool.queue_tail = job;
+    p = &job->next;
+  }
+
+  // Finished replies are freed here, running ones by their worker
+  p = &pool.active;
+  while (*p) {
+    worker_job_t *job = *p;
+    if (job->conn_id == c->id && job->state == JOB_DONE) {
+      *p = job->next;
+      pool.pending--;
+      pool.orphaned++;
+      free_job(job);
+      continue;
+    }
+    if (job->conn_id == c->id)
+      job->orphaned = 1;
+    p = &job->next;
+  }
+
+  pthread_mutex_unlock(&pool.lock);
+}
+
+void worker_pool_get_stats(worker_pool_stats_t *stats) {
+  pthread_mutex_lock(&pool.lock);
+  stats->threads = pool.thread_count;
+  stats->max_queue = pool.max_queue;
+  stats->queue_depth = pool.queue_depth;
+  stats->running = pool.running;
+  stats->pending = pool.pending;
+  stats->completed = pool.completed;
+  stats->rejected = pool.rejected;
+  stats->orphaned = pool.orphaned;
+  pthread_mutex_unlock(&pool.lock);
+}
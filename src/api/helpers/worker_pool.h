@@ -0,0 +1,50 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include "../api_manager.h"
+
+// Default pool sizing
+#define WORKER_POOL_THREADS 2
+#define WORKER_POOL_MAX_QUEUE 16
+
+// worker_pool_submit() results
+#define WORKER_SUBMIT_OK 0
+#define WORKER_SUBMIT_QUEUE_FULL -1
+#define WORKER_SUBMIT_ROUTE_BUSY -2
+#define WORKER_SUBMIT_FAILED -3
+
+typedef struct {
+  int threads;
+  int max_queue;
+  int queue_depth;  // Jobs waiting for a thread
+  int running;      // Jobs currently executing
+  int pending;      // Finished jobs waiting for the event loop
+  unsigned long completed;
+  unsigned long rejected;
+  unsigned long orphaned; // Connection closed before the reply was sent
+} worker_pool_stats_t;
+
+// Called on every pool thread as it starts and as it exits, e.g. to give
+// each one a database connection of its own. Set them before init.
+typedef void (*worker_thread_fn)(void);
+void worker_pool_set_thread_hooks(worker_thread_fn start,
+                                  worker_thread_fn stop);
+
+// Pool lifecycle. mg_wakeup_init() must have been called on mgr.
+int worker_pool_init(struct mg_mgr *mgr, int threads, int max_queue);
+void worker_pool_shutdown(void);
+int worker_pool_running(void);
+
+// Queue a blocking route for execution off the event loop. The request is
+// copied, so hm does not need to outlive the call.
+int worker_pool_submit(struct mg_connection *c, struct mg_http_message *hm,
+                       route_t *route, const route_params_t *params);
+
+// Event loop hooks: MG_EV_WAKEUP delivers a finished reply, MG_EV_CLOSE
+// drops anything still pending for the connection.
+void worker_pool_deliver(struct mg_connection *c, struct mg_str *data);
+void worker_pool_cancel(struct mg_connection *c);
+
+void worker_pool_get_stats(worker_pool_stats_t *stats);
+
+#endif // WORKER_POOL_H
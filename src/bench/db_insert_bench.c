@@ -0,0 +1,129 @@
+// Event inserts/sec before and after the statement cache and WAL
+//
+//   make -f Makefile.host bench
+//   bench/db_insert_bench [dir] [inserts]
+//
+// "Before" is the old db_log_event(): a rollback-journal database at the
+// default synchronous=FULL, preparing and finalizing the INSERT on every
+// call. "After" is db_log_event_now() on a database opened by db_init(),
+// so WAL, synchronous=NORMAL and the cached statement. Every insert
+// commits on its own in both, as a lone event did. The databases are
+// temporary files in dir (default /tmp); point it at flash to see what
+// the fsyncs cost on the router.
+#include "../api/helpers/database.h"
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_DEFAULT_INSERTS 2000
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void remove_db(const char *path) {
+  char extra[300];
+  unlink(path);
+  const char *suffixes[] = {"-journal", "-wal", "-shm"};
+  for (int i = 0; i < 3; i++) {
+    snprintf(extra, sizeof(extra), "%s%s", path, suffixes[i]);
+    unlink(extra);
+  }
+}
+
+// The pre-cache helper, verbatim but for the handle it is given
+static int legacy_log_event(sqlite3 *db, const char *event_type,
+                            const char *description, const char *data) {
+  const char *sql =
+      "INSERT INTO system_events (timestamp, event_type, description, data) "
+      "VALUES (?, ?, ?, ?)";
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    return -1;
+  sqlite3_bind_int64(stmt, 1, time(NULL));
+  sqlite3_bind_text(stmt, 2, event_type, -1, SQLITE_STATIC);
+  sqlite3_bind_text(stmt, 3, description, -1, SQLITE_STATIC);
+  sqlite3_bind_text(stmt, 4, data ? data : "", -1, SQLITE_STATIC);
+  int rc = sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  return rc == SQLITE_DONE ? 0 : -1;
+}
+
+static double bench_legacy(const char *path, int inserts) {
+  sqlite3 *db;
+  if (sqlite3_open(path, &db) != SQLITE_OK)
+    return -1;
+  sqlite3_exec(db,
+               "CREATE TABLE system_events ("
+               "  id INTEGER PRIMARY KEY AUTOINCREMENT,"
+               "  timestamp INTEGER NOT NULL,"
+               "  event_type TEXT NOT NULL,"
+               "  description TEXT,"
+               "  data TEXT);"
+               "CREATE INDEX idx_events_type_time ON "
+               "system_events(event_type, timestamp);",
+               NULL, NULL, NULL);
+
+  double start = now_s();
+  for (int i = 0; i < inserts; i++) {
+    if (legacy_log_event(db, "BENCH", "Benchmark event", NULL) != 0) {
+      sqlite3_close(db);
+      return -1;
+    }
+  }
+  double elapsed = now_s() - start;
+  sqlite3_close(db);
+  return inserts / elapsed;
+}
+
+static double bench_cached(const char *path, int inserts) {
+  if (db_init(path, NULL) != 0)
+    return -1;
+
+  double start = now_s();
+  for (int i = 0; i < inserts; i++) {
+    if (db_log_event_now("BENCH", "Benchmark event", NULL) != 0) {
+      db_close();
+      return -1;
+    }
+  }
+  double elapsed = now_s() - start;
+  db_close();
+  return inserts / elapsed;
+}
+
+int main(int argc, char **argv) {
+  const char *dir = argc > 1 ? argv[1] : "/tmp";
+  int inserts = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_INSERTS;
+  if (inserts < 1) {
+    fprintf(stderr, "usage: %s [dir] [inserts]\n", argv[0]);
+    return 1;
+  }
+
+  char legacy_path[256], cached_path[256];
+  snprintf(legacy_path, sizeof(legacy_path), "%s/db_insert_bench.%d.legacy",
+           dir, (int)getpid());
+  snprintf(cached_path, sizeof(cached_path), "%s/db_insert_bench.%d.cached",
+           dir, (int)getpid());
+
+  // db_init() prints its setup, so the report comes after both runs
+  double legacy = bench_legacy(legacy_path, inserts);
+  double cached = bench_cached(cached_path, inserts);
+  remove_db(legacy_path);
+  remove_db(cached_path);
+  if (legacy < 0 || cached < 0) {
+    fprintf(stderr, "insert failed in %s\n", dir);
+    return 1;
+  }
+
+  printf("db_insert_bench: %d single-row event inserts in %s\n", inserts,
+         dir);
+  printf("  rollback journal, prepare per call  %9.0f inserts/s\n", legacy);
+  printf("  WAL + NORMAL, cached statement      %9.0f inserts/s  (%.1fx)\n",
+         cached, cached / legacy);
+  return 0;
+}
@@ -0,0 +1,122 @@
+// Interface and route listing: rtnetlink dumps against the old ip pipelines
+//
+//   make -f Makefile.host bench
+//   bench/netlink_bench [rounds]
+//
+// /api/network/interfaces used to popen() `ip addr show | grep | awk | tr`
+// and /api/network/routes `ip route show`. This times each pipeline, read
+// to the end, against the netlink dumps that replaced them on the host's
+// own tables. Both must list the same interfaces and main-table routes.
+// Needs `ip` on the PATH.
+#include "../api/helpers/netlink.h"
+#include <linux/rtnetlink.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#define BENCH_DEFAULT_ROUNDS 200
+
+#define IFACES_COMMAND                                                         \
+  "ip addr show | grep -E '^[0-9]+:' | awk '{print $2}' | tr -d ':'"
+#define ROUTES_COMMAND "ip route show"
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+// Lines of output, or -1 if the command could not be run
+static int run_lines(const char *command) {
+  FILE *pipe = popen(command, "r");
+  if (!pipe)
+    return -1;
+  char line[512];
+  int lines = 0;
+  while (fgets(line, sizeof(line), pipe))
+    lines++;
+  return pclose(pipe) == 0 ? lines : -1;
+}
+
+static int count_link(const netlink_link_t *link, void *ctx) {
+  (void)link;
+  (*(int *)ctx)++;
+  return 0;
+}
+
+static int count_addr(const netlink_addr_t *addr, void *ctx) {
+  (void)addr;
+  (*(int *)ctx)++;
+  return 0;
+}
+
+// `ip route show` lists the main table only
+static int count_main_route(const netlink_route_t *route, void *ctx) {
+  if (route->table == RT_TABLE_MAIN)
+    (*(int *)ctx)++;
+  return 0;
+}
+
+// The endpoint's work: every link, then every address to attach to them
+static int netlink_interfaces(void) {
+  int links = 0, addrs = 0;
+  if (netlink_links(count_link, &links) < 0 ||
+      netlink_addrs(AF_UNSPEC, count_addr, &addrs) < 0)
+    return -1;
+  return links;
+}
+
+static int netlink_main_routes(void) {
+  int routes = 0;
+  return netlink_routes(AF_INET, count_main_route, &routes) < 0 ? -1 : routes;
+}
+
+typedef struct {
+  const char *name;
+  int (*legacy)(void);
+  int (*netlink)(void);
+} case_t;
+
+static int legacy_interfaces(void) { return run_lines(IFACES_COMMAND); }
+static int legacy_routes(void) { return run_lines(ROUTES_COMMAND); }
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_ROUNDS;
+  if (rounds < 1) {
+    fprintf(stderr, "usage: %s [rounds]\n", argv[0]);
+    return 1;
+  }
+
+  const case_t cases[] = {
+      {"interfaces", legacy_interfaces, netlink_interfaces},
+      {"routes", legacy_routes, netlink_main_routes},
+  };
+
+  printf("netlink_bench: %d rounds\n", rounds);
+  printf("  %-10s %7s %16s %16s\n", "listing", "entries", "ip pipeline us",
+         "netlink us");
+  for (int i = 0; i < 2; i++) {
+    int legacy = cases[i].legacy();
+    int dumped = cases[i].netlink();
+    if (legacy < 0 || dumped < 0 || legacy != dumped) {
+      fprintf(stderr, "%s disagree: ip %d, netlink %d\n", cases[i].name,
+              legacy, dumped);
+      return 1;
+    }
+
+    double start = now_us();
+    for (int round = 0; round < rounds; round++)
+      cases[i].legacy();
+    double legacy_us = (now_us() - start) / rounds;
+
+    start = now_us();
+    for (int round = 0; round < rounds; round++)
+      cases[i].netlink();
+    double netlink_us = (now_us() - start) / rounds;
+
+    printf("  %-10s %7d %16.1f %16.1f  (%.0fx)\n", cases[i].name, dumped,
+           legacy_us, netlink_us, legacy_us / netlink_us);
+  }
+  return 0;
+}
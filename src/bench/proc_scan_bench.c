@@ -0,0 +1,223 @@
+// /proc walk cost per PID: proc_scanner against the old fopen/sscanf walk
+//
+//   make -f Makefile.host bench
+//   bench/proc_scan_bench [pids]
+//
+// Builds a synthetic /proc with comm, status and stat files for each PID
+// under a temporary directory and scans it with both. The old walk read
+// comm and then status line by line for VmRSS; the scanner does one read()
+// of stat per process through a directory fd. Both must find the same
+// processes and the same RSS total.
+#include "../api/helpers/proc_scanner.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_DEFAULT_PIDS 2000
+#define BENCH_ROUNDS 20
+
+static char root[] = "/tmp/proc_scan_bench.XXXXXX";
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static int write_file(const char *dir, const char *name, const char *text) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  FILE *f = fopen(path, "w");
+  if (!f)
+    return -1;
+  fputs(text, f);
+  return fclose(f);
+}
+
+// One process directory, laid out as a 5.x kernel writes it
+static int make_process(int pid, long page_kb) {
+  char dir[128], name[16], text[2048];
+  snprintf(dir, sizeof(dir), "%s/%d", root, pid);
+  if (mkdir(dir, 0755) != 0)
+    return -1;
+
+  // A few names with spaces and parentheses, as comm allows
+  if (pid % 97 == 0)
+    snprintf(name, sizeof(name), "kworker/%d:1", pid % 8);
+  else if (pid % 89 == 0)
+    snprintf(name, sizeof(name), "a (b) c");
+  else
+    snprintf(name, sizeof(name), "proc%d", pid);
+  long rss_pages = 100 + pid % 5000;
+
+  snprintf(text, sizeof(text), "%s\n", name);
+  if (write_file(dir, "comm", text) != 0)
+    return -1;
+
+  snprintf(text, sizeof(text),
+           "Name:\t%s\nUmask:\t0022\nState:\tS (sleeping)\nTgid:\t%d\n"
+           "Ngid:\t0\nPid:\t%d\nPPid:\t1\nTracerPid:\t0\n"
+           "Uid:\t0\t0\t0\t0\nGid:\t0\t0\t0\t0\nFDSize:\t64\n"
+           "Groups:\t\nNStgid:\t%d\nNSpid:\t%d\nNSpgid:\t%d\nNSsid:\t%d\n"
+           "VmPeak:\t   12345 kB\nVmSize:\t   12000 kB\nVmLck:\t       0 kB\n"
+           "VmPin:\t       0 kB\nVmHWM:\t    %ld kB\nVmRSS:\t    %ld kB\n"
+           "RssAnon:\t     800 kB\nRssFile:\t    1200 kB\n"
+           "RssShmem:\t       0 kB\nVmData:\t    1000 kB\n"
+           "VmStk:\t     132 kB\nVmExe:\t     400 kB\nVmLib:\t    2000 kB\n"
+           "VmPTE:\t      48 kB\nVmSwap:\t       0 kB\n"
+           "HugetlbPages:\t       0 kB\nCoreDumping:\t0\nTHP_enabled:\t1\n"
+           "Threads:\t1\nSigQ:\t0/7823\nSigPnd:\t0000000000000000\n"
+           "ShdPnd:\t0000000000000000\nSigBlk:\t0000000000000000\n"
+           "SigIgn:\t0000000000001000\nSigCgt:\t0000000180000002\n"
+           "CapInh:\t0000000000000000\nCapPrm:\t000001ffffffffff\n"
+           "CapEff:\t000001ffffffffff\nCapBnd:\t000001ffffffffff\n"
+           "CapAmb:\t0000000000000000\nNoNewPrivs:\t0\nSeccomp:\t0\n"
+           "Speculation_Store_Bypass:\tvulnerable\n"
+           "Cpus_allowed:\t1\nCpus_allowed_list:\t0\n"
+           "Mems_allowed:\t1\nMems_allowed_list:\t0\n"
+           "voluntary_ctxt_switches:\t100\n"
+           "nonvoluntary_ctxt_switches:\t10\n",
+           name, pid, pid, pid, pid, pid, pid, rss_pages * page_kb,
+           rss_pages * page_kb);
+  if (write_file(dir, "status", text) != 0)
+    return -1;
+
+  snprintf(text, sizeof(text),
+           "%d (%s) S 1 %d %d 0 -1 4194560 100 0 0 0 %d %d 0 0 20 0 1 0 "
+           "%d 12288000 %ld 18446744073709551615 1 1 0 0 0 0 0 4096 "
+           "2 0 0 0 17 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n",
+           pid, name, pid, pid, pid % 300, pid % 50, 1000 + pid, rss_pages);
+  return write_file(dir, "stat", text);
+}
+
+static void remove_tree(int pids) {
+  char path[256];
+  const char *files[] = {"comm", "status", "stat"};
+  for (int pid = 1; pid <= pids; pid++) {
+    for (int i = 0; i < 3; i++) {
+      snprintf(path, sizeof(path), "%s/%d/%s", root, pid, files[i]);
+      unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/%d", root, pid);
+    rmdir(path);
+  }
+  rmdir(root);
+}
+
+typedef struct {
+  int count;
+  long long rss_kb;
+} totals_t;
+
+// The walk both /proc readers did before proc_scanner, minus their
+// 1000-process cap
+static void legacy_scan(totals_t *totals) {
+  DIR *dir = opendir(root);
+  struct dirent *entry;
+  while (dir && (entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+      continue;
+    int pid = atoi(entry->d_name);
+    char comm_path[300], status_path[300];
+    snprintf(comm_path, sizeof(comm_path), "%s/%d/comm", root, pid);
+    snprintf(status_path, sizeof(status_path), "%s/%d/status", root, pid);
+
+    FILE *comm_file = fopen(comm_path, "r");
+    FILE *status_file = fopen(status_path, "r");
+    if (comm_file && status_file) {
+      char name[21] = {0};
+      char line[128];
+      int rss_kb = 0;
+      if (fgets(name, sizeof(name), comm_file)) {
+        char *nl = strchr(name, '\n');
+        if (nl)
+          *nl = '\0';
+      }
+      while (fgets(line, sizeof(line), status_file)) {
+        if (sscanf(line, "VmRSS: %d kB", &rss_kb) == 1)
+          break;
+      }
+      if (strlen(name) > 0 && rss_kb > 0) {
+        totals->count++;
+        totals->rss_kb += rss_kb;
+      }
+    }
+    if (comm_file)
+      fclose(comm_file);
+    if (status_file)
+      fclose(status_file);
+  }
+  if (dir)
+    closedir(dir);
+}
+
+static int add_stat(const proc_stat_t *stat, void *ctx) {
+  totals_t *totals = ctx;
+  totals->count++;
+  totals->rss_kb += stat->rss_kb;
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int pids = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_PIDS;
+  if (pids < 1 || !mkdtemp(root)) {
+    fprintf(stderr, "usage: %s [pids]\n", argv[0]);
+    return 1;
+  }
+
+  proc_scanner_t scanner;
+  int rc = 1;
+  if (proc_scanner_open(&scanner, root) != 0) {
+    fprintf(stderr, "cannot open %s\n", root);
+    rmdir(root);
+    return 1;
+  }
+  for (int pid = 1; pid <= pids; pid++) {
+    if (make_process(pid, scanner.page_kb) != 0) {
+      fprintf(stderr, "cannot build %s/%d\n", root, pid);
+      goto out;
+    }
+  }
+
+  totals_t legacy = {0, 0}, scanned = {0, 0};
+  legacy_scan(&legacy);
+  proc_scanner_each(&scanner, add_stat, &scanned);
+  if (legacy.count != pids || scanned.count != pids ||
+      legacy.rss_kb != scanned.rss_kb) {
+    fprintf(stderr,
+            "scans disagree: legacy %d processes %lld kB, "
+            "scanner %d processes %lld kB\n",
+            legacy.count, legacy.rss_kb, scanned.count, scanned.rss_kb);
+    goto out;
+  }
+
+  // Files stay in the page cache, so this is parsing and syscall cost
+  double start = now_ns();
+  for (int round = 0; round < BENCH_ROUNDS; round++) {
+    totals_t t = {0, 0};
+    legacy_scan(&t);
+  }
+  double legacy_ns = (now_ns() - start) / ((double)BENCH_ROUNDS * pids);
+
+  start = now_ns();
+  for (int round = 0; round < BENCH_ROUNDS; round++) {
+    totals_t t = {0, 0};
+    proc_scanner_each(&scanner, add_stat, &t);
+  }
+  double scanner_ns = (now_ns() - start) / ((double)BENCH_ROUNDS * pids);
+
+  printf("proc_scan_bench: %d synthetic PIDs x %d rounds\n", pids,
+         BENCH_ROUNDS);
+  printf("  fopen comm + status, sscanf  %8.2f us/pid\n", legacy_ns / 1000);
+  printf("  proc_scanner, one stat read  %8.2f us/pid  (%.1fx)\n",
+         scanner_ns / 1000, legacy_ns / scanner_ns);
+  rc = 0;
+
+out:
+  proc_scanner_close(&scanner);
+  remove_tree(pids);
+  return rc;
+}
@@ -0,0 +1,179 @@
+// Process usage statistics: query plan and latency on a large history
+//
+//   make -f Makefile.host bench
+//   bench/process_usage_bench [dir] [rows]
+//
+// Fills a database opened by db_init() with rows process records (1M by
+// default): BENCH_PROCESSES processes sampled in every snapshot, snapshots
+// spread evenly over the last BENCH_HISTORY_DAYS days. Then checks that
+// the usage query is answered from idx_processes_name_snapshot alone and
+// times db_get_process_usage_stats() over several windows, against the
+// same query forced to scan the table.
+#include "../api/helpers/database.h"
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_DEFAULT_ROWS 1000000
+#define BENCH_PROCESSES 50
+#define BENCH_HISTORY_DAYS 30
+#define BENCH_ROUNDS 20
+
+// STMT_PROCESS_USAGE as database.c prepares it
+#define USAGE_SQL                                                              \
+  "SELECT ram_kb FROM process_records "                                        \
+  "WHERE name_id = (SELECT id FROM process_names WHERE name = ?1) "            \
+  "AND snapshot_id >= (SELECT id FROM system_snapshots "                       \
+  "WHERE timestamp > ?2 ORDER BY timestamp, id LIMIT 1)"
+
+// The same rows found without any index on process_records
+#define SCAN_SQL                                                               \
+  "SELECT ram_kb FROM process_records NOT INDEXED "                            \
+  "WHERE name_id = (SELECT id FROM process_names WHERE name = ?1) "            \
+  "AND snapshot_id >= (SELECT id FROM system_snapshots "                       \
+  "WHERE timestamp > ?2 ORDER BY timestamp, id LIMIT 1)"
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static void remove_db(const char *path) {
+  char extra[300];
+  unlink(path);
+  const char *suffixes[] = {"-journal", "-wal", "-shm"};
+  for (int i = 0; i < 3; i++) {
+    snprintf(extra, sizeof(extra), "%s%s", path, suffixes[i]);
+    unlink(extra);
+  }
+}
+
+// Snapshots and their process records in one transaction, generated by
+// SQLite itself; going through db_save_snapshot_now() would take minutes
+static int fill(int snapshots) {
+  char sql[1024];
+  time_t start = time(NULL) - (time_t)BENCH_HISTORY_DAYS * 86400;
+  int step = BENCH_HISTORY_DAYS * 86400 / snapshots;
+  snprintf(sql, sizeof(sql),
+           "BEGIN;"
+           "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n "
+           "WHERE i < %d) "
+           "INSERT INTO process_names (id, name) SELECT i, 'proc' || i FROM n;"
+           "WITH RECURSIVE s(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM s "
+           "WHERE i < %d) "
+           "INSERT INTO system_snapshots (timestamp, total_processes) "
+           "SELECT %lld + i * %d, %d FROM s;"
+           "INSERT INTO process_records "
+           "(snapshot_id, pid, name_id, ram_kb, rank_position) "
+           "SELECT s.id, 100 + n.id, n.id, "
+           "1000 + (s.id * 7919 + n.id * 104729) %% 50000, n.id "
+           "FROM system_snapshots s, process_names n;"
+           "COMMIT;",
+           BENCH_PROCESSES, snapshots - 1, (long long)start, step,
+           BENCH_PROCESSES);
+  return db_execute(sql);
+}
+
+// Print the plan, and return 1 if the records come from the covering index
+static int check_plan(void) {
+  sqlite3_stmt *stmt = db_prepare("EXPLAIN QUERY PLAN " USAGE_SQL);
+  if (!stmt)
+    return 0;
+  int covered = 0;
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    const char *detail = (const char *)sqlite3_column_text(stmt, 3);
+    printf("    %s\n", detail);
+    if (strstr(detail, "process_records") &&
+        strstr(detail, "COVERING INDEX idx_processes_name_snapshot"))
+      covered = 1;
+  }
+  sqlite3_finalize(stmt);
+  return covered;
+}
+
+static long long scan_rows(const char *name, int days) {
+  sqlite3_stmt *stmt = db_prepare(SCAN_SQL);
+  if (!stmt)
+    return -1;
+  sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+  sqlite3_bind_int64(stmt, 2, time(NULL) - (time_t)days * 86400);
+  long long rows = 0;
+  while (sqlite3_step(stmt) == SQLITE_ROW)
+    rows++;
+  sqlite3_finalize(stmt);
+  return rows;
+}
+
+int main(int argc, char **argv) {
+  const char *dir = argc > 1 ? argv[1] : "/tmp";
+  int rows = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_ROWS;
+  if (rows < BENCH_PROCESSES) {
+    fprintf(stderr, "usage: %s [dir] [rows]\n", argv[0]);
+    return 1;
+  }
+
+  char path[256];
+  snprintf(path, sizeof(path), "%s/process_usage_bench.%d", dir,
+           (int)getpid());
+  if (db_init(path, NULL) != 0) {
+    remove_db(path);
+    return 1;
+  }
+
+  int rc = 1;
+  double start = now_ms();
+  if (fill(rows / BENCH_PROCESSES) != 0) {
+    fprintf(stderr, "cannot fill %s\n", path);
+    goto out;
+  }
+  double fill_ms = now_ms() - start;
+
+  printf("process_usage_bench: %d process records, %d processes, %d days\n",
+         rows / BENCH_PROCESSES * BENCH_PROCESSES, BENCH_PROCESSES,
+         BENCH_HISTORY_DAYS);
+  printf("  filled in %.0f ms\n", fill_ms);
+  printf("  query plan:\n");
+  if (!check_plan()) {
+    fprintf(stderr, "process_records is not read from the covering index\n");
+    goto out;
+  }
+
+  const int windows[] = {1, 7, BENCH_HISTORY_DAYS};
+  const char *name = "proc17";
+  printf("  %-6s %10s %14s %14s\n", "days", "samples", "index ms/query",
+         "scan ms/query");
+  for (int w = 0; w < 3; w++) {
+    db_process_usage_t usage;
+    start = now_ms();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+      if (db_get_process_usage_stats(name, windows[w], &usage) != 0) {
+        fprintf(stderr, "usage query failed\n");
+        goto out;
+      }
+    }
+    double index_ms = (now_ms() - start) / BENCH_ROUNDS;
+
+    // One round is enough to show the scan; it is also the check that both
+    // find the same samples
+    start = now_ms();
+    long long scanned = scan_rows(name, windows[w]);
+    double scan_ms = now_ms() - start;
+    if (scanned != usage.samples) {
+      fprintf(stderr, "index found %lld samples, scan %lld\n", usage.samples,
+              scanned);
+      goto out;
+    }
+    printf("  %-6d %10lld %14.2f %14.2f  (%.0fx)\n", windows[w],
+           usage.samples, index_ms, scan_ms, scan_ms / index_ms);
+  }
+  rc = 0;
+
+out:
+  db_close();
+  remove_db(path);
+  return rc;
+}
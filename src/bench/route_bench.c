@@ -0,0 +1,165 @@
+// Route lookup: compiled trie against the old linear mg_match scan
+//
+//   make -f Makefile.host bench
+//
+// Registers BENCH_MODULES * BENCH_ROUTES_PER_MODULE routes shaped like the
+// real ones (literal paths, some with a {param} segment) and times lookups
+// of every registered path plus misses. Both lookups must agree on every
+// URI, so this also checks the trie against the scan it replaced.
+#include "../api/api_manager.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MODULES 8
+#define BENCH_ROUTES_PER_MODULE 30
+#define BENCH_ROUNDS 2000
+
+static const char *modules[BENCH_MODULES] = {
+    "system", "network", "wireless", "monitoring",
+    "database", "status", "firewall", "services"};
+
+static void handler(struct mg_connection *c, struct mg_http_message *hm,
+                    const route_params_t *params) {
+  (void)c;
+  (void)hm;
+  (void)params;
+}
+
+typedef struct {
+  char uri[128];
+  http_method_t method;
+  int not_allowed; // The path exists, but not for this method
+} probe_t;
+
+// The old dispatcher: first route whose method and glob pattern match
+static int linear_find(const api_manager_t *manager, const char *globs[],
+                       struct mg_str uri, http_method_t method) {
+  for (int i = 0; i < manager->route_count; i++) {
+    if (manager->routes[i].method == method &&
+        mg_match(uri, mg_str(globs[i]), NULL))
+      return i;
+  }
+  return ROUTE_NOT_FOUND;
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+int main(void) {
+  api_manager_t manager;
+  api_manager_init(&manager);
+
+  // Registration logs every route; keep the report readable
+  fflush(stdout);
+  int saved_stdout = dup(STDOUT_FILENO);
+  int devnull = open("/dev/null", O_WRONLY);
+  dup2(devnull, STDOUT_FILENO);
+
+  int total = BENCH_MODULES * (BENCH_ROUTES_PER_MODULE + 1);
+  const char **globs = calloc(total, sizeof(*globs));
+  probe_t *probes = calloc(total * 2, sizeof(*probes));
+  int probe_count = 0;
+  for (int m = 0; m < BENCH_MODULES; m++) {
+    for (int r = 0; r < BENCH_ROUTES_PER_MODULE; r++) {
+      char path[128], glob[128];
+      http_method_t method = r % 3 == 0 ? METHOD_POST : METHOD_GET;
+      probe_t *hit = &probes[probe_count++];
+      probe_t *miss = &probes[probe_count++];
+      if (r % 5 == 4) {
+        snprintf(path, sizeof(path), "/api/%s/item%d/{id}", modules[m], r);
+        snprintf(glob, sizeof(glob), "/api/%s/item%d/*", modules[m], r);
+        snprintf(hit->uri, sizeof(hit->uri), "/api/%s/item%d/%d", modules[m],
+                 r, 1000 + r);
+      } else {
+        snprintf(path, sizeof(path), "/api/%s/item%d", modules[m], r);
+        snprintf(glob, sizeof(glob), "%s", path);
+        snprintf(hit->uri, sizeof(hit->uri), "%s", path);
+      }
+      hit->method = method;
+      snprintf(miss->uri, sizeof(miss->uri), "/api/%s/missing%d/x", modules[m],
+               r);
+      miss->method = METHOD_GET;
+      api_register_route(&manager, path, method, handler, "bench");
+      globs[manager.route_count - 1] = strdup(glob);
+    }
+
+    // A {param} sibling taking a method its literal neighbours lack: the
+    // lookup has to back off the literal branch to find it
+    char path[128], glob[128];
+    snprintf(path, sizeof(path), "/api/%s/{id}", modules[m]);
+    snprintf(glob, sizeof(glob), "/api/%s/*", modules[m]);
+    api_register_route(&manager, path, METHOD_DELETE, handler, "bench");
+    globs[manager.route_count - 1] = strdup(glob);
+    probe_t *hit = &probes[probe_count++];
+    snprintf(hit->uri, sizeof(hit->uri), "/api/%s/item0", modules[m]);
+    hit->method = METHOD_DELETE;
+    probe_t *miss = &probes[probe_count++];
+    snprintf(miss->uri, sizeof(miss->uri), "/api/%s/item0", modules[m]);
+    miss->method = METHOD_PATCH;
+    miss->not_allowed = 1;
+  }
+  api_build_router(&manager);
+
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+  close(devnull);
+
+  // Both must agree before either is worth timing
+  int mismatches = 0;
+  for (int i = 0; i < probe_count; i++) {
+    route_params_t params;
+    struct mg_str uri = mg_str(probes[i].uri);
+    int trie = api_find_route(&manager, uri, probes[i].method, &params);
+    int scan = linear_find(&manager, globs, uri, probes[i].method);
+    // The scan cannot tell 405 from 404
+    int expected = probes[i].not_allowed ? ROUTE_METHOD_NOT_ALLOWED : scan;
+    if (trie != expected) {
+      fprintf(stderr, "mismatch on %s: trie %d, expected %d\n",
+              probes[i].uri, trie, expected);
+      mismatches++;
+    }
+  }
+  if (mismatches)
+    return 1;
+
+  volatile int sink = 0;
+  double start = now_ns();
+  for (int round = 0; round < BENCH_ROUNDS; round++) {
+    for (int i = 0; i < probe_count; i++)
+      sink += linear_find(&manager, globs, mg_str(probes[i].uri),
+                          probes[i].method);
+  }
+  double scan_ns = (now_ns() - start) / ((double)BENCH_ROUNDS * probe_count);
+
+  start = now_ns();
+  for (int round = 0; round < BENCH_ROUNDS; round++) {
+    for (int i = 0; i < probe_count; i++) {
+      route_params_t params;
+      sink += api_find_route(&manager, mg_str(probes[i].uri),
+                             probes[i].method, &params);
+    }
+  }
+  double trie_ns = (now_ns() - start) / ((double)BENCH_ROUNDS * probe_count);
+  (void)sink;
+
+  printf("route_bench: %d routes, %d lookups (half misses) x %d rounds\n",
+         manager.route_count, probe_count, BENCH_ROUNDS);
+  printf("  linear mg_match scan  %9.1f ns/lookup\n", scan_ns);
+  printf("  compiled trie         %9.1f ns/lookup  (%.1fx)\n", trie_ns,
+         scan_ns / trie_ns);
+
+  for (int i = 0; i < manager.route_count; i++)
+    free((void *)globs[i]);
+  free(globs);
+  free(probes);
+  api_manager_free(&manager);
+  return 0;
+}
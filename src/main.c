@@ -1,8 +1,19 @@
 #include "api/api_manager.h"
+#include "api/helpers/cpu_sampler.h"
+#include "api/helpers/db_writer.h"
+#include "api/helpers/snapshot_scheduler.h"
 #include "api/helpers/database.h"
+#include "api/helpers/netdev_sampler.h"
+#include "api/helpers/nl80211.h"
+#include "api/helpers/process_sampler.h"
+#include "api/helpers/uci_config.h"
+#include "api/helpers/wifi_scan.h"
+#include "api/helpers/worker_pool.h"
 #include "mongoose/mongoose.h"
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 static struct mg_mgr mgr;
 static api_manager_t api_manager;
@@ -18,9 +29,22 @@ static void event_handler(struct mg_connection *c, int ev, void *ev_data) {
   if (ev == MG_EV_HTTP_MSG) {
     struct mg_http_message *hm = (struct mg_http_message *)ev_data;
     api_handle_request(&api_manager, c, hm);
+  } else if (ev == MG_EV_WAKEUP) {
+    // Reply from a blocking handler finished on the worker pool
+    worker_pool_deliver(c, (struct mg_str *)ev_data);
+  } else if (ev == MG_EV_CLOSE) {
+    worker_pool_cancel(c);
   }
 }
 
+// Each pool thread reads through its own connection and statement cache,
+// so blocking handlers running side by side never share a statement.
+// Without one the thread falls back to the main connection.
+static void worker_db_open(void) {
+  if (db_thread_open() != 0)
+    fprintf(stderr, "Worker pool: no database connection of its own\n");
+}
+
 // Initialize all API endpoints
 void initialize_api_endpoints() {
   printf("Initializing API endpoints...\n");
@@ -34,6 +58,11 @@ void initialize_api_endpoints() {
   register_database_endpoints(&api_manager);
 
   printf("Registered %d API endpoints\n", api_manager.route_count);
+
+  // Compile the route table into the dispatch trie
+  if (api_build_router(&api_manager) != 0) {
+    fprintf(stderr, "Failed to build API router\n");
+  }
 }
 
 // Print startup information
@@ -63,17 +92,84 @@ int main(int argc, char *argv[]) {
   signal(SIGINT, signal_handler);
   signal(SIGTERM, signal_handler);
 
-  // Initialize database
+  // Parse command line: [port] [--db path] [--sample-interval ms]
+  // [--db-cache-kb kb] [--db-mmap-kb kb] [--snapshot-interval s]
+  // [--cleanup-interval s] [--retention-days days]
+  // [--event-retention-days days] [--network-retention-days days]
+  // [--persist-path path] [--persist-interval s] [--uci-dir path]
+  // [--network-history-interval s] [--wifi-record dir] [--wifi-replay dir]
+  const char *port = "9000";
   const char *db_path = "/tmp/openwrt_api.db";
-  if (argc > 2 && strcmp(argv[2], "--db") == 0 && argc > 3) {
-    db_path = argv[3];
+  int sample_interval_ms = PROCESS_SAMPLE_INTERVAL_MS;
+  db_tuning_t db_tuning = {DB_DEFAULT_CACHE_SIZE_KB, DB_DEFAULT_MMAP_SIZE_KB};
+  int snapshot_interval_s = 0;
+  int cleanup_interval_s = SNAPSHOT_CLEANUP_INTERVAL_S;
+  db_retention_t retention = {0, -1, -1}; // Events and network follow
+  const char *persist_path = NULL;
+  int persist_interval_s = DB_PERSIST_INTERVAL_S;
+  int network_history_s = NETDEV_HISTORY_INTERVAL_S;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--db") == 0 && i + 1 < argc) {
+      db_path = argv[++i];
+    } else if (strcmp(argv[i], "--db-cache-kb") == 0 && i + 1 < argc) {
+      db_tuning.cache_size_kb = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--db-mmap-kb") == 0 && i + 1 < argc) {
+      db_tuning.mmap_size_kb = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--sample-interval") == 0 && i + 1 < argc) {
+      sample_interval_ms = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--snapshot-interval") == 0 && i + 1 < argc) {
+      snapshot_interval_s = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--cleanup-interval") == 0 && i + 1 < argc) {
+      cleanup_interval_s = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--retention-days") == 0 && i + 1 < argc) {
+      retention.snapshot_days = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--event-retention-days") == 0 &&
+               i + 1 < argc) {
+      retention.event_days = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--network-retention-days") == 0 &&
+               i + 1 < argc) {
+      retention.network_days = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--persist-path") == 0 && i + 1 < argc) {
+      persist_path = argv[++i];
+    } else if (strcmp(argv[i], "--persist-interval") == 0 && i + 1 < argc) {
+      persist_interval_s = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--uci-dir") == 0 && i + 1 < argc) {
+      uci_config_set_dir(argv[++i]);
+    } else if (strcmp(argv[i], "--network-history-interval") == 0 &&
+               i + 1 < argc) {
+      network_history_s = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--wifi-record") == 0 && i + 1 < argc) {
+      nl80211_record_dir(argv[++i]);
+    } else if (strcmp(argv[i], "--wifi-replay") == 0 && i + 1 < argc) {
+      nl80211_replay_dir(argv[++i]);
+    } else if (i == 1) {
+      port = argv[i];
+    }
   }
 
-  if (db_init(db_path) != 0) {
+  if (retention.event_days < 0)
+    retention.event_days = retention.snapshot_days;
+  if (retention.network_days < 0)
+    retention.network_days = retention.snapshot_days;
+
+  // Initialize database. In hybrid mode a live database lost with tmpfs is
+  // first restored from its persistent copy.
+  if (persist_path && *persist_path &&
+      db_persist_init(db_path, persist_path) != 0) {
+    fprintf(stderr, "Starting with an empty database\n");
+  }
+
+  if (db_init(db_path, &db_tuning) != 0) {
     fprintf(stderr, "Failed to initialize database at %s\n", db_path);
     return 1;
   }
 
+  // Batch writes on a thread of their own; without it they run inline
+  if (db_writer_start(DB_WRITER_FLUSH_MS, DB_WRITER_MAX_BATCH_ROWS,
+                      DB_WRITER_MAX_QUEUE) != 0) {
+    fprintf(stderr, "Database writer unavailable, writing inline\n");
+  }
+
   // Log startup event
   db_log_event("STARTUP", "API server starting", NULL);
 
@@ -86,10 +182,12 @@ int main(int argc, char *argv[]) {
   // Initialize Mongoose manager
   mg_mgr_init(&mgr);
 
-  // Parse command line arguments for port (optional)
-  const char *port = "9000";
-  if (argc > 1) {
-    port = argv[1];
+  // Start worker threads for blocking handlers; they post replies back
+  // through the mg_wakeup() pipe. Without it, those handlers run inline.
+  worker_pool_set_thread_hooks(worker_db_open, db_thread_close);
+  if (!mg_wakeup_init(&mgr) ||
+      worker_pool_init(&mgr, WORKER_POOL_THREADS, WORKER_POOL_MAX_QUEUE) != 0) {
+    fprintf(stderr, "Worker pool unavailable, blocking handlers run inline\n");
   }
 
   // Create HTTP server
@@ -100,23 +198,58 @@ int main(int argc, char *argv[]) {
       mg_http_listen(&mgr, listen_addr, event_handler, NULL);
   if (c == NULL) {
     fprintf(stderr, "Failed to create HTTP server on port %s\n", port);
+    worker_pool_shutdown();
+    db_writer_stop();
     db_close();
     return 1;
   }
 
+  // Sample /proc/stat from the event loop for /api/monitoring/cpu
+  if (cpu_sampler_start(&mgr, CPU_SAMPLE_INTERVAL_MS) != 0) {
+    fprintf(stderr, "CPU sampler unavailable\n");
+  }
+
+  // Sample /proc/net/dev for /api/network/throughput and network_status
+  if (netdev_sampler_start(&mgr, NETDEV_SAMPLE_INTERVAL_MS,
+                           network_history_s) != 0) {
+    fprintf(stderr, "Network sampler unavailable\n");
+  }
+
+  // Scan /proc in the background; process endpoints read the latest table
+  if (process_sampler_start(sample_interval_ms) != 0) {
+    fprintf(stderr, "Process sampler unavailable, scanning per request\n");
+  }
+
+  // Periodic snapshots, retention and checkpoints, in place of the old
+  // cron job
+  if (snapshot_scheduler_start(&mgr, snapshot_interval_s, cleanup_interval_s,
+                               &retention, persist_interval_s) != 0) {
+    fprintf(stderr, "Snapshot scheduler unavailable\n");
+  }
+
   // Print startup information
   print_startup_info();
   printf("Database: %s\n\n", db_path);
 
   // Main event loop
   while (server_running) {
-    mg_mgr_poll(&mgr, 1000);
+    mg_mgr_poll(&mgr, snapshot_scheduler_poll_ms(1000));
   }
 
   // Cleanup
   printf("Cleaning up...\n");
   db_log_event("SHUTDOWN", "API server shutting down", NULL);
+  worker_pool_shutdown();
+  wifi_scan_stop();
+  db_writer_stop(); // Commits the queued SHUTDOWN event
+  if (db_persist_checkpoint() != 0)
+    fprintf(stderr, "Final checkpoint failed\n");
+  process_sampler_stop();
   mg_mgr_free(&mgr);
+  cpu_sampler_stop();
+  netdev_sampler_stop();
+  snapshot_scheduler_stop();
+  api_manager_free(&api_manager);
   db_close();
   printf("Server stopped.\n");
 
@@ -0,0 +1,117 @@
+// UCI parser check against the sample packages in tests/fixtures/uci
+//
+//   make -f Makefile.host check
+//   tests/uci_config_check [fixture dir]
+//
+// The fixtures cover single, double and mixed quoting, escaped quotes,
+// trailing and commented-out lines, lists, anonymous sections and a named
+// section split over two blocks. Every lookup below is answered the way
+// `uci get` answers it on a router holding the same files.
+#include "../api/helpers/uci_config.h"
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+  const char *path;
+  const char *expected; // NULL when the value must not be set
+} lookup_t;
+
+static const lookup_t lookups[] = {
+    {"network.loopback", "interface"},
+    {"network.loopback.ipaddr", "127.0.0.1"},
+    {"network.globals.ula_prefix", "fd12:3456:789a::/48"},
+    {"network.lan.device", "br-lan"},
+    {"network.lan.proto", "static"},
+    {"network.lan.dns", "1.1.1.1 9.9.9.9"},
+    {"network.lan.ip6assign", "64"},
+    {"network.@device[0].ports", "lan1 lan2"},
+    {"network.@device[-1].name", "br-lan"},
+    {"network.@interface[2].proto", "dhcp"},
+    {"network.wan.hostname", "it's-a-router"},
+    {"network.wan.peerdns", NULL},
+    {"network.guest.proto", NULL},
+    {"wireless.radio0", "wifi-device"},
+    {"wireless.radio0.htmode", "HE20"},
+    {"wireless.default_radio0.ssid", "Cafe \"Corner\" Wi-Fi"},
+    {"wireless.default_radio0.key", "pass phrase with spaces"},
+    {"wireless.@wifi-iface[0].mode", "ap"},
+    {"wireless.@wifi-iface[1].ssid", "Upstream"},
+    {"wireless.@wifi-iface[-1].disabled", "1"},
+    {"wireless.@wifi-iface[2].ssid", NULL},
+    {"firewall.defaults.input", NULL},
+};
+
+// What `uci show wireless` prints for the fixture
+static const char wireless_show[] =
+    "wireless.radio0=wifi-device\n"
+    "wireless.radio0.type='mac80211'\n"
+    "wireless.radio0.path='platform/soc/18000000.wifi'\n"
+    "wireless.radio0.channel='1'\n"
+    "wireless.radio0.band='2g'\n"
+    "wireless.radio0.htmode='HE20'\n"
+    "wireless.default_radio0=wifi-iface\n"
+    "wireless.default_radio0.device='radio0'\n"
+    "wireless.default_radio0.network='lan'\n"
+    "wireless.default_radio0.mode='ap'\n"
+    "wireless.default_radio0.ssid='Cafe \"Corner\" Wi-Fi'\n"
+    "wireless.default_radio0.encryption='sae-mixed'\n"
+    "wireless.default_radio0.key='pass phrase with spaces'\n"
+    "wireless.@wifi-iface[1]=wifi-iface\n"
+    "wireless.@wifi-iface[1].device='radio0'\n"
+    "wireless.@wifi-iface[1].mode='sta'\n"
+    "wireless.@wifi-iface[1].ssid='Upstream'\n"
+    "wireless.@wifi-iface[1].disabled='1'\n";
+
+// Lines of `uci show network` whose quoting is worth pinning down
+static const char *network_show_lines[] = {
+    "network.lan.dns='1.1.1.1' '9.9.9.9'\n",
+    "network.wan.hostname='it'\\''s-a-router'\n",
+    "network.@device[0].ports='lan1' 'lan2'\n",
+};
+
+int main(int argc, char **argv) {
+  const char *dir = argc > 1 ? argv[1] : "tests/fixtures/uci";
+  if (uci_config_set_dir(dir) != 0) {
+    fprintf(stderr, "usage: %s [fixture dir]\n", argv[0]);
+    return 1;
+  }
+
+  int failures = 0;
+  for (size_t i = 0; i < sizeof(lookups) / sizeof(lookups[0]); i++) {
+    char value[128];
+    const lookup_t *l = &lookups[i];
+    int rc = uci_config_get(l->path, value, sizeof(value));
+    if (l->expected ? rc != 0 || strcmp(value, l->expected) != 0 : rc == 0) {
+      fprintf(stderr, "FAIL %s: got %s%s%s, expected %s%s%s\n", l->path,
+              rc == 0 ? "'" : "", rc == 0 ? value : "unset",
+              rc == 0 ? "'" : "", l->expected ? "'" : "",
+              l->expected ? l->expected : "unset", l->expected ? "'" : "");
+      failures++;
+    }
+  }
+
+  char out[4096];
+  int lines = uci_config_show("wireless", out, sizeof(out));
+  if (lines != 18 || strcmp(out, wireless_show) != 0) {
+    fprintf(stderr, "FAIL uci show wireless (%d lines):\n%s", lines, out);
+    failures++;
+  }
+
+  lines = uci_config_show("network", out, sizeof(out));
+  for (size_t i = 0;
+       i < sizeof(network_show_lines) / sizeof(network_show_lines[0]); i++) {
+    if (!strstr(out, network_show_lines[i])) {
+      fprintf(stderr, "FAIL uci show network lacks %s", network_show_lines[i]);
+      failures++;
+    }
+  }
+  if (uci_config_show("firewall", out, sizeof(out)) != -1) {
+    fprintf(stderr, "FAIL uci show firewall: package should not exist\n");
+    failures++;
+  }
+
+  size_t checks = sizeof(lookups) / sizeof(lookups[0]) + 2 +
+                  sizeof(network_show_lines) / sizeof(network_show_lines[0]);
+  printf("uci_config_check: %zu checks, %d failed\n", checks, failures);
+  return failures ? 1 : 0;
+}